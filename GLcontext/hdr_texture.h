@@ -0,0 +1,210 @@
+//
+//  hdr_texture.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "stb_image.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// define HDR_TEXTURE_NO_SIMD for the scalar conversions other CPUs get
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(HDR_TEXTURE_NO_SIMD)
+#include <immintrin.h>
+#define HDR_TEXTURE_X86
+#endif
+
+/// Loads Radiance .hdr images into the bound GL_TEXTURE_2D as half floats
+/// (GL_RGBA16F, 8 bytes a pixel) or packed floats (GL_R11F_G11F_B10F, 4
+/// bytes a pixel, no sign and 5-6 bits of mantissa, plenty for lighting)
+class HdrTexture
+{
+public:
+    enum Format
+    {
+        Half,
+        Packed
+    };
+    
+    /// Decode and upload; the converted pixels are written straight into a
+    /// mapped pixel unpack buffer
+    static bool load(const char* path, Format format, int* width, int* height)
+    {
+        int channels;
+        float* rgb = stbi_loadf(path, width, height, &channels, STBI_rgb);
+        if (!rgb)
+        {
+            std::cout << "ERROR::HDR_TEXTURE::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+        
+        size_t count = (size_t)*width * *height;
+        GLsizeiptr imageSize = (GLsizeiptr)(count * (format == Half ? 8 : 4));
+        
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, imageSize, nullptr, GL_STREAM_DRAW);
+        
+        bool loaded = false;
+        void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (pixels)
+        {
+            if (format == Half) toHalf((uint16_t*)pixels, rgb, count);
+            else toPacked((uint32_t*)pixels, rgb, count);
+            loaded = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+        }
+        stbi_image_free(rgb);
+        
+        if (loaded)
+        {
+            if (format == Half)
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, *width, *height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, *width, *height, 0, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, nullptr);
+        }
+        else
+        {
+            std::cout << "ERROR::HDR_TEXTURE::UPLOAD_FAILED " << path << std::endl;
+        }
+        
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        return loaded;
+    }
+    
+    /// RGB floats to RGBA half floats with alpha 1
+    static void toHalf(uint16_t* out, const float* rgb, size_t count)
+    {
+        size_t i = 0;
+#ifdef HDR_TEXTURE_X86
+        if (hasF16C()) i = toHalfF16C(out, rgb, count);
+#endif
+        for (; i < count; ++i)
+        {
+            out[i * 4 + 0] = halfFromFloat(rgb[i * 3 + 0]);
+            out[i * 4 + 1] = halfFromFloat(rgb[i * 3 + 1]);
+            out[i * 4 + 2] = halfFromFloat(rgb[i * 3 + 2]);
+            out[i * 4 + 3] = 0x3c00;
+        }
+    }
+    
+    /// RGB floats to GL_UNSIGNED_INT_10F_11F_11F_REV
+    static void toPacked(uint32_t* out, const float* rgb, size_t count)
+    {
+        size_t i = 0;
+#ifdef HDR_TEXTURE_X86
+        i = toPackedSSE2(out, rgb, count);
+#endif
+        for (; i < count; ++i)
+            out[i] = smallFloat(rgb[i * 3 + 0], 6) | smallFloat(rgb[i * 3 + 1], 6) << 11 | smallFloat(rgb[i * 3 + 2], 5) << 22;
+    }
+    
+    /// IEEE half, rounded to nearest even
+    static uint16_t halfFromFloat(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t magnitude = bits & 0x7fffffff;
+        if (magnitude >= 0x7f800000) return (uint16_t)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+        if (magnitude >= 0x477ff000) return (uint16_t)(sign | 0x7c00); // rounds past 65504
+        if (magnitude < 0x38800000)
+        {
+            // denormal: scaling by 2^24 is exact, so this rounds once
+            float scaled;
+            memcpy(&scaled, &magnitude, 4);
+            return (uint16_t)(sign | (uint32_t)std::nearbyint(scaled * 16777216.0f));
+        }
+        return (uint16_t)(sign | ((magnitude + 0x0fff + ((magnitude >> 13) & 1) - 0x38000000) >> 13));
+    }
+    
+    /// Unsigned 11- or 10-bit float (6 or 5 mantissa bits, the half exponent),
+    /// rounded to nearest even. Negatives and NaN become 0, anything too big
+    /// the largest finite value
+    static uint32_t smallFloat(float value, int mantissaBits)
+    {
+        if (!(value > 0.0f)) return 0;
+        float largest = mantissaBits == 6 ? 65024.0f : 64512.0f;
+        if (value > largest) value = largest;
+        if (value < 6.103515625e-05f) return (uint32_t)std::nearbyint(value * (float)(1 << (14 + mantissaBits)));
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        int shift = 23 - mantissaBits;
+        bits += (1u << (shift - 1)) - 1 + ((bits >> shift) & 1);
+        return (bits >> shift) - ((127 - 15) << mantissaBits);
+    }
+
+private:
+#ifdef HDR_TEXTURE_X86
+    static bool hasF16C()
+    {
+        static const bool supported = __builtin_cpu_supports("f16c");
+        return supported;
+    }
+    
+    /// Two pixels a store. Pixels are loaded 4 floats at a time, so the last
+    /// one is left to the scalar loop rather than read past the end
+    __attribute__((target("f16c")))
+    static size_t toHalfF16C(uint16_t* out, const float* rgb, size_t count)
+    {
+        const __m128 rgbMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        const __m128 alpha = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        size_t i = 0;
+        for (; i + 2 < count; i += 2)
+        {
+            __m128 a = _mm_or_ps(_mm_and_ps(_mm_loadu_ps(rgb + i * 3), rgbMask), alpha);
+            __m128 b = _mm_or_ps(_mm_and_ps(_mm_loadu_ps(rgb + i * 3 + 3), rgbMask), alpha);
+            __m128i halves = _mm_unpacklo_epi64(_mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT), _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+            _mm_storeu_si128((__m128i*)(out + i * 4), halves);
+        }
+        return i;
+    }
+    
+    /// Same rounding as smallFloat, four values at a time
+    static __m128i smallFloatSSE2(__m128 value, int mantissaBits)
+    {
+        const __m128 largest = _mm_set1_ps(mantissaBits == 6 ? 65024.0f : 64512.0f);
+        const __m128 smallestNormal = _mm_set1_ps(6.103515625e-05f);
+        int shift = 23 - mantissaBits;
+        
+        value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), largest); // max() takes the 0 for NaN
+        __m128i denormal = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps((float)(1 << (14 + mantissaBits)))));
+        
+        __m128i bits = _mm_castps_si128(value);
+        __m128i count = _mm_cvtsi32_si128(shift);
+        __m128i odd = _mm_and_si128(_mm_srl_epi32(bits, count), _mm_set1_epi32(1));
+        bits = _mm_add_epi32(bits, _mm_add_epi32(odd, _mm_set1_epi32((1 << (shift - 1)) - 1)));
+        __m128i normal = _mm_sub_epi32(_mm_srl_epi32(bits, count), _mm_set1_epi32((127 - 15) << mantissaBits));
+        
+        __m128i small = _mm_castps_si128(_mm_cmplt_ps(value, smallestNormal));
+        return _mm_or_si128(_mm_and_si128(small, denormal), _mm_andnot_si128(small, normal));
+    }
+    
+    static size_t toPackedSSE2(uint32_t* out, const float* rgb, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 < count; i += 4)
+        {
+            __m128 r = _mm_loadu_ps(rgb + i * 3);
+            __m128 g = _mm_loadu_ps(rgb + i * 3 + 3);
+            __m128 b = _mm_loadu_ps(rgb + i * 3 + 6);
+            __m128 unused = _mm_loadu_ps(rgb + i * 3 + 9);
+            _MM_TRANSPOSE4_PS(r, g, b, unused);
+            __m128i packed = _mm_or_si128(smallFloatSSE2(r, 6),
+                             _mm_or_si128(_mm_slli_epi32(smallFloatSSE2(g, 6), 11), _mm_slli_epi32(smallFloatSSE2(b, 5), 22)));
+            _mm_storeu_si128((__m128i*)(out + i), packed);
+        }
+        return i;
+    }
+#endif
+};
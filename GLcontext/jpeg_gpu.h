@@ -0,0 +1,233 @@
+//
+//  jpeg_gpu.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "shader.h"
+#include "stb_image.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/// Hybrid JPEG decode: stb_image only entropy decodes (stbi_jpeg_coefficients_*,
+/// safe on a loading thread), then three passes on the GPU dequantize, IDCT,
+/// upsample and color convert straight into the destination texture
+class JpegGpuDecoder
+{
+public:
+    /// 'shaderDirectory' holds the jpeg*.vert/frag files and ends in a slash
+    explicit JpegGpuDecoder(const std::string& shaderDirectory)
+        : columns((shaderDirectory + "jpegQuad.vert").c_str(), (shaderDirectory + "jpegIdctColumns.frag").c_str()),
+          rows((shaderDirectory + "jpegQuad.vert").c_str(), (shaderDirectory + "jpegIdctRows.frag").c_str()),
+          color((shaderDirectory + "jpegQuad.vert").c_str(), (shaderDirectory + "jpegColor.frag").c_str())
+    {
+        ready = linked(columns) && linked(rows) && linked(color);
+        
+        float basis[64];
+        for (int n = 0; n < 8; ++n)
+            for (int k = 0; k < 8; ++k)
+                basis[n * 8 + k] = (k == 0 ? std::sqrt(0.5f) : 1.0f) * 0.5f * std::cos((2 * n + 1) * k * 3.14159265358979f / 16.0f);
+        
+        columns.use();
+        columns.setInt("coefficients", 0);
+        glUniform1fv(glGetUniformLocation(columns.shaderProgram, "basis"), 64, basis);
+        rows.use();
+        rows.setInt("columns", 0);
+        glUniform1fv(glGetUniformLocation(rows.shaderProgram, "basis"), 64, basis);
+        color.use();
+        for (int i = 0; i < 3; ++i)
+            color.setInt("planes[" + std::to_string(i) + "]", i);
+        glUseProgram(0);
+        
+        glGenVertexArrays(1, &vao);
+        glGenFramebuffers(1, &fbo);
+    }
+    
+    ~JpegGpuDecoder()
+    {
+        glDeleteProgram(columns.shaderProgram);
+        glDeleteProgram(rows.shaderProgram);
+        glDeleteProgram(color.shaderProgram);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteFramebuffers(1, &fbo);
+    }
+    
+    JpegGpuDecoder(const JpegGpuDecoder&) = delete;
+    JpegGpuDecoder& operator=(const JpegGpuDecoder&) = delete;
+    
+    /// False if the shaders failed to build; decode() then always fails
+    bool valid() const { return ready; }
+    
+    /// Define level 0 of 'texture' as GL_RGB8 and render the image into it.
+    /// Returns false (leaving the caller to decode on the CPU) if the image
+    /// is beyond this GL's limits
+    bool decode(const stbi_jpeg_coefficients& jpeg, GLuint texture)
+    {
+        if (!ready) return false;
+        
+        GLint maxTexels, maxSize;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        for (int i = 0; i < jpeg.components; ++i)
+        {
+            const stbi_jpeg_component& c = jpeg.comp[i];
+            if ((int64_t)c.blocks_w * c.blocks_h * 64 > maxTexels || c.blocks_w * 8 > maxSize || c.blocks_h * 8 > maxSize)
+            {
+                std::cout << "ERROR::JPEG_GPU::IMAGE_TOO_LARGE " << jpeg.width << "x" << jpeg.height << std::endl;
+                return false;
+            }
+        }
+        
+        // the planes have one level and are read on units 0-2; a sampler
+        // object left bound there (a mipmapped one from a SamplerCache, say)
+        // would make them incomplete, so those units go without
+        GLint previousFramebuffer, previousTextures[3], previousSamplers[3], previousUnit, viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &previousUnit);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        for (int i = 2; i >= 0; --i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTextures[i]);
+            glGetIntegerv(GL_SAMPLER_BINDING, &previousSamplers[i]);
+            glBindSampler(i, 0);
+        }
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glBindVertexArray(vao);
+        
+        // dequantize and IDCT each component into an 8-bit plane
+        GLuint planes[3] = { 0, 0, 0 };
+        bool ok = true;
+        for (int i = 0; i < jpeg.components && ok; ++i)
+            ok = decodePlane(jpeg.comp[i], planes[i]);
+        
+        // upsample and convert into the destination
+        if (ok)
+        {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, jpeg.width, jpeg.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            ok = attach(texture);
+        }
+        if (ok)
+        {
+            color.use();
+            color.setInt("components", jpeg.components);
+            color.setBool("isRgb", jpeg.is_rgb != 0);
+            for (int i = 0; i < jpeg.components; ++i)
+            {
+                const stbi_jpeg_component& c = jpeg.comp[i];
+                std::string index = "[" + std::to_string(i) + "]";
+                glUniform2i(glGetUniformLocation(color.shaderProgram, ("planeSize" + index).c_str()), c.width, c.height);
+                color.setVec2("ratio" + index, (float)c.h / jpeg.h_max, (float)c.v / jpeg.v_max);
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, planes[i]);
+            }
+            glViewport(0, 0, jpeg.width, jpeg.height);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glDeleteTextures(3, planes);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        for (int i = 0; i < 3; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, previousTextures[i]);
+            glBindSampler(i, previousSamplers[i]);
+        }
+        glActiveTexture(previousUnit);
+        return ok;
+    }
+
+private:
+    Shader columns, rows, color;
+    GLuint vao = 0, fbo = 0;
+    bool ready = false;
+    
+    static bool linked(const Shader& shader)
+    {
+        GLint success = 0;
+        glGetProgramiv(shader.shaderProgram, GL_LINK_STATUS, &success);
+        return success != 0;
+    }
+    
+    bool attach(GLuint texture)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE) return true;
+        std::cout << "ERROR::JPEG_GPU::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        return false;
+    }
+    
+    static GLuint makeTexture(GLenum internalFormat, GLenum format, GLenum type, int width, int height)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        return texture;
+    }
+    
+    /// Coefficients -> (columns pass) float intermediate -> (rows pass) plane
+    bool decodePlane(const stbi_jpeg_component& c, GLuint& plane)
+    {
+        int paddedWidth = c.blocks_w * 8, paddedHeight = c.blocks_h * 8;
+        
+        // the coefficients go up as they are, a texture buffer of shorts
+        GLuint buffer, coefficients;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)c.blocks_w * c.blocks_h * 64 * sizeof(short), c.coeff, GL_STREAM_DRAW);
+        glGenTextures(1, &coefficients);
+        glBindTexture(GL_TEXTURE_BUFFER, coefficients);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R16I, buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        
+        GLuint intermediate = makeTexture(GL_R32F, GL_RED, GL_FLOAT, paddedWidth, paddedHeight);
+        plane = makeTexture(GL_R8, GL_RED, GL_UNSIGNED_BYTE, paddedWidth, paddedHeight);
+        
+        bool ok = attach(intermediate);
+        if (ok)
+        {
+            int quant[64];
+            for (int k = 0; k < 64; ++k) quant[k] = c.quant[k];
+            columns.use();
+            columns.setInt("blocksWide", c.blocks_w);
+            glUniform1iv(glGetUniformLocation(columns.shaderProgram, "quant"), 64, quant);
+            glBindTexture(GL_TEXTURE_BUFFER, coefficients);
+            glViewport(0, 0, paddedWidth, paddedHeight);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            ok = attach(plane);
+        }
+        if (ok)
+        {
+            // only the pixels the color pass can reach
+            rows.use();
+            glBindTexture(GL_TEXTURE_2D, intermediate);
+            glViewport(0, 0, c.width, c.height);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glDeleteTextures(1, &coefficients);
+        glDeleteBuffers(1, &buffer);
+        glDeleteTextures(1, &intermediate);
+        return ok;
+    }
+};
@@ -11,10 +11,9 @@
 #include <sstream>
 #include <string>
 
-#include <SDL2/SDL.h>
+#include <unistd.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include <SDL2/SDL.h>
 
 #include <GL/glew.h>  // Has to be included first
 #define GLFW_INCLUDE_GLCOREARB
@@ -24,13 +23,29 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "mesh_loader.h"
+#include "sampler_cache.h"
 #include "shader.h"
+#include "texture_manager.h"
+#include "upload_scheduler.h"
+#include "upload_thread.h"
+#include "vertex_format.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 /// Main rendering loop
-void run(SDL_Window* window, GLuint shaderProgram, GLuint vao)
+void run(SDL_Window* window, GLuint shaderProgram, Mesh& mesh, TextureManager& textures, const TextureManager::Handle& texture,
+         SamplerCache& samplers, GLuint sampler, UploadScheduler& uploads,
+         UploadThread& loader)
 {
     bool loop = true;
     
+    // The shader draws positions as they come, so the view is the identity;
+    // faces aren't culled, so only meshlets off the frustum are left out
+    glm::mat4 transform(1.0f);
+    Meshlets::View view = Meshlets::view(glm::value_ptr(transform), false);
+    
     while (loop)
     {
         SDL_Event event;
@@ -41,10 +56,16 @@ void run(SDL_Window* window, GLuint shaderProgram, GLuint vao)
             glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT);
             
+            uploads.beginFrame();
+            textures.beginFrame();
+            loader.poll();
+            texture.bind();
+            samplers.bind(0, sampler);
             glUseProgram(shaderProgram);
-            glBindVertexArray(vao);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            mesh.draw(view);
             
+            // streamed content goes up in what is left of the frame
+            uploads.update();
             SDL_GL_SwapWindow(window);
         }
     }
@@ -120,6 +141,7 @@ int main(int argc, const char * argv[])
     /// Load Shaders
     const char* vertPath = "/Users/acanois/src/graphics/open_gl_stuff/GLcontext/GLcontext/shaders/vertShader.vert";
     const char* fragPath = "/Users/acanois/src/graphics/open_gl_stuff/GLcontext/GLcontext/shaders/fragShader.frag";
+    const char* shaderDirectory = "/Users/acanois/src/graphics/open_gl_stuff/GLcontext/GLcontext/shaders/";
     
     std::string vertSource;
     std::string fragSource;
@@ -204,80 +226,73 @@ int main(int argc, const char * argv[])
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
     
-    /// Create vertices and indices
-    float vertices[] = {
-        // positions         // colors           // texture coords
-        0.5f,  0.5f, 0.0f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f,    // top right
-        0.5f, -0.5f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 0.0f,    // bottom right
-        -0.5f, -0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
-        -0.5f,  0.5f, 0.0f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f    // top left
-    };
-    GLuint indices[] = {
-        0, 1, 3,  // first triangle
-        1, 2, 3   // second triange
-    };
-    
-    GLuint vbo, vao, ebo;
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(vao);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    
-    // Position attributes
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // Color attributes
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    // Texture coord attributes
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    // Positions as half floats, colors as unorm8 and texture coords as
+    // unorm16: 16 bytes a vertex rather than 32
+    typedef VertexFormat<Attribute<MeshAttribute::Position, VertexEncoding::Half<3>>,
+                         Attribute<MeshAttribute::Color, VertexEncoding::Unorm8<3>>,
+                         Attribute<MeshAttribute::TexCoord, VertexEncoding::Unorm16<2>>> QuadVertex;
     
     //// GENERATING A TEXTURE
     //// ===========================================================
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // Textures come from the manager, which loads each image once, keeps them
+    // within a memory budget and caches the decoded result between runs. It
+    // lives in this block so its GL objects go before the context does, as
+    // do the mesh, the samplers the textures are drawn with and the loading
+    // thread's shared context
+    {
+        TextureManager textures(shaderDirectory, 256ull << 20);
+        SamplerCache samplers;
+        UploadScheduler uploads;
+        UploadThread loader(mainWindow);
     
-    // Set texture Parameters
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+        //// Load the quad, written straight into its buffers in QuadVertex's
+        //// format, its triangles in meshlets in vertex cache order. The
+        //// first run bakes it, and later ones decode that instead
+        MeshLoader meshes(QuadVertex::layout());
+        const char* meshPath = "/Users/acanois/src/graphics/open_gl_stuff/GLcontext/GLcontext/assets/quad.obj";
+        const char* bakedPath = "/Users/acanois/src/graphics/open_gl_stuff/GLcontext/GLcontext/assets/quad.mesh";
+        Mesh quad;
+        if (access(bakedPath, R_OK) == 0) quad = meshes.load(bakedPath);
+        if (!quad)
+        {
+            quad = meshes.load(meshPath);
+            if (quad) meshes.save(quad, bakedPath);
+        }
+        if (!quad)
+        {
+            std::cout << "Mesh did not load correctly!" << std::endl;
+        }
+        
+        //// Load and generate the texture
+        const char* texturePath = "/Users/acanois/src/graphics/sdl_stuff/sdl_test/sdl_test/assets/container.jpg";
+        TextureManager::Handle texture = textures.acquire(texturePath);
+        if (!texture)
+        {
+            std::cout << "Texture did not load correctly!" << std::endl;
+        }
+        texture.bind();
     
-    // Sets nearest (sharper) filtering when textures get smaller, linear when magnified
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // Set texture Parameters: mirrored repeat, trilinear when textures
+        // get smaller, linear when magnified. They live in a sampler rather
+        // than on the texture
+        SamplerState sampling;
+        sampling.wrap(GL_MIRRORED_REPEAT);
     
-    // Set mipmapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        //// Only needed to specify a border color when using GL_CLAMP_TO_BORDER
+        // float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        // std::copy(borderColor, borderColor + 4, sampling.borderColor);
     
+        GLuint sampler = samplers.get(sampling);
     
-    //// Only needed to specify a border color when using GL_CLAMP_TO_EDGE
-    // float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    // glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        run(mainWindow, shaderProgram, quad, textures, texture, samplers, sampler, uploads, loader);
     
-    //// Load and generate the texture
-    int width, height, numColorChannels;
-    unsigned char* image = stbi_load("/Users/acanois/src/graphics/sdl_stuff/sdl_test/sdl_test/assets/container.jpg", &width, &height, &numColorChannels, 0);
-    if (image)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Texture did not load correctly!" << std::endl;
+        meshes.printStats();
+        quad.meshlets.printStats();
+        textures.printStats();
+        samplers.printStats();
+        uploads.printStats();
+        loader.printStats();
     }
-    stbi_image_free(image); // Clear the image data
-    
-    run(mainWindow, shaderProgram, vao);
     
     close(mainContext, mainWindow);
     
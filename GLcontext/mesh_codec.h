@@ -0,0 +1,650 @@
+//
+//  mesh_codec.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MESH_CODEC_X86
+#endif
+
+/// Compression for vertex and index buffers as the GPU takes them, for
+/// geometry on disk, with decoders quick enough (GB/s a core) to run
+/// straight into mapped buffers at load time.
+///
+/// Vertices go in blocks of 256, a 4-byte word of the vertex at a time, as
+/// the attribute in it suggests: differences from the vertex before, a byte
+/// or 16 bits at a time in zigzag form (so small steps either way are small
+/// numbers), or for floats the bits that changed. Each byte of those then
+/// goes in groups of 16, packed to 0, 2, 4 or 8 bits by the largest. Blocks
+/// stand alone, so they can be decoded in parallel; SSE2 decodes a group of
+/// 16 vertices at a time.
+///
+/// Indices go a triangle at a time against the 16 edges and 16 vertices seen
+/// last, after Kapoulkine's meshoptimizer: a triangle across an edge just
+/// seen, whose other vertex is also just seen or the next new one, is a
+/// byte, and only vertices seen neither way are written out. That is most of
+/// them for triangles in vertex cache order with vertices in fetch order,
+/// which is how MeshOptimizer leaves them. Triangles can come back rotated,
+/// (b, c, a) for (a, b, c), which keeps their winding. Segments of 16K
+/// triangles stand alone.
+///
+///     std::vector<unsigned char> packed = MeshCodec::encodeVertices(vertices, count, layout.stride, MeshCodec::channels(layout));
+///     ...
+///     MeshCodec::decodeVertices(mapping, count, layout.stride, packed.data(), packed.size());
+class MeshCodec
+{
+public:
+    /// How a word of the vertex is coded
+    enum Channel : unsigned char
+    {
+        Delta8,     // four bytes
+        Delta16,    // two 16-bit halves
+        Xor32       // one 32-bit float, or packed 2_10_10_10
+    };
+    
+    enum { BlockVertices = 256, SegmentTriangles = 16384 };
+    
+    /// The channel for each word of 'layout''s vertices
+    static std::vector<unsigned char> channels(const VertexLayout& layout)
+    {
+        std::vector<unsigned char> result((size_t)layout.stride / 4, Delta8);
+        for (const VertexAttribute& attribute : layout.attributes)
+        {
+            Channel channel = Delta8;
+            size_t bytes = (size_t)attribute.components;
+            switch (attribute.type)
+            {
+                case GL_FLOAT: channel = Xor32; bytes *= 4; break;
+                case GL_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_2_10_10_10_REV: channel = Xor32; bytes = 4; break;
+                case GL_HALF_FLOAT: case GL_SHORT: case GL_UNSIGNED_SHORT: channel = Delta16; bytes *= 2; break;
+                default: break;
+            }
+            for (size_t word = attribute.offset / 4; word < (attribute.offset + bytes + 3) / 4 && word < result.size(); ++word)
+                result[word] = channel;
+        }
+        return result;
+    }
+    
+    static size_t vertexBlocks(size_t vertexCount) { return (vertexCount + BlockVertices - 1) / BlockVertices; }
+    
+    static size_t indexSegments(size_t indexCount) { return (indexCount / 3 + SegmentTriangles - 1) / SegmentTriangles; }
+    
+    // ------------------------------------------------------------------------
+    // Vertices
+    
+    /// 'vertexCount' vertices 'stride' bytes apart (a multiple of four), a
+    /// channel for each of their words. Empty if the stride can't be coded
+    static std::vector<unsigned char> encodeVertices(const void* vertices, size_t vertexCount, size_t stride,
+                                                     const std::vector<unsigned char>& channels)
+    {
+        size_t words = stride / 4, blocks = vertexBlocks(vertexCount);
+        std::vector<unsigned char> out;
+        if (stride % 4 != 0 || channels.size() != words || words == 0 || words > 255) return out;
+        
+        // the words and their channels, then where each block starts and
+        // where the last ends
+        out.push_back((unsigned char)words);
+        out.insert(out.end(), channels.begin(), channels.end());
+        out.resize(align4(out.size()), 0);
+        size_t table = out.size();
+        out.resize(table + (blocks + 1) * 4, 0);
+        
+        uint32_t coded[BlockVertices];
+        unsigned char plane[BlockVertices];
+        for (size_t block = 0; block < blocks; ++block)
+        {
+            write32(&out[table + block * 4], (uint32_t)out.size());
+            size_t first = block * BlockVertices, count = std::min((size_t)BlockVertices, vertexCount - first);
+            size_t groups = (count + 15) / 16;
+            for (size_t word = 0; word < words; ++word)
+            {
+                const unsigned char* source = (const unsigned char*)vertices + first * stride + word * 4;
+                uint32_t previous = 0;
+                for (size_t i = 0; i < count; ++i)
+                {
+                    uint32_t value = read32(source + i * stride);
+                    coded[i] = encodeWord(channels[word], value, previous);
+                    previous = value;
+                }
+                for (int byte = 0; byte < 4; ++byte)
+                {
+                    for (size_t i = 0; i < groups * 16; ++i) plane[i] = i < count ? (unsigned char)(coded[i] >> (byte * 8)) : 0;
+                    packPlane(out, plane, groups);
+                }
+            }
+        }
+        write32(&out[table + blocks * 4], (uint32_t)out.size());
+        return out;
+    }
+    
+    /// Blocks 'firstBlock' up to 'endBlock' of what encodeVertices made, into
+    /// 'destination' (all the vertices, not just those). Each block is built
+    /// in a small buffer and copied whole, as write-combined mappings like.
+    /// False if the data doesn't fit the vertices or is cut short
+    static bool decodeVertices(void* destination, size_t vertexCount, size_t stride, const unsigned char* data, size_t size,
+                               size_t firstBlock, size_t endBlock)
+    {
+        size_t words = stride / 4, blocks = vertexBlocks(vertexCount);
+        if (stride % 4 != 0 || words == 0 || size < 1 || data[0] != words) return false;
+        size_t table = align4(1 + words);
+        if (size < table + (blocks + 1) * 4 || endBlock > blocks || firstBlock > endBlock) return false;
+        const unsigned char* channels = data + 1;
+        for (size_t word = 0; word < words; ++word)
+            if (channels[word] > Xor32) return false;
+        
+        std::vector<unsigned char> scratch(BlockVertices * stride);
+        for (size_t block = firstBlock; block < endBlock; ++block)
+        {
+            size_t begin = read32(data + table + block * 4), end = read32(data + table + block * 4 + 4);
+            if (begin < table + (blocks + 1) * 4 || begin > end || end > size) return false;
+            size_t first = block * BlockVertices, count = std::min((size_t)BlockVertices, vertexCount - first);
+            if (!decodeBlock(scratch.data(), count, stride, channels, data + begin, data + end)) return false;
+            memcpy((unsigned char*)destination + first * stride, scratch.data(), count * stride);
+        }
+        return true;
+    }
+    
+    static bool decodeVertices(void* destination, size_t vertexCount, size_t stride, const unsigned char* data, size_t size)
+    {
+        return decodeVertices(destination, vertexCount, stride, data, size, 0, vertexBlocks(vertexCount));
+    }
+    
+    // ------------------------------------------------------------------------
+    // Indices
+    
+    /// A triangle list
+    static std::vector<unsigned char> encodeIndices(const uint32_t* indices, size_t indexCount)
+    {
+        size_t triangleCount = indexCount / 3, segments = indexSegments(indexCount);
+        
+        // how many segments, then for each where its codes and its extra
+        // bytes start and the next new vertex at its start, then the end
+        std::vector<unsigned char> out(4 + segments * 12 + 4, 0);
+        write32(&out[0], (uint32_t)segments);
+        uint32_t next = 0;
+        for (size_t segment = 0; segment < segments; ++segment)
+        {
+            size_t first = segment * SegmentTriangles, end = std::min(triangleCount, first + SegmentTriangles);
+            Fifo fifo(next);
+            std::vector<unsigned char> codes, extra;
+            codes.reserve((end - first) * 2);
+            for (size_t t = first; t < end; ++t)
+            {
+                uint32_t a = indices[t * 3 + 0], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+                
+                // across an edge still in the fifo, turned to start there
+                int edge = -1;
+                uint32_t x = a, y = b, z = c;
+                for (int age = 0; age < EdgeCodes && edge < 0; ++age)
+                {
+                    const uint32_t* seen = fifo.edge(age);
+                    if (seen[0] == a && seen[1] == b) edge = age;
+                    else if (seen[0] == b && seen[1] == c) { edge = age; x = b; y = c; z = a; }
+                    else if (seen[0] == c && seen[1] == a) { edge = age; x = c; y = a; z = b; }
+                }
+                if (edge >= 0)
+                {
+                    codes.push_back((unsigned char)(edge << 4 | encodeVertex(fifo, z, extra)));
+                    fifo.pushEdge(z, y);
+                    fifo.pushEdge(x, z);
+                    continue;
+                }
+                int codeA = encodeVertex(fifo, a, extra);
+                int codeB = encodeVertex(fifo, b, extra);
+                int codeC = encodeVertex(fifo, c, extra);
+                codes.push_back((unsigned char)(NoEdge | codeA));
+                codes.push_back((unsigned char)(codeB << 4 | codeC));
+                fifo.pushEdge(b, a);
+                fifo.pushEdge(c, b);
+                fifo.pushEdge(a, c);
+            }
+            unsigned char* entry = &out[4 + segment * 12];
+            write32(entry, (uint32_t)out.size());
+            write32(entry + 4, (uint32_t)(out.size() + codes.size()));
+            write32(entry + 8, next);
+            out.insert(out.end(), codes.begin(), codes.end());
+            out.insert(out.end(), extra.begin(), extra.end());
+            next = fifo.next;
+        }
+        write32(&out[4 + segments * 12], (uint32_t)out.size());
+        return out;
+    }
+    
+    /// Segments 'firstSegment' up to 'endSegment' of what encodeIndices made,
+    /// into 'destination' (all the indices) as 'indexSize' byte indices.
+    /// False if the data is cut short or names a vertex past 'vertexCount'
+    static bool decodeIndices(void* destination, size_t indexSize, size_t indexCount, size_t vertexCount,
+                              const unsigned char* data, size_t size, size_t firstSegment, size_t endSegment)
+    {
+        size_t triangleCount = indexCount / 3, segments = indexSegments(indexCount);
+        size_t table = 4 + segments * 12 + 4;
+        if (size < table || read32(data) != segments || endSegment > segments || firstSegment > endSegment) return false;
+        if (indexSize != 2 && indexSize != 4) return false;
+        for (size_t segment = firstSegment; segment < endSegment; ++segment)
+        {
+            const unsigned char* entry = data + 4 + segment * 12;
+            size_t codes = read32(entry), extra = read32(entry + 4), end = read32(entry + 12);
+            if (codes < table || codes > extra || extra > end || end > size) return false;
+            size_t first = segment * SegmentTriangles, count = std::min(triangleCount - first, (size_t)SegmentTriangles);
+            Fifo fifo(read32(entry + 8));
+            bool decoded = indexSize == 2
+                ? decodeSegment((uint16_t*)destination + first * 3, count, vertexCount, fifo, data + codes, data + extra, data + extra, data + end)
+                : decodeSegment((uint32_t*)destination + first * 3, count, vertexCount, fifo, data + codes, data + extra, data + extra, data + end);
+            if (!decoded) return false;
+        }
+        return true;
+    }
+    
+    static bool decodeIndices(void* destination, size_t indexSize, size_t indexCount, size_t vertexCount,
+                              const unsigned char* data, size_t size)
+    {
+        return decodeIndices(destination, indexSize, indexCount, vertexCount, data, size, 0, indexSegments(indexCount));
+    }
+
+private:
+    // index codes: the edge's age in the high four bits (below NoEdge), and
+    // for each vertex Next, an age in the vertex fifo plus one, or Explicit
+    enum { EdgeCodes = 14, NoEdge = 0xe0, Next = 0, Explicit = 15 };
+    
+    /// The edges and vertices an index coder has seen last, alike at both ends
+    struct Fifo
+    {
+        uint32_t edges[16][2];
+        uint32_t vertices[16];
+        unsigned edgeHead = 0, vertexHead = 0;
+        uint32_t next, last;    // the next new vertex, the last written out
+        
+        explicit Fifo(uint32_t next) : next(next), last(next)
+        {
+            memset(edges, 0, sizeof(edges));
+            memset(vertices, 0, sizeof(vertices));
+        }
+        
+        const uint32_t* edge(int age) const { return edges[(edgeHead - 1 - age) & 15]; }
+        uint32_t vertex(int age) const { return vertices[(vertexHead - 1 - age) & 15]; }
+        
+        void pushEdge(uint32_t a, uint32_t b)
+        {
+            edges[edgeHead & 15][0] = a;
+            edges[edgeHead & 15][1] = b;
+            ++edgeHead;
+        }
+        
+        void pushVertex(uint32_t vertex) { vertices[vertexHead++ & 15] = vertex; }
+    };
+    
+    static size_t align4(size_t size) { return (size + 3) & ~(size_t)3; }
+    
+    static uint32_t read32(const unsigned char* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return value;
+    }
+    
+    static void write32(unsigned char* p, uint32_t value) { memcpy(p, &value, 4); }
+    
+    /// Bytes a header byte's four groups take
+    static size_t packedBytes(unsigned header)
+    {
+        static const unsigned char sizes[4] = { 0, 4, 8, 16 };
+        return sizes[header & 3] + sizes[header >> 2 & 3] + sizes[header >> 4 & 3] + sizes[header >> 6];
+    }
+    
+    // ------------------------------------------------------------------------
+    // Vertex coding
+    
+    static uint32_t encodeWord(unsigned char channel, uint32_t value, uint32_t previous)
+    {
+        uint32_t coded = 0;
+        switch (channel)
+        {
+            case Delta8:
+                for (int i = 0; i < 4; ++i)
+                {
+                    uint32_t delta = ((value >> (i * 8)) - (previous >> (i * 8))) & 0xff;
+                    coded |= ((delta << 1 ^ (delta & 0x80 ? 0xff : 0)) & 0xff) << (i * 8);
+                }
+                return coded;
+            case Delta16:
+                for (int i = 0; i < 2; ++i)
+                {
+                    uint32_t delta = ((value >> (i * 16)) - (previous >> (i * 16))) & 0xffff;
+                    coded |= ((delta << 1 ^ (delta & 0x8000 ? 0xffff : 0)) & 0xffff) << (i * 16);
+                }
+                return coded;
+            default:
+                return value ^ previous;
+        }
+    }
+    
+    /// A group's code, in two bits of a header byte a plane keeps before its
+    /// groups: 0 for all zeros, 1 for 2 bits each, 2 for 4 and 3 for 8. Two
+    /// bits pack value i into byte i % 4 at bit 2 * (i / 4), and four bits
+    /// into byte i % 8 at bit 4 * (i / 8), which is what unpacks quickest
+    static void packPlane(std::vector<unsigned char>& out, const unsigned char* plane, size_t groups)
+    {
+        size_t headers = out.size();
+        out.resize(headers + (groups + 3) / 4, 0);
+        for (size_t group = 0; group < groups; ++group)
+        {
+            const unsigned char* values = plane + group * 16;
+            unsigned any = 0;
+            for (int i = 0; i < 16; ++i) any |= values[i];
+            unsigned code = any == 0 ? 0 : any < 4 ? 1 : any < 16 ? 2 : 3;
+            out[headers + group / 4] |= (unsigned char)(code << (group % 4 * 2));
+            if (code == 1)
+            {
+                for (int i = 0; i < 4; ++i)
+                    out.push_back((unsigned char)(values[i] | values[4 + i] << 2 | values[8 + i] << 4 | values[12 + i] << 6));
+            }
+            else if (code == 2)
+            {
+                for (int i = 0; i < 8; ++i) out.push_back((unsigned char)(values[i] | values[8 + i] << 4));
+            }
+            else if (code == 3)
+            {
+                out.insert(out.end(), values, values + 16);
+            }
+        }
+    }
+    
+    /// 'count' vertices into 'vertices', from a block running to 'end'
+    static bool decodeBlock(unsigned char* vertices, size_t count, size_t stride, const unsigned char* channels,
+                            const unsigned char* p, const unsigned char* end)
+    {
+        size_t groups = (count + 15) / 16, headerBytes = (groups + 3) / 4;
+        for (size_t word = 0; word < stride / 4; ++word)
+        {
+            // where each of its four planes' headers and groups are
+            const unsigned char* headers[4];
+            const unsigned char* packed[4];
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                if ((size_t)(end - p) < headerBytes) return false;
+                size_t bytes = 0;
+                for (size_t h = 0; h < headerBytes; ++h) bytes += packedBytes(p[h]);
+                if ((size_t)(end - p) - headerBytes < bytes) return false;
+                headers[byte] = p;
+                packed[byte] = p + headerBytes;
+                p += headerBytes + bytes;
+            }
+            unsigned char* out = vertices + word * 4;
+#ifdef MESH_CODEC_X86
+            switch (channels[word])
+            {
+                case Delta8: decodeWordSSE2<Delta8>(out, count, stride, headers, packed); break;
+                case Delta16: decodeWordSSE2<Delta16>(out, count, stride, headers, packed); break;
+                default: decodeWordSSE2<Xor32>(out, count, stride, headers, packed); break;
+            }
+#else
+            decodeWord(channels[word], out, count, stride, headers, packed);
+#endif
+        }
+        return p == end;
+    }
+    
+    static void unpackGroup(const unsigned char* packed, unsigned code, unsigned char* values)
+    {
+        switch (code)
+        {
+            case 0:
+                memset(values, 0, 16);
+                break;
+            case 1:
+                for (int i = 0; i < 16; ++i) values[i] = packed[i % 4] >> (i / 4 * 2) & 3;
+                break;
+            case 2:
+                for (int i = 0; i < 16; ++i) values[i] = packed[i % 8] >> (i / 8 * 4) & 15;
+                break;
+            default:
+                memcpy(values, packed, 16);
+                break;
+        }
+    }
+    
+    /// One word of each vertex, a group of 16 at a time
+    static void decodeWord(unsigned char channel, unsigned char* out, size_t count, size_t stride,
+                           const unsigned char* headers[4], const unsigned char* packed[4])
+    {
+        static const unsigned char sizes[4] = { 0, 4, 8, 16 };
+        uint32_t previous = 0;
+        for (size_t group = 0; group * 16 < count; ++group)
+        {
+            unsigned char planes[4][16];
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                unsigned code = headers[byte][group / 4] >> (group % 4 * 2) & 3;
+                unpackGroup(packed[byte], code, planes[byte]);
+                packed[byte] += sizes[code];
+            }
+            for (size_t i = 0; i < 16 && group * 16 + i < count; ++i)
+            {
+                uint32_t coded = planes[0][i] | planes[1][i] << 8 | planes[2][i] << 16 | (uint32_t)planes[3][i] << 24;
+                uint32_t value = 0;
+                switch (channel)
+                {
+                    case Delta8:
+                        for (int b = 0; b < 4; ++b)
+                        {
+                            uint32_t zigzag = coded >> (b * 8) & 0xff;
+                            value |= (((zigzag >> 1 ^ (0u - (zigzag & 1))) + (previous >> (b * 8))) & 0xff) << (b * 8);
+                        }
+                        break;
+                    case Delta16:
+                        for (int b = 0; b < 2; ++b)
+                        {
+                            uint32_t zigzag = coded >> (b * 16) & 0xffff;
+                            value |= (((zigzag >> 1 ^ (0u - (zigzag & 1))) + (previous >> (b * 16))) & 0xffff) << (b * 16);
+                        }
+                        break;
+                    default:
+                        value = coded ^ previous;
+                        break;
+                }
+                write32(out + (group * 16 + i) * stride, value);
+                previous = value;
+            }
+        }
+    }
+
+#ifdef MESH_CODEC_X86
+    static __m128i unpackGroupSSE2(const unsigned char* packed, unsigned code)
+    {
+        switch (code)
+        {
+            case 0:
+                return _mm_setzero_si128();
+            case 1:
+            {
+                __m128i bits = _mm_cvtsi32_si128((int)read32(packed)), mask = _mm_set1_epi8(3);
+                __m128i low = _mm_unpacklo_epi32(_mm_and_si128(bits, mask), _mm_and_si128(_mm_srli_epi16(bits, 2), mask));
+                __m128i high = _mm_unpacklo_epi32(_mm_and_si128(_mm_srli_epi16(bits, 4), mask), _mm_and_si128(_mm_srli_epi16(bits, 6), mask));
+                return _mm_unpacklo_epi64(low, high);
+            }
+            case 2:
+            {
+                __m128i bits = _mm_loadl_epi64((const __m128i*)packed), mask = _mm_set1_epi8(15);
+                return _mm_unpacklo_epi64(_mm_and_si128(bits, mask), _mm_and_si128(_mm_srli_epi16(bits, 4), mask));
+            }
+            default:
+                return _mm_loadu_si128((const __m128i*)packed);
+        }
+    }
+    
+    /// decodeWord for one channel: the four planes of a group transposed into
+    /// the words of 16 vertices, four to a register, then undone and added
+    /// (or xored) up across the register in two steps
+    template <int channel>
+    static void decodeWordSSE2(unsigned char* out, size_t count, size_t stride, const unsigned char* headers[4],
+                               const unsigned char* packed[4])
+    {
+        static const unsigned char sizes[4] = { 0, 4, 8, 16 };
+        __m128i previous = _mm_setzero_si128();
+        for (size_t group = 0; group * 16 < count; ++group)
+        {
+            __m128i planes[4];
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                unsigned code = headers[byte][group / 4] >> (group % 4 * 2) & 3;
+                planes[byte] = unpackGroupSSE2(packed[byte], code);
+                packed[byte] += sizes[code];
+            }
+            __m128i low01 = _mm_unpacklo_epi8(planes[0], planes[1]), high01 = _mm_unpackhi_epi8(planes[0], planes[1]);
+            __m128i low23 = _mm_unpacklo_epi8(planes[2], planes[3]), high23 = _mm_unpackhi_epi8(planes[2], planes[3]);
+            __m128i words[4] = { _mm_unpacklo_epi16(low01, low23), _mm_unpackhi_epi16(low01, low23),
+                                 _mm_unpacklo_epi16(high01, high23), _mm_unpackhi_epi16(high01, high23) };
+            for (int r = 0; r < 4; ++r)
+            {
+                __m128i x = words[r];
+                if (channel == Delta8)
+                {
+                    x = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(0x7f)),
+                                      _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(x, _mm_set1_epi8(1))));
+                    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+                    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+                    x = _mm_add_epi8(x, previous);
+                }
+                else if (channel == Delta16)
+                {
+                    x = _mm_xor_si128(_mm_srli_epi16(x, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(x, _mm_set1_epi16(1))));
+                    x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+                    x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+                    x = _mm_add_epi16(x, previous);
+                }
+                else
+                {
+                    x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+                    x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+                    x = _mm_xor_si128(x, previous);
+                }
+                previous = _mm_shuffle_epi32(x, 0xff);
+                
+                size_t first = group * 16 + r * 4;
+                if (first + 4 <= count)
+                {
+                    write32(out + (first + 0) * stride, (uint32_t)_mm_cvtsi128_si32(x));
+                    write32(out + (first + 1) * stride, (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(x, 0x55)));
+                    write32(out + (first + 2) * stride, (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(x, 0xaa)));
+                    write32(out + (first + 3) * stride, (uint32_t)_mm_cvtsi128_si32(previous));
+                }
+                else
+                {
+                    uint32_t lanes[4];
+                    _mm_storeu_si128((__m128i*)lanes, x);
+                    for (size_t i = first; i < count; ++i) write32(out + i * stride, lanes[i - first]);
+                    return;
+                }
+            }
+        }
+    }
+#endif
+
+    // ------------------------------------------------------------------------
+    // Index coding
+    
+    static void writeVarint(std::vector<unsigned char>& out, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((unsigned char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((unsigned char)value);
+    }
+    
+    /// How 'vertex' is coded, writing it out if it has to be
+    static int encodeVertex(Fifo& fifo, uint32_t vertex, std::vector<unsigned char>& extra)
+    {
+        if (vertex == fifo.next)
+        {
+            fifo.pushVertex(fifo.next++);
+            return Next;
+        }
+        for (int age = 0; age < Explicit - 1; ++age)
+            if (fifo.vertex(age) == vertex) return 1 + age;
+        uint32_t delta = vertex - fifo.last;
+        writeVarint(extra, delta << 1 ^ (0u - (delta >> 31)));
+        fifo.last = vertex;
+        fifo.pushVertex(vertex);
+        return Explicit;
+    }
+    
+    static bool decodeVertex(Fifo& fifo, unsigned code, const unsigned char*& extra, const unsigned char* end, uint32_t& vertex)
+    {
+        if (code == Next)
+        {
+            vertex = fifo.next++;
+            fifo.pushVertex(vertex);
+            return true;
+        }
+        if (code != Explicit)
+        {
+            vertex = fifo.vertex((int)code - 1);
+            return true;
+        }
+        uint32_t zigzag = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            if (extra == end || shift > 28) return false;
+            unsigned char byte = *extra++;
+            zigzag |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        vertex = fifo.last + (zigzag >> 1 ^ (0u - (zigzag & 1)));
+        fifo.last = vertex;
+        fifo.pushVertex(vertex);
+        return true;
+    }
+    
+    template <typename Index>
+    static bool decodeSegment(Index* out, size_t triangles, size_t vertexCount, Fifo& fifo, const unsigned char* codes,
+                              const unsigned char* codesEnd, const unsigned char* extra, const unsigned char* extraEnd)
+    {
+        for (size_t t = 0; t < triangles; ++t)
+        {
+            if (codes == codesEnd) return false;
+            unsigned code = *codes++;
+            uint32_t x, y, z;
+            if (code < NoEdge)
+            {
+                const uint32_t* edge = fifo.edge((int)(code >> 4));
+                x = edge[0];
+                y = edge[1];
+                if (!decodeVertex(fifo, code & 15, extra, extraEnd, z)) return false;
+                fifo.pushEdge(z, y);
+                fifo.pushEdge(x, z);
+            }
+            else
+            {
+                if (code >= NoEdge + 16 || codes == codesEnd) return false;
+                unsigned more = *codes++;
+                if (!decodeVertex(fifo, code & 15, extra, extraEnd, x) || !decodeVertex(fifo, more >> 4, extra, extraEnd, y) ||
+                    !decodeVertex(fifo, more & 15, extra, extraEnd, z)) return false;
+                fifo.pushEdge(y, x);
+                fifo.pushEdge(z, y);
+                fifo.pushEdge(x, z);
+            }
+            if (x >= vertexCount || y >= vertexCount || z >= vertexCount) return false;
+            out[t * 3 + 0] = (Index)x;
+            out[t * 3 + 1] = (Index)y;
+            out[t * 3 + 2] = (Index)z;
+        }
+        return codes == codesEnd && extra == extraEnd;
+    }
+};
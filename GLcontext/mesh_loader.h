@@ -0,0 +1,1648 @@
+//
+//  mesh_loader.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "mesh_codec.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "meshlets.h"
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// The locations meshes feed their attributes to, as vertShader.vert has
+/// them. A layout can leave any of them out
+struct MeshAttribute
+{
+    enum : GLuint { Position = 0, Color = 1, TexCoord = 2, Normal = 3, Tangent = 4, Count = 5 };
+};
+
+/// Triangles on the GPU: one vertex buffer in a VertexLayout, one index
+/// buffer, and the parts of it that were separate in the file. Where the
+/// layout stores positions normalized they are relative to the bounds: the
+/// shader gets center + scale * position back. Bounds, meshlets and errors
+/// are all in model units.
+class Mesh
+{
+public:
+    struct Part
+    {
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+        std::vector<MeshLod::Level> lods;   // the full part then coarser ones, if any were made
+    };
+    
+    GLuint vertexBuffer = 0, indexBuffer = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    size_t vertexCount = 0, indexCount = 0;
+    std::vector<Part> parts;
+    VertexLayout layout;
+    float boundsMin[3] = { 0, 0, 0 }, boundsMax[3] = { 0, 0, 0 };
+    float center[3] = { 0, 0, 0 };
+    float scale = 1;
+    std::vector<float> lodErrors;           // each level's worst error over the parts, for MeshLod::select
+    Meshlets meshlets;                      // the full parts in clusters, if they were made
+    
+    Mesh() = default;
+    
+    ~Mesh()
+    {
+        if (vao) glDeleteVertexArrays(1, &vao);
+        if (vertexBuffer) glDeleteBuffers(1, &vertexBuffer);
+        if (indexBuffer) glDeleteBuffers(1, &indexBuffer);
+    }
+    
+    Mesh(Mesh&& other) { *this = std::move(other); }
+    
+    Mesh& operator=(Mesh&& other)
+    {
+        std::swap(vertexBuffer, other.vertexBuffer);
+        std::swap(indexBuffer, other.indexBuffer);
+        std::swap(indexType, other.indexType);
+        std::swap(vertexCount, other.vertexCount);
+        std::swap(indexCount, other.indexCount);
+        std::swap(parts, other.parts);
+        std::swap(layout, other.layout);
+        std::swap(boundsMin, other.boundsMin);
+        std::swap(boundsMax, other.boundsMax);
+        std::swap(center, other.center);
+        std::swap(scale, other.scale);
+        std::swap(lodErrors, other.lodErrors);
+        std::swap(meshlets, other.meshlets);
+        std::swap(vao, other.vao);
+        return *this;
+    }
+    
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    
+    explicit operator bool() const { return vertexBuffer != 0; }
+    
+    size_t indexSize() const { return indexType == GL_UNSIGNED_SHORT ? 2 : 4; }
+    
+    /// Bind its vertex array, making it the first time. Vertex arrays belong
+    /// to the context that makes them, so a mesh loaded on a loading thread
+    /// gets its own here, on the render thread
+    void bind()
+    {
+        if (vao)
+        {
+            glBindVertexArray(vao);
+            return;
+        }
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        layout.apply(vertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    }
+    
+    /// All its parts, at level of detail 'lod' or the coarsest each has.
+    /// Leaves its vertex array bound
+    void draw(size_t lod = 0)
+    {
+        bind();
+        for (const Part& part : parts)
+        {
+            size_t first = part.firstIndex, count = part.indexCount;
+            if (lod > 0 && !part.lods.empty())
+            {
+                const MeshLod::Level& level = part.lods[std::min(lod, part.lods.size() - 1)];
+                first = level.firstIndex;
+                count = level.indexCount;
+            }
+            glDrawElements(GL_TRIANGLES, (GLsizei)count, indexType, (const void*)(first * indexSize()));
+        }
+    }
+    
+    /// The full parts, less the meshlets 'view' can't see; all of them if
+    /// none were made. Leaves its vertex array bound
+    void draw(const Meshlets::View& view)
+    {
+        if (meshlets.empty())
+        {
+            draw();
+            return;
+        }
+        bind();
+        meshlets.draw(view, indexType);
+    }
+
+private:
+    GLuint vao = 0;
+};
+
+/// Loads OBJ and binary glTF 2.0 (.glb) meshes into a VertexLayout. Files
+/// are mapped rather than read; parsing is split across threads (an OBJ
+/// into runs of whole lines, a glTF into ranges of each accessor), and the
+/// vertices are encoded by those threads straight into the mapped vertex
+/// buffer, so the only copies on the way are the ones that change the data.
+/// With 'optimize', each part goes through a MeshOptimizer on the way, and
+/// with 'lods' levels of detail are made for each, over the same vertices
+/// and after the full parts in the index buffer. The full parts are split
+/// into meshlets as 'meshlets' says, for draws that cull them.
+///
+/// save() bakes a loaded mesh, as it is on the GPU, into a file of its own
+/// with the vertices and indices compressed by MeshCodec; load() takes those
+/// back (for the same layout) without parsing or optimizing anything,
+/// decoding across the threads straight into the mapped buffers.
+///
+///     MeshLoader meshes(MeshVertex::layout());
+///     Mesh mesh = meshes.load("bunny.obj");
+///     meshes.save(mesh, "bunny.mesh");
+///     mesh.draw();
+///
+/// OBJ faces with more than three corners are fanned, and "v x y z r g b"
+/// lines give vertex colors; groups and materials are ignored. Texture
+/// coords are flipped to glTF's convention (v down from the top row), which
+/// is how images are uploaded here. glTF primitives other than triangle
+/// lists, sparse accessors and buffers outside the .glb are not supported;
+/// node transforms are not applied.
+class MeshLoader
+{
+public:
+    struct Stats
+    {
+        size_t meshes = 0;
+        size_t failed = 0;
+        size_t lods = 0;            // levels made past the full parts
+        size_t meshlets = 0;
+        size_t baked = 0;           // of the meshes, those that were loaded baked
+        size_t saved = 0;
+        uint64_t vertices = 0, triangles = 0;
+        uint64_t bytesRead = 0;     // of files mapped
+        double parseMs = 0;         // parsing, and welding OBJ corners into vertices
+        double optimizeMs = 0;
+        double simplifyMs = 0;      // making levels of detail
+        double meshletMs = 0;       // clustering, and numbering vertices again after
+        double writeMs = 0;         // encoding into the GPU buffers
+        double decodeMs = 0;        // baked meshes, into the GPU buffers
+        double saveMs = 0;          // reading meshes back, compressing and writing them
+        int threads = 0;
+    };
+    
+    /// 'threads' 0 uses a thread a core
+    explicit MeshLoader(const VertexLayout& layout, bool optimize = true, int threads = 0,
+                        const MeshLod::Settings& lods = MeshLod::Settings(),
+                        const Meshlets::Settings& meshlets = Meshlets::Settings())
+        : layout(layout), optimizeMeshes(optimize), lodSettings(lods), meshletSettings(meshlets),
+          threadCount(threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency()))
+    {
+        statistics.threads = threadCount;
+    }
+    
+    /// An OBJ, a .glb, or a mesh save() baked. An empty mesh if the file
+    /// can't be read or parsed
+    Mesh load(const std::string& path)
+    {
+        Mapping file;
+        if (!file.map(path))
+        {
+            std::cout << "ERROR::MESH_LOADER::CANNOT_READ " << path << std::endl;
+            ++statistics.failed;
+            return Mesh();
+        }
+        statistics.bytesRead += file.size;
+        
+        Mesh mesh;
+        bool binary = file.size >= 4 && memcmp(file.data, "glTF", 4) == 0;
+        bool baked = file.size >= 4 && memcmp(file.data, "GLMS", 4) == 0;
+        if (baked) mesh = loadBaked(file, path);
+        else if (binary) mesh = loadGlb(file, path);
+        else if (endsWith(path, ".obj")) mesh = loadObj(file, path);
+        else std::cout << "ERROR::MESH_LOADER::UNKNOWN_FORMAT " << path << " (OBJ or binary glTF)" << std::endl;
+        
+        if (mesh)
+        {
+            ++statistics.meshes;
+            statistics.vertices += mesh.vertexCount;
+            for (const Mesh::Part& part : mesh.parts) statistics.triangles += part.indexCount / 3;
+        }
+        else
+        {
+            ++statistics.failed;
+        }
+        return mesh;
+    }
+    
+    /// Bake 'mesh', which has to be in this loader's layout, for load() to
+    /// read back: the buffers are read back from the GPU and compressed, and
+    /// the parts, levels of detail and meshlets kept as they are. The file
+    /// is written next to 'path' and renamed over it
+    bool save(const Mesh& mesh, const std::string& path)
+    {
+        if (!mesh || mesh.layout.stride % 4 != 0)
+        {
+            std::cout << "ERROR::MESH_LOADER::CANNOT_BAKE " << path << std::endl;
+            return false;
+        }
+        Clock::time_point start = Clock::now();
+        
+        size_t stride = (size_t)mesh.layout.stride;
+        GLint previousBuffer;
+        glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &previousBuffer);
+        std::vector<unsigned char> vertices(mesh.vertexCount * stride);
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)vertices.size(), vertices.data());
+        std::vector<uint32_t> indices(mesh.indexCount);
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.indexBuffer);
+        if (mesh.indexType == GL_UNSIGNED_SHORT)
+        {
+            std::vector<uint16_t> shortIndices(mesh.indexCount);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)(shortIndices.size() * sizeof(uint16_t)), shortIndices.data());
+            std::copy(shortIndices.begin(), shortIndices.end(), indices.begin());
+        }
+        else
+        {
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)(indices.size() * sizeof(uint32_t)), indices.data());
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, previousBuffer);
+        
+        std::vector<unsigned char> vertexStream = MeshCodec::encodeVertices(vertices.data(), mesh.vertexCount, stride,
+                                                                            MeshCodec::channels(mesh.layout));
+        std::vector<unsigned char> indexStream = MeshCodec::encodeIndices(indices.data(), indices.size());
+        
+        BakedHeader header = {};
+        header.magic = BakedMagic;
+        header.version = BakedVersion;
+        header.stride = (uint32_t)mesh.layout.stride;
+        header.attributes = (uint32_t)mesh.layout.attributes.size();
+        header.vertexCount = mesh.vertexCount;
+        header.indexCount = mesh.indexCount;
+        header.indexType = mesh.indexType;
+        header.parts = (uint32_t)mesh.parts.size();
+        header.lodErrors = (uint32_t)mesh.lodErrors.size();
+        header.meshlets = (uint32_t)mesh.meshlets.size();
+        memcpy(header.boundsMin, mesh.boundsMin, sizeof(header.boundsMin));
+        memcpy(header.boundsMax, mesh.boundsMax, sizeof(header.boundsMax));
+        memcpy(header.center, mesh.center, sizeof(header.center));
+        header.scale = mesh.scale;
+        header.vertexBytes = vertexStream.size();
+        header.indexBytes = indexStream.size();
+        
+        std::vector<unsigned char> blob;
+        append(blob, &header, 1);
+        for (const VertexAttribute& attribute : mesh.layout.attributes)
+        {
+            BakedAttribute record = baked(attribute);
+            append(blob, &record, 1);
+        }
+        for (const Mesh::Part& part : mesh.parts)
+        {
+            BakedPart record = { part.firstIndex, part.indexCount, (uint32_t)part.lods.size(), 0 };
+            append(blob, &record, 1);
+            for (const MeshLod::Level& level : part.lods)
+            {
+                BakedLevel levelRecord = { level.firstIndex, level.indexCount, level.error, 0 };
+                append(blob, &levelRecord, 1);
+            }
+        }
+        append(blob, mesh.lodErrors.data(), mesh.lodErrors.size());
+        for (size_t i = 0; i < mesh.meshlets.size(); ++i)
+        {
+            Meshlets::Meshlet meshlet = mesh.meshlets.meshlet(i);
+            append(blob, &meshlet, 1);
+        }
+        append(blob, vertexStream.data(), vertexStream.size());
+        append(blob, indexStream.data(), indexStream.size());
+        
+        // readers only ever see a complete file
+        std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        bool written = file && fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+        if (file) written = fclose(file) == 0 && written;
+        if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::MESH_LOADER::WRITE_FAILED " << path << ": " << strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        ++statistics.saved;
+        statistics.saveMs += elapsedMs(start);
+        return true;
+    }
+    
+    const MeshOptimizer& optimizer() const { return meshOptimizer; }
+    
+    Stats stats() const { return statistics; }
+    
+    void printStats() const
+    {
+        std::cout << "MESH_LOADER: " << statistics.meshes << " meshes (" << statistics.failed << " failed), "
+            << statistics.vertices << " vertices, " << statistics.triangles << " triangles from "
+            << statistics.bytesRead / 1024 << " KB on " << statistics.threads << " threads: parse " << statistics.parseMs
+            << " ms, optimize " << statistics.optimizeMs << " ms, " << statistics.lods << " LODs in " << statistics.simplifyMs
+            << " ms, " << statistics.meshlets << " meshlets in " << statistics.meshletMs << " ms, write " << statistics.writeMs
+            << " ms, " << statistics.baked << " baked decoded in " << statistics.decodeMs << " ms, " << statistics.saved
+            << " saved in " << statistics.saveMs << " ms" << std::endl;
+        if (optimizeMeshes) meshOptimizer.printStats();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    enum : uint32_t { Missing = ~0u };
+    enum { LodCacheSize = 16 };     // the cache levels of detail are ordered for, the optimizer's default
+    
+    static constexpr uint32_t BakedMagic = 0x534d4c47; // "GLMS"
+    static constexpr uint32_t BakedVersion = 1;
+    
+    /// A baked mesh: this, the layout's attributes, each part followed by
+    /// its levels, the levels' errors, the meshlets, then the vertex and
+    /// index streams from MeshCodec
+    struct BakedHeader
+    {
+        uint32_t magic, version;
+        uint32_t stride, attributes;
+        uint64_t vertexCount, indexCount;
+        uint32_t indexType, parts, lodErrors, meshlets;
+        float boundsMin[3], boundsMax[3], center[3], scale;
+        uint64_t vertexBytes, indexBytes;
+    };
+    
+    struct BakedAttribute
+    {
+        uint32_t location, components, type, normalized, offset;
+    };
+    
+    struct BakedPart
+    {
+        uint64_t firstIndex, indexCount;
+        uint32_t lods, reserved;
+    };
+    
+    struct BakedLevel
+    {
+        uint64_t firstIndex, indexCount;
+        float error;
+        uint32_t reserved;
+    };
+    
+    /// A file mapped read-only
+    struct Mapping
+    {
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        
+        Mapping() = default;
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+        ~Mapping() { if (data) munmap((void*)data, size); }
+        
+        bool map(const std::string& path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat info;
+            void* mapping = MAP_FAILED;
+            if (fstat(fd, &info) == 0 && info.st_size > 0)
+                mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED) return false;
+            data = (const unsigned char*)mapping;
+            size = (size_t)info.st_size;
+            return true;
+        }
+    };
+    
+    /// What a parser hands on: the vertices, the triangles, for each part
+    /// the range of both, and positions as floats for the bounds and the
+    /// optimizer. The attributes themselves come from the parser's fetch
+    /// as the vertices are written
+    struct Geometry
+    {
+        struct Range
+        {
+            size_t firstIndex, indexCount;
+            size_t firstVertex, vertexCount;    // the part's indices start from firstVertex
+        };
+        
+        size_t vertexCount = 0;
+        std::vector<uint32_t> indices;
+        const float* positions = nullptr;       // three a vertex
+        std::vector<Range> ranges;
+    };
+    
+    /// The floats a vertex is written from, a row an attribute
+    typedef float Attributes[MeshAttribute::Count][4];
+    
+    VertexLayout layout;
+    bool optimizeMeshes;
+    MeshLod::Settings lodSettings;
+    Meshlets::Settings meshletSettings;
+    int threadCount;
+    MeshOptimizer meshOptimizer;
+    Stats statistics;
+    
+    static bool endsWith(const std::string& text, const char* suffix)
+    {
+        size_t length = strlen(suffix);
+        if (text.size() < length) return false;
+        for (size_t i = 0; i < length; ++i)
+            if (tolower((unsigned char)text[text.size() - length + i]) != suffix[i]) return false;
+        return true;
+    }
+    
+    static double elapsedMs(Clock::time_point since)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    }
+    
+    template <typename T>
+    static void append(std::vector<unsigned char>& blob, const T* items, size_t count)
+    {
+        blob.insert(blob.end(), (const unsigned char*)items, (const unsigned char*)(items + count));
+    }
+    
+    /// Copy 'count' items out of 'p' and step past them. False if there
+    /// aren't that many before 'end'
+    template <typename T>
+    static bool take(const unsigned char*& p, const unsigned char* end, T* items, size_t count)
+    {
+        if ((size_t)(end - p) / sizeof(T) < count) return false;
+        if (count) memcpy(items, p, count * sizeof(T));
+        p += count * sizeof(T);
+        return true;
+    }
+    
+    static bool within(uint64_t first, uint64_t count, uint64_t total) { return first <= total && count <= total - first; }
+    
+    static BakedAttribute baked(const VertexAttribute& attribute)
+    {
+        BakedAttribute record = { attribute.location, (uint32_t)attribute.components, attribute.type, attribute.normalized,
+                                  (uint32_t)attribute.offset };
+        return record;
+    }
+    
+    /// Run 'body(begin, end)' over 'count' items in a contiguous range a
+    /// thread, none smaller than 'grain', the last on this one
+    template <typename Body>
+    void parallelFor(size_t count, size_t grain, Body body) const
+    {
+        size_t chunks = std::min<size_t>(threadCount, (count + grain - 1) / std::max<size_t>(grain, 1));
+        if (chunks <= 1)
+        {
+            if (count) body((size_t)0, count);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunks; ++i)
+            workers.emplace_back(body, count * i / chunks, count * (i + 1) / chunks);
+        body((size_t)0, count / chunks);
+        for (std::thread& worker : workers) worker.join();
+    }
+    
+    static void defaults(Attributes& attributes)
+    {
+        static const float values[MeshAttribute::Count][4] = {
+            { 0, 0, 0, 1 }, { 1, 1, 1, 1 }, { 0, 0, 0, 0 }, { 0, 0, 1, 0 }, { 1, 0, 0, 1 },
+        };
+        memcpy(attributes, values, sizeof(values));
+    }
+    
+    /// The attributes the layout keeps, for the simplifier to weigh against
+    /// position error: 'count' floats a vertex of 'range'
+    template <typename Fetch>
+    std::vector<float> lodAttributes(const Geometry::Range& range, Fetch& fetch, size_t& count) const
+    {
+        static const GLuint locations[] = { MeshAttribute::Color, MeshAttribute::TexCoord, MeshAttribute::Normal };
+        static const int sizes[] = { 3, 2, 3 };
+        std::vector<GLuint> kept;
+        count = 0;
+        for (int i = 0; i < 3; ++i)
+            if (layout.find(locations[i]))
+            {
+                kept.push_back(i);
+                count += sizes[i];
+            }
+        std::vector<float> attributes(range.vertexCount * count);
+        if (count == 0) return attributes;
+        float weight = lodSettings.attributeWeight;
+        parallelFor(range.vertexCount, 4096, [&](size_t begin, size_t end)
+        {
+            Attributes values;
+            for (size_t v = begin; v < end; ++v)
+            {
+                defaults(values);
+                fetch(range.firstVertex + v, values);
+                float* out = &attributes[v * count];
+                for (GLuint i : kept)
+                    for (int c = 0; c < sizes[i]; ++c) *out++ = values[locations[i]][c] * weight;
+            }
+        });
+        return attributes;
+    }
+    
+    // ------------------------------------------------------------------------
+    // Writing
+    
+    /// Optimize the geometry's parts and make their levels of detail, then encode its vertices into a new
+    /// vertex buffer, 'fetch(vertex, attributes)' giving the floats for each,
+    /// and its indices into a new index buffer, both through mappings
+    template <typename Fetch>
+    Mesh build(Geometry& geometry, Fetch fetch, const std::string& path)
+    {
+        Mesh mesh;
+        if (geometry.vertexCount == 0 || geometry.indices.empty())
+        {
+            std::cout << "ERROR::MESH_LOADER::NO_TRIANGLES " << path << std::endl;
+            return mesh;
+        }
+        mesh.layout = layout;
+        
+        // bounds, and where normalized positions are relative to
+        for (int c = 0; c < 3; ++c)
+        {
+            mesh.boundsMin[c] = INFINITY;
+            mesh.boundsMax[c] = -INFINITY;
+        }
+        for (size_t v = 0; v < geometry.vertexCount; ++v)
+            for (int c = 0; c < 3; ++c)
+            {
+                mesh.boundsMin[c] = std::min(mesh.boundsMin[c], geometry.positions[v * 3 + c]);
+                mesh.boundsMax[c] = std::max(mesh.boundsMax[c], geometry.positions[v * 3 + c]);
+            }
+        const VertexAttribute* position = layout.find(MeshAttribute::Position);
+        if (position && position->normalized)
+        {
+            mesh.scale = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                mesh.center[c] = (mesh.boundsMin[c] + mesh.boundsMax[c]) / 2;
+                mesh.scale = std::max(mesh.scale, (mesh.boundsMax[c] - mesh.boundsMin[c]) / 2);
+            }
+            if (mesh.scale == 0) mesh.scale = 1;
+        }
+        
+        // coarser levels of each part, in its own vertex numbers
+        Clock::time_point start = Clock::now();
+        std::vector<std::vector<std::vector<uint32_t>>> levels(geometry.ranges.size());
+        std::vector<std::vector<float>> levelErrors(geometry.ranges.size());
+        if (lodSettings.levels > 0)
+        {
+            for (size_t r = 0; r < geometry.ranges.size(); ++r)
+            {
+                const Geometry::Range& range = geometry.ranges[r];
+                size_t attributeCount = 0;
+                std::vector<float> attributes = lodAttributes(range, fetch, attributeCount);
+                levels[r] = MeshLod::chain(&geometry.indices[range.firstIndex], range.indexCount, range.vertexCount,
+                                           geometry.positions + range.firstVertex * 3, 3 * sizeof(float),
+                                           attributes.data(), attributeCount, lodSettings, levelErrors[r]);
+                statistics.lods += levels[r].size() - 1;
+            }
+            statistics.simplifyMs += elapsedMs(start);
+        }
+        
+        // each part optimized on its own; the remap takes vertices to where
+        // they go in the buffer, Unused for ones no triangle uses
+        start = Clock::now();
+        std::vector<uint32_t> remap(geometry.vertexCount);
+        size_t used = 0;
+        for (size_t r = 0; r < geometry.ranges.size(); ++r)
+        {
+            const Geometry::Range& range = geometry.ranges[r];
+            if (!optimizeMeshes)
+            {
+                for (size_t v = 0; v < range.vertexCount; ++v) remap[range.firstVertex + v] = (uint32_t)(range.firstVertex + v);
+                for (size_t i = 0; i < range.indexCount; ++i) geometry.indices[range.firstIndex + i] += (uint32_t)range.firstVertex;
+                for (size_t l = 1; l < levels[r].size(); ++l)
+                    for (uint32_t& index : levels[r][l]) index += (uint32_t)range.firstVertex;
+                used = std::max(used, range.firstVertex + range.vertexCount);
+                continue;
+            }
+            std::vector<uint32_t> indices(geometry.indices.begin() + range.firstIndex,
+                                          geometry.indices.begin() + range.firstIndex + range.indexCount);
+            std::vector<uint32_t> partRemap = meshOptimizer.optimize(indices, range.vertexCount,
+                                                                     geometry.positions + range.firstVertex * 3, 3 * sizeof(float));
+            size_t partUsed = 0;
+            for (size_t v = 0; v < range.vertexCount; ++v)
+            {
+                uint32_t target = partRemap[v];
+                remap[range.firstVertex + v] = target == MeshOptimizer::Unused ? (uint32_t)MeshOptimizer::Unused : (uint32_t)(used + target);
+                partUsed += target != MeshOptimizer::Unused;
+            }
+            for (size_t i = 0; i < range.indexCount; ++i) geometry.indices[range.firstIndex + i] = (uint32_t)(used + indices[i]);
+            // the coarser levels use a subset of the full part's vertices, and in cache order too
+            for (size_t l = 1; l < levels[r].size(); ++l)
+            {
+                std::vector<uint32_t>& level = levels[r][l];
+                for (uint32_t& index : level) index = partRemap[index];
+                indices.resize(level.size());
+                MeshOptimizer::optimizeVertexCache(indices.data(), level.data(), level.size(), partUsed, LodCacheSize);
+                for (size_t i = 0; i < level.size(); ++i) level[i] = (uint32_t)(used + indices[i]);
+            }
+            used += partUsed;
+        }
+        if (optimizeMeshes) statistics.optimizeMs += elapsedMs(start);
+        
+        // the full parts in meshlets, from positions in the buffer's order
+        if (meshletSettings.maxTriangles > 0)
+        {
+            start = Clock::now();
+            std::vector<float> placed(used * 3, 0.0f);
+            for (size_t v = 0; v < geometry.vertexCount; ++v)
+                if (remap[v] != MeshOptimizer::Unused) memcpy(&placed[(size_t)remap[v] * 3], geometry.positions + v * 3, 3 * sizeof(float));
+            for (const Geometry::Range& range : geometry.ranges)
+                mesh.meshlets.build(&geometry.indices[range.firstIndex], range.indexCount, range.firstIndex, placed.data(),
+                                    3 * sizeof(float), used, meshletSettings);
+            // clustering moves triangles out of the order the optimizer
+            // numbered vertices in; every vertex is in a full part, so this
+            // only renumbers them
+            if (optimizeMeshes)
+            {
+                std::vector<uint32_t> renumber = MeshOptimizer::optimizeVertexFetch(geometry.indices.data(), geometry.indices.size(), used);
+                for (uint32_t& target : remap)
+                    if (target != MeshOptimizer::Unused) target = renumber[target];
+                for (std::vector<std::vector<uint32_t>>& partLevels : levels)
+                    for (size_t l = 1; l < partLevels.size(); ++l)
+                        for (uint32_t& index : partLevels[l]) index = renumber[index];
+            }
+            statistics.meshlets += mesh.meshlets.size();
+            statistics.meshletMs += elapsedMs(start);
+        }
+        
+        // the levels go after all the full parts
+        std::vector<std::vector<MeshLod::Level>> partLods(geometry.ranges.size());
+        for (size_t r = 0; r < geometry.ranges.size(); ++r)
+        {
+            for (size_t l = 0; l < levels[r].size(); ++l)
+            {
+                MeshLod::Level level;
+                level.firstIndex = l == 0 ? geometry.ranges[r].firstIndex : geometry.indices.size();
+                level.indexCount = l == 0 ? geometry.ranges[r].indexCount : levels[r][l].size();
+                level.error = levelErrors[r][l];
+                if (l > 0) geometry.indices.insert(geometry.indices.end(), levels[r][l].begin(), levels[r][l].end());
+                partLods[r].push_back(level);
+            }
+            std::vector<std::vector<uint32_t>>().swap(levels[r]);
+        }
+        size_t lodCount = 0;
+        for (const std::vector<MeshLod::Level>& lods : partLods) lodCount = std::max(lodCount, lods.size());
+        mesh.lodErrors.assign(lodCount, 0.0f);
+        for (const std::vector<MeshLod::Level>& lods : partLods)
+            for (size_t l = 0; l < lodCount && !lods.empty(); ++l)
+                mesh.lodErrors[l] = std::max(mesh.lodErrors[l], lods[std::min(l, lods.size() - 1)].error);
+        
+        start = Clock::now();
+        GLint previousBuffer;
+        glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &previousBuffer);
+        
+        // the vertices, encoded by the threads straight into the mapping
+        size_t stride = (size_t)layout.stride;
+        glGenBuffers(1, &mesh.vertexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.vertexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(used * stride), nullptr, GL_STATIC_DRAW);
+        unsigned char* vertices = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)(used * stride),
+                                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        bool written = vertices != nullptr;
+        if (vertices)
+        {
+            parallelFor(geometry.vertexCount, 4096, [&](size_t begin, size_t end)
+            {
+                Attributes attributes;
+                for (size_t v = begin; v < end; ++v)
+                {
+                    if (remap[v] == MeshOptimizer::Unused) continue;
+                    defaults(attributes);
+                    fetch(v, attributes);
+                    float* p = attributes[MeshAttribute::Position];
+                    for (int c = 0; c < 3; ++c) p[c] = (p[c] - mesh.center[c]) / mesh.scale;
+                    unsigned char* vertex = vertices + (size_t)remap[v] * stride;
+                    memset(vertex, 0, stride);
+                    for (const VertexAttribute& attribute : layout.attributes)
+                        if (attribute.location < MeshAttribute::Count)
+                            attribute.encode(attributes[attribute.location], vertex + attribute.offset);
+                }
+            });
+            written = glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+        }
+        
+        // the indices, 16-bit where they fit
+        mesh.vertexCount = used;
+        mesh.indexCount = geometry.indices.size();
+        mesh.indexType = MeshOptimizer::fitsShort(used) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        glGenBuffers(1, &mesh.indexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.indexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(mesh.indexCount * mesh.indexSize()), nullptr, GL_STATIC_DRAW);
+        void* indices = written ? glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)(mesh.indexCount * mesh.indexSize()),
+                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) : nullptr;
+        written = indices != nullptr;
+        if (indices)
+        {
+            bool shortIndices = mesh.indexType == GL_UNSIGNED_SHORT;
+            parallelFor(mesh.indexCount, 1 << 16, [&](size_t begin, size_t end)
+            {
+                if (shortIndices)
+                    std::copy(geometry.indices.begin() + begin, geometry.indices.begin() + end, (uint16_t*)indices + begin);
+                else
+                    memcpy((uint32_t*)indices + begin, geometry.indices.data() + begin, (end - begin) * sizeof(uint32_t));
+            });
+            written = glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, previousBuffer);
+        statistics.writeMs += elapsedMs(start);
+        
+        if (!written)
+        {
+            std::cout << "ERROR::MESH_LOADER::WRITE_FAILED " << path << std::endl;
+            return Mesh();
+        }
+        for (size_t r = 0; r < geometry.ranges.size(); ++r)
+        {
+            Mesh::Part part;
+            part.firstIndex = geometry.ranges[r].firstIndex;
+            part.indexCount = geometry.ranges[r].indexCount;
+            part.lods = std::move(partLods[r]);
+            mesh.parts.push_back(std::move(part));
+        }
+        return mesh;
+    }
+    
+    // ------------------------------------------------------------------------
+    // OBJ
+    
+    struct Corner
+    {
+        uint32_t position, texCoord, normal;
+        bool operator==(const Corner& other) const
+        {
+            return position == other.position && texCoord == other.texCoord && normal == other.normal;
+        }
+    };
+    
+    /// What a run of lines holds. Negative (relative) indices are counted
+    /// from the run's own start until the runs before it are counted
+    struct ObjRun
+    {
+        const char* begin;
+        const char* end;
+        std::vector<float> positions, colors, texCoords, normals;
+        std::vector<Corner> corners;
+        std::vector<std::pair<size_t, int>> relative;   // corner, and which of its indices
+        size_t firstPosition = 0, firstTexCoord = 0, firstNormal = 0, firstCorner = 0;
+        bool bad = false;
+    };
+    
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+    
+    static const char* skipSpace(const char* p, const char* end)
+    {
+        while (p < end && isSpace(*p)) ++p;
+        return p;
+    }
+    
+    /// A decimal float, without the locale and the copies strtof makes. Null
+    /// if there is no number at 'p'
+    static const char* parseFloat(const char* p, const char* end, float& value)
+    {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        p = skipSpace(p, end);
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) ++p;
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; }
+            else ++exponent;
+        }
+        if (p < end && *p == '.')
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+                if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; --exponent; }
+        if (!any) return nullptr;
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char* q = p + 1;
+            bool negativeExponent = q < end && *q == '-';
+            if (q < end && (*q == '-' || *q == '+')) ++q;
+            int e = 0;
+            bool anyExponent = false;
+            for (; q < end && *q >= '0' && *q <= '9'; ++q, anyExponent = true) e = std::min(e * 10 + (*q - '0'), 10000);
+            if (anyExponent)
+            {
+                exponent += negativeExponent ? -e : e;
+                p = q;
+            }
+        }
+        double result = (double)mantissa;
+        if (exponent < 0) result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+        else if (exponent > 0) result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+        value = (float)(negative ? -result : result);
+        return p;
+    }
+    
+    static const char* parseInt(const char* p, const char* end, int64_t& value)
+    {
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) ++p;
+        if (p == end || *p < '0' || *p > '9') return nullptr;
+        int64_t result = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) result = std::min<int64_t>(result * 10 + (*p - '0'), (int64_t)1 << 40);
+        value = negative ? -result : result;
+        return p;
+    }
+    
+    /// Parse a run of whole lines
+    static void parseObjRun(ObjRun& run)
+    {
+        const char* p = run.begin;
+        const char* end = run.end;
+        std::vector<Corner> polygon;
+        std::vector<std::pair<size_t, int>> polygonRelative;
+        while (p < end)
+        {
+            p = skipSpace(p, end);
+            const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+            if (!lineEnd) lineEnd = end;
+            
+            if (lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1]))
+            {
+                float values[7];
+                int count = 0;
+                for (const char* q = p + 1; count < 7 && (q = parseFloat(q, lineEnd, values[count])); ) ++count;
+                if (count < 3) run.bad = true;
+                for (int c = 0; c < 3; ++c) run.positions.push_back(c < count ? values[c] : 0.0f);
+                if (count >= 6 && run.colors.size() < run.positions.size() - 3)
+                    run.colors.resize(run.positions.size() - 3, 1.0f);
+                if (count >= 6 || !run.colors.empty())
+                    for (int c = 3; c < 6; ++c) run.colors.push_back(count >= 6 ? values[c] : 1.0f);
+            }
+            else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+            {
+                float u = 0, v = 0;
+                const char* q = parseFloat(p + 2, lineEnd, u);
+                if (!q || !parseFloat(q, lineEnd, v)) v = 0;
+                run.texCoords.push_back(u);
+                run.texCoords.push_back(1.0f - v);
+            }
+            else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+            {
+                float n[3] = { 0, 0, 1 };
+                const char* q = p + 2;
+                for (int c = 0; c < 3 && q; ++c) q = parseFloat(q, lineEnd, n[c]);
+                if (!q) run.bad = true;
+                run.normals.insert(run.normals.end(), n, n + 3);
+            }
+            else if (lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1]))
+            {
+                // corners are position[/texCoord][/normal], 1-based, or negative counting back
+                polygon.clear();
+                polygonRelative.clear();
+                const char* q = skipSpace(p + 1, lineEnd);
+                while (q < lineEnd && !isSpace(*q) && *q != '\n')
+                {
+                    Corner corner = { Missing, Missing, Missing };
+                    uint32_t* slots[3] = { &corner.position, &corner.texCoord, &corner.normal };
+                    size_t counts[3] = { run.positions.size() / 3, run.texCoords.size() / 2, run.normals.size() / 3 };
+                    for (int k = 0; k < 3 && q < lineEnd; ++k)
+                    {
+                        if (k > 0)
+                        {
+                            if (*q != '/') break;
+                            ++q;
+                            if (q < lineEnd && *q == '/') continue;
+                        }
+                        int64_t index;
+                        const char* next = parseInt(q, lineEnd, index);
+                        if (!next || index == 0)
+                        {
+                            run.bad = true;
+                            break;
+                        }
+                        q = next;
+                        if (index > 0)
+                        {
+                            *slots[k] = (uint32_t)(index - 1);
+                        }
+                        else
+                        {
+                            *slots[k] = (uint32_t)(int64_t)(counts[k] + index);
+                            polygonRelative.push_back(std::make_pair(polygon.size(), k));
+                        }
+                    }
+                    while (q < lineEnd && !isSpace(*q)) ++q;
+                    q = skipSpace(q, lineEnd);
+                    if (corner.position == Missing) run.bad = true;
+                    polygon.push_back(corner);
+                }
+                for (size_t i = 1; i + 1 < polygon.size(); ++i)
+                {
+                    size_t corners[3] = { 0, i, i + 1 };
+                    for (size_t c : corners)
+                    {
+                        for (const std::pair<size_t, int>& relative : polygonRelative)
+                            if (relative.first == c) run.relative.push_back(std::make_pair(run.corners.size(), relative.second));
+                        run.corners.push_back(polygon[c]);
+                    }
+                }
+            }
+            p = lineEnd + 1;
+        }
+        if (!run.colors.empty()) run.colors.resize(run.positions.size(), 1.0f);
+    }
+    
+    static uint32_t hashCorner(const Corner& corner)
+    {
+        uint64_t h = corner.position * 0x9E3779B97F4A7C15ull;
+        h ^= (corner.texCoord + 0x632BE59BD9B4E019ull) * 0xC2B2AE3D27D4EB4Full;
+        h ^= (corner.normal + 0x165667B19E3779F9ull) * 0x85EBCA77C2B2AE63ull;
+        h ^= h >> 29;
+        return (uint32_t)(h ^ (h >> 32));
+    }
+    
+    Mesh loadObj(const Mapping& file, const std::string& path)
+    {
+        Clock::time_point start = Clock::now();
+        const char* text = (const char*)file.data;
+        const char* textEnd = text + file.size;
+        
+        // runs of whole lines, parsed in parallel
+        size_t runCount = std::max<size_t>(1, std::min<size_t>(threadCount * 4, file.size / (256 << 10)));
+        std::vector<ObjRun> runs(runCount);
+        const char* p = text;
+        for (size_t i = 0; i < runCount; ++i)
+        {
+            runs[i].begin = p;
+            const char* split = i + 1 == runCount ? textEnd : std::max(p, text + file.size * (i + 1) / runCount);
+            const char* newline = split < textEnd ? (const char*)memchr(split, '\n', textEnd - split) : nullptr;
+            p = i + 1 == runCount || !newline ? textEnd : newline + 1;
+            runs[i].end = p;
+        }
+        parallelFor(runCount, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i) parseObjRun(runs[i]);
+        });
+        
+        // where each run's elements start, then its relative indices made absolute
+        size_t positionCount = 0, texCoordCount = 0, normalCount = 0, cornerCount = 0;
+        bool colored = false, bad = false;
+        for (ObjRun& run : runs)
+        {
+            run.firstPosition = positionCount;
+            run.firstTexCoord = texCoordCount;
+            run.firstNormal = normalCount;
+            run.firstCorner = cornerCount;
+            positionCount += run.positions.size() / 3;
+            texCoordCount += run.texCoords.size() / 2;
+            normalCount += run.normals.size() / 3;
+            cornerCount += run.corners.size();
+            colored |= !run.colors.empty();
+            bad |= run.bad;
+            for (const std::pair<size_t, int>& relative : run.relative)
+            {
+                Corner& corner = run.corners[relative.first];
+                uint32_t* slot = relative.second == 0 ? &corner.position : relative.second == 1 ? &corner.texCoord : &corner.normal;
+                *slot += (uint32_t)(relative.second == 0 ? run.firstPosition : relative.second == 1 ? run.firstTexCoord : run.firstNormal);
+            }
+        }
+        if (bad) std::cout << "ERROR::MESH_LOADER::MALFORMED_LINES " << path << " (skipped what could not be read)" << std::endl;
+        
+        // the runs' elements side by side
+        std::vector<float> positions(positionCount * 3), colors(colored ? positionCount * 3 : 0);
+        std::vector<float> texCoords(texCoordCount * 2), normals(normalCount * 3);
+        std::vector<Corner> corners(cornerCount);
+        parallelFor(runCount, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                ObjRun& run = runs[i];
+                std::copy(run.positions.begin(), run.positions.end(), positions.begin() + run.firstPosition * 3);
+                if (colored && run.colors.empty())
+                    std::fill(colors.begin() + run.firstPosition * 3, colors.begin() + (run.firstPosition * 3 + run.positions.size()), 1.0f);
+                else
+                    std::copy(run.colors.begin(), run.colors.end(), colors.begin() + run.firstPosition * 3);
+                std::copy(run.texCoords.begin(), run.texCoords.end(), texCoords.begin() + run.firstTexCoord * 2);
+                std::copy(run.normals.begin(), run.normals.end(), normals.begin() + run.firstNormal * 3);
+                std::copy(run.corners.begin(), run.corners.end(), corners.begin() + run.firstCorner);
+                std::vector<float>().swap(run.positions);
+                std::vector<float>().swap(run.colors);
+                std::vector<float>().swap(run.texCoords);
+                std::vector<float>().swap(run.normals);
+                std::vector<Corner>().swap(run.corners);
+            }
+        });
+        
+        // corners pointing past what the file has lose the attribute, or the
+        // triangle if it is the position
+        std::atomic<bool> outOfRange(false);
+        bool welded = true;         // every corner's indices agree, so positions are the vertices
+        {
+            std::atomic<bool> mixed(false);
+            parallelFor(cornerCount, 1 << 16, [&](size_t begin, size_t end)
+            {
+                bool differs = false;
+                for (size_t c = begin; c < end; ++c)
+                {
+                    Corner& corner = corners[c];
+                    if (corner.position >= positionCount) { corner.position = 0; outOfRange = true; }
+                    if (corner.texCoord != Missing && corner.texCoord >= texCoordCount) corner.texCoord = Missing;
+                    if (corner.normal != Missing && corner.normal >= normalCount) corner.normal = Missing;
+                    differs |= (corner.texCoord != Missing && corner.texCoord != corner.position)
+                        || (corner.normal != Missing && corner.normal != corner.position);
+                }
+                if (differs) mixed = true;
+            });
+            welded = !mixed;
+        }
+        if (outOfRange) std::cout << "ERROR::MESH_LOADER::BAD_INDEX " << path << std::endl;
+        cornerCount -= cornerCount % 3;
+        
+        Geometry geometry;
+        geometry.indices.resize(cornerCount);
+        std::vector<Corner> vertices;   // the corner each vertex was made from, unless welded
+        std::vector<float> vertexPositions;
+        if (welded)
+        {
+            for (size_t c = 0; c < cornerCount; ++c) geometry.indices[c] = corners[c].position;
+            geometry.vertexCount = positionCount;
+            geometry.positions = positions.data();
+        }
+        else
+        {
+            weld(corners, cornerCount, geometry.indices, vertices);
+            geometry.vertexCount = vertices.size();
+            vertexPositions.resize(vertices.size() * 3);
+            parallelFor(vertices.size(), 1 << 14, [&](size_t begin, size_t end)
+            {
+                for (size_t v = begin; v < end; ++v)
+                    memcpy(&vertexPositions[v * 3], &positions[(size_t)vertices[v].position * 3], 3 * sizeof(float));
+            });
+            geometry.positions = vertexPositions.data();
+        }
+        std::vector<Corner>().swap(corners);
+        geometry.ranges.push_back({ 0, cornerCount, 0, geometry.vertexCount });
+        statistics.parseMs += elapsedMs(start);
+        
+        return build(geometry, [&](size_t v, Attributes& attributes)
+        {
+            Corner corner = welded ? Corner{ (uint32_t)v, (uint32_t)v, (uint32_t)v } : vertices[v];
+            memcpy(attributes[MeshAttribute::Position], &positions[(size_t)corner.position * 3], 3 * sizeof(float));
+            if (colored) memcpy(attributes[MeshAttribute::Color], &colors[(size_t)corner.position * 3], 3 * sizeof(float));
+            if (corner.texCoord < texCoordCount) memcpy(attributes[MeshAttribute::TexCoord], &texCoords[(size_t)corner.texCoord * 2], 2 * sizeof(float));
+            if (corner.normal < normalCount) memcpy(attributes[MeshAttribute::Normal], &normals[(size_t)corner.normal * 3], 3 * sizeof(float));
+        }, path);
+    }
+    
+    /// One vertex per distinct corner. Corners are split between threads by
+    /// hash, so each welds its own share with no locking, and the shares'
+    /// vertices are numbered one after the other
+    void weld(const std::vector<Corner>& corners, size_t cornerCount, std::vector<uint32_t>& indices, std::vector<Corner>& vertices) const
+    {
+        std::vector<uint32_t> hashes(cornerCount);
+        parallelFor(cornerCount, 1 << 16, [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; ++c) hashes[c] = hashCorner(corners[c]);
+        });
+        
+        size_t shares = (size_t)threadCount;
+        std::vector<std::vector<Corner>> shareVertices(shares);
+        parallelFor(shares, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t share = begin; share < end; ++share)
+            {
+                // open addressing, slots holding vertex + 1
+                std::vector<Corner>& keys = shareVertices[share];
+                std::vector<uint32_t> slots(1024, 0);
+                for (size_t c = 0; c < cornerCount; ++c)
+                {
+                    if (hashes[c] % shares != share) continue;
+                    if (keys.size() * 2 >= slots.size())
+                    {
+                        std::vector<uint32_t> grown(slots.size() * 2, 0);
+                        size_t mask = grown.size() - 1;
+                        for (uint32_t k = 0; k < keys.size(); ++k)
+                        {
+                            size_t slot = (hashCorner(keys[k]) / shares) & mask;
+                            while (grown[slot]) slot = (slot + 1) & mask;
+                            grown[slot] = k + 1;
+                        }
+                        slots.swap(grown);
+                    }
+                    size_t mask = slots.size() - 1;
+                    size_t slot = (hashes[c] / shares) & mask;
+                    while (slots[slot] && !(keys[slots[slot] - 1] == corners[c])) slot = (slot + 1) & mask;
+                    if (!slots[slot])
+                    {
+                        keys.push_back(corners[c]);
+                        slots[slot] = (uint32_t)keys.size();
+                    }
+                    indices[c] = slots[slot] - 1;
+                }
+            }
+        });
+        
+        std::vector<size_t> firstVertex(shares + 1, 0);
+        for (size_t share = 0; share < shares; ++share) firstVertex[share + 1] = firstVertex[share] + shareVertices[share].size();
+        vertices.resize(firstVertex[shares]);
+        parallelFor(shares, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t share = begin; share < end; ++share)
+                std::copy(shareVertices[share].begin(), shareVertices[share].end(), vertices.begin() + firstVertex[share]);
+        });
+        parallelFor(cornerCount, 1 << 16, [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; ++c) indices[c] += (uint32_t)firstVertex[hashes[c] % shares];
+        });
+    }
+    
+    // ------------------------------------------------------------------------
+    // glTF
+    
+    /// Just enough JSON for a glTF's
+    struct Json
+    {
+        enum Type { Null, Bool, Number, String, Array, Object };
+        
+        Type type = Null;
+        double number = 0;
+        std::string text;
+        std::vector<Json> items;
+        std::vector<std::pair<std::string, Json>> members;
+        
+        const Json& operator[](const char* key) const
+        {
+            for (const std::pair<std::string, Json>& member : members)
+                if (member.first == key) return member.second;
+            return none();
+        }
+        
+        const Json& operator[](size_t index) const { return index < items.size() ? items[index] : none(); }
+        
+        bool has(const char* key) const { return (*this)[key].type != Null; }
+        
+        int64_t integer(int64_t fallback = -1) const { return type == Number ? (int64_t)number : fallback; }
+        
+        static const Json& none()
+        {
+            static const Json empty;
+            return empty;
+        }
+        
+        static bool parse(const char*& p, const char* end, Json& value, int depth = 0)
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+            if (p == end || depth > 64) return false;
+            if (*p == '{' || *p == '[')
+            {
+                bool object = *p == '{';
+                char close = object ? '}' : ']';
+                value.type = object ? Object : Array;
+                ++p;
+                for (bool first = true;; first = false)
+                {
+                    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+                    if (p < end && *p == close) { ++p; return true; }
+                    if (!first)
+                    {
+                        if (p == end || *p != ',') return false;
+                        ++p;
+                    }
+                    if (object)
+                    {
+                        Json key;
+                        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+                        if (p == end || *p != '"' || !parse(p, end, key, depth + 1)) return false;
+                        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+                        if (p == end || *p != ':') return false;
+                        ++p;
+                        value.members.emplace_back(key.text, Json());
+                        if (!parse(p, end, value.members.back().second, depth + 1)) return false;
+                    }
+                    else
+                    {
+                        value.items.emplace_back();
+                        if (!parse(p, end, value.items.back(), depth + 1)) return false;
+                    }
+                }
+            }
+            if (*p == '"')
+            {
+                value.type = String;
+                for (++p; p < end && *p != '"'; ++p)
+                {
+                    if (*p != '\\') { value.text += *p; continue; }
+                    if (++p == end) return false;
+                    switch (*p)
+                    {
+                        case 'n': value.text += '\n'; break;
+                        case 't': value.text += '\t'; break;
+                        case 'r': value.text += '\r'; break;
+                        case 'b': value.text += '\b'; break;
+                        case 'f': value.text += '\f'; break;
+                        case 'u': p = std::min(p + 4, end - 1); value.text += '?'; break;    // names glTF looks up are ASCII
+                        default: value.text += *p; break;
+                    }
+                }
+                if (p == end) return false;
+                ++p;
+                return true;
+            }
+            if (end - p >= 4 && memcmp(p, "true", 4) == 0) { value.type = Bool; value.number = 1; p += 4; return true; }
+            if (end - p >= 5 && memcmp(p, "false", 5) == 0) { value.type = Bool; p += 5; return true; }
+            if (end - p >= 4 && memcmp(p, "null", 4) == 0) { p += 4; return true; }
+            float number;
+            const char* next = parseFloat(p, end, number);
+            if (!next) return false;
+            // integers (offsets, counts) need more than a float's 24 bits
+            int64_t integer;
+            const char* integerEnd = parseInt(p, end, integer);
+            value.type = Number;
+            value.number = integerEnd == next ? (double)integer : number;
+            p = next;
+            return true;
+        }
+    };
+    
+    /// An accessor resolved to the bytes in the binary chunk
+    struct Accessor
+    {
+        const unsigned char* data = nullptr;
+        size_t count = 0, stride = 0;
+        int components = 0;
+        GLenum componentType = GL_FLOAT;
+        bool normalized = false;
+        
+        explicit operator bool() const { return data != nullptr; }
+        
+        /// Element 'i' as floats, normalized integers scaled as glTF says
+        void read(size_t i, float* out) const
+        {
+            const unsigned char* element = data + i * stride;
+            for (int c = 0; c < components; ++c)
+            {
+                switch (componentType)
+                {
+                    case GL_FLOAT: memcpy(&out[c], element + c * 4, 4); break;
+                    case GL_UNSIGNED_BYTE: out[c] = normalized ? element[c] / 255.0f : element[c]; break;
+                    case GL_BYTE: out[c] = normalized ? std::max((int8_t)element[c] / 127.0f, -1.0f) : (int8_t)element[c]; break;
+                    case GL_UNSIGNED_SHORT:
+                    {
+                        uint16_t value;
+                        memcpy(&value, element + c * 2, 2);
+                        out[c] = normalized ? value / 65535.0f : value;
+                        break;
+                    }
+                    case GL_SHORT:
+                    {
+                        int16_t value;
+                        memcpy(&value, element + c * 2, 2);
+                        out[c] = normalized ? std::max(value / 32767.0f, -1.0f) : value;
+                        break;
+                    }
+                    case GL_UNSIGNED_INT:
+                    {
+                        uint32_t value;
+                        memcpy(&value, element + c * 4, 4);
+                        out[c] = (float)value;
+                        break;
+                    }
+                }
+            }
+        }
+        
+        uint32_t index(size_t i) const
+        {
+            const unsigned char* element = data + i * stride;
+            if (componentType == GL_UNSIGNED_BYTE) return element[0];
+            if (componentType == GL_UNSIGNED_SHORT)
+            {
+                uint16_t value;
+                memcpy(&value, element, 2);
+                return value;
+            }
+            uint32_t value;
+            memcpy(&value, element, 4);
+            return value;
+        }
+    };
+    
+    static int componentSize(GLenum type)
+    {
+        switch (type)
+        {
+            case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+            case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+            case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+        }
+        return 0;
+    }
+    
+    /// Accessor 'index', checked against the binary chunk; empty if it
+    /// doesn't fit or isn't one this can read
+    static Accessor accessor(const Json& json, int64_t index, const unsigned char* bin, size_t binSize)
+    {
+        Accessor result;
+        const Json& description = json["accessors"][(size_t)index];
+        if (index < 0 || description.type != Json::Object || description.has("sparse")) return result;
+        const Json& view = json["bufferViews"][(size_t)description["bufferView"].integer()];
+        if (view.type != Json::Object || view["buffer"].integer(0) != 0) return result;
+        
+        static const char* types[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+        int components = 0;
+        for (int i = 0; i < 4; ++i)
+            if (description["type"].text == types[i]) components = i + 1;
+        GLenum componentType = (GLenum)description["componentType"].integer(0);
+        int size = componentSize(componentType);
+        if (!components || !size) return result;
+        
+        size_t count = (size_t)description["count"].integer(0);
+        size_t elementSize = (size_t)(components * size);
+        size_t stride = (size_t)view["byteStride"].integer(0);
+        if (stride == 0) stride = elementSize;
+        size_t viewOffset = (size_t)view["byteOffset"].integer(0), viewLength = (size_t)view["byteLength"].integer(0);
+        size_t offset = (size_t)description["byteOffset"].integer(0);
+        if (count == 0 || viewOffset > binSize || viewLength > binSize - viewOffset || offset > viewLength
+            || (count - 1) * stride + elementSize > viewLength - offset) return result;
+        
+        result.data = bin + viewOffset + offset;
+        result.count = count;
+        result.stride = stride;
+        result.components = components;
+        result.componentType = componentType;
+        result.normalized = description["normalized"].type == Json::Bool && description["normalized"].number != 0;
+        return result;
+    }
+    
+    Mesh loadGlb(const Mapping& file, const std::string& path)
+    {
+        Clock::time_point start = Clock::now();
+        
+        // header, then a JSON chunk and a binary one
+        uint32_t header[3], jsonLength = 0, jsonType = 0, binLength = 0, binType = 0;
+        if (file.size >= 20) memcpy(header, file.data, 12);
+        if (file.size >= 20)
+        {
+            memcpy(&jsonLength, file.data + 12, 4);
+            memcpy(&jsonType, file.data + 16, 4);
+        }
+        if (file.size < 20 || header[1] != 2 || jsonType != 0x4E4F534A || jsonLength > file.size - 20)
+        {
+            std::cout << "ERROR::MESH_LOADER::BAD_GLB " << path << std::endl;
+            return Mesh();
+        }
+        const unsigned char* bin = nullptr;
+        size_t binOffset = 20 + ((jsonLength + 3) & ~3u);
+        if (binOffset + 8 <= file.size)
+        {
+            memcpy(&binLength, file.data + binOffset, 4);
+            memcpy(&binType, file.data + binOffset + 4, 4);
+            if (binType == 0x004E4942 && binLength <= file.size - binOffset - 8) bin = file.data + binOffset + 8;
+        }
+        
+        Json json;
+        const char* text = (const char*)file.data + 20;
+        if (!Json::parse(text, text + jsonLength, json) || json.type != Json::Object)
+        {
+            std::cout << "ERROR::MESH_LOADER::BAD_JSON " << path << std::endl;
+            return Mesh();
+        }
+        
+        // every triangle-list primitive of every mesh is a part
+        struct Primitive
+        {
+            Accessor attributes[MeshAttribute::Count];
+            Accessor indices;
+        };
+        static const char* names[MeshAttribute::Count] = { "POSITION", "COLOR_0", "TEXCOORD_0", "NORMAL", "TANGENT" };
+        std::vector<Primitive> primitives;
+        Geometry geometry;
+        size_t vertexCount = 0, indexCount = 0;
+        bool skipped = false;
+        for (const Json& mesh : json["meshes"].items)
+            for (const Json& description : mesh["primitives"].items)
+            {
+                Primitive primitive;
+                for (GLuint a = 0; a < MeshAttribute::Count; ++a)
+                    if (description["attributes"].has(names[a]))
+                        primitive.attributes[a] = accessor(json, description["attributes"][names[a]].integer(), bin, binLength);
+                Accessor& position = primitive.attributes[MeshAttribute::Position];
+                if (description.has("indices")) primitive.indices = accessor(json, description["indices"].integer(), bin, binLength);
+                bool valid = description["mode"].integer(4) == 4 && position && position.components == 3
+                    && (!description.has("indices") || (primitive.indices && primitive.indices.components == 1));
+                if (!valid)
+                {
+                    skipped = true;
+                    continue;
+                }
+                size_t primitiveIndices = primitive.indices ? primitive.indices.count : position.count;
+                geometry.ranges.push_back({ indexCount, primitiveIndices - primitiveIndices % 3, vertexCount, position.count });
+                vertexCount += position.count;
+                indexCount += geometry.ranges.back().indexCount;
+                primitives.push_back(primitive);
+            }
+        if (skipped) std::cout << "ERROR::MESH_LOADER::SKIPPED_PRIMITIVES " << path << " (not triangle lists, or unreadable)" << std::endl;
+        
+        // positions and indices of every part at once, a range of each a task
+        geometry.vertexCount = vertexCount;
+        geometry.indices.resize(indexCount);
+        std::vector<float> positions(vertexCount * 3);
+        struct Task { size_t primitive; bool indices; size_t begin, end; };
+        std::vector<Task> tasks;
+        const size_t TaskSize = 1 << 16;
+        for (size_t i = 0; i < primitives.size(); ++i)
+        {
+            for (size_t begin = 0; begin < geometry.ranges[i].vertexCount; begin += TaskSize)
+                tasks.push_back({ i, false, begin, std::min(begin + TaskSize, geometry.ranges[i].vertexCount) });
+            for (size_t begin = 0; begin < geometry.ranges[i].indexCount; begin += TaskSize)
+                tasks.push_back({ i, true, begin, std::min(begin + TaskSize, geometry.ranges[i].indexCount) });
+        }
+        std::atomic<bool> outOfRange(false);
+        parallelFor(tasks.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t t = begin; t < end; ++t)
+            {
+                const Task& task = tasks[t];
+                const Primitive& primitive = primitives[task.primitive];
+                const Geometry::Range& range = geometry.ranges[task.primitive];
+                if (!task.indices)
+                {
+                    for (size_t v = task.begin; v < task.end; ++v)
+                        primitive.attributes[MeshAttribute::Position].read(v, &positions[(range.firstVertex + v) * 3]);
+                    continue;
+                }
+                for (size_t i = task.begin; i < task.end; ++i)
+                {
+                    uint32_t index = primitive.indices ? primitive.indices.index(i) : (uint32_t)i;
+                    if (index >= range.vertexCount)
+                    {
+                        index = 0;
+                        outOfRange = true;
+                    }
+                    geometry.indices[range.firstIndex + i] = index;
+                }
+            }
+        });
+        if (outOfRange) std::cout << "ERROR::MESH_LOADER::BAD_INDEX " << path << std::endl;
+        geometry.positions = positions.data();
+        statistics.parseMs += elapsedMs(start);
+        
+        return build(geometry, [&](size_t v, Attributes& attributes)
+        {
+            size_t part = (size_t)(std::upper_bound(geometry.ranges.begin(), geometry.ranges.end(), v,
+                [](size_t vertex, const Geometry::Range& range) { return vertex < range.firstVertex; }) - geometry.ranges.begin()) - 1;
+            const Primitive& primitive = primitives[part];
+            size_t local = v - geometry.ranges[part].firstVertex;
+            for (GLuint a = 0; a < MeshAttribute::Count; ++a)
+                if (primitive.attributes[a] && local < primitive.attributes[a].count)
+                    primitive.attributes[a].read(local, attributes[a]);
+        }, path);
+    }
+    
+    // ------------------------------------------------------------------------
+    // Baked
+    
+    /// What save() wrote, for this loader's layout. The vertex stream's
+    /// blocks and the index stream's segments are shared out between the
+    /// threads, each decoding its range straight into the mapped buffer
+    Mesh loadBaked(const Mapping& file, const std::string& path)
+    {
+        Clock::time_point start = Clock::now();
+        const unsigned char* p = file.data;
+        const unsigned char* end = file.data + file.size;
+        BakedHeader header;
+        bool valid = take(p, end, &header, 1) && header.magic == BakedMagic && header.version == BakedVersion
+            && header.vertexCount > 0 && header.vertexCount <= UINT32_MAX && header.indexCount > 0
+            && header.indexCount <= UINT32_MAX && header.indexCount % 3 == 0
+            && (header.indexType == GL_UNSIGNED_INT || (header.indexType == GL_UNSIGNED_SHORT && MeshOptimizer::fitsShort(header.vertexCount)));
+        
+        // the vertices are only any use in the layout they were baked in
+        bool sameLayout = valid && header.stride == (uint32_t)layout.stride && header.attributes == layout.attributes.size();
+        for (uint32_t a = 0; valid && a < header.attributes; ++a)
+        {
+            BakedAttribute attribute;
+            valid = take(p, end, &attribute, 1);
+            if (sameLayout && valid)
+            {
+                BakedAttribute expected = baked(layout.attributes[a]);
+                sameLayout = memcmp(&attribute, &expected, sizeof(BakedAttribute)) == 0;
+            }
+        }
+        if (valid && !sameLayout)
+        {
+            std::cout << "ERROR::MESH_LOADER::OTHER_LAYOUT " << path << " (baked for another vertex layout)" << std::endl;
+            return Mesh();
+        }
+        
+        Mesh mesh;
+        mesh.layout = layout;
+        mesh.vertexCount = (size_t)header.vertexCount;
+        mesh.indexCount = (size_t)header.indexCount;
+        mesh.indexType = header.indexType;
+        memcpy(mesh.boundsMin, header.boundsMin, sizeof(mesh.boundsMin));
+        memcpy(mesh.boundsMax, header.boundsMax, sizeof(mesh.boundsMax));
+        memcpy(mesh.center, header.center, sizeof(mesh.center));
+        mesh.scale = header.scale;
+        for (uint32_t i = 0; valid && i < header.parts; ++i)
+        {
+            BakedPart record;
+            valid = take(p, end, &record, 1) && within(record.firstIndex, record.indexCount, header.indexCount);
+            Mesh::Part part;
+            part.firstIndex = (size_t)record.firstIndex;
+            part.indexCount = (size_t)record.indexCount;
+            for (uint32_t l = 0; valid && l < record.lods; ++l)
+            {
+                BakedLevel levelRecord;
+                valid = take(p, end, &levelRecord, 1) && within(levelRecord.firstIndex, levelRecord.indexCount, header.indexCount);
+                MeshLod::Level level;
+                level.firstIndex = (size_t)levelRecord.firstIndex;
+                level.indexCount = (size_t)levelRecord.indexCount;
+                level.error = levelRecord.error;
+                part.lods.push_back(level);
+            }
+            mesh.parts.push_back(std::move(part));
+        }
+        valid = valid && header.lodErrors <= (size_t)(end - p) / sizeof(float);
+        if (valid)
+        {
+            mesh.lodErrors.resize(header.lodErrors);
+            take(p, end, mesh.lodErrors.data(), mesh.lodErrors.size());
+        }
+        for (uint32_t i = 0; valid && i < header.meshlets; ++i)
+        {
+            Meshlets::Meshlet meshlet;
+            valid = take(p, end, &meshlet, 1) && within(meshlet.firstIndex, meshlet.indexCount, header.indexCount);
+            if (valid) mesh.meshlets.add(meshlet);
+        }
+        valid = valid && header.vertexBytes <= (size_t)(end - p) && (size_t)(end - p) - header.vertexBytes == header.indexBytes;
+        if (!valid)
+        {
+            std::cout << "ERROR::MESH_LOADER::BAD_BAKED " << path << std::endl;
+            return Mesh();
+        }
+        const unsigned char* vertexStream = p;
+        const unsigned char* indexStream = p + header.vertexBytes;
+        
+        GLint previousBuffer;
+        glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &previousBuffer);
+        std::atomic<bool> decoded(true);
+        
+        size_t stride = (size_t)layout.stride;
+        glGenBuffers(1, &mesh.vertexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.vertexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(mesh.vertexCount * stride), nullptr, GL_STATIC_DRAW);
+        void* vertices = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)(mesh.vertexCount * stride),
+                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (vertices)
+        {
+            parallelFor(MeshCodec::vertexBlocks(mesh.vertexCount), 16, [&](size_t first, size_t last)
+            {
+                if (!MeshCodec::decodeVertices(vertices, mesh.vertexCount, stride, vertexStream, (size_t)header.vertexBytes, first, last))
+                    decoded = false;
+            });
+            decoded = glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE && decoded;
+        }
+        
+        glGenBuffers(1, &mesh.indexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.indexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(mesh.indexCount * mesh.indexSize()), nullptr, GL_STATIC_DRAW);
+        void* indices = vertices && decoded ? glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)(mesh.indexCount * mesh.indexSize()),
+                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) : nullptr;
+        if (indices)
+        {
+            parallelFor(MeshCodec::indexSegments(mesh.indexCount), 1, [&](size_t first, size_t last)
+            {
+                if (!MeshCodec::decodeIndices(indices, mesh.indexSize(), mesh.indexCount, mesh.vertexCount, indexStream,
+                                              (size_t)header.indexBytes, first, last))
+                    decoded = false;
+            });
+            decoded = glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE && decoded;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, previousBuffer);
+        
+        if (!vertices || !indices || !decoded)
+        {
+            std::cout << "ERROR::MESH_LOADER::BAD_BAKED " << path << " (streams don't decode)" << std::endl;
+            return Mesh();
+        }
+        ++statistics.baked;
+        statistics.decodeMs += elapsedMs(start);
+        return mesh;
+    }
+};
@@ -0,0 +1,477 @@
+//
+//  mesh_lod.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/// Levels of detail: simplified versions of a mesh's triangles over the
+/// same vertices, so every level of a mesh draws from one vertex buffer and
+/// its index lists can share one index buffer, and the choice between them
+/// by how many pixels their error covers.
+///
+/// simplify() collapses edges by quadric error (Garland and Heckbert 1997),
+/// moving a vertex onto a neighbour rather than making new ones. Vertices at
+/// the same position (seams where normals or texture coords split) move
+/// together, each onto the neighbour's vertex with the nearest attributes,
+/// and how far those attributes are apart adds to the error. Open borders,
+/// and edges more than two triangles share, can be kept where they are.
+///
+///     std::vector<float> errors;
+///     std::vector<std::vector<uint32_t>> levels = MeshLod::chain(indices.data(), indices.size(), vertexCount,
+///                                                                positions, sizeof(float) * 3, nullptr, 0, settings, errors);
+///     ...
+///     lod = MeshLod::select(errors, lod, distance, MeshLod::pixelsPerUnit(fovY, height));
+class MeshLod
+{
+public:
+    struct Settings
+    {
+        int levels = 0;                 // most to make past the full mesh; 0 makes none
+        float ratio = 0.5f;             // of the triangles in the level before
+        float maxError = 0.02f;         // no level is further off than this, of the mesh's size
+        float attributeWeight = 0.5f;   // how much attributes apart counts against position error
+        bool lockBorders = true;        // so parts and tiles still meet
+        size_t minTriangles = 64;       // not worth a level below
+    };
+    
+    /// A level in a shared index buffer, with how far off it is in model units
+    struct Level
+    {
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+        float error = 0;
+    };
+    
+    /// 'indices' with edges collapsed until no more than 'targetIndexCount'
+    /// are left or the next would be further off than 'targetError' (model
+    /// units). Positions are three floats 'positionStride' bytes apart;
+    /// 'attributes', if any, are 'attributeCount' floats a vertex, already
+    /// weighted. 'error' gets how far off the result is
+    static std::vector<uint32_t> simplify(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                          const float* positions, size_t positionStride,
+                                          const float* attributes, size_t attributeCount,
+                                          size_t targetIndexCount, float targetError, bool lockBorders, float* error = nullptr)
+    {
+        std::vector<uint32_t> result(indices, indices + indexCount - indexCount % 3);
+        if (error) *error = 0;
+        float extent = meshExtent(result, positions, positionStride);
+        if (result.empty() || extent <= 0) return result;
+        
+        // positions relative to the mesh's size, so errors and attributes compare
+        std::vector<float> scaled(vertexCount * 3, 0.0f);
+        for (size_t v = 0; v < vertexCount; ++v)
+            for (int c = 0; c < 3; ++c) scaled[v * 3 + c] = position(positions, positionStride, (uint32_t)v)[c] / extent;
+        
+        // vertices used, grouped by position; a group's vertices are its wedges
+        std::vector<uint32_t> group(vertexCount, Unused);
+        std::vector<uint32_t> wedgeFirst, wedges;
+        size_t groupCount = groupWedges(result, scaled, group, wedgeFirst, wedges);
+        
+        std::vector<Quadric> quadrics(groupCount);
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            Quadric plane = Quadric::triangle(&scaled[result[i] * 3], &scaled[result[i + 1] * 3], &scaled[result[i + 2] * 3]);
+            for (int c = 0; c < 3; ++c) quadrics[group[result[i + c]]].add(plane);
+        }
+        
+        float limit = (targetError / extent) * (targetError / extent);
+        float worst = 0;
+        std::vector<uint32_t> groupTarget(groupCount), wedgeTarget(vertexCount);
+        std::vector<uint32_t> adjacencyFirst, adjacency;
+        std::vector<char> flags(groupCount);
+        std::vector<Collapse> collapses;
+        std::vector<std::pair<uint32_t, uint32_t>> unique, neighbours;
+        std::vector<char> borderEdge;
+        while (result.size() > targetIndexCount)
+        {
+            size_t triangleCount = result.size() / 3;
+            
+            // the triangles around each group, and which groups may move
+            adjacencyFirst.assign(groupCount + 1, 0);
+            for (uint32_t v : result) ++adjacencyFirst[group[v] + 1];
+            for (size_t g = 0; g < groupCount; ++g) adjacencyFirst[g + 1] += adjacencyFirst[g];
+            adjacency.resize(result.size());
+            std::vector<uint32_t> filled(adjacencyFirst.begin(), adjacencyFirst.end() - 1);
+            for (size_t i = 0; i < result.size(); ++i) adjacency[filled[group[result[i]]]++] = (uint32_t)(i / 3);
+            
+            // each edge once, from its lower group, with how many triangles share it
+            std::fill(flags.begin(), flags.end(), 0);
+            unique.clear();
+            borderEdge.clear();
+            for (uint32_t g = 0; g < groupCount; ++g)
+            {
+                neighbours.clear();
+                for (uint32_t k = adjacencyFirst[g]; k < adjacencyFirst[g + 1]; ++k)
+                {
+                    const uint32_t* triangle = &result[adjacency[k] * 3];
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        if (group[triangle[c]] != g) continue;
+                        uint32_t sides[2] = { group[triangle[(c + 1) % 3]], group[triangle[(c + 2) % 3]] };
+                        for (uint32_t h : sides)
+                        {
+                            if (h == g) continue;
+                            size_t i = 0;
+                            while (i < neighbours.size() && neighbours[i].first != h) ++i;
+                            if (i == neighbours.size()) neighbours.push_back(std::make_pair(h, 0u));
+                            ++neighbours[i].second;
+                        }
+                        break;
+                    }
+                }
+                for (const std::pair<uint32_t, uint32_t>& neighbour : neighbours)
+                {
+                    char kind = neighbour.second == 1 ? Border : neighbour.second > 2 ? Locked : 0;
+                    flags[g] |= kind;
+                    if (neighbour.first < g) continue;
+                    unique.push_back(std::make_pair(g, neighbour.first));
+                    borderEdge.push_back(kind == Border);
+                }
+            }
+            
+            // the cheaper way to collapse each edge
+            collapses.clear();
+            for (size_t e = 0; e < unique.size(); ++e)
+            {
+                Collapse best;
+                best.cost = INFINITY;
+                for (int direction = 0; direction < 2; ++direction)
+                {
+                    uint32_t from = direction ? unique[e].second : unique[e].first;
+                    uint32_t to = direction ? unique[e].first : unique[e].second;
+                    if (!canMove(flags[from], flags[to], borderEdge[e] != 0, lockBorders)) continue;
+                    Quadric sum = quadrics[from];
+                    sum.add(quadrics[to]);
+                    float distance = sum.error(&scaled[wedges[wedgeFirst[to]] * 3]);
+                    float cost = distance + attributeCost(from, to, wedgeFirst, wedges, attributes, attributeCount, nullptr);
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.error = distance;
+                        best.from = from;
+                        best.to = to;
+                    }
+                }
+                if (best.cost < INFINITY) collapses.push_back(best);
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+            
+            // the cheapest collapses, until enough are gone. Groups that moved or
+            // were moved onto stay put for the rest of the pass, and each
+            // collapse is checked against the triangles as the ones before it left them
+            for (size_t g = 0; g < groupCount; ++g) groupTarget[g] = (uint32_t)g;
+            std::vector<char> pinned(groupCount, 0);
+            size_t removed = 0, done = 0;
+            for (const Collapse& collapse : collapses)
+            {
+                if ((triangleCount - removed) * 3 <= targetIndexCount) break;
+                if (pinned[collapse.from] || groupTarget[collapse.to] != collapse.to || collapse.error > limit) continue;
+                size_t closing = 0;
+                if (flips(collapse, result, group, groupTarget, adjacencyFirst, adjacency, wedgeFirst, wedges, scaled, closing)) continue;
+                
+                removed += closing;
+                pinned[collapse.from] = pinned[collapse.to] = 1;
+                groupTarget[collapse.from] = collapse.to;
+                attributeCost(collapse.from, collapse.to, wedgeFirst, wedges, attributes, attributeCount, &wedgeTarget);
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                worst = std::max(worst, collapse.error);
+                ++done;
+            }
+            if (done == 0) break;
+            
+            // moved corners onto their targets, dropping triangles that closed up
+            size_t written = 0;
+            for (size_t t = 0; t < triangleCount; ++t)
+            {
+                uint32_t corners[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    uint32_t v = result[t * 3 + c];
+                    corners[c] = groupTarget[group[v]] == group[v] ? v : wedgeTarget[v];
+                }
+                if (group[corners[0]] == group[corners[1]] || group[corners[1]] == group[corners[2]] || group[corners[0]] == group[corners[2]])
+                    continue;
+                memcpy(&result[written], corners, sizeof(corners));
+                written += 3;
+            }
+            result.resize(written);
+        }
+        if (error) *error = std::sqrt(worst) * extent;
+        return result;
+    }
+    
+    /// The full mesh, then each level simplified from the one before it,
+    /// until the settings say stop. 'errors' gets each level's error in
+    /// model units, 0 for the first
+    static std::vector<std::vector<uint32_t>> chain(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                                    const float* positions, size_t positionStride,
+                                                    const float* attributes, size_t attributeCount,
+                                                    const Settings& settings, std::vector<float>& errors)
+    {
+        std::vector<std::vector<uint32_t>> levels(1, std::vector<uint32_t>(indices, indices + indexCount - indexCount % 3));
+        errors.assign(1, 0.0f);
+        float maxError = settings.maxError * meshExtent(levels[0], positions, positionStride);
+        while ((int)levels.size() <= settings.levels)
+        {
+            const std::vector<uint32_t>& previous = levels.back();
+            size_t target = (size_t)(previous.size() / 3 * settings.ratio) * 3;
+            if (target / 3 < settings.minTriangles || errors.back() >= maxError) break;
+            float error = 0;
+            std::vector<uint32_t> level = simplify(previous.data(), previous.size(), vertexCount, positions, positionStride,
+                                                   attributes, attributeCount, target, maxError - errors.back(), settings.lockBorders, &error);
+            // not worth a level unless it lost a good share of the triangles
+            if (level.size() > previous.size() - previous.size() / 10 || level.empty()) break;
+            errors.push_back(errors.back() + error);
+            levels.push_back(std::move(level));
+        }
+        return levels;
+    }
+    
+    /// Pixels a unit at distance 1 covers, for a vertical field of view
+    /// 'fovY' (radians) over 'viewportHeight' pixels
+    static float pixelsPerUnit(float fovY, float viewportHeight)
+    {
+        return viewportHeight / (2 * std::tan(fovY / 2));
+    }
+    
+    /// The coarsest level whose error covers no more than 'thresholdPixels'
+    /// at 'distance', starting from 'current'. Moving to a coarser level
+    /// takes its error to be under the threshold by 'hysteresis' (a share of
+    /// it), while the current one is kept until it is over, so an object
+    /// near a switching distance doesn't pop back and forth
+    static size_t select(const std::vector<float>& errors, size_t current, float distance, float pixelsPerUnit,
+                         float thresholdPixels = 1.0f, float hysteresis = 0.25f)
+    {
+        if (errors.empty()) return 0;
+        current = std::min(current, errors.size() - 1);
+        float scale = pixelsPerUnit / std::max(distance, 1e-6f);
+        size_t finest = 0, coarser = 0;
+        for (size_t i = 0; i < errors.size(); ++i)
+        {
+            if (errors[i] * scale <= thresholdPixels) finest = i;
+            if (errors[i] * scale <= thresholdPixels * (1 - hysteresis)) coarser = i;
+        }
+        if (errors[current] * scale > thresholdPixels) return finest;
+        return std::max(current, coarser);
+    }
+
+private:
+    enum : uint32_t { Unused = ~0u };
+    enum : char { Border = 1, Locked = 2 };
+    
+    struct Collapse
+    {
+        uint32_t from = 0, to = 0;
+        float cost = 0;         // what collapses are ordered by, attributes and all
+        float error = 0;        // the squared distance alone, what is reported
+    };
+    
+    /// Summed squared distances to planes, weighted by area, as the
+    /// symmetric 3x3 matrix, vector and constant of the quadratic form
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0, weight = 0;
+        
+        static Quadric triangle(const float* p0, const float* p1, const float* p2)
+        {
+            double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] }, v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            double n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+            double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            Quadric q;
+            if (length == 0) return q;
+            double area = length / 2;
+            for (double& x : n) x /= length;
+            double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+            q.a00 = area * n[0] * n[0]; q.a01 = area * n[0] * n[1]; q.a02 = area * n[0] * n[2];
+            q.a11 = area * n[1] * n[1]; q.a12 = area * n[1] * n[2]; q.a22 = area * n[2] * n[2];
+            q.b0 = area * n[0] * d; q.b1 = area * n[1] * d; q.b2 = area * n[2] * d;
+            q.c = area * d * d;
+            q.weight = area;
+            return q;
+        }
+        
+        void add(const Quadric& q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; weight += q.weight;
+        }
+        
+        /// The mean squared distance of 'p' to the planes
+        float error(const float* p) const
+        {
+            double x = p[0], y = p[1], z = p[2];
+            double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + a11 * y * y + 2 * a12 * y * z + a22 * z * z
+                + 2 * (b0 * x + b1 * y + b2 * z) + c;
+            return weight > 0 ? (float)std::max(e / weight, 0.0) : 0.0f;
+        }
+    };
+    
+    static const float* position(const float* positions, size_t stride, uint32_t v)
+    {
+        return (const float*)((const char*)positions + v * stride);
+    }
+    
+    /// The largest side of the box around the vertices 'indices' use
+    static float meshExtent(const std::vector<uint32_t>& indices, const float* positions, size_t stride)
+    {
+        float low[3] = { INFINITY, INFINITY, INFINITY }, high[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (uint32_t v : indices)
+            for (int c = 0; c < 3; ++c)
+            {
+                low[c] = std::min(low[c], position(positions, stride, v)[c]);
+                high[c] = std::max(high[c], position(positions, stride, v)[c]);
+            }
+        float extent = 0;
+        for (int c = 0; c < 3; ++c) extent = std::max(extent, high[c] - low[c]);
+        return indices.empty() ? 0 : extent;
+    }
+    
+    /// Number the positions the indices use; 'group' gets each vertex's, and
+    /// each group's vertices are wedges[wedgeFirst[g]] on. Returns how many
+    static size_t groupWedges(const std::vector<uint32_t>& indices, const std::vector<float>& scaled, std::vector<uint32_t>& group,
+                              std::vector<uint32_t>& wedgeFirst, std::vector<uint32_t>& wedges)
+    {
+        std::vector<uint32_t> used;
+        for (uint32_t v : indices)
+            if (group[v] == Unused)
+            {
+                group[v] = 0;
+                used.push_back(v);
+            }
+        std::sort(used.begin(), used.end(), [&](uint32_t a, uint32_t b)
+        {
+            int order = memcmp(&scaled[a * 3], &scaled[b * 3], 3 * sizeof(float));
+            return order < 0 || (order == 0 && a < b);
+        });
+        wedges = used;
+        wedgeFirst.clear();
+        for (size_t i = 0; i < used.size(); ++i)
+        {
+            if (i == 0 || memcmp(&scaled[used[i] * 3], &scaled[used[i - 1] * 3], 3 * sizeof(float)) != 0)
+                wedgeFirst.push_back((uint32_t)i);
+            group[used[i]] = (uint32_t)(wedgeFirst.size() - 1);
+        }
+        size_t groupCount = wedgeFirst.size();
+        wedgeFirst.push_back((uint32_t)used.size());
+        return groupCount;
+    }
+    
+    /// Locked groups stay; border ones only slide along the border, onto
+    /// another border group, unless borders are locked too
+    static bool canMove(char from, char to, bool alongBorder, bool lockBorders)
+    {
+        if (from & Locked) return false;
+        if (from & Border) return !lockBorders && alongBorder && (to & Border);
+        return true;
+    }
+    
+    /// The worst squared distance between a wedge of 'from' and the nearest
+    /// wedge of 'to'. With 'targets', records those nearest wedges
+    static float attributeCost(uint32_t from, uint32_t to, const std::vector<uint32_t>& wedgeFirst, const std::vector<uint32_t>& wedges,
+                               const float* attributes, size_t attributeCount, std::vector<uint32_t>* targets)
+    {
+        float worst = 0;
+        for (uint32_t i = wedgeFirst[from]; i < wedgeFirst[from + 1]; ++i)
+        {
+            uint32_t nearest = wedges[wedgeFirst[to]];
+            float best = INFINITY;
+            for (uint32_t j = wedgeFirst[to]; j < wedgeFirst[to + 1] && attributeCount; ++j)
+            {
+                float distance = 0;
+                for (size_t k = 0; k < attributeCount; ++k)
+                {
+                    float d = attributes[wedges[i] * attributeCount + k] - attributes[wedges[j] * attributeCount + k];
+                    distance += d * d;
+                }
+                if (distance < best)
+                {
+                    best = distance;
+                    nearest = wedges[j];
+                }
+            }
+            if (attributeCount) worst = std::max(worst, best);
+            if (targets) (*targets)[wedges[i]] = nearest;
+        }
+        return worst;
+    }
+    
+    /// Whether moving 'from' onto 'to' turns one of its triangles over, or
+    /// nearly so, as the pass's collapses so far ('groupTarget') left them.
+    /// 'closing' gets how many of them it closes up
+    static bool flips(const Collapse& collapse, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& group,
+                      const std::vector<uint32_t>& groupTarget, const std::vector<uint32_t>& adjacencyFirst,
+                      const std::vector<uint32_t>& adjacency, const std::vector<uint32_t>& wedgeFirst,
+                      const std::vector<uint32_t>& wedges, const std::vector<float>& scaled, size_t& closing)
+    {
+        closing = 0;
+        const float* target = &scaled[wedges[wedgeFirst[collapse.to]] * 3];
+        for (uint32_t k = adjacencyFirst[collapse.from]; k < adjacencyFirst[collapse.from + 1]; ++k)
+        {
+            const uint32_t* triangle = &indices[adjacency[k] * 3];
+            uint32_t corners[3] = { groupTarget[group[triangle[0]]], groupTarget[group[triangle[1]]], groupTarget[group[triangle[2]]] };
+            if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]) continue;   // closed already
+            if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+            {
+                ++closing;
+                continue;
+            }
+            const float* before[3];
+            const float* after[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                before[c] = &scaled[wedges[wedgeFirst[corners[c]]] * 3];
+                after[c] = corners[c] == collapse.from ? target : before[c];
+            }
+            float n0[3], n1[3];
+            cross(before, n0);
+            cross(after, n1);
+            // compared squared, to save the square roots
+            float squared0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+            float squared1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+            if (squared0 == 0) continue;
+            float dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+            if (dot <= 0 || dot * dot <= 0.0625f * squared0 * squared1) return true;
+            // nor into a sliver thinner than it was (area against its longest
+            // side under 0.05), whose facing is anyone's guess
+            float longest0 = longestSide(before), longest1 = longestSide(after);
+            if (squared1 < 0.0025f * longest1 * longest1 && squared1 * longest0 * longest0 < squared0 * longest1 * longest1) return true;
+        }
+        return false;
+    }
+    
+    /// The longest side of a triangle, squared
+    static float longestSide(const float* const* p)
+    {
+        float longest = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const float* a = p[i];
+            const float* b = p[(i + 1) % 3];
+            longest = std::max(longest, (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]));
+        }
+        return longest;
+    }
+    
+    static void cross(const float* const* p, float* n)
+    {
+        float u[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+        float v[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+    }
+};
@@ -0,0 +1,381 @@
+//
+//  mesh_optimizer.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+/// Reorders indexed triangle lists so the GPU does less work drawing them,
+/// the same at load time or in an offline tool:
+///
+/// - triangles for the post-transform vertex cache (Tipsify, Sander et al.
+///   2007), which also splits the mesh into clusters where the order jumps
+/// - those clusters so outward-facing ones draw first and hide the rest,
+///   for less overdraw
+/// - vertices into the order triangles first use them, for sequential fetch
+///
+/// and reports the average cache miss ratio (misses a triangle, ACMR) and
+/// the average transform to vertex ratio (misses a vertex, ATVR) before and
+/// after, as a FIFO cache of 'cacheSize' sees them.
+///
+///     std::vector<uint32_t> remap = optimizer.optimize(indices, vertexCount, positions, sizeof(float) * 3);
+///     vertexCount = MeshOptimizer::remapVertices(packed.data(), original.data(), vertexCount, QuadVertex::stride, remap);
+///     GLenum indexType = MeshOptimizer::uploadIndices(GL_ELEMENT_ARRAY_BUFFER, indices, vertexCount, GL_STATIC_DRAW);
+class MeshOptimizer
+{
+public:
+    enum : uint32_t { Unused = ~0u };           // in a remap, for vertices no triangle uses
+    
+    struct CacheStats
+    {
+        float acmr = 0;     // misses a triangle: 0.5 at best, 3 at worst
+        float atvr = 0;     // misses a vertex used: 1 at best
+    };
+    
+    struct Stats
+    {
+        size_t meshes = 0;
+        size_t triangles = 0;
+        size_t clusters = 0;
+        size_t shortIndexMeshes = 0;    // small enough for 16-bit indices
+        CacheStats before, after;       // over all triangles
+        double ms = 0;
+    };
+    
+    explicit MeshOptimizer(int cacheSize = 16, float overdrawThreshold = 1.05f)
+        : cacheSize(cacheSize), overdrawThreshold(overdrawThreshold)
+    {
+    }
+    
+    /// All three steps on 'indices' (a triangle list) in place, with
+    /// 'positions' three floats each, 'positionStride' bytes apart; null
+    /// positions skip the overdraw step. Where Tipsify misses more than the
+    /// order given (a small grid row by row can), that order is kept as one
+    /// cluster. Returns the remap from old vertex numbers to new, which
+    /// 'indices' already use
+    std::vector<uint32_t> optimize(std::vector<uint32_t>& indices, size_t vertexCount, const float* positions, size_t positionStride)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+        
+        std::vector<uint32_t> reordered(indices.size());
+        std::vector<uint32_t> clusters;
+        optimizeVertexCache(reordered.data(), indices.data(), indices.size(), vertexCount, cacheSize, &clusters);
+        if (analyzeVertexCache(reordered.data(), reordered.size(), vertexCount, cacheSize).acmr > before.acmr)
+        {
+            reordered = indices;
+            clusters.assign(1, 0);
+        }
+        if (positions)
+        {
+            optimizeOverdraw(indices.data(), reordered.data(), indices.size(), positions, positionStride, clusters,
+                             cacheSize, overdrawThreshold);
+        }
+        else
+        {
+            indices.swap(reordered);
+        }
+        std::vector<uint32_t> remap = optimizeVertexFetch(indices.data(), indices.size(), vertexCount);
+        
+        CacheStats after = analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+        size_t triangles = indices.size() / 3;
+        size_t total = statistics.triangles + triangles;
+        if (total)
+        {
+            statistics.before.acmr = (statistics.before.acmr * statistics.triangles + before.acmr * triangles) / total;
+            statistics.before.atvr = (statistics.before.atvr * statistics.triangles + before.atvr * triangles) / total;
+            statistics.after.acmr = (statistics.after.acmr * statistics.triangles + after.acmr * triangles) / total;
+            statistics.after.atvr = (statistics.after.atvr * statistics.triangles + after.atvr * triangles) / total;
+        }
+        ++statistics.meshes;
+        statistics.triangles = total;
+        statistics.clusters += clusters.size();
+        size_t used = 0;
+        for (uint32_t target : remap) used += target != Unused;
+        if (fitsShort(used)) ++statistics.shortIndexMeshes;
+        statistics.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return remap;
+    }
+    
+    Stats stats() const { return statistics; }
+    
+    void printStats() const
+    {
+        std::cout << "MESH_OPTIMIZER: " << statistics.meshes << " meshes (" << statistics.shortIndexMeshes << " with 16-bit indices), "
+            << statistics.triangles << " triangles in " << statistics.clusters << " clusters, ACMR " << statistics.before.acmr
+            << " -> " << statistics.after.acmr << ", ATVR " << statistics.before.atvr << " -> " << statistics.after.atvr
+            << ", " << statistics.ms << " ms" << std::endl;
+    }
+    
+    /// Misses a FIFO cache of 'cacheSize' vertices has drawing 'indices'
+    static CacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize)
+    {
+        // a vertex is in the FIFO while fewer than cacheSize misses came after its own
+        std::vector<size_t> missedAt(vertexCount, 0);
+        std::vector<char> seen(vertexCount, 0);
+        size_t misses = 0, used = 0;
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            uint32_t v = indices[i];
+            if (!seen[v]) { seen[v] = 1; ++used; }
+            else if (misses - missedAt[v] < (size_t)cacheSize) continue;
+            missedAt[v] = ++misses;
+        }
+        CacheStats result;
+        if (indexCount) result.acmr = (float)misses / (indexCount / 3);
+        if (used) result.atvr = (float)misses / used;
+        return result;
+    }
+    
+    /// Tipsify: fan around a vertex, then move to the neighbour whose
+    /// triangles will most likely still find their vertices in the cache.
+    /// 'clusters', if given, gets the first index of each run that started
+    /// from a dead end, where the cache starts cold
+    static void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                    int cacheSize, std::vector<uint32_t>* clusters = nullptr)
+    {
+        size_t triangleCount = indexCount / 3;
+        if (clusters) clusters->clear();
+        if (triangleCount == 0) return;
+        
+        // the triangles around each vertex
+        std::vector<uint32_t> live(vertexCount, 0);
+        for (size_t i = 0; i < indexCount; ++i) ++live[indices[i]];
+        std::vector<uint32_t> first(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; ++v) first[v + 1] = first[v] + live[v];
+        std::vector<uint32_t> adjacency(indexCount);
+        std::vector<uint32_t> filled(first.begin(), first.end() - 1);
+        for (size_t i = 0; i < indexCount; ++i) adjacency[filled[indices[i]]++] = (uint32_t)(i / 3);
+        
+        std::vector<uint32_t> cached(vertexCount, 0);    // the timestamp a vertex went in
+        std::vector<char> emitted(triangleCount, 0);
+        std::vector<uint32_t> deadEnds;
+        std::vector<uint32_t> candidates;
+        uint32_t time = cacheSize + 1;
+        size_t written = 0, cursor = 0;
+        
+        int64_t fan = indices[0];
+        bool cold = true;
+        while (fan >= 0)
+        {
+            if (cold && clusters) clusters->push_back((uint32_t)written);
+            candidates.clear();
+            for (uint32_t k = first[fan]; k < first[fan + 1]; ++k)
+            {
+                uint32_t t = adjacency[k];
+                if (emitted[t]) continue;
+                emitted[t] = 1;
+                for (int c = 0; c < 3; ++c)
+                {
+                    uint32_t v = indices[t * 3 + c];
+                    destination[written++] = v;
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    --live[v];
+                    if (time - cached[v] > (uint32_t)cacheSize) cached[v] = time++;
+                }
+            }
+            
+            // the candidate whose triangles fit in the cache, and of those the oldest
+            int64_t best = -1;
+            int64_t bestPriority = -1;
+            for (uint32_t v : candidates)
+            {
+                if (live[v] == 0) continue;
+                int64_t priority = 0;
+                if (time - cached[v] + 2 * live[v] <= (uint32_t)cacheSize) priority = time - cached[v];
+                if (priority > bestPriority) { best = v; bestPriority = priority; }
+            }
+            cold = best < 0;
+            if (cold)
+            {
+                // a dead end: a recent vertex with triangles left, else the next one in order
+                while (!deadEnds.empty() && best < 0)
+                {
+                    uint32_t v = deadEnds.back();
+                    deadEnds.pop_back();
+                    if (live[v] > 0) best = v;
+                }
+                while (best < 0 && cursor < vertexCount)
+                {
+                    if (live[cursor] > 0) best = (int64_t)cursor;
+                    ++cursor;
+                }
+            }
+            fan = best;
+        }
+    }
+    
+    /// Order the clusters of 'indices' (as optimizeVertexCache left them) so
+    /// ones facing out from the mesh's centre draw first. Clusters are split
+    /// further where the cache has warmed up enough that a split costs less
+    /// than 'threshold' times the mesh's ACMR, so there are more to sort
+    static void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions,
+                                 size_t positionStride, const std::vector<uint32_t>& hardClusters, int cacheSize, float threshold)
+    {
+        size_t vertexCount = 0;
+        for (size_t i = 0; i < indexCount; ++i) vertexCount = std::max<size_t>(vertexCount, indices[i] + 1);
+        std::vector<uint32_t> clusters = softClusters(indices, indexCount, vertexCount, hardClusters, cacheSize, threshold);
+        
+        auto position = [&](uint32_t v) { return (const float*)((const char*)positions + v * positionStride); };
+        
+        // the mesh's centre, by area
+        double centre[3] = { 0, 0, 0 }, area = 0;
+        for (size_t i = 0; i + 2 < indexCount; i += 3)
+        {
+            float normal[3];
+            float a = triangleNormal(position(indices[i]), position(indices[i + 1]), position(indices[i + 2]), normal);
+            for (int c = 0; c < 3; ++c)
+                centre[c] += a * (position(indices[i])[c] + position(indices[i + 1])[c] + position(indices[i + 2])[c]) / 3;
+            area += a;
+        }
+        for (int c = 0; c < 3; ++c) centre[c] = area > 0 ? centre[c] / area : 0;
+        
+        // how far each cluster faces out: its centre from the mesh's along its normal
+        struct Sorted { float outward; uint32_t cluster; };
+        std::vector<Sorted> order(clusters.size());
+        for (size_t k = 0; k < clusters.size(); ++k)
+        {
+            size_t begin = clusters[k], end = k + 1 < clusters.size() ? clusters[k + 1] : indexCount;
+            double clusterCentre[3] = { 0, 0, 0 }, normal[3] = { 0, 0, 0 }, clusterArea = 0;
+            for (size_t i = begin; i + 2 < end; i += 3)
+            {
+                float n[3];
+                const float *a = position(indices[i]), *b = position(indices[i + 1]), *c = position(indices[i + 2]);
+                float weight = triangleNormal(a, b, c, n);
+                for (int j = 0; j < 3; ++j)
+                {
+                    clusterCentre[j] += weight * (a[j] + b[j] + c[j]) / 3;
+                    normal[j] += weight * n[j];
+                }
+                clusterArea += weight;
+            }
+            float outward = 0;
+            if (clusterArea > 0)
+                for (int j = 0; j < 3; ++j) outward += (float)((clusterCentre[j] / clusterArea - centre[j]) * normal[j] / clusterArea);
+            order[k] = { outward, (uint32_t)k };
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Sorted& a, const Sorted& b) { return a.outward > b.outward; });
+        
+        size_t written = 0;
+        for (const Sorted& sorted : order)
+        {
+            size_t begin = clusters[sorted.cluster], end = sorted.cluster + 1 < clusters.size() ? clusters[sorted.cluster + 1] : indexCount;
+            memcpy(destination + written, indices + begin, (end - begin) * sizeof(uint32_t));
+            written += end - begin;
+        }
+    }
+    
+    /// Renumber vertices in the order 'indices' first use them. Returns the
+    /// remap, old to new; Unused for vertices no triangle uses
+    static std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount)
+    {
+        std::vector<uint32_t> remap(vertexCount, Unused);
+        uint32_t next = 0;
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            uint32_t& target = remap[indices[i]];
+            if (target == Unused) target = next++;
+            indices[i] = target;
+        }
+        return remap;
+    }
+    
+    /// Move 'vertexSize' byte vertices to where 'remap' says, dropping unused
+    /// ones. 'destination' and 'vertices' must not overlap. Returns how many
+    /// are left
+    static size_t remapVertices(void* destination, const void* vertices, size_t vertexCount, size_t vertexSize,
+                                const std::vector<uint32_t>& remap)
+    {
+        size_t used = 0;
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            if (remap[v] == Unused) continue;
+            memcpy((char*)destination + (size_t)remap[v] * vertexSize, (const char*)vertices + v * vertexSize, vertexSize);
+            ++used;
+        }
+        return used;
+    }
+    
+    static bool fitsShort(size_t vertexCount) { return vertexCount <= 65536; }
+    
+    /// Fill 'target' with 'indices', as 16-bit ones where 'vertexCount'
+    /// allows. Returns the type to draw them with
+    static GLenum uploadIndices(GLenum target, const std::vector<uint32_t>& indices, size_t vertexCount, GLenum usage)
+    {
+        if (!fitsShort(vertexCount))
+        {
+            glBufferData(target, indices.size() * sizeof(uint32_t), indices.data(), usage);
+            return GL_UNSIGNED_INT;
+        }
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        glBufferData(target, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), usage);
+        return GL_UNSIGNED_SHORT;
+    }
+
+private:
+    int cacheSize;
+    float overdrawThreshold;
+    Stats statistics;
+    
+    /// Twice the area, with the unit normal in 'normal'
+    static float triangleNormal(const float* a, const float* b, const float* c, float* normal)
+    {
+        float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        normal[0] = u[1] * v[2] - u[2] * v[1];
+        normal[1] = u[2] * v[0] - u[0] * v[2];
+        normal[2] = u[0] * v[1] - u[1] * v[0];
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        for (int i = 0; i < 3; ++i) normal[i] = length > 0 ? normal[i] / length : 0;
+        return length;
+    }
+    
+    /// The hard clusters, split again wherever the cluster so far already
+    /// misses no more than 'threshold' times the whole mesh does, as
+    /// starting over there costs little
+    static std::vector<uint32_t> softClusters(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                              const std::vector<uint32_t>& hardClusters, int cacheSize, float threshold)
+    {
+        float meshAcmr = analyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr;
+        std::vector<uint32_t> clusters;
+        std::vector<size_t> missedAt(vertexCount, 0);
+        std::vector<uint32_t> stamp(vertexCount, 0);    // which cluster last saw the vertex
+        uint32_t current = 0;
+        size_t misses = 0, start = 0;
+        size_t hard = 0;
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            bool boundary = hard < hardClusters.size() && hardClusters[hard] == i;
+            if (boundary) ++hard;
+            if (boundary || (i > start && (float)misses / ((i - start) / 3) <= threshold * meshAcmr && i - start >= (size_t)cacheSize * 3))
+            {
+                // the cache starts cold in each, as the clusters may end up anywhere
+                clusters.push_back((uint32_t)i);
+                start = i;
+                misses = 0;
+                ++current;
+            }
+            for (size_t c = 0; c < 3; ++c)
+            {
+                uint32_t v = indices[i + c];
+                if (stamp[v] == current && misses - missedAt[v] < (size_t)cacheSize) continue;
+                stamp[v] = current;
+                missedAt[v] = ++misses;
+            }
+        }
+        return clusters;
+    }
+};
@@ -0,0 +1,561 @@
+//
+//  meshlets.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MESHLETS_X86
+#endif
+
+/// A mesh's triangles in clusters ("meshlets") of up to a hundred or so
+/// that lie close together and face much the same way, each with a bounding
+/// sphere and a cone around its normals, so that clusters off screen or
+/// facing away can be left out of a draw on the CPU.
+///
+/// build() grows each cluster from a seed over shared vertices, taking the
+/// triangle that adds the fewest vertices, then the one nearest the cluster
+/// and closest to its facing, and reorders the triangles in place so every
+/// cluster is one range of the index buffer, each in vertex cache order.
+/// draw() tests four clusters at a time against the frustum and, where back
+/// faces are culled anyway, against their cones: a cluster faces away as a
+/// whole when the camera sees it from inside the cone's back side. What is
+/// left goes to one glMultiDrawElements, neighbouring clusters merged into
+/// one range.
+///
+///     meshlets.build(indices.data(), indices.size(), 0, positions, sizeof(float) * 3, vertexCount, Meshlets::Settings());
+///     ...
+///     meshlets.draw(Meshlets::view(glm::value_ptr(projection * view * model)), GL_UNSIGNED_INT);
+class Meshlets
+{
+public:
+    struct Settings
+    {
+        size_t maxVertices = 64;        // distinct vertices a cluster
+        size_t maxTriangles = 124;      // 0 makes none
+        float coneWeight = 0.5f;        // how much facing apart counts against distance apart when growing
+        int cacheSize = 16;             // the vertex cache each is ordered for; 0 leaves them as they grew
+    };
+    
+    /// What a frame sees, in the mesh's model space
+    struct View
+    {
+        float planes[6][4];             // normalized, facing in
+        float camera[4];                // a point (w 1), or for a parallel projection the way it looks, negated (w 0)
+        float facing = 0;               // 1 if back faces turn away from the camera, -1 if the projection mirrors, 0 not to test
+    };
+    
+    /// A cluster: its range of the index buffer, its bounding sphere, and
+    /// its normals' cone as the sine of its half angle (over 1 for none)
+    struct Meshlet
+    {
+        uint32_t firstIndex = 0, indexCount = 0;
+        float center[3] = { 0, 0, 0 };
+        float radius = 0;
+        float axis[3] = { 0, 0, 0 };
+        float cutoff = 2;
+    };
+    
+    struct Stats
+    {
+        size_t frames = 0;
+        uint64_t tested = 0;
+        uint64_t outside = 0;           // off the frustum
+        uint64_t backfacing = 0;        // on it, but facing away
+        uint64_t draws = 0;             // ranges drawn, neighbours merged
+        uint64_t triangles = 0;         // drawn
+    };
+    
+    size_t size() const { return firstIndices.size(); }
+    
+    bool empty() const { return firstIndices.empty(); }
+    
+    /// Cluster 'indices' (a triangle list) and reorder them in place so each
+    /// cluster is a range. 'firstIndex' is where they start in the index
+    /// buffer; positions are three floats 'positionStride' bytes apart. Adds
+    /// to the clusters already built, so a mesh's parts can go one by one
+    void build(uint32_t* indices, size_t indexCount, size_t firstIndex, const float* positions, size_t positionStride,
+               size_t vertexCount, const Settings& settings)
+    {
+        size_t triangleCount = indexCount / 3;
+        if (settings.maxTriangles == 0 || triangleCount == 0) return;
+        size_t maxVertices = std::max(settings.maxVertices, (size_t)3);
+        
+        // each triangle's centroid and unit normal
+        std::vector<float> centroids(triangleCount * 3), normals(triangleCount * 3);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            const float* a = position(positions, positionStride, indices[t * 3 + 0]);
+            const float* b = position(positions, positionStride, indices[t * 3 + 1]);
+            const float* c = position(positions, positionStride, indices[t * 3 + 2]);
+            for (int k = 0; k < 3; ++k) centroids[t * 3 + k] = (a[k] + b[k] + c[k]) / 3;
+            float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            float* normal = &normals[t * 3];
+            normal[0] = u[1] * v[2] - u[2] * v[1];
+            normal[1] = u[2] * v[0] - u[0] * v[2];
+            normal[2] = u[0] * v[1] - u[1] * v[0];
+            normalize(normal);
+        }
+        
+        // the triangles around each vertex
+        std::vector<uint32_t> triangleFirst(vertexCount + 1, 0), vertexTriangles(triangleCount * 3);
+        for (size_t i = 0; i < triangleCount * 3; ++i) ++triangleFirst[indices[i] + 1];
+        for (size_t v = 0; v < vertexCount; ++v) triangleFirst[v + 1] += triangleFirst[v];
+        std::vector<uint32_t> cursor(triangleFirst.begin(), triangleFirst.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; ++i) vertexTriangles[cursor[indices[i]]++] = (uint32_t)(i / 3);
+        std::vector<uint32_t>().swap(cursor);
+        std::vector<uint32_t> live(vertexCount);    // triangles around it no cluster has yet
+        for (size_t v = 0; v < vertexCount; ++v) live[v] = triangleFirst[v + 1] - triangleFirst[v];
+        
+        // a stamp a cluster, so neither needs clearing between them
+        std::vector<uint32_t> vertexStamp(vertexCount, 0), candidateStamp(triangleCount, 0);
+        std::vector<char> used(triangleCount, 0);
+        std::vector<uint32_t> order, ends, candidates;
+        order.reserve(triangleCount);
+        uint32_t stamp = 0;
+        size_t nextUnused = 0;
+        float lastCenter[3] = { 0, 0, 0 };
+        while (order.size() < triangleCount)
+        {
+            // start from what the last cluster left at its edge, the triangle
+            // with fewest others left around it (the likeliest to be cut off)
+            // and then the nearest; else from the first no cluster has
+            uint32_t next = Missing, fewestLive = Missing;
+            float nearest = INFINITY;
+            for (uint32_t t : candidates)
+            {
+                if (used[t]) continue;
+                uint32_t around = live[indices[t * 3 + 0]] + live[indices[t * 3 + 1]] + live[indices[t * 3 + 2]];
+                float distance = distanceSquared(&centroids[t * 3], lastCenter);
+                if (around < fewestLive || (around == fewestLive && distance < nearest))
+                {
+                    fewestLive = around;
+                    nearest = distance;
+                    next = t;
+                }
+            }
+            if (next == Missing)
+            {
+                while (used[nextUnused]) ++nextUnused;
+                next = (uint32_t)nextUnused;
+            }
+            candidates.clear();
+            ++stamp;
+            
+            size_t begin = order.size(), clusterVertices = 0;
+            float centerSum[3] = { 0, 0, 0 }, normalSum[3] = { 0, 0, 0 };
+            while (next != Missing)
+            {
+                used[next] = 1;
+                order.push_back(next);
+                for (int k = 0; k < 3; ++k)
+                {
+                    uint32_t v = indices[next * 3 + k];
+                    --live[v];
+                    if (vertexStamp[v] == stamp) continue;
+                    vertexStamp[v] = stamp;
+                    ++clusterVertices;
+                    for (uint32_t i = triangleFirst[v]; i < triangleFirst[v + 1]; ++i)
+                    {
+                        uint32_t t = vertexTriangles[i];
+                        if (used[t] || candidateStamp[t] == stamp) continue;
+                        candidateStamp[t] = stamp;
+                        candidates.push_back(t);
+                    }
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    centerSum[k] += centroids[next * 3 + k];
+                    normalSum[k] += normals[next * 3 + k];
+                }
+                size_t triangles = order.size() - begin;
+                if (triangles >= settings.maxTriangles) break;
+                
+                // the neighbour adding fewest vertices, then the nearest and
+                // most alike in facing. One that is the last at a vertex goes
+                // before others adding as many, since left behind it would
+                // start a cluster of its own
+                float center[3] = { centerSum[0] / triangles, centerSum[1] / triangles, centerSum[2] / triangles };
+                float facing[3] = { normalSum[0], normalSum[1], normalSum[2] };
+                normalize(facing);
+                next = Missing;
+                int fewest = 7;
+                float best = INFINITY;
+                size_t kept = 0;
+                for (size_t c = 0; c < candidates.size(); ++c)
+                {
+                    uint32_t t = candidates[c];
+                    if (used[t]) continue;
+                    candidates[kept++] = t;
+                    const uint32_t* corners = &indices[t * 3];
+                    int added = (vertexStamp[corners[0]] != stamp) + (vertexStamp[corners[1]] != stamp) + (vertexStamp[corners[2]] != stamp);
+                    if (clusterVertices + added > maxVertices) continue;
+                    bool last = live[corners[0]] == 1 || live[corners[1]] == 1 || live[corners[2]] == 1;
+                    added = added * 2 - (added > 0 && last);
+                    if (added > fewest) continue;
+                    // one closing a gap costs nothing wherever it is
+                    if (added == 0)
+                    {
+                        next = t;
+                        kept = std::copy(candidates.begin() + c + 1, candidates.end(), candidates.begin() + kept) - candidates.begin();
+                        break;
+                    }
+                    const float* normal = &normals[t * 3];
+                    float alike = normal[0] * facing[0] + normal[1] * facing[1] + normal[2] * facing[2];
+                    float score = distanceSquared(&centroids[t * 3], center) * (1 + settings.coneWeight * (1 - alike));
+                    if (added < fewest || score < best)
+                    {
+                        fewest = added;
+                        best = score;
+                        next = t;
+                    }
+                }
+                candidates.resize(kept);
+            }
+            ends.push_back(order.size());
+            size_t triangles = order.size() - begin;
+            for (int k = 0; k < 3; ++k) lastCenter[k] = centerSum[k] / triangles;
+        }
+        
+        // the triangles in cluster order
+        std::vector<uint32_t> reordered(triangleCount * 3);
+        for (size_t i = 0; i < triangleCount; ++i) memcpy(&reordered[i * 3], &indices[order[i] * 3], 3 * sizeof(uint32_t));
+        memcpy(indices, reordered.data(), triangleCount * 3 * sizeof(uint32_t));
+        std::vector<uint32_t>().swap(reordered);
+        
+        // and within each, in vertex cache order, over vertices numbered for
+        // the cluster so that costs no more than it does
+        if (settings.cacheSize > 0)
+        {
+            std::vector<uint32_t> localVertex(vertexCount), vertices, local, cached;
+            size_t begin = 0;
+            for (size_t end : ends)
+            {
+                ++stamp;
+                vertices.clear();
+                local.clear();
+                for (size_t i = begin * 3; i < end * 3; ++i)
+                {
+                    uint32_t v = indices[i];
+                    if (vertexStamp[v] != stamp)
+                    {
+                        vertexStamp[v] = stamp;
+                        localVertex[v] = (uint32_t)vertices.size();
+                        vertices.push_back(v);
+                    }
+                    local.push_back(localVertex[v]);
+                }
+                cached.resize(local.size());
+                MeshOptimizer::optimizeVertexCache(cached.data(), local.data(), local.size(), vertices.size(), settings.cacheSize);
+                for (size_t i = 0; i < cached.size(); ++i) indices[begin * 3 + i] = vertices[cached[i]];
+                begin = end;
+            }
+        }
+        
+        // and each cluster's bounds
+        size_t begin = 0;
+        for (size_t end : ends)
+        {
+            float low[3] = { INFINITY, INFINITY, INFINITY }, high[3] = { -INFINITY, -INFINITY, -INFINITY };
+            float axis[3] = { 0, 0, 0 };
+            for (size_t t = begin; t < end; ++t)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    const float* p = position(positions, positionStride, indices[t * 3 + k]);
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        low[c] = std::min(low[c], p[c]);
+                        high[c] = std::max(high[c], p[c]);
+                    }
+                }
+                for (int c = 0; c < 3; ++c) axis[c] += normals[order[t] * 3 + c];
+            }
+            float center[3] = { (low[0] + high[0]) / 2, (low[1] + high[1]) / 2, (low[2] + high[2]) / 2 };
+            float radius = 0;
+            for (size_t t = begin; t < end; ++t)
+                for (int k = 0; k < 3; ++k)
+                    radius = std::max(radius, distanceSquared(position(positions, positionStride, indices[t * 3 + k]), center));
+            
+            // the cone: its cutoff is the sine of the widest angle between
+            // the axis and a normal, and one wider than a right angle, less
+            // a bit, is no use
+            float spread = normalize(axis) > 0 ? 1.0f : -1.0f;
+            for (size_t t = begin; t < end && spread > NoCone; ++t)
+            {
+                const float* normal = &normals[order[t] * 3];
+                if (normal[0] == 0 && normal[1] == 0 && normal[2] == 0) continue;
+                spread = std::min(spread, normal[0] * axis[0] + normal[1] * axis[1] + normal[2] * axis[2]);
+            }
+            
+            Meshlet meshlet;
+            meshlet.firstIndex = (uint32_t)(firstIndex + begin * 3);
+            meshlet.indexCount = (uint32_t)((end - begin) * 3);
+            for (int c = 0; c < 3; ++c)
+            {
+                meshlet.center[c] = center[c];
+                meshlet.axis[c] = axis[c];
+            }
+            meshlet.radius = std::sqrt(radius);
+            meshlet.cutoff = spread > NoCone ? std::sqrt(1 - spread * spread) : 2.0f;
+            add(meshlet);
+            begin = end;
+        }
+    }
+    
+    /// Cluster 'index', as add() takes it
+    Meshlet meshlet(size_t index) const
+    {
+        Meshlet meshlet;
+        meshlet.firstIndex = firstIndices[index];
+        meshlet.indexCount = indexCounts[index];
+        for (int c = 0; c < 3; ++c)
+        {
+            meshlet.center[c] = fields[CenterX + c][index];
+            meshlet.axis[c] = fields[AxisX + c][index];
+        }
+        meshlet.radius = fields[Radius][index];
+        meshlet.cutoff = fields[Cutoff][index];
+        return meshlet;
+    }
+    
+    /// Add a cluster built before, for meshes that were saved with theirs
+    void add(const Meshlet& meshlet)
+    {
+        size_t count = size();
+        for (std::vector<float>& field : fields) field.resize(count);
+        firstIndices.push_back(meshlet.firstIndex);
+        indexCounts.push_back(meshlet.indexCount);
+        for (int c = 0; c < 3; ++c)
+        {
+            fields[CenterX + c].push_back(meshlet.center[c]);
+            fields[AxisX + c].push_back(meshlet.axis[c]);
+        }
+        fields[Radius].push_back(meshlet.radius);
+        fields[Cutoff].push_back(meshlet.cutoff);
+        
+        // padded to four, with ones that are never on screen
+        for (int f = 0; f < FieldCount; ++f) fields[f].resize((count + 4) & ~(size_t)3, f == Radius ? -1e30f : 0.0f);
+    }
+    
+    /// The frustum and camera of 'modelViewProjection' (column-major, as
+    /// glm keeps it). Back faces are taken to be clockwise ones, GL's
+    /// default; without 'backfaces' only the frustum is tested, for meshes
+    /// drawn without GL_CULL_FACE
+    static View view(const float* modelViewProjection, bool backfaces = true)
+    {
+        const float* m = modelViewProjection;
+        float rows[4][4];
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c) rows[r][c] = m[c * 4 + r];
+        
+        View view;
+        for (int p = 0; p < 6; ++p)
+        {
+            float sign = p & 1 ? -1.0f : 1.0f;
+            float* plane = view.planes[p];
+            for (int c = 0; c < 4; ++c) plane[c] = rows[3][c] + sign * rows[p / 2][c];
+            float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            if (length > 0)
+                for (int c = 0; c < 4; ++c) plane[c] /= length;
+        }
+        
+        // the camera is what x, y and w all vanish at: a point, or for a
+        // parallel projection a direction, the one depth grows along
+        float eye[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            int a = i == 0 ? 1 : 0, b = i <= 1 ? 2 : 1, c = i <= 2 ? 3 : 2;
+            float minor = rows[0][a] * (rows[1][b] * rows[3][c] - rows[1][c] * rows[3][b]) -
+                rows[0][b] * (rows[1][a] * rows[3][c] - rows[1][c] * rows[3][a]) +
+                rows[0][c] * (rows[1][a] * rows[3][b] - rows[1][b] * rows[3][a]);
+            eye[i] = i & 1 ? -minor : minor;
+        }
+        float determinant = rows[2][0] * eye[0] + rows[2][1] * eye[1] + rows[2][2] * eye[2] + rows[2][3] * eye[3];
+        float extent = std::fabs(eye[0]) + std::fabs(eye[1]) + std::fabs(eye[2]);
+        if (std::fabs(eye[3]) > extent * 1e-6f)
+        {
+            for (int c = 0; c < 3; ++c) view.camera[c] = eye[c] / eye[3];
+            view.camera[3] = 1;
+        }
+        else
+        {
+            for (int c = 0; c < 3; ++c) view.camera[c] = determinant > 0 ? -eye[c] : eye[c];
+            normalize(view.camera);
+            view.camera[3] = 0;
+        }
+        // projections turn right-handed model space left-handed, which is
+        // what makes counterclockwise front facing; one that doesn't flips it
+        view.facing = !backfaces || determinant == 0 ? 0.0f : determinant < 0 ? 1.0f : -1.0f;
+        return view;
+    }
+    
+    /// The clusters 'view' sees, as ranges of 'indexSize' byte indices for
+    /// glMultiDrawElements. Returns how many
+    size_t cull(const View& view, size_t indexSize, std::vector<GLsizei>& counts, std::vector<const void*>& offsets)
+    {
+        counts.clear();
+        offsets.clear();
+        size_t count = size(), end = 0;
+        for (size_t i = 0; i < count; i += 4)
+        {
+            int backfacing = 0;
+#ifdef MESHLETS_X86
+            int outside = cullSSE2(view, i, backfacing);
+#else
+            int outside = cullScalar(view, i, backfacing);
+#endif
+            int lanes = count - i >= 4 ? 15 : (1 << (count - i)) - 1;
+            statistics.outside += __builtin_popcount(outside & lanes);
+            statistics.backfacing += __builtin_popcount(backfacing & lanes);
+            int visible = ~(outside | backfacing) & lanes;
+            for (size_t j = 0; visible; ++j, visible >>= 1)
+            {
+                if (!(visible & 1)) continue;
+                size_t first = firstIndices[i + j], length = indexCounts[i + j];
+                if (!counts.empty() && first == end)
+                {
+                    counts.back() += (GLsizei)length;
+                }
+                else
+                {
+                    counts.push_back((GLsizei)length);
+                    offsets.push_back((const void*)(first * indexSize));
+                }
+                end = first + length;
+                statistics.triangles += length / 3;
+            }
+        }
+        ++statistics.frames;
+        statistics.tested += count;
+        statistics.draws += counts.size();
+        return counts.size();
+    }
+    
+    /// The clusters 'view' sees, from the bound vertex array
+    void draw(const View& view, GLenum indexType)
+    {
+        cull(view, indexType == GL_UNSIGNED_SHORT ? 2 : 4, drawCounts, drawOffsets);
+        if (!drawCounts.empty())
+            glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), (GLsizei)drawCounts.size());
+    }
+    
+    Stats stats() const { return statistics; }
+    
+    void printStats() const
+    {
+        std::cout << "MESHLETS: " << size() << " clusters, " << statistics.frames << " frames tested " << statistics.tested
+            << " (" << statistics.outside << " outside, " << statistics.backfacing << " facing away), "
+            << statistics.triangles << " triangles drawn in " << statistics.draws << " ranges" << std::endl;
+    }
+
+private:
+    enum : uint32_t { Missing = ~0u };
+    enum Field { CenterX, CenterY, CenterZ, Radius, AxisX, AxisY, AxisZ, Cutoff, FieldCount };
+    
+    // how far a normal may turn from the axis, as a cosine, before the cone
+    // is wider than any view could see all the way round
+    static constexpr float NoCone = 0.1f;
+    
+    std::vector<uint32_t> firstIndices, indexCounts;
+    std::vector<float> fields[FieldCount];   // a field at a time, for four clusters a load
+    std::vector<GLsizei> drawCounts;
+    std::vector<const void*> drawOffsets;
+    Stats statistics;
+    
+    static const float* position(const float* positions, size_t stride, uint32_t vertex)
+    {
+        return (const float*)((const unsigned char*)positions + (size_t)vertex * stride);
+    }
+    
+    static float distanceSquared(const float* a, const float* b)
+    {
+        float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+        return x * x + y * y + z * z;
+    }
+    
+    /// Returns the length it had; zero vectors stay zero
+    static float normalize(float* v)
+    {
+        float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0)
+            for (int c = 0; c < 3; ++c) v[c] /= length;
+        return length;
+    }
+    
+    /// Clusters 'first' to 'first' + 3: a bit each that is off the frustum,
+    /// returned, and in 'backfacing' a bit each that faces away
+    int cullScalar(const View& view, size_t first, int& backfacing) const
+    {
+        int outside = 0;
+        backfacing = 0;
+        for (int j = 0; j < 4; ++j)
+        {
+            size_t i = first + j;
+            float x = fields[CenterX][i], y = fields[CenterY][i], z = fields[CenterZ][i], radius = fields[Radius][i];
+            for (const float* plane : view.planes)
+                if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius) outside |= 1 << j;
+            if (view.facing == 0 || outside >> j & 1) continue;
+            
+            // facing away from everywhere on its sphere the camera looks from
+            const float* camera = view.camera;
+            float vx = x * camera[3] - camera[0], vy = y * camera[3] - camera[1], vz = z * camera[3] - camera[2];
+            float along = (vx * fields[AxisX][i] + vy * fields[AxisY][i] + vz * fields[AxisZ][i]) * view.facing;
+            float length = std::sqrt(vx * vx + vy * vy + vz * vz);
+            if (along >= fields[Cutoff][i] * length + radius * camera[3]) backfacing |= 1 << j;
+        }
+        return outside;
+    }
+
+#ifdef MESHLETS_X86
+    /// cullScalar, four at once
+    int cullSSE2(const View& view, size_t first, int& backfacing) const
+    {
+        __m128 x = _mm_loadu_ps(&fields[CenterX][first]);
+        __m128 y = _mm_loadu_ps(&fields[CenterY][first]);
+        __m128 z = _mm_loadu_ps(&fields[CenterZ][first]);
+        __m128 radius = _mm_loadu_ps(&fields[Radius][first]);
+        __m128 below = _mm_sub_ps(_mm_setzero_ps(), radius);
+        __m128 out = _mm_setzero_ps();
+        for (const float* plane : view.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+            out = _mm_or_ps(out, _mm_cmplt_ps(distance, below));
+        }
+        int outside = _mm_movemask_ps(out);
+        backfacing = 0;
+        if (view.facing == 0 || outside == 15) return outside;
+        
+        const float* camera = view.camera;
+        __m128 w = _mm_set1_ps(camera[3]);
+        __m128 vx = _mm_sub_ps(_mm_mul_ps(x, w), _mm_set1_ps(camera[0]));
+        __m128 vy = _mm_sub_ps(_mm_mul_ps(y, w), _mm_set1_ps(camera[1]));
+        __m128 vz = _mm_sub_ps(_mm_mul_ps(z, w), _mm_set1_ps(camera[2]));
+        __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&fields[AxisX][first])),
+                                             _mm_mul_ps(vy, _mm_loadu_ps(&fields[AxisY][first]))),
+                                  _mm_mul_ps(vz, _mm_loadu_ps(&fields[AxisZ][first])));
+        along = _mm_mul_ps(along, _mm_set1_ps(view.facing));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+        __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&fields[Cutoff][first]), length), _mm_mul_ps(radius, w));
+        backfacing = _mm_movemask_ps(_mm_cmpge_ps(along, limit)) & ~outside;
+        return outside;
+    }
+#endif
+};
@@ -0,0 +1,460 @@
+//
+//  mip_generator.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "shader.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Builds GL_TEXTURE_2D mip chains on the GPU, with a choice of filter and
+/// many textures at a time, in place of glGenerateMipmap (which some drivers
+/// run on the CPU, one texture a call, with a filter of their choosing).
+///
+/// With compute shaders, mipGenerate.comp makes up to 12 levels of up to 16
+/// textures a dispatch into one buffer, and the levels are uploaded from it
+/// as a pixel unpack buffer; Kaiser filtering takes a dispatch a level.
+/// Without, mipDownsample.frag renders each level from the one above; plain
+/// box filtering of non-sRGB textures is then left to glGenerateMipmap.
+///
+/// Textures of 8-bit or half float formats are filtered as asked. sRGB
+/// formats are always filtered in linear light. Anything else goes to
+/// glGenerateMipmap. Levels are made from GL_TEXTURE_BASE_LEVEL down to
+/// GL_TEXTURE_MAX_LEVEL or 1x1; a mutable texture gets any it is missing.
+///
+///     MipGenerator mips(shaderDirectory);
+///     mips.generate(renderTargets.data(), renderTargets.size());
+///     mips.generate(albedo, MipGenerator::Srgb);
+class MipGenerator
+{
+public:
+    enum Filter
+    {
+        Box,        // 2x2 average of the stored values
+        Kaiser,     // Kaiser windowed sinc, 12 taps across: sharper, less aliasing
+        Srgb,       // 2x2 average of 8-bit values taken as sRGB, in linear light
+    };
+    
+    struct Stats
+    {
+        uint64_t textures = 0;
+        uint64_t levels = 0;        // made by the shaders
+        uint64_t dispatches = 0;
+        uint64_t fallbacks = 0;     // textures left to glGenerateMipmap
+    };
+    
+    /// 'shaderDirectory' holds mipGenerate.comp, mipDownsample.frag and
+    /// jpegQuad.vert, and ends in a slash
+    explicit MipGenerator(const std::string& shaderDirectory)
+        : downsample((shaderDirectory + "jpegQuad.vert").c_str(), (shaderDirectory + "mipDownsample.frag").c_str())
+    {
+        float weights[12];
+        kaiserWeights(weights);
+        
+        if (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_shading_language_packing)
+        {
+            reduce.reset(new Shader((shaderDirectory + "mipGenerate.comp").c_str()));
+            if (!linked(*reduce)) reduce.reset();
+        }
+        if (reduce)
+        {
+            GLint units;
+            glGetIntegerv(GL_MAX_COMPUTE_TEXTURE_IMAGE_UNITS, &units);
+            maxJobs = units < MaxJobs ? units : MaxJobs;
+            reduce->use();
+            for (int i = 0; i < MaxJobs; ++i)
+                reduce->setInt("sources[" + std::to_string(i) + "]", i);
+            glUniform1fv(glGetUniformLocation(reduce->shaderProgram, "kaiserWeights"), 12, weights);
+            
+            GLuint zero[MaxJobs] = {};
+            glGenBuffers(1, &levelBuffer);
+            glGenBuffers(1, &counterBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), zero, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        
+        downsample.use();
+        downsample.setInt("source", 0);
+        glUniform1fv(glGetUniformLocation(downsample.shaderProgram, "kaiserWeights"), 12, weights);
+        glUseProgram(0);
+        fragments = linked(downsample);
+        
+        glGenVertexArrays(1, &vao);
+        glGenFramebuffers(1, &fbo);
+    }
+    
+    ~MipGenerator()
+    {
+        if (reduce) glDeleteProgram(reduce->shaderProgram);
+        glDeleteProgram(downsample.shaderProgram);
+        glDeleteBuffers(1, &levelBuffer);
+        glDeleteBuffers(1, &counterBuffer);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteFramebuffers(1, &fbo);
+    }
+    
+    MipGenerator(const MipGenerator&) = delete;
+    MipGenerator& operator=(const MipGenerator&) = delete;
+    
+    /// True if levels are made by compute shaders
+    bool usesCompute() const { return reduce != nullptr; }
+    
+    void generate(GLuint texture, Filter filter = Box) { generate(&texture, 1, filter); }
+    
+    /// Fill the mip chains of 'textures' from their base levels. Leaves the
+    /// texture and sampler bindings, program and pixel unpack state as they
+    /// were
+    void generate(const GLuint* textures, size_t count, Filter filter = Box)
+    {
+        GLint previousUnit, previousProgram, previousUnpackBuffer, previousAlignment, previousRowLength;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &previousUnit);
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousUnpackBuffer);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glGetIntegerv(GL_UNPACK_ROW_LENGTH, &previousRowLength);
+        // a sampler object bound to a unit overrides the texture's own
+        // filtering, and a mipmapped one makes levels still being made
+        // incomplete, so the units used go without
+        std::vector<GLint> previousTextures(std::max(maxJobs, 1)), previousSamplers(previousTextures.size());
+        for (size_t i = 0; i < previousTextures.size(); ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTextures[i]);
+            glGetIntegerv(GL_SAMPLER_BINDING, &previousSamplers[i]);
+            glBindSampler((GLuint)i, 0);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        
+        std::vector<Job> jobs;
+        for (size_t i = 0; i < count; ++i)
+        {
+            Job job;
+            if (!prepare(textures[i], filter, job)) continue;
+            ++statistics.textures;
+            if (job.storage == Other || (!reduce && filter == Box && !job.srgb) || (!reduce && !fragments))
+            {
+                glGenerateMipmap(GL_TEXTURE_2D);
+                ++statistics.fallbacks;
+            }
+            else if (reduce)
+            {
+                jobs.push_back(job);
+            }
+            else
+            {
+                render(job, filter);
+            }
+        }
+        if (!jobs.empty()) dispatch(jobs, filter);
+        
+        for (size_t i = 0; i < previousTextures.size(); ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+            glBindTexture(GL_TEXTURE_2D, previousTextures[i]);
+            glBindSampler((GLuint)i, previousSamplers[i]);
+        }
+        glActiveTexture(previousUnit);
+        glUseProgram(previousProgram);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousUnpackBuffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, previousRowLength);
+    }
+    
+    Stats stats() const { return statistics; }
+    
+    void printStats() const
+    {
+        std::cout << "MIP_GENERATOR: " << statistics.textures << " textures, " << statistics.levels << " levels in "
+            << statistics.dispatches << (reduce ? " dispatches, " : " passes, ") << statistics.fallbacks << " left to glGenerateMipmap" << std::endl;
+    }
+
+private:
+    static const int MaxJobs = 16;                          // as in mipGenerate.comp
+    static const int64_t MaxBatchBytes = 64ll << 20;        // of levels between uploads
+    static const int Wide = 1, Decode = 2, Encode = 4;      // job flags
+    
+    enum Storage { Bytes, Halves, Other };
+    
+    struct Job
+    {
+        GLuint texture = 0;
+        int base = 0, last = 0;     // levels read from and made down to
+        int next = 0;               // the level the next pass reads
+        int width = 0, height = 0;  // of the base level
+        Storage storage = Other;
+        bool srgb = false;
+        int flags = 0;
+    };
+    
+    Shader downsample;
+    std::unique_ptr<Shader> reduce;
+    bool fragments = false;
+    int maxJobs = 0;
+    GLuint levelBuffer = 0, counterBuffer = 0;
+    GLsizeiptr levelCapacity = 0;
+    GLuint vao = 0, fbo = 0;
+    Stats statistics;
+    
+    static bool linked(const Shader& shader)
+    {
+        GLint success = 0;
+        glGetProgramiv(shader.shaderProgram, GL_LINK_STATUS, &success);
+        return success != 0;
+    }
+    
+    static Storage storageFor(GLenum internalFormat, bool* srgb)
+    {
+        *srgb = false;
+        switch (internalFormat)
+        {
+            case GL_SRGB8: case GL_SRGB8_ALPHA8: case GL_SRGB: case GL_SRGB_ALPHA:
+                *srgb = true;
+                return Bytes;
+            case GL_R8: case GL_RG8: case GL_RGB8: case GL_RGBA8: case GL_RED: case GL_RG: case GL_RGB: case GL_RGBA:
+                return Bytes;
+            case GL_R16F: case GL_RG16F: case GL_RGB16F: case GL_RGBA16F: case GL_R11F_G11F_B10F: case GL_RGB9_E5:
+                return Halves;
+        }
+        return Other;
+    }
+    
+    static int texelWords(const Job& job) { return job.storage == Halves ? 2 : 1; }
+    static GLenum texelType(const Job& job) { return job.storage == Halves ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE; }
+    int levelWidth(const Job& job, int level) const { return std::max(job.width >> (level - job.base), 1); }
+    int levelHeight(const Job& job, int level) const { return std::max(job.height >> (level - job.base), 1); }
+    
+    /// Kaiser window (alpha 4) over a sinc three output texels wide, as taps
+    /// at source texel centres around the 2x2 block under an output texel
+    static void kaiserWeights(float* weights)
+    {
+        auto besselI0 = [](double x)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 32; ++k)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        const double pi = 3.14159265358979, alpha = 4.0, width = 3.0;
+        double total = 0.0;
+        for (int i = 0; i < 12; ++i)
+        {
+            double d = (i - 5.5) / 2.0;
+            double sinc = std::sin(pi * d) / (pi * d);
+            double window = besselI0(alpha * std::sqrt(1.0 - (d / width) * (d / width))) / besselI0(alpha);
+            weights[i] = (float)(sinc * window);
+            total += weights[i];
+        }
+        for (int i = 0; i < 12; ++i) weights[i] = (float)(weights[i] / total);
+    }
+    
+    /// Bind 'texture' to unit 0 and work out what to make; define the levels
+    /// a mutable texture is missing. False if there is nothing to do
+    bool prepare(GLuint texture, Filter filter, Job& job)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GLint base, maxLevel, immutable = 0, immutableLevels = 0, internalFormat;
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &base);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+        if (immutable) glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &immutableLevels);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, base, GL_TEXTURE_WIDTH, &job.width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, base, GL_TEXTURE_HEIGHT, &job.height);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, base, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        if (job.width == 0 || job.height == 0) return false;
+        
+        job.texture = texture;
+        job.base = job.next = base;
+        job.last = std::min(base + Texture::mipLevels(job.width, job.height) - 1, maxLevel);
+        if (immutable) job.last = std::min(job.last, immutableLevels - 1);
+        if (job.last <= job.base) return false;
+        
+        job.storage = storageFor(internalFormat, &job.srgb);
+        if (job.storage == Other) return true;
+        if (job.storage == Halves) job.flags |= Wide;
+        if (filter == Srgb && !job.srgb && job.storage == Bytes) job.flags |= Decode | Encode;
+        if (job.srgb) job.flags |= Encode;  // read linear, stored encoded
+        
+        if (!immutable)
+        {
+            for (int level = job.base + 1; level <= job.last; ++level)
+            {
+                GLint width, height, format;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_INTERNAL_FORMAT, &format);
+                if (width != levelWidth(job, level) || height != levelHeight(job, level) || format != internalFormat)
+                    glTexImage2D(GL_TEXTURE_2D, level, internalFormat, levelWidth(job, level), levelHeight(job, level), 0,
+                                 GL_RGBA, texelType(job), nullptr);
+            }
+        }
+        return true;
+    }
+    
+    /// Compute passes until every job has its chain: each pass reads one
+    /// level of each texture and makes up to 12 below it (6 if the level
+    /// read is too big for the last group to finish from a 64x64 level)
+    void dispatch(std::vector<Job>& jobs, Filter filter)
+    {
+        reduce->use();
+        reduce->setBool("kaiser", filter == Kaiser);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, levelBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, counterBuffer);
+        
+        std::vector<Job*> batch;
+        std::vector<int> counts;
+        for (;;)
+        {
+            batch.clear();
+            counts.clear();
+            int64_t words = 0;
+            for (Job& job : jobs)
+            {
+                if (job.next >= job.last) continue;
+                int width = levelWidth(job, job.next), height = levelHeight(job, job.next);
+                int count = filter == Kaiser ? 1 : std::min(job.last - job.next, std::max(width, height) < 8192 ? 12 : 6);
+                int64_t jobWords = 0;
+                for (int level = job.next + 1; level <= job.next + count; ++level)
+                    jobWords += (int64_t)levelWidth(job, level) * levelHeight(job, level) * texelWords(job);
+                if (!batch.empty() && ((int)batch.size() == maxJobs || (words + jobWords) * 4 > MaxBatchBytes))
+                    break;
+                batch.push_back(&job);
+                counts.push_back(count);
+                words += jobWords;
+            }
+            if (batch.empty()) break;
+            run(batch, counts, filter, words);
+        }
+        
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    
+    void run(const std::vector<Job*>& batch, const std::vector<int>& counts, Filter filter, int64_t words)
+    {
+        if (words * 4 > levelCapacity)
+        {
+            levelCapacity = (GLsizeiptr)words * 4;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, levelBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, levelCapacity, nullptr, GL_STREAM_COPY);
+        }
+        
+        GLint tiles[4 * MaxJobs] = {}, levels[4 * MaxJobs] = {};
+        int groups = 0;
+        int64_t word = 0;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const Job& job = *batch[i];
+            int width = levelWidth(job, job.next), height = levelHeight(job, job.next);
+            int across = (width + 63) / 64;
+            int jobGroups = filter == Kaiser ? (levelWidth(job, job.next + 1) * levelHeight(job, job.next + 1) + 255) / 256
+                                             : across * ((height + 63) / 64);
+            GLint tile[4] = { width, height, across, groups };
+            GLint level[4] = { job.next - job.base, counts[i], (GLint)word, job.flags };
+            std::copy(tile, tile + 4, tiles + 4 * i);
+            std::copy(level, level + 4, levels + 4 * i);
+            groups += jobGroups;
+            for (int l = job.next + 1; l <= job.next + counts[i]; ++l)
+                word += (int64_t)levelWidth(job, l) * levelHeight(job, l) * texelWords(job);
+            
+            glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+            glBindTexture(GL_TEXTURE_2D, job.texture);
+        }
+        glUniform4iv(glGetUniformLocation(reduce->shaderProgram, "jobTiles"), MaxJobs, tiles);
+        glUniform4iv(glGetUniformLocation(reduce->shaderProgram, "jobLevels"), MaxJobs, levels);
+        reduce->setInt("jobCount", (int)batch.size());
+        reduce->setInt("groupCount", groups);
+        // a row of up to 256 groups per y, so big batches stay under the
+        // 65535 groups a dispatch dimension may have
+        glDispatchCompute(std::min(groups, 256), (groups + 255) / 256, 1);
+        ++statistics.dispatches;
+        
+        glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+        glActiveTexture(GL_TEXTURE0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, levelBuffer);
+        word = 0;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            Job& job = *batch[i];
+            glBindTexture(GL_TEXTURE_2D, job.texture);
+            for (int l = job.next + 1; l <= job.next + counts[i]; ++l)
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, levelWidth(job, l), levelHeight(job, l), GL_RGBA, texelType(job),
+                                (const void*)(uintptr_t)(word * 4));
+                word += (int64_t)levelWidth(job, l) * levelHeight(job, l) * texelWords(job);
+            }
+            job.next += counts[i];
+            statistics.levels += counts[i];
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    
+    /// Fragment passes, a level each, for the bound texture: the level above
+    /// is made the texture's only level so reading it and drawing into the
+    /// next are not a feedback loop
+    void render(const Job& job, Filter filter)
+    {
+        GLint previousFramebuffer, previousVertexArray, viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLboolean previousSrgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glBindVertexArray(vao);
+        downsample.use();
+        downsample.setBool("kaiser", filter == Kaiser);
+        downsample.setBool("decode", (job.flags & Decode) != 0);
+        downsample.setBool("encode", (job.flags & Encode) != 0);
+        
+        GLint maxLevel;
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        bool complete = true;
+        for (int level = job.base + 1; level <= job.last && complete; ++level)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, job.texture, level);
+            complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+            if (!complete) break;
+            glUniform2i(glGetUniformLocation(downsample.shaderProgram, "sourceSize"), levelWidth(job, level - 1), levelHeight(job, level - 1));
+            glViewport(0, 0, levelWidth(job, level), levelHeight(job, level));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            ++statistics.levels;
+            ++statistics.dispatches;
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.base);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glBindVertexArray(previousVertexArray);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (previousSrgb) glEnable(GL_FRAMEBUFFER_SRGB);
+        if (!complete)
+        {
+            // not renderable here: all the driver's
+            glGenerateMipmap(GL_TEXTURE_2D);
+            ++statistics.fallbacks;
+        }
+    }
+};
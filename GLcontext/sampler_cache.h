@@ -0,0 +1,173 @@
+//
+//  sampler_cache.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+/// How a texture is sampled, kept apart from the texture. Every field is four
+/// bytes, so states compare and hash as plain memory
+struct SamplerState
+{
+    GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLenum magFilter = GL_LINEAR;
+    GLenum wrapS = GL_REPEAT;
+    GLenum wrapT = GL_REPEAT;
+    GLenum wrapR = GL_REPEAT;
+    GLenum compareMode = GL_NONE;       // GL_COMPARE_REF_TO_TEXTURE for shadow maps
+    GLenum compareFunc = GL_LEQUAL;
+    float maxAnisotropy = 1.0f;         // clamped to what the GL supports
+    float minLod = -1000.0f;
+    float maxLod = 1000.0f;
+    float lodBias = 0.0f;
+    float borderColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    
+    /// The same wrap mode in every direction
+    SamplerState& wrap(GLenum mode)
+    {
+        wrapS = wrapT = wrapR = mode;
+        return *this;
+    }
+    
+    bool operator==(const SamplerState& other) const { return memcmp(this, &other, sizeof(SamplerState)) == 0; }
+};
+
+static_assert(sizeof(SamplerState) == 15 * 4, "SamplerState must have no padding to compare and hash as memory");
+
+/// Sampler objects, one per distinct SamplerState. Textures sampled through
+/// them carry no sampling state of their own, so thousands of textures
+/// sampled alike share one sampler and the driver never validates
+/// per-texture parameters. Binds go through the cache, which remembers what
+/// each texture unit has and skips binding it again.
+///
+/// A sampler bound to a unit overrides the state of every texture on it.
+/// Textures that keep their own state (TextureAtlas, VirtualTexture) want
+/// sampler 0 on their units: bind(unit, 0).
+///
+///     SamplerState tiled;
+///     tiled.wrap(GL_MIRRORED_REPEAT);
+///     GLuint sampler = samplers.get(tiled);
+///     ...
+///     // each draw
+///     samplers.bind(0, sampler);
+class SamplerCache
+{
+public:
+    struct Stats
+    {
+        size_t samplers = 0;
+        uint64_t binds = 0;         // glBindSampler calls made
+        uint64_t skipped = 0;       // binds of what the unit already had
+    };
+    
+    SamplerCache()
+    {
+        GLint units = 0;
+        glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units);
+        bound.assign(std::max(units, 1), 0);
+        if (GLEW_EXT_texture_filter_anisotropic) glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+    }
+    
+    ~SamplerCache()
+    {
+        for (const auto& sampler : samplers) glDeleteSamplers(1, &sampler.second);
+    }
+    
+    SamplerCache(const SamplerCache&) = delete;
+    SamplerCache& operator=(const SamplerCache&) = delete;
+    
+    /// The sampler for 'state', made the first time it is asked for. Lives
+    /// as long as the cache
+    GLuint get(SamplerState state)
+    {
+        state.maxAnisotropy = std::min(std::max(state.maxAnisotropy, 1.0f), maxAnisotropy);
+        auto found = samplers.find(state);
+        if (found != samplers.end()) return found->second;
+        
+        GLuint sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, state.minFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, state.magFilter);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, state.wrapS);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, state.wrapT);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, state.wrapR);
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, state.compareMode);
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, state.compareFunc);
+        glSamplerParameterf(sampler, GL_TEXTURE_MIN_LOD, state.minLod);
+        glSamplerParameterf(sampler, GL_TEXTURE_MAX_LOD, state.maxLod);
+        glSamplerParameterf(sampler, GL_TEXTURE_LOD_BIAS, state.lodBias);
+        glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, state.borderColor);
+        if (state.maxAnisotropy > 1.0f) glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, state.maxAnisotropy);
+        samplers.emplace(state, sampler);
+        return sampler;
+    }
+    
+    /// Bind 'sampler' (from get(), or 0 for none) to a texture unit unless
+    /// it is already there
+    void bind(GLuint unit, GLuint sampler)
+    {
+        if (unit < bound.size() && bound[unit] == sampler)
+        {
+            ++skipped;
+            return;
+        }
+        glBindSampler(unit, sampler);
+        if (unit < bound.size()) bound[unit] = sampler;
+        ++binds;
+    }
+    
+    void bind(GLuint unit, const SamplerState& state) { bind(unit, get(state)); }
+    
+    /// Forget what the units have, after samplers were bound other than
+    /// through the cache
+    void invalidate()
+    {
+        std::fill(bound.begin(), bound.end(), (GLuint)-1);
+    }
+    
+    Stats stats() const
+    {
+        Stats s;
+        s.samplers = samplers.size();
+        s.binds = binds;
+        s.skipped = skipped;
+        return s;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "SAMPLER_CACHE: " << s.samplers << " samplers, " << s.binds << " binds, " << s.skipped << " skipped" << std::endl;
+    }
+
+private:
+    struct Hash
+    {
+        size_t operator()(const SamplerState& state) const
+        {
+            uint32_t words[sizeof(SamplerState) / 4];
+            memcpy(words, &state, sizeof(words));
+            uint64_t h = 0xcbf29ce484222325ull;
+            for (uint32_t word : words) h = (h ^ word) * 0x100000001b3ull;
+            return (size_t)(h ^ (h >> 32));
+        }
+    };
+    
+    std::unordered_map<SamplerState, GLuint, Hash> samplers;
+    std::vector<GLuint> bound;      // per texture unit
+    float maxAnisotropy = 1.0f;
+    uint64_t binds = 0;
+    uint64_t skipped = 0;
+};
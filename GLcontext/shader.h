@@ -19,7 +19,9 @@
 
 class Shader
 {
+public:
     GLuint shaderProgram;
+    
     Shader(const char* vertPath, const char* fragPath)
     {
         std::string vertSource;
@@ -69,7 +71,6 @@ class Shader
         checkCompileErrors(fragmentShader, "FRAGMENT");
         
         // Shader Program
-        unsigned int shaderProgram;
         shaderProgram = glCreateProgram(); // Creates a new program and returns the ID reference
         glAttachShader(shaderProgram, vertexShader);
         glAttachShader(shaderProgram, fragmentShader);
@@ -81,6 +82,40 @@ class Shader
         glDeleteShader(fragmentShader);
     }
     
+    // a compute program, where the GL has compute shaders
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath)
+    {
+        std::string computeSource;
+        std::ifstream computeFile;
+        computeFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        
+        try {
+            computeFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << computeFile.rdbuf();
+            computeFile.close();
+            computeSource = cShaderStream.str();
+        }
+        catch (const std::ifstream::failure&) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        
+        const char* cShaderCode = computeSource.c_str();
+        
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &cShaderCode, nullptr);
+        glCompileShader(computeShader);
+        checkCompileErrors(computeShader, "COMPUTE");
+        
+        shaderProgram = glCreateProgram();
+        glAttachShader(shaderProgram, computeShader);
+        glLinkProgram(shaderProgram);
+        checkCompileErrors(shaderProgram, "PROGRAM");
+        
+        glDeleteShader(computeShader);
+    }
+    
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
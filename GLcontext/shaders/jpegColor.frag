@@ -0,0 +1,87 @@
+#version 410 core
+
+// Upsample the component planes and convert YCbCr to RGB
+
+out vec4 FragColor;
+
+uniform sampler2D planes[3];
+uniform ivec2 planeSize[3];  // pixels actually in each component
+uniform vec2 ratio[3];       // component resolution / image resolution
+uniform int components;      // 1 or 3
+uniform bool isRgb;
+
+// Same filters as stb_image: exact at full resolution, the centred
+// triangle filter at half resolution, nearest neighbour otherwise
+float axisWeight(float ratio, float position, out int first, out int second)
+{
+    if (ratio == 0.5)
+    {
+        float centre = position * 0.5 - 0.5;
+        first = int(floor(centre));
+        second = first + 1;
+        return centre - floor(centre);
+    }
+    first = int(floor(position * ratio));
+    second = first;
+    return 0.0;
+}
+
+float sampleComponent(int index, vec2 pixel)
+{
+    ivec2 first, second;
+    float wx = axisWeight(ratio[index].x, pixel.x + 0.5, first.x, second.x);
+    float wy = axisWeight(ratio[index].y, pixel.y + 0.5, first.y, second.y);
+    ivec2 last = planeSize[index] - 1;
+    first = clamp(first, ivec2(0), last);
+    second = clamp(second, ivec2(0), last);
+    
+    float a, b, c, d;
+    // sampler arrays need constant indices in 4.1
+    if (index == 0)
+    {
+        a = texelFetch(planes[0], ivec2(first.x, first.y), 0).r;
+        b = texelFetch(planes[0], ivec2(second.x, first.y), 0).r;
+        c = texelFetch(planes[0], ivec2(first.x, second.y), 0).r;
+        d = texelFetch(planes[0], ivec2(second.x, second.y), 0).r;
+    }
+    else if (index == 1)
+    {
+        a = texelFetch(planes[1], ivec2(first.x, first.y), 0).r;
+        b = texelFetch(planes[1], ivec2(second.x, first.y), 0).r;
+        c = texelFetch(planes[1], ivec2(first.x, second.y), 0).r;
+        d = texelFetch(planes[1], ivec2(second.x, second.y), 0).r;
+    }
+    else
+    {
+        a = texelFetch(planes[2], ivec2(first.x, first.y), 0).r;
+        b = texelFetch(planes[2], ivec2(second.x, first.y), 0).r;
+        c = texelFetch(planes[2], ivec2(first.x, second.y), 0).r;
+        d = texelFetch(planes[2], ivec2(second.x, second.y), 0).r;
+    }
+    return mix(mix(a, b, wx), mix(c, d, wx), wy);
+}
+
+void main()
+{
+    vec2 pixel = floor(gl_FragCoord.xy);
+    float y = sampleComponent(0, pixel);
+    if (components == 1)
+    {
+        FragColor = vec4(y, y, y, 1.0);
+        return;
+    }
+    
+    float cb = sampleComponent(1, pixel);
+    float cr = sampleComponent(2, pixel);
+    if (isRgb)
+    {
+        FragColor = vec4(y, cb, cr, 1.0);
+        return;
+    }
+    
+    cb -= 128.0 / 255.0;
+    cr -= 128.0 / 255.0;
+    FragColor = vec4(clamp(vec3(y + 1.40200 * cr,
+                                y - 0.34414 * cb - 0.71414 * cr,
+                                y + 1.77200 * cb), 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,27 @@
+#version 410 core
+
+// First half of the IDCT: dequantize and transform each block's columns.
+// Output texel (bx*8 + u, by*8 + y) holds frequency u at pixel row y
+
+out float Column;
+
+uniform isamplerBuffer coefficients; // 64 a block, row-major, blocks row-major
+uniform int blocksWide;
+uniform int quant[64];
+uniform float basis[64];             // basis[n*8 + k] = C(k)/2 * cos((2n + 1)k pi/16)
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    int u = p.x & 7;
+    int y = p.y & 7;
+    int first = ((p.y >> 3) * blocksWide + (p.x >> 3)) * 64 + u;
+    
+    float sum = 0.0;
+    for (int v = 0; v < 8; ++v)
+    {
+        int coefficient = texelFetch(coefficients, first + v * 8).r * quant[v * 8 + u];
+        sum += basis[y * 8 + v] * float(coefficient);
+    }
+    Column = sum;
+}
@@ -0,0 +1,21 @@
+#version 410 core
+
+// Second half of the IDCT: transform the rows and level shift to 8-bit samples
+
+out float Sample;
+
+uniform sampler2D columns;
+uniform float basis[64];
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    int first = p.x & ~7;
+    int x = p.x & 7;
+    
+    float sum = 0.0;
+    for (int u = 0; u < 8; ++u)
+        sum += basis[x * 8 + u] * texelFetch(columns, ivec2(first + u, p.y), 0).r;
+    // stored as unorm, so round to the sample stb_image would produce
+    Sample = clamp(floor(sum + 128.5), 0.0, 255.0) / 255.0;
+}
@@ -0,0 +1,54 @@
+#version 410 core
+
+// One mip level from the level above, where there are no compute shaders:
+// the filters of mipGenerate.comp a level a pass. The level above is the
+// texture's only level while this runs
+
+out vec4 FragColor;
+
+uniform sampler2D source;
+uniform ivec2 sourceSize;
+uniform bool kaiser;
+uniform float kaiserWeights[12];
+uniform bool decode;        // the texels read are sRGB values to linearize
+uniform bool encode;        // the level is stored as sRGB values
+
+vec3 toLinear(vec3 c)
+{
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+vec3 toSrgb(vec3 c)
+{
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, greaterThan(c, vec3(0.0031308)));
+}
+
+vec4 fetch(ivec2 p)
+{
+    vec4 value = texelFetch(source, clamp(p, ivec2(0), sourceSize - 1), 0);
+    if (decode) value.rgb = toLinear(value.rgb);
+    return value;
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 value = vec4(0.0);
+    if (kaiser)
+    {
+        for (int y = 0; y < 12; ++y)
+        {
+            vec4 row = vec4(0.0);
+            for (int x = 0; x < 12; ++x)
+                row += kaiserWeights[x] * fetch(2 * p + ivec2(x - 5, y - 5));
+            value += kaiserWeights[y] * row;
+        }
+        value = max(value, vec4(0.0));
+    }
+    else
+    {
+        value = 0.25 * (fetch(2 * p) + fetch(2 * p + ivec2(1, 0)) + fetch(2 * p + ivec2(0, 1)) + fetch(2 * p + ivec2(1, 1)));
+    }
+    if (encode) value.rgb = toSrgb(clamp(value.rgb, 0.0, 1.0));
+    FragColor = value;
+}
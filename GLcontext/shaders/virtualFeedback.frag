@@ -0,0 +1,30 @@
+#version 410 core
+
+// Which virtual texture tile each pixel needs: its page and level, as
+// virtualTexture.frag would pick them at full resolution. Rendered into a
+// smaller target, so the level is biased back by how much smaller, and the
+// point looked at moves around the pixel from frame to frame so the pages
+// between pixel centres get seen too
+
+out uvec4 Feedback;
+
+in vec3 ourColor;
+in vec2 TexCoord;
+
+uniform vec2 imageScale;
+uniform float virtualSize;
+uniform float tileSize;
+uniform float maxLevel;
+uniform float feedbackBias;     // log2 of how much smaller the target is
+uniform vec2 feedbackJitter;    // this frame's offset within the pixel, -0.5 to 0.5
+
+void main()
+{
+    vec2 texel = TexCoord * imageScale * virtualSize;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    texel = clamp(texel + dx * feedbackJitter.x + dy * feedbackJitter.y, vec2(0.0), imageScale * virtualSize);
+    float level = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0)) - feedbackBias), 0.0, maxLevel);
+
+    uvec2 page = min(uvec2(texel / (tileSize * exp2(level))), uvec2(virtualSize / tileSize / exp2(level)) - 1u);
+    Feedback = uvec4(page, uint(level), 1u);
+}
@@ -0,0 +1,32 @@
+#version 410 core
+
+// fragShader.frag through a virtual texture: the page table says where in
+// the tile cache the finest resident tile over TexCoord is
+
+out vec4 FragColor;
+
+in vec3 ourColor;
+in vec2 TexCoord;
+
+uniform sampler2D pageTable;    // per page: tile cache slot, level of the tile there
+uniform sampler2D tileCache;
+uniform vec2 imageScale;        // image size / virtual size
+uniform float virtualSize;      // texels across level 0, a power of two of tiles
+uniform float tileSize;
+uniform float tileBorder;
+uniform float cacheSize;        // texels across the tile cache
+uniform float maxLevel;
+
+void main()
+{
+    vec2 texel = clamp(TexCoord, 0.0, 1.0) * imageScale * virtualSize;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float level = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0))), 0.0, maxLevel);
+
+    ivec2 page = min(ivec2(texel / (tileSize * exp2(level))), ivec2(virtualSize / tileSize / exp2(level)) - 1);
+    vec4 entry = floor(texelFetch(pageTable, page, int(level)) * 255.0 + 0.5);
+    vec2 position = texel / exp2(entry.z);
+    vec2 inTile = position - floor(position / tileSize) * tileSize;
+    vec2 physical = entry.xy * (tileSize + 2.0 * tileBorder) + tileBorder + inTile;
+    FragColor = textureLod(tileCache, physical / cacheSize, 0.0);
+}
@@ -163,6 +163,114 @@
 //
 // ===========================================================================
 //
+// Decoding into your own memory
+//
+// stbi_load_into() and friends decode into a buffer you provide instead of
+// one allocated by stb_image, e.g. a mapped pixel buffer object or a staging
+// area. Query the size first, then decode:
+//
+//    int x,y,n;
+//    stbi_info(filename, &x, &y, &n);
+//    // ... stride >= x*4, buffer holds at least (y-1)*stride + x*4 bytes ...
+//    stbi_load_into(filename, buffer, buffer_len, stride, &x, &y, &n, 4);
+//
+// Pass desired_channels explicitly so the buffer size is known up front.
+// JPEG and 8-bit non-interlaced PNG decode straight into the destination;
+// other formats are decoded to a temporary and copied. The call fails with
+// "buffer too small" rather than write past out_len.
+//
+// ===========================================================================
+//
+// Streaming decode
+//
+// stbi_load_rows() and friends never build the whole image; finished rows
+// are handed to a callback as soon as they are decoded, so you can upload or
+// tile them and throw them away:
+//
+//    int on_rows(void *user, stbi_uc const *rows, int y, int num_rows, int stride)
+//    {
+//       // 'rows' is image row y; row y+i is at rows + i*stride
+//       return 1; // or 0 to stop decoding
+//    }
+//    ...
+//    stbi_load_rows(filename, &x, &y, &n, 4, on_rows, user);
+//
+// x, y and n are filled in before the first callback. Rows arrive in file
+// order; with stbi_set_flip_vertically_on_load() they arrive bottom-up and
+// the stride is negative. The row pointer is only valid during the call.
+//
+// Memory use:
+//    - baseline JPEG: a few MCU rows of the image width
+//    - progressive JPEG: the coefficients (2 bytes/sample), no pixel planes
+//    - non-interlaced PNG: the compressed data plus a 96KB inflate window
+//    - everything else decodes the full image and delivers it as one band
+//
+// ===========================================================================
+//
+// Region decode
+//
+// stbi_load_region() and friends return just a rectangle of the image, for
+// pulling tiles out of pictures too big to decode whole:
+//
+//    data = stbi_load_region(filename, left, top, width, height, &x, &y, &n, 0);
+//
+// The rectangle is in output coordinates (so after any vertical flip) and
+// is clipped to the image; x and y get its clipped size. The result is the
+// same as cropping stbi_load()'s. Work saved:
+//    - baseline JPEG: MCUs outside the rectangle are entropy decoded but not
+//      idct'd or color converted, and decoding stops below it. With restart
+//      markers, intervals that don't touch it aren't even entropy decoded
+//    - progressive JPEG: every scan is still read; only the idct is saved
+//    - non-interlaced PNG: inflating stops after the last row
+//    - everything else decodes the full image
+//
+// ===========================================================================
+//
+// Threads
+//
+// Any number of threads can decode at once. stbi_failure_reason() reports
+// the last failure on the calling thread. The setters below
+//
+//    stbi_set_flip_vertically_on_load, stbi_set_unpremultiply_on_load,
+//    stbi_convert_iphone_png_to_rgb, stbi_hdr_to_ldr_gamma/_scale,
+//    stbi_ldr_to_hdr_gamma/_scale
+//
+// change process-wide defaults. Calling them while other threads decode is
+// safe, but which of those decodes see the change is unspecified, so it's
+// still best to set them up front. Each also has a _thread version that
+// overrides the default on the calling thread only. To pick settings per
+// call instead, fill in a stbi_load_options and use the _ex version of a
+// loader; the allocator and jpeg_scale can only be chosen this way:
+//
+//    stbi_load_options opt;
+//    stbi_load_options_default(&opt); // this thread's current settings
+//    opt.flip_vertically = 1;
+//    data = stbi_load_from_memory_ex(buffer, len, &x, &y, &n, 4, &opt);
+//
+// Thread-local storage needs C11, C++11, or the GCC/Clang/MSVC extensions;
+// without it (or with STBI_NO_THREAD_LOCALS) the failure reason is shared
+// and the _thread setters change the process-wide default.
+//
+// ===========================================================================
+//
+// Working memory
+//
+// Besides the image it returns, a decoder needs scratch memory: JPEG
+// component planes, the compressed and inflated PNG data, and so on. By
+// default this comes from a per-thread arena that is emptied when each
+// decode finishes, so a thread loading many images keeps reusing the same
+// few blocks instead of going back to malloc every time. Up to
+// STBI_ARENA_KEEP bytes (default 4MB) stay cached between images; call
+// stbi_thread_arena_free() before a thread exits to give them back, or
+// #define STBI_ARENA_KEEP 0 to cache nothing. Without thread-local storage
+// scratch memory comes straight from STBI_MALLOC.
+//
+// To supply your own, point stbi_load_options.allocator at a stbi_allocator.
+// Returned images always come from STBI_MALLOC either way, so
+// stbi_image_free() doesn't change.
+//
+// ===========================================================================
+//
 // UNICODE:
 //
 //   If compiling for Windows and you wish to use Unicode filenames, compile
@@ -173,6 +281,21 @@
 //
 // ===========================================================================
 //
+// Reduced-size JPEG
+//
+// Set stbi_load_options.jpeg_scale to 2, 4 or 8 and a JPEG comes back at
+// 1/2, 1/4 or 1/8 of its size (rounded up), for previews and small mip
+// levels. Each 8x8 block goes through a 4x4, 2x2 or DC-only inverse DCT
+// instead of the full one, so the idct, upsampling, color conversion and
+// planes all shrink with the output; only the entropy decode costs the
+// same. Each reduced pixel is the average of the ones a full decode makes
+// there, as with libjpeg's scaled decodes. Chroma subsampled equally both
+// ways (4:2:0) decodes with a bigger idct instead of being upsampled, e.g.
+// 2x2 at 1/8. *x and *y report the reduced size; stbi_info still reports
+// the full one. Other formats ignore the setting.
+//
+// ===========================================================================
+//
 // Philosophy
 //
 // stb libraries are designed with the following priorities:
@@ -360,6 +483,37 @@ extern "C" {
         int      (*eof)   (void *user);                       // returns nonzero if we are at end of file/data
     } stbi_io_callbacks;
     
+    // scratch memory for one decode; see "Working memory" above. 'resize' is
+    // given the old size, and 'release' may be a no-op if the memory is
+    // reclaimed some other way once the load returns
+    typedef struct
+    {
+        void *(*alloc)  (void *user, size_t size);
+        void *(*resize) (void *user, void *p, size_t old_size, size_t new_size);
+        void  (*release)(void *user, void *p);
+        void  *user;
+    } stbi_allocator;
+    
+    // decoder settings for one call; see "Threads" above
+    typedef struct
+    {
+        int   flip_vertically;     // stbi_set_flip_vertically_on_load
+        int   unpremultiply;       // stbi_set_unpremultiply_on_load
+        int   convert_iphone_png;  // stbi_convert_iphone_png_to_rgb
+        float hdr_to_ldr_gamma;    // stbi_hdr_to_ldr_gamma
+        float hdr_to_ldr_scale;    // stbi_hdr_to_ldr_scale
+        float ldr_to_hdr_gamma;    // stbi_ldr_to_hdr_gamma
+        float ldr_to_hdr_scale;    // stbi_ldr_to_hdr_scale
+        stbi_allocator const *allocator; // scratch memory; NULL for the thread's arena
+        int   jpeg_scale;          // JPEG only: 2, 4 or 8 decodes at 1/n size; 0 or 1 full size
+    } stbi_load_options;
+    
+    // fill 'opt' with the settings a plain stbi_load would use on this thread
+    STBIDEF void stbi_load_options_default(stbi_load_options *opt);
+    
+    // free the scratch memory this thread's arena is holding on to
+    STBIDEF void stbi_thread_arena_free(void);
+    
     ////////////////////////////////////
     //
     // 8-bits-per-channel interface
@@ -374,10 +528,125 @@ extern "C" {
     // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
     
+    // as above, with settings from 'opt' instead of the defaults
+    STBIDEF stbi_uc *stbi_load_from_memory_ex   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_uc *stbi_load_ex            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_uc *stbi_load_from_file_ex  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+#endif
+
 #ifndef STBI_NO_GIF
     STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
+
+    ////////////////////////////////////
+    //
+    // 8-bits-per-channel interface, decoding into caller-provided memory
+    //
+    // 'out' is 'out_len' bytes; rows are written 'out_stride' bytes apart
+    // (0 means tightly packed). returns 1 on success, 0 on failure.
+    
+    STBIDEF int stbi_load_into_from_memory   (stbi_uc           const *buffer, int len   , stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk  , void *user, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_into            (char const *filename, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF int stbi_load_into_from_file  (FILE *f, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+    STBIDEF int stbi_load_into_from_memory_ex   (stbi_uc           const *buffer, int len   , stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF int stbi_load_into_from_callbacks_ex(stbi_io_callbacks const *clbk  , void *user, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_into_ex            (char const *filename, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF int stbi_load_into_from_file_ex  (FILE *f, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+#endif
+
+    ////////////////////////////////////
+    //
+    // 8-bits-per-channel interface, streaming rows to a callback
+    //
+    // returns 1 on success, 0 on failure or if the callback returned 0.
+    
+    typedef int (*stbi_row_callback)(void *user, stbi_uc const *rows, int y, int num_rows, int stride);
+    
+    STBIDEF int stbi_load_rows_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user);
+    STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_rows            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user);
+    STBIDEF int stbi_load_rows_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user);
+#endif
+
+    STBIDEF int stbi_load_rows_from_memory_ex   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt);
+    STBIDEF int stbi_load_rows_from_callbacks_ex(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF int stbi_load_rows_ex            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt);
+    STBIDEF int stbi_load_rows_from_file_ex  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt);
+#endif
+
+    ////////////////////////////////////
+    //
+    // 8-bits-per-channel interface, decoding a rectangle of the image
+    //
+    // the rectangle is clipped to the image and *x, *y report its clipped
+    // size. returns NULL if nothing of it is inside the image.
+    
+    STBIDEF stbi_uc *stbi_load_region_from_memory   (stbi_uc           const *buffer, int len   , int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_uc *stbi_load_region_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_uc *stbi_load_region            (char const *filename, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF stbi_uc *stbi_load_region_from_file  (FILE *f, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+    STBIDEF stbi_uc *stbi_load_region_from_memory_ex   (stbi_uc           const *buffer, int len   , int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_uc *stbi_load_region_from_callbacks_ex(stbi_io_callbacks const *clbk  , void *user, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_uc *stbi_load_region_ex            (char const *filename, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_uc *stbi_load_region_from_file_ex  (FILE *f, int left, int top, int width, int height, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+#endif
+
+    ////////////////////////////////////
+    //
+    // JPEG coefficient interface: entropy decoding only
+    //
+    // dequantization, IDCT, upsampling and color conversion are left to the
+    // caller (e.g. a GPU). returns 1 on success, 0 on failure; CMYK files
+    // are not supported. free the result with stbi_jpeg_coefficients_free.
     
+    typedef struct
+    {
+        int h, v;                 // sampling factors
+        int width, height;        // pixels in this component, before upsampling
+        int blocks_w, blocks_h;   // 8x8 blocks stored, padded out to whole MCUs
+        short *coeff;             // blocks_w*blocks_h blocks of 64, row-major within the block, not dequantized
+        stbi_us quant[64];        // quantization table, row-major
+    } stbi_jpeg_component;
+    
+    typedef struct
+    {
+        int width, height;
+        int components;           // 1 or 3
+        int h_max, v_max;         // largest sampling factors
+        int is_rgb;               // 3 components stored as RGB rather than YCbCr
+        stbi_jpeg_component comp[3];
+    } stbi_jpeg_coefficients;
+    
+    STBIDEF int  stbi_jpeg_coefficients_from_memory   (stbi_uc           const *buffer, int len   , stbi_jpeg_coefficients *out);
+    STBIDEF int  stbi_jpeg_coefficients_from_callbacks(stbi_io_callbacks const *clbk  , void *user, stbi_jpeg_coefficients *out);
+
+#ifndef STBI_NO_STDIO
+    STBIDEF int  stbi_jpeg_coefficients_load          (char const *filename, stbi_jpeg_coefficients *out);
+    STBIDEF int  stbi_jpeg_coefficients_from_file     (FILE *f, stbi_jpeg_coefficients *out);
+#endif
+
+    STBIDEF void stbi_jpeg_coefficients_free(stbi_jpeg_coefficients *c);
+
 #ifdef STBI_WINDOWS_UTF8
     STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -395,6 +664,14 @@ extern "C" {
     STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
 #endif
     
+    STBIDEF stbi_us *stbi_load_16_from_memory_ex   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_us *stbi_load_16_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    
+#ifndef STBI_NO_STDIO
+    STBIDEF stbi_us *stbi_load_16_ex          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF stbi_us *stbi_load_from_file_16_ex(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+#endif
+    
     ////////////////////////////////////
     //
     // float-per-channel interface
@@ -402,21 +679,29 @@ extern "C" {
 #ifndef STBI_NO_LINEAR
     STBIDEF float *stbi_loadf_from_memory     (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
     STBIDEF float *stbi_loadf_from_callbacks  (stbi_io_callbacks const *clbk, void *user, int *x, int *y,  int *channels_in_file, int desired_channels);
+    STBIDEF float *stbi_loadf_from_memory_ex  (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF float *stbi_loadf_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
     
 #ifndef STBI_NO_STDIO
     STBIDEF float *stbi_loadf            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
     STBIDEF float *stbi_loadf_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
+    STBIDEF float *stbi_loadf_ex         (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
+    STBIDEF float *stbi_loadf_from_file_ex(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt);
 #endif
 #endif
     
 #ifndef STBI_NO_HDR
     STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma);
     STBIDEF void   stbi_hdr_to_ldr_scale(float scale);
+    STBIDEF void   stbi_hdr_to_ldr_gamma_thread(float gamma);
+    STBIDEF void   stbi_hdr_to_ldr_scale_thread(float scale);
 #endif // STBI_NO_HDR
     
 #ifndef STBI_NO_LINEAR
     STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma);
     STBIDEF void   stbi_ldr_to_hdr_scale(float scale);
+    STBIDEF void   stbi_ldr_to_hdr_gamma_thread(float gamma);
+    STBIDEF void   stbi_ldr_to_hdr_scale_thread(float scale);
 #endif // STBI_NO_LINEAR
     
     // stbi_is_hdr is always defined, but always returns false if STBI_NO_HDR
@@ -428,8 +713,7 @@ extern "C" {
 #endif // STBI_NO_STDIO
     
     
-    // get a VERY brief reason for failure
-    // NOT THREADSAFE
+    // get a VERY brief reason for the last failure on this thread
     STBIDEF const char *stbi_failure_reason  (void);
     
     // free the loaded image -- this is just free()
@@ -462,6 +746,11 @@ extern "C" {
     // flip the image vertically, so the first pixel in the output array is the bottom left
     STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
     
+    // as above, for the calling thread only
+    STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
+    STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
+    STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+    
     // ZLIB client - used by PNG, available for other purposes
     
     STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -547,6 +836,20 @@ extern "C" {
 #define STBI_EXTERN extern
 #endif
 
+#ifndef STBI_NO_THREAD_LOCALS
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define STBI_THREAD_LOCAL thread_local
+#elif defined(__GNUC__) && __GNUC__ < 5
+#define STBI_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define STBI_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define STBI_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define STBI_THREAD_LOCAL __thread
+#endif
+#endif
+
 
 #ifndef _MSC_VER
 #ifdef __cplusplus
@@ -609,6 +912,15 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #define STBI_REALLOC_SIZED(p,oldsz,newsz) STBI_REALLOC(p,newsz)
 #endif
 
+// profiling hooks around the decoders' inner stages: entropy, idct,
+// upsample, convert (JPEG) and inflate, unfilter (PNG). a profiler can
+// define both to time them; stages may nest (unfilter runs inside inflate
+// when streaming)
+#ifndef STBI_PROFILE_BEGIN
+#define STBI_PROFILE_BEGIN(stage) ((void) 0)
+#define STBI_PROFILE_END(stage)   ((void) 0)
+#endif
+
 // x86/x64 detection
 #if defined(__x86_64__) || defined(_M_X64)
 #define STBI__X64_TARGET
@@ -671,7 +983,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
     int info3 = stbi__cpuid3();
@@ -682,7 +994,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_HDR)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
     // If we're even attempting to compile this on GCC/Clang, that means
@@ -730,6 +1042,21 @@ typedef struct
     
     stbi_uc *img_buffer, *img_buffer_end;
     stbi_uc *img_buffer_original, *img_buffer_original_end;
+    
+    // caller-provided output for stbi_load_into, or NULL
+    stbi_uc *out_user;
+    size_t out_user_len;
+    int out_user_stride;
+    
+    // row consumer for stbi_load_rows, or NULL
+    struct stbi__row_sink *row_sink;
+    
+    // settings for this call
+    stbi_load_options opt;
+    
+    // where scratch memory comes from while a decode is running
+    stbi_allocator const *work;
+    int work_nest;
 } stbi__context;
 
 
@@ -740,6 +1067,11 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
     s->io.read = NULL;
     s->read_from_callbacks = 0;
+    s->out_user = NULL;
+    s->row_sink = NULL;
+    stbi_load_options_default(&s->opt);
+    s->work = NULL;
+    s->work_nest = 0;
     s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
     s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -751,6 +1083,11 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
     s->io_user_data = user;
     s->buflen = sizeof(s->buffer_start);
     s->read_from_callbacks = 1;
+    s->out_user = NULL;
+    s->row_sink = NULL;
+    stbi_load_options_default(&s->opt);
+    s->work = NULL;
+    s->work_nest = 0;
     s->img_buffer_original = s->buffer_start;
     stbi__refill_buffer(s);
     s->img_buffer_original_end = s->img_buffer_end;
@@ -815,6 +1152,8 @@ typedef struct
 static int      stbi__jpeg_test(stbi__context *s);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
+static int      stbi__jpeg_load_rows(stbi__context *s, int req_comp);
+static int      stbi__jpeg_load_coefficients(stbi__context *s, stbi_jpeg_coefficients *out);
 #endif
 
 #ifndef STBI_NO_PNG
@@ -822,6 +1161,8 @@ static int      stbi__png_test(stbi__context *s);
 static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__png_info(stbi__context *s, int *x, int *y, int *comp);
 static int      stbi__png_is16(stbi__context *s);
+static int      stbi__png_can_stream(stbi__context *s);
+static int      stbi__png_load_rows(stbi__context *s, int req_comp);
 #endif
 
 #ifndef STBI_NO_BMP
@@ -868,8 +1209,12 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
-// this is not threadsafe
-static const char *stbi__g_failure_reason;
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL
+#else
+static
+#endif
+const char *stbi__g_failure_reason;
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -942,11 +1287,13 @@ static int stbi__mad4sizes_valid(int a, int b, int c, int d, int add)
 #endif
 
 // mallocs with size overflow checking
+#ifndef STBI_NO_PNG
 static void *stbi__malloc_mad2(int a, int b, int add)
 {
     if (!stbi__mad2sizes_valid(a, b, add)) return NULL;
     return stbi__malloc(a*b + add);
 }
+#endif
 
 static void *stbi__malloc_mad3(int a, int b, int c, int add)
 {
@@ -983,169 +1330,727 @@ STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 }
 
 #ifndef STBI_NO_LINEAR
-static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
+static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp, stbi_load_options const *opt);
 #endif
 
 #ifndef STBI_NO_HDR
-static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
+static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp, stbi_load_options const *opt);
 #endif
 
-static int stbi__vertically_flip_on_load = 0;
-
-STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
+// the legacy setters store each setting as an int (floats by their bits)
+// plus a bit saying it has been set. The process-wide copy is read and
+// written atomically, so a setter racing a decode on another thread is
+// harmless; a thread's own overrides sit in thread-local storage
+enum
 {
-    stbi__vertically_flip_on_load = flag_true_if_should_flip;
-}
+    STBI__SET_unpremultiply,
+    STBI__SET_iphone,
+    STBI__SET_flip,
+    STBI__SET_hdr_to_ldr_gamma,
+    STBI__SET_hdr_to_ldr_scale,
+    STBI__SET_ldr_to_hdr_gamma,
+    STBI__SET_ldr_to_hdr_scale,
+    STBI__SET_count
+};
 
-static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
-{
-    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
-    ri->bits_per_channel = 8; // default is 8 so most paths don't have to be changed
-    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
-    ri->num_channels = 0;
-    
-#ifndef STBI_NO_JPEG
-    if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri);
-#endif
-#ifndef STBI_NO_PNG
-    if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri);
-#endif
-#ifndef STBI_NO_BMP
-    if (stbi__bmp_test(s))  return stbi__bmp_load(s,x,y,comp,req_comp, ri);
-#endif
-#ifndef STBI_NO_GIF
-    if (stbi__gif_test(s))  return stbi__gif_load(s,x,y,comp,req_comp, ri);
-#endif
-#ifndef STBI_NO_PSD
-    if (stbi__psd_test(s))  return stbi__psd_load(s,x,y,comp,req_comp, ri, bpc);
-#endif
-#ifndef STBI_NO_PIC
-    if (stbi__pic_test(s))  return stbi__pic_load(s,x,y,comp,req_comp, ri);
-#endif
-#ifndef STBI_NO_PNM
-    if (stbi__pnm_test(s))  return stbi__pnm_load(s,x,y,comp,req_comp, ri);
-#endif
-    
-#ifndef STBI_NO_HDR
-    if (stbi__hdr_test(s)) {
-        float *hdr = stbi__hdr_load(s, x,y,comp,req_comp, ri);
-        return stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
-    }
+static const stbi_load_options stbi__default_options = { 0, 0, 0, 2.2f, 1.0f, 2.2f, 1.0f, NULL, 0 };
+
+#if defined(__GNUC__) || defined(__clang__)
+#define stbi__atomic_load(p)    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define stbi__atomic_store(p,v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define stbi__atomic_or(p,v)    __atomic_fetch_or(p, v, __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+// volatile accesses have acquire/release semantics under /volatile:ms
+#define stbi__atomic_load(p)    (*(int volatile *) (p))
+#define stbi__atomic_store(p,v) (*(int volatile *) (p) = (v))
+#define stbi__atomic_or(p,v)    _InterlockedOr((long volatile *) (p), v)
+#else
+#define stbi__atomic_load(p)    (*(p))
+#define stbi__atomic_store(p,v) (*(p) = (v))
+#define stbi__atomic_or(p,v)    (*(p) |= (v))
 #endif
-    
-#ifndef STBI_NO_TGA
-    // test tga last because it's a crappy test!
-    if (stbi__tga_test(s))
-    return stbi__tga_load(s,x,y,comp,req_comp, ri);
+
+static int stbi__global_set;
+static int stbi__global_settings[STBI__SET_count];
+
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL int stbi__thread_set;
+static STBI_THREAD_LOCAL int stbi__thread_settings[STBI__SET_count];
 #endif
-    
-    return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
-}
 
-static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
+static int stbi__float_bits(float f)
 {
     int i;
-    int img_len = w * h * channels;
-    stbi_uc *reduced;
-    
-    reduced = (stbi_uc *) stbi__malloc(img_len);
-    if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
-    
-    for (i = 0; i < img_len; ++i)
-    reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
-    
-    STBI_FREE(orig);
-    return reduced;
+    memcpy(&i, &f, sizeof(i));
+    return i;
 }
 
-static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
+static float stbi__bits_float(int i)
 {
-    int i;
-    int img_len = w * h * channels;
-    stbi__uint16 *enlarged;
-    
-    enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
-    if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
-    
-    for (i = 0; i < img_len; ++i)
-    enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
-    
-    STBI_FREE(orig);
-    return enlarged;
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
 }
 
-static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
+static void stbi__apply_settings(stbi_load_options *opt, int set, int const *value)
 {
-    int row;
-    size_t bytes_per_row = (size_t)w * bytes_per_pixel;
-    stbi_uc temp[2048];
-    stbi_uc *bytes = (stbi_uc *)image;
-    
-    for (row = 0; row < (h>>1); row++) {
-        stbi_uc *row0 = bytes + row*bytes_per_row;
-        stbi_uc *row1 = bytes + (h - row - 1)*bytes_per_row;
-        // swap row0 with row1
-        size_t bytes_left = bytes_per_row;
-        while (bytes_left) {
-            size_t bytes_copy = (bytes_left < sizeof(temp)) ? bytes_left : sizeof(temp);
-            memcpy(temp, row0, bytes_copy);
-            memcpy(row0, row1, bytes_copy);
-            memcpy(row1, temp, bytes_copy);
-            row0 += bytes_copy;
-            row1 += bytes_copy;
-            bytes_left -= bytes_copy;
-        }
-    }
+    if (set & (1 << STBI__SET_unpremultiply))    opt->unpremultiply      = value[STBI__SET_unpremultiply];
+    if (set & (1 << STBI__SET_iphone))           opt->convert_iphone_png = value[STBI__SET_iphone];
+    if (set & (1 << STBI__SET_flip))             opt->flip_vertically    = value[STBI__SET_flip];
+    if (set & (1 << STBI__SET_hdr_to_ldr_gamma)) opt->hdr_to_ldr_gamma   = stbi__bits_float(value[STBI__SET_hdr_to_ldr_gamma]);
+    if (set & (1 << STBI__SET_hdr_to_ldr_scale)) opt->hdr_to_ldr_scale   = stbi__bits_float(value[STBI__SET_hdr_to_ldr_scale]);
+    if (set & (1 << STBI__SET_ldr_to_hdr_gamma)) opt->ldr_to_hdr_gamma   = stbi__bits_float(value[STBI__SET_ldr_to_hdr_gamma]);
+    if (set & (1 << STBI__SET_ldr_to_hdr_scale)) opt->ldr_to_hdr_scale   = stbi__bits_float(value[STBI__SET_ldr_to_hdr_scale]);
 }
 
-#ifndef STBI_NO_GIF
-static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
+static void stbi__set_global(int which, int value)
 {
-    int slice;
-    int slice_size = w * h * bytes_per_pixel;
-    
-    stbi_uc *bytes = (stbi_uc *)image;
-    for (slice = 0; slice < z; ++slice) {
-        stbi__vertical_flip(bytes, w, h, bytes_per_pixel);
-        bytes += slice_size;
-    }
+    stbi__atomic_store(&stbi__global_settings[which], value);
+    stbi__atomic_or(&stbi__global_set, 1 << which);
+}
+
+#ifdef STBI_THREAD_LOCAL
+static void stbi__set_thread(int which, int value)
+{
+    stbi__thread_settings[which] = value;
+    stbi__thread_set |= 1 << which;
 }
+#else
+// no thread-local storage: there is only the process-wide setting
+#define stbi__set_thread stbi__set_global
 #endif
 
-static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+STBIDEF void stbi_load_options_default(stbi_load_options *opt)
 {
-    stbi__result_info ri;
-    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
-    
-    if (result == NULL)
-    return NULL;
-    
-    if (ri.bits_per_channel != 8) {
-        STBI_ASSERT(ri.bits_per_channel == 16);
-        result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
-        ri.bits_per_channel = 8;
-    }
-    
-    // @TODO: move stbi__convert_format to here
-    
-    if (stbi__vertically_flip_on_load) {
-        int channels = req_comp ? req_comp : *comp;
-        stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
-    }
-    
-    return (unsigned char *) result;
+    int i, global[STBI__SET_count];
+    int set = stbi__atomic_load(&stbi__global_set);
+    for (i=0; i < STBI__SET_count; ++i)
+    global[i] = (set & (1 << i)) ? stbi__atomic_load(&stbi__global_settings[i]) : 0;
+    *opt = stbi__default_options;
+    stbi__apply_settings(opt, set, global);
+#ifdef STBI_THREAD_LOCAL
+    stbi__apply_settings(opt, stbi__thread_set, stbi__thread_settings);
+#endif
 }
 
-static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
-    stbi__result_info ri;
-    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
-    
-    if (result == NULL)
-    return NULL;
-    
-    if (ri.bits_per_channel != 16) {
-        STBI_ASSERT(ri.bits_per_channel == 8);
+    stbi__set_global(STBI__SET_flip, flag_true_if_should_flip);
+}
+
+STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
+{
+    stbi__set_global(STBI__SET_unpremultiply, flag_true_if_should_unpremultiply);
+}
+
+STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
+{
+    stbi__set_global(STBI__SET_iphone, flag_true_if_should_convert);
+}
+
+STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip)
+{
+    stbi__set_thread(STBI__SET_flip, flag_true_if_should_flip);
+}
+
+STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply)
+{
+    stbi__set_thread(STBI__SET_unpremultiply, flag_true_if_should_unpremultiply);
+}
+
+STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert)
+{
+    stbi__set_thread(STBI__SET_iphone, flag_true_if_should_convert);
+}
+
+// scratch memory straight from the heap
+static void *stbi__heap_alloc(void *user, size_t size)
+{
+    STBI_NOTUSED(user);
+    return STBI_MALLOC(size);
+}
+
+static void *stbi__heap_resize(void *user, void *p, size_t old_size, size_t new_size)
+{
+    STBI_NOTUSED(user);
+    STBI_NOTUSED(old_size);
+    return STBI_REALLOC_SIZED(p, old_size, new_size);
+}
+
+static void stbi__heap_release(void *user, void *p)
+{
+    STBI_NOTUSED(user);
+    STBI_FREE(p);
+}
+
+static stbi_allocator const stbi__heap_allocator = { stbi__heap_alloc, stbi__heap_resize, stbi__heap_release, NULL };
+
+#ifdef STBI_THREAD_LOCAL
+#ifndef STBI_ARENA_KEEP
+#define STBI_ARENA_KEEP  (4 << 20)
+#endif
+#define STBI__ARENA_MIN  (64 << 10)
+
+// the arena is a stack of blocks; allocations are bumped off the newest
+// one and each is preceded by its size, padded to keep 16-byte alignment
+typedef struct stbi__arena_block
+{
+    struct stbi__arena_block *next;
+    size_t size, used;
+} stbi__arena_block;
+
+#define STBI__ARENA_PAD(n)     (((n) + 15) & ~(size_t) 15)
+#define STBI__ARENA_HEADER     STBI__ARENA_PAD(sizeof(stbi__arena_block))
+#define STBI__ARENA_DATA(b)    ((stbi_uc *) (b) + STBI__ARENA_HEADER)
+
+typedef struct
+{
+    stbi__arena_block *head;
+    int nest; // decodes in progress on this thread
+} stbi__arena;
+
+static STBI_THREAD_LOCAL stbi__arena stbi__thread_arena;
+
+static void *stbi__arena_alloc(void *user, size_t size)
+{
+    stbi__arena_block *b = stbi__thread_arena.head;
+    size_t need = 16 + STBI__ARENA_PAD(size);
+    stbi_uc *p;
+    STBI_NOTUSED(user);
+    if (need < size) return NULL;
+    if (b == NULL || b->size - b->used < need) {
+        // double the block size each time so a thread that keeps decoding
+        // similar images settles on one block big enough for all of it
+        size_t block_size = b ? b->size * 2 : STBI__ARENA_MIN;
+        if (block_size > STBI_ARENA_KEEP) block_size = STBI_ARENA_KEEP;
+        if (block_size < need) block_size = need;
+        if (block_size + STBI__ARENA_HEADER < block_size) return NULL;
+        b = (stbi__arena_block *) STBI_MALLOC(STBI__ARENA_HEADER + block_size);
+        if (b == NULL) return NULL;
+        b->next = stbi__thread_arena.head;
+        b->size = block_size;
+        b->used = 0;
+        stbi__thread_arena.head = b;
+    }
+    p = STBI__ARENA_DATA(b) + b->used;
+    *(size_t *) p = size;
+    b->used += need;
+    return p + 16;
+}
+
+// if p was the last allocation, return how much of the head block is used
+// without it; otherwise (size_t) -1
+static size_t stbi__arena_below(void *p)
+{
+    stbi__arena_block *b = stbi__thread_arena.head;
+    stbi_uc *q = (stbi_uc *) p - 16;
+    if (b == NULL || q < STBI__ARENA_DATA(b) || q >= STBI__ARENA_DATA(b) + b->used) return (size_t) -1;
+    if (q + 16 + STBI__ARENA_PAD(*(size_t *) q) != STBI__ARENA_DATA(b) + b->used) return (size_t) -1;
+    return (size_t) (q - STBI__ARENA_DATA(b));
+}
+
+static void *stbi__arena_resize(void *user, void *p, size_t old_size, size_t new_size)
+{
+    size_t below;
+    void *q;
+    STBI_NOTUSED(old_size);
+    if (p == NULL) return stbi__arena_alloc(user, new_size);
+    old_size = *(size_t *) ((stbi_uc *) p - 16);
+    // the last allocation can grow in place
+    below = stbi__arena_below(p);
+    if (below != (size_t) -1) {
+        stbi__arena_block *b = stbi__thread_arena.head;
+        size_t need = 16 + STBI__ARENA_PAD(new_size);
+        if (need >= new_size && b->size - below >= need) {
+            *(size_t *) ((stbi_uc *) p - 16) = new_size;
+            b->used = below + need;
+            return p;
+        }
+    }
+    q = stbi__arena_alloc(user, new_size);
+    if (q == NULL) return NULL;
+    memcpy(q, p, old_size < new_size ? old_size : new_size);
+    return q;
+}
+
+// only the last allocation is actually given back; the rest goes when the
+// decode finishes
+static void stbi__arena_release(void *user, void *p)
+{
+    size_t below;
+    STBI_NOTUSED(user);
+    if (p == NULL) return;
+    below = stbi__arena_below(p);
+    if (below != (size_t) -1) stbi__thread_arena.head->used = below;
+}
+
+static stbi_allocator const stbi__arena_allocator = { stbi__arena_alloc, stbi__arena_resize, stbi__arena_release, NULL };
+
+// empty the arena, keeping the largest block that fits in STBI_ARENA_KEEP
+static void stbi__arena_reset(void)
+{
+    stbi__arena_block *b = stbi__thread_arena.head, *keep = NULL;
+    while (b) {
+        stbi__arena_block *next = b->next;
+        if (b->size <= STBI_ARENA_KEEP && (keep == NULL || b->size > keep->size)) {
+            if (keep) STBI_FREE(keep);
+            keep = b;
+        } else {
+            STBI_FREE(b);
+        }
+        b = next;
+    }
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    stbi__thread_arena.head = keep;
+}
+
+STBIDEF void stbi_thread_arena_free(void)
+{
+    stbi__arena_block *b = stbi__thread_arena.head;
+    if (stbi__thread_arena.nest) return; // called from inside a decode
+    while (b) {
+        stbi__arena_block *next = b->next;
+        STBI_FREE(b);
+        b = next;
+    }
+    stbi__thread_arena.head = NULL;
+}
+#else
+STBIDEF void stbi_thread_arena_free(void) {}
+#endif
+
+// pick the scratch allocator at the start of a decode. these nest, since
+// a float load goes through the 8-bit one, and a row callback may itself
+// start a decode on the same thread
+static void stbi__work_begin(stbi__context *s)
+{
+    if (s->work_nest++) return;
+    if (s->opt.allocator) {
+        s->work = s->opt.allocator;
+        return;
+    }
+#ifdef STBI_THREAD_LOCAL
+    s->work = &stbi__arena_allocator;
+    ++stbi__thread_arena.nest;
+#else
+    s->work = &stbi__heap_allocator;
+#endif
+}
+
+static void stbi__work_end(stbi__context *s)
+{
+    if (--s->work_nest) return;
+#ifdef STBI_THREAD_LOCAL
+    if (s->work == &stbi__arena_allocator && --stbi__thread_arena.nest == 0)
+    stbi__arena_reset();
+#endif
+    s->work = NULL;
+}
+
+static void *stbi__work_malloc(stbi__context *s, size_t size)
+{
+    return s->work->alloc(s->work->user, size);
+}
+
+static void stbi__work_free(stbi__context *s, void *p)
+{
+    if (p) s->work->release(s->work->user, p);
+}
+
+static void *stbi__work_malloc_mad2(stbi__context *s, int a, int b, int add)
+{
+    if (!stbi__mad2sizes_valid(a, b, add)) return NULL;
+    return stbi__work_malloc(s, a*b + add);
+}
+
+#if !defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)
+static void *stbi__work_malloc_mad3(stbi__context *s, int a, int b, int c, int add)
+{
+    if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
+    return stbi__work_malloc(s, a*b*c + add);
+}
+#endif
+
+// for stbi_load_into: resolve the default stride and check that a w*h*n
+// image fits in the caller's buffer
+static int stbi__out_user_fits(stbi__context *s, int w, int h, int n)
+{
+    size_t row_bytes = (size_t) w * n;
+    if (s->out_user_stride == 0) {
+        if (!stbi__mul2sizes_valid(w, n)) return stbi__err("too large", "Image too large to decode");
+        s->out_user_stride = w * n;
+    }
+    if ((size_t) s->out_user_stride < row_bytes) return stbi__err("bad stride", "Output stride smaller than a row");
+    if (h > 0 && (size_t) (h-1) * s->out_user_stride + row_bytes > s->out_user_len)
+    return stbi__err("buffer too small", "Output buffer too small for image");
+    return 1;
+}
+
+// for stbi_load_rows: the callback plus what it needs to know about the rows
+typedef struct stbi__row_sink
+{
+    stbi_row_callback cb;
+    void *user;
+    int *x, *y, *comp;
+    int w, h, n; // output size and channels per pixel
+    int flip;
+    // stbi_load_region: the rectangle in output orientation (clipped to the
+    // image by stbi__row_sink_begin) and the image it is collected into
+    int region, left, top, width, height;
+    stbi_uc *out;
+    // rows the consumer needs, in file order: decoders may skip work before
+    // y0 and stop at y1. one that sends only columns [span_x0,
+    // span_x0+span_w) of each row sets the span after stbi__row_sink_begin
+    int y0, y1, span_x0, span_w;
+} stbi__row_sink;
+
+// called once the header is known, before any rows are sent
+static int stbi__row_sink_begin(stbi__row_sink *k, int w, int h, int comp, int n)
+{
+    k->w = w;
+    k->h = h;
+    k->n = n;
+    *k->x = w;
+    *k->y = h;
+    if (k->comp) *k->comp = comp;
+    k->span_x0 = 0;
+    k->span_w = w;
+    if (!k->region) {
+        k->y0 = 0;
+        k->y1 = h;
+        return 1;
+    }
+    
+    if (k->left < 0) { k->width += k->left; k->left = 0; }
+    if (k->top < 0) { k->height += k->top; k->top = 0; }
+    if (k->width > w - k->left) k->width = w - k->left;
+    if (k->height > h - k->top) k->height = h - k->top;
+    if (k->width <= 0 || k->height <= 0) return stbi__err("bad region", "Region is outside the image");
+    k->y0 = k->flip ? h - k->top - k->height : k->top;
+    k->y1 = k->y0 + k->height;
+    k->out = (stbi_uc *) stbi__malloc_mad3(k->width, k->height, n, 0);
+    if (!k->out) return stbi__err("outofmem", "Out of memory");
+    return 1;
+}
+
+// stbi_load_region's row callback: keep the part inside the rectangle
+static int stbi__region_rows(void *user, stbi_uc const *rows, int y, int num_rows, int stride)
+{
+    stbi__row_sink *k = (stbi__row_sink *) user;
+    int i, row_bytes = k->width * k->n;
+    rows += (k->left - k->span_x0) * k->n;
+    for (i=0; i < num_rows; ++i, rows += stride) {
+        if (y+i >= k->top && y+i < k->top + k->height)
+        memcpy(k->out + (size_t) (y+i - k->top) * row_bytes, rows, row_bytes);
+    }
+    return 1;
+}
+
+// send num_rows tightly packed rows, the first of which is row y in file order
+static int stbi__emit_rows(stbi__row_sink *k, stbi_uc const *rows, int y, int num_rows)
+{
+    int row_bytes = k->span_w * k->n, ok;
+    if (num_rows <= 0) return 1;
+    if (k->flip)
+    ok = k->cb(k->user, rows + (size_t) (num_rows-1) * row_bytes, k->h - y - num_rows, num_rows, -row_bytes);
+    else
+    ok = k->cb(k->user, rows, y, num_rows, row_bytes);
+    return ok ? 1 : stbi__err("stopped", "Decoding stopped by callback");
+}
+
+static void *stbi__load_format(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
+{
+    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
+    ri->bits_per_channel = 8; // default is 8 so most paths don't have to be changed
+    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
+    ri->num_channels = 0;
+    
+#ifndef STBI_NO_JPEG
+    if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri);
+#endif
+#ifndef STBI_NO_PNG
+    if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri);
+#endif
+#ifndef STBI_NO_BMP
+    if (stbi__bmp_test(s))  return stbi__bmp_load(s,x,y,comp,req_comp, ri);
+#endif
+#ifndef STBI_NO_GIF
+    if (stbi__gif_test(s))  return stbi__gif_load(s,x,y,comp,req_comp, ri);
+#endif
+#ifndef STBI_NO_PSD
+    if (stbi__psd_test(s))  return stbi__psd_load(s,x,y,comp,req_comp, ri, bpc);
+#endif
+#ifndef STBI_NO_PIC
+    if (stbi__pic_test(s))  return stbi__pic_load(s,x,y,comp,req_comp, ri);
+#endif
+#ifndef STBI_NO_PNM
+    if (stbi__pnm_test(s))  return stbi__pnm_load(s,x,y,comp,req_comp, ri);
+#endif
+    
+#ifndef STBI_NO_HDR
+    if (stbi__hdr_test(s)) {
+        float *hdr = stbi__hdr_load(s, x,y,comp,req_comp, ri);
+        return stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp, &s->opt);
+    }
+#endif
+    
+#ifndef STBI_NO_TGA
+    // test tga last because it's a crappy test!
+    if (stbi__tga_test(s))
+    return stbi__tga_load(s,x,y,comp,req_comp, ri);
+#endif
+    
+    return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
+}
+
+static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
+{
+    void *result;
+    stbi__work_begin(s);
+    result = stbi__load_format(s, x, y, comp, req_comp, ri, bpc);
+    stbi__work_end(s);
+    return result;
+}
+
+static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
+{
+    int i;
+    int img_len = w * h * channels;
+    stbi_uc *reduced;
+    
+    reduced = (stbi_uc *) stbi__malloc(img_len);
+    if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
+    
+    for (i = 0; i < img_len; ++i)
+    reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+    
+    STBI_FREE(orig);
+    return reduced;
+}
+
+static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
+{
+    int i;
+    int img_len = w * h * channels;
+    stbi__uint16 *enlarged;
+    
+    enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
+    if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
+    
+    for (i = 0; i < img_len; ++i)
+    enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+    
+    STBI_FREE(orig);
+    return enlarged;
+}
+
+static void stbi__vertical_flip_stride(void *image, size_t bytes_per_row, size_t stride, int h)
+{
+    int row;
+    stbi_uc temp[2048];
+    stbi_uc *bytes = (stbi_uc *)image;
+    
+    for (row = 0; row < (h>>1); row++) {
+        stbi_uc *row0 = bytes + row*stride;
+        stbi_uc *row1 = bytes + (h - row - 1)*stride;
+        // swap row0 with row1
+        size_t bytes_left = bytes_per_row;
+        while (bytes_left) {
+            size_t bytes_copy = (bytes_left < sizeof(temp)) ? bytes_left : sizeof(temp);
+            memcpy(temp, row0, bytes_copy);
+            memcpy(row0, row1, bytes_copy);
+            memcpy(row1, temp, bytes_copy);
+            row0 += bytes_copy;
+            row1 += bytes_copy;
+            bytes_left -= bytes_copy;
+        }
+    }
+}
+
+static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
+{
+    size_t bytes_per_row = (size_t)w * bytes_per_pixel;
+    stbi__vertical_flip_stride(image, bytes_per_row, bytes_per_row, h);
+}
+
+#ifndef STBI_NO_GIF
+static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
+{
+    int slice;
+    int slice_size = w * h * bytes_per_pixel;
+    
+    stbi_uc *bytes = (stbi_uc *)image;
+    for (slice = 0; slice < z; ++slice) {
+        stbi__vertical_flip(bytes, w, h, bytes_per_pixel);
+        bytes += slice_size;
+    }
+}
+#endif
+
+static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__result_info ri;
+    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+    
+    if (result == NULL)
+    return NULL;
+    
+    if (ri.bits_per_channel != 8) {
+        STBI_ASSERT(ri.bits_per_channel == 16);
+        result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
+        ri.bits_per_channel = 8;
+    }
+    
+    // @TODO: move stbi__convert_format to here
+    
+    if (s->opt.flip_vertically) {
+        int channels = req_comp ? req_comp : *comp;
+        if (result == s->out_user)
+        stbi__vertical_flip_stride(result, (size_t) *x * channels, s->out_user_stride, *y);
+        else
+        stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+    }
+    
+    return (unsigned char *) result;
+}
+
+static int stbi__load_into_main(stbi__context *s, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp)
+{
+    stbi_uc *result;
+    int j, channels;
+    
+    if (out == NULL || out_stride < 0) return stbi__err("bad output", "Invalid output buffer");
+    s->out_user = out;
+    s->out_user_len = out_len;
+    s->out_user_stride = out_stride;
+    
+    result = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
+    if (result == NULL)
+    return 0;
+    
+    // JPEG and simple PNGs decode in place; everything else is copied over
+    if (result == out)
+    return 1;
+    
+    channels = req_comp ? req_comp : *comp;
+    if (!stbi__out_user_fits(s, *x, *y, channels)) {
+        STBI_FREE(result);
+        return 0;
+    }
+    for (j=0; j < *y; ++j)
+    memcpy(out + (size_t) j * s->out_user_stride, result + (size_t) j * *x * channels, (size_t) *x * channels);
+    STBI_FREE(result);
+    return 1;
+}
+
+// decode into a sink that has its callback, outputs, flip and region set
+static int stbi__load_sink_main(stbi__context *s, stbi__row_sink *sink, int req_comp)
+{
+    stbi_uc *result;
+    int x, y, file_comp, ok;
+    
+    if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+    
+    // JPEG and non-interlaced PNG stream; the rest decode whole and go out as one band
+    stbi__work_begin(s);
+#ifndef STBI_NO_JPEG
+    if (stbi__jpeg_test(s)) {
+        s->row_sink = sink;
+        ok = stbi__jpeg_load_rows(s, req_comp);
+        s->row_sink = NULL;
+        stbi__work_end(s);
+        return ok;
+    }
+#endif
+#ifndef STBI_NO_PNG
+    if (stbi__png_can_stream(s)) {
+        s->row_sink = sink;
+        ok = stbi__png_load_rows(s, req_comp);
+        s->row_sink = NULL;
+        stbi__work_end(s);
+        return ok;
+    }
+#endif
+    stbi__work_end(s);
+
+    result = stbi__load_and_postprocess_8bit(s, &x, &y, &file_comp, req_comp);
+    if (result == NULL)
+    return 0;
+    sink->flip = 0; // already flipped
+    ok = stbi__row_sink_begin(sink, x, y, file_comp, req_comp ? req_comp : file_comp) && stbi__emit_rows(sink, result, 0, y);
+    STBI_FREE(result);
+    return ok;
+}
+
+static int stbi__load_rows_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *user)
+{
+    stbi__row_sink sink;
+    if (cb == NULL) return stbi__err("bad callback", "Invalid row callback");
+    sink.cb = cb;
+    sink.user = user;
+    sink.x = x;
+    sink.y = y;
+    sink.comp = comp;
+    sink.flip = s->opt.flip_vertically;
+    sink.region = 0;
+    return stbi__load_sink_main(s, &sink, req_comp);
+}
+
+static stbi_uc *stbi__load_region_main(stbi__context *s, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__row_sink sink;
+    int image_x, image_y;
+    if (width <= 0 || height <= 0) return stbi__errpuc("bad region", "Region is empty");
+    sink.cb = stbi__region_rows;
+    sink.user = &sink;
+    sink.x = &image_x;
+    sink.y = &image_y;
+    sink.comp = comp;
+    sink.flip = s->opt.flip_vertically;
+    sink.region = 1;
+    sink.left = left;
+    sink.top = top;
+    sink.width = width;
+    sink.height = height;
+    sink.out = NULL;
+    if (!stbi__load_sink_main(s, &sink, req_comp)) {
+        STBI_FREE(sink.out);
+        return NULL;
+    }
+    *x = sink.width;
+    *y = sink.height;
+    return sink.out;
+}
+
+static int stbi__jpeg_coefficients_main(stbi__context *s, stbi_jpeg_coefficients *out)
+{
+    int ok;
+    if (out == NULL) return stbi__err("bad output", "Invalid output buffer");
+    memset(out, 0, sizeof(*out));
+#ifndef STBI_NO_JPEG
+    stbi__work_begin(s);
+    ok = stbi__jpeg_test(s) ? stbi__jpeg_load_coefficients(s, out) : stbi__err("not JPEG", "Image not of a known type, or corrupt");
+    stbi__work_end(s);
+#else
+    ok = stbi__err("not JPEG", "Image not of a known type, or corrupt");
+#endif
+    return ok;
+}
+
+static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+    stbi__result_info ri;
+    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
+    
+    if (result == NULL)
+    return NULL;
+    
+    if (ri.bits_per_channel != 16) {
+        STBI_ASSERT(ri.bits_per_channel == 8);
         result = stbi__convert_8_to_16((stbi_uc *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
         ri.bits_per_channel = 16;
     }
@@ -1153,7 +2058,7 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
     // @TODO: move stbi__convert_format16 to here
     // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
     
-    if (stbi__vertically_flip_on_load) {
+    if (s->opt.flip_vertically) {
         int channels = req_comp ? req_comp : *comp;
         stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
     }
@@ -1162,9 +2067,9 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
 {
-    if (stbi__vertically_flip_on_load && result != NULL) {
+    if (s->opt.flip_vertically && result != NULL) {
         int channels = req_comp ? req_comp : *comp;
         stbi__vertical_flip(result, *x, *y, channels * sizeof(float));
     }
@@ -1224,6 +2129,16 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
     return result;
 }
 
+STBIDEF stbi_uc *stbi_load_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    unsigned char *result;
+    if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+    result = stbi_load_from_file_ex(f,x,y,comp,req_comp,opt);
+    fclose(f);
+    return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
     unsigned char *result;
@@ -1237,11 +2152,31 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
     return result;
 }
 
+STBIDEF stbi_uc *stbi_load_from_file_ex(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    unsigned char *result;
+    stbi__context s;
+    stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
+    result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_from_file_16_ex(f,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi__uint16 *stbi_load_from_file_16_ex(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
 {
     stbi__uint16 *result;
     stbi__context s;
     stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
     result = stbi__load_and_postprocess_16bit(&s,x,y,comp,req_comp);
     if (result) {
         // need to 'unget' all the characters in the IO buffer
@@ -1250,12 +2185,142 @@ STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp,
     return result;
 }
 
+STBIDEF int stbi_load_into(char const *filename, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_into_ex(filename,out,out_len,out_stride,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF int stbi_load_into_ex(char const *filename, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_load_into_from_file_ex(f,out,out_len,out_stride,x,y,comp,req_comp,opt);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_load_into_from_file(FILE *f, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_into_from_file_ex(f,out,out_len,out_stride,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF int stbi_load_into_from_file_ex(FILE *f, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
+    result = stbi__load_into_main(&s,out,out_len,out_stride,x,y,comp,req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
+STBIDEF int stbi_load_rows(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user)
+{
+    return stbi_load_rows_ex(filename,x,y,comp,req_comp,cb,cb_user,NULL);
+}
+
+STBIDEF int stbi_load_rows_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_load_rows_from_file_ex(f,x,y,comp,req_comp,cb,cb_user,opt);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_load_rows_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user)
+{
+    return stbi_load_rows_from_file_ex(f,x,y,comp,req_comp,cb,cb_user,NULL);
+}
+
+STBIDEF int stbi_load_rows_from_file_ex(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
+    result = stbi__load_rows_main(&s,x,y,comp,req_comp,cb,cb_user);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
+STBIDEF stbi_uc *stbi_load_region(char const *filename, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_region_ex(filename,left,top,width,height,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi_uc *stbi_load_region_ex(char const *filename, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    stbi_uc *result;
+    if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+    result = stbi_load_region_from_file_ex(f,left,top,width,height,x,y,comp,req_comp,opt);
+    fclose(f);
+    return result;
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_file(FILE *f, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_region_from_file_ex(f,left,top,width,height,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_file_ex(FILE *f, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi_uc *result;
+    stbi__context s;
+    stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
+    result = stbi__load_region_main(&s,left,top,width,height,x,y,comp,req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
+STBIDEF int stbi_jpeg_coefficients_load(char const *filename, stbi_jpeg_coefficients *out)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_jpeg_coefficients_from_file(f,out);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_jpeg_coefficients_from_file(FILE *f, stbi_jpeg_coefficients *out)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s,f);
+    result = stbi__jpeg_coefficients_main(&s,out);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
 STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_16_ex(filename,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi_us *stbi_load_16_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
 {
     FILE *f = stbi__fopen(filename, "rb");
     stbi__uint16 *result;
     if (!f) return (stbi_us *) stbi__errpuc("can't fopen", "Unable to open file");
-    result = stbi_load_from_file_16(f,x,y,comp,req_comp);
+    result = stbi_load_from_file_16_ex(f,x,y,comp,req_comp,opt);
     fclose(f);
     return result;
 }
@@ -1271,9 +2336,23 @@ STBIDEF stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x
 }
 
 STBIDEF stbi_us *stbi_load_16_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+    return stbi_load_16_from_callbacks_ex(clbk,user,x,y,channels_in_file,desired_channels,NULL);
+}
+
+STBIDEF stbi_us *stbi_load_16_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt)
 {
     stbi__context s;
     stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__load_and_postprocess_16bit(&s,x,y,channels_in_file,desired_channels);
+}
+
+STBIDEF stbi_us *stbi_load_16_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
     return stbi__load_and_postprocess_16bit(&s,x,y,channels_in_file,desired_channels);
 }
 
@@ -1291,6 +2370,124 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
     return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
+    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_into_from_memory_ex(buffer,len,out,out_len,out_stride,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF int stbi_load_into_from_memory_ex(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
+    return stbi__load_into_main(&s,out,out_len,out_stride,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_into_from_callbacks_ex(clbk,user,out,out_len,out_stride,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF int stbi_load_into_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, stbi_uc *out, size_t out_len, int out_stride, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__load_into_main(&s,out,out_len,out_stride,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user)
+{
+    return stbi_load_rows_from_memory_ex(buffer,len,x,y,comp,req_comp,cb,cb_user,NULL);
+}
+
+STBIDEF int stbi_load_rows_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
+    return stbi__load_rows_main(&s,x,y,comp,req_comp,cb,cb_user);
+}
+
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user)
+{
+    return stbi_load_rows_from_callbacks_ex(clbk,user,x,y,comp,req_comp,cb,cb_user,NULL);
+}
+
+STBIDEF int stbi_load_rows_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_row_callback cb, void *cb_user, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__load_rows_main(&s,x,y,comp,req_comp,cb,cb_user);
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_memory(stbi_uc const *buffer, int len, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_region_from_memory_ex(buffer,len,left,top,width,height,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_memory_ex(stbi_uc const *buffer, int len, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
+    return stbi__load_region_main(&s,left,top,width,height,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_callbacks(stbi_io_callbacks const *clbk, void *user, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_load_region_from_callbacks_ex(clbk,user,left,top,width,height,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF stbi_uc *stbi_load_region_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int left, int top, int width, int height, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__load_region_main(&s,left,top,width,height,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_jpeg_coefficients_from_memory(stbi_uc const *buffer, int len, stbi_jpeg_coefficients *out)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    return stbi__jpeg_coefficients_main(&s,out);
+}
+
+STBIDEF int stbi_jpeg_coefficients_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_jpeg_coefficients *out)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    return stbi__jpeg_coefficients_main(&s,out);
+}
+
+STBIDEF void stbi_jpeg_coefficients_free(stbi_jpeg_coefficients *c)
+{
+    int i;
+    if (c == NULL) return;
+    for (i=0; i < 3; ++i) {
+        STBI_FREE(c->comp[i].coeff);
+        c->comp[i].coeff = NULL;
+    }
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1298,8 +2495,10 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
     stbi__context s;
     stbi__start_mem(&s,buffer,len);
     
+    stbi__work_begin(&s);
     result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-    if (stbi__vertically_flip_on_load) {
+    stbi__work_end(&s);
+    if (s.opt.flip_vertically) {
         stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
     }
     
@@ -1314,15 +2513,18 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
 #ifndef STBI_NO_HDR
     if (stbi__hdr_test(s)) {
         stbi__result_info ri;
-        float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+        float *hdr_data;
+        stbi__work_begin(s);
+        hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+        stbi__work_end(s);
         if (hdr_data)
-        stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+        stbi__float_postprocess(s,hdr_data,x,y,comp,req_comp);
         return hdr_data;
     }
 #endif
     data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
     if (data)
-    return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+    return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp, &s->opt);
     return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
 }
 
@@ -1334,27 +2536,52 @@ STBIDEF float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, in
 }
 
 STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_loadf_from_callbacks_ex(clbk,user,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF float *stbi_loadf_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
 {
     stbi__context s;
     stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+    if (opt) s.opt = *opt;
+    return stbi__loadf_main(&s,x,y,comp,req_comp);
+}
+
+STBIDEF float *stbi_loadf_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
+{
+    stbi__context s;
+    stbi__start_mem(&s,buffer,len);
+    if (opt) s.opt = *opt;
     return stbi__loadf_main(&s,x,y,comp,req_comp);
 }
 
 #ifndef STBI_NO_STDIO
 STBIDEF float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_loadf_ex(filename,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF float *stbi_loadf_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
 {
     float *result;
     FILE *f = stbi__fopen(filename, "rb");
     if (!f) return stbi__errpf("can't fopen", "Unable to open file");
-    result = stbi_loadf_from_file(f,x,y,comp,req_comp);
+    result = stbi_loadf_from_file_ex(f,x,y,comp,req_comp,opt);
     fclose(f);
     return result;
 }
 
 STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+    return stbi_loadf_from_file_ex(f,x,y,comp,req_comp,NULL);
+}
+
+STBIDEF float *stbi_loadf_from_file_ex(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_load_options const *opt)
 {
     stbi__context s;
     stbi__start_file(&s,f);
+    if (opt) s.opt = *opt;
     return stbi__loadf_main(&s,x,y,comp,req_comp);
 }
 #endif // !STBI_NO_STDIO
@@ -1421,16 +2648,16 @@ STBIDEF int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void
 }
 
 #ifndef STBI_NO_LINEAR
-static float stbi__l2h_gamma=2.2f, stbi__l2h_scale=1.0f;
-
-STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma = gamma; }
-STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale = scale; }
+STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__set_global(STBI__SET_ldr_to_hdr_gamma, stbi__float_bits(gamma)); }
+STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__set_global(STBI__SET_ldr_to_hdr_scale, stbi__float_bits(scale)); }
+STBIDEF void   stbi_ldr_to_hdr_gamma_thread(float gamma) { stbi__set_thread(STBI__SET_ldr_to_hdr_gamma, stbi__float_bits(gamma)); }
+STBIDEF void   stbi_ldr_to_hdr_scale_thread(float scale) { stbi__set_thread(STBI__SET_ldr_to_hdr_scale, stbi__float_bits(scale)); }
 #endif
 
-static float stbi__h2l_gamma_i=1.0f/2.2f, stbi__h2l_scale_i=1.0f;
-
-STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1/gamma; }
-STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1/scale; }
+STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__set_global(STBI__SET_hdr_to_ldr_gamma, stbi__float_bits(gamma)); }
+STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__set_global(STBI__SET_hdr_to_ldr_scale, stbi__float_bits(scale)); }
+STBIDEF void   stbi_hdr_to_ldr_gamma_thread(float gamma) { stbi__set_thread(STBI__SET_hdr_to_ldr_gamma, stbi__float_bits(gamma)); }
+STBIDEF void   stbi_hdr_to_ldr_scale_thread(float scale) { stbi__set_thread(STBI__SET_hdr_to_ldr_scale, stbi__float_bits(scale)); }
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1574,9 +2801,36 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
     return (stbi_uc) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
+// convert one row of x pixels from img_n to req_comp components
+static void stbi__convert_format_row(unsigned char *src, unsigned char *dest, int img_n, int req_comp, unsigned int x)
+{
+    int i;
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+    // convert source image with img_n components to one with req_comp components;
+    // avoid switch per pixel, so use switch per scanline and massive macros
+    switch (STBI__COMBO(img_n, req_comp)) {
+        STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
+        STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+        STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
+        STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
+        STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+        STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
+        STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
+        STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+        STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
+        STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+        STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+        STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
+        default: STBI_ASSERT(0);
+    }
+#undef STBI__CASE
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-    int i,j;
+    int j;
     unsigned char *good;
     
     if (req_comp == img_n) return data;
@@ -1588,31 +2842,8 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
         return stbi__errpuc("outofmem", "Out of memory");
     }
     
-    for (j=0; j < (int) y; ++j) {
-        unsigned char *src  = data + j * x * img_n   ;
-        unsigned char *dest = good + j * x * req_comp;
-        
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-        // convert source image with img_n components to one with req_comp components;
-        // avoid switch per pixel, so use switch per scanline and massive macros
-        switch (STBI__COMBO(img_n, req_comp)) {
-            STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-            STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-            STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-            STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-            STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-            STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-            STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-            STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-            STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-            STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-            STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-            STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-            default: STBI_ASSERT(0);
-        }
-#undef STBI__CASE
-    }
+    for (j=0; j < (int) y; ++j)
+    stbi__convert_format_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x);
     
     STBI_FREE(data);
     return good;
@@ -1623,9 +2854,36 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
     return (stbi__uint16) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
+// convert one row of x pixels from img_n to req_comp components
+static void stbi__convert_format16_row(stbi__uint16 *src, stbi__uint16 *dest, int img_n, int req_comp, unsigned int x)
+{
+    int i;
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+    // convert source image with img_n components to one with req_comp components;
+    // avoid switch per pixel, so use switch per scanline and massive macros
+    switch (STBI__COMBO(img_n, req_comp)) {
+        STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
+        STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+        STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
+        STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
+        STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+        STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
+        STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
+        STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+        STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
+        STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+        STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+        STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
+        default: STBI_ASSERT(0);
+    }
+#undef STBI__CASE
+}
+
 static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-    int i,j;
+    int j;
     stbi__uint16 *good;
     
     if (req_comp == img_n) return data;
@@ -1637,38 +2895,15 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
         return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
     }
     
-    for (j=0; j < (int) y; ++j) {
-        stbi__uint16 *src  = data + j * x * img_n   ;
-        stbi__uint16 *dest = good + j * x * req_comp;
-        
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-        // convert source image with img_n components to one with req_comp components;
-        // avoid switch per pixel, so use switch per scanline and massive macros
-        switch (STBI__COMBO(img_n, req_comp)) {
-            STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
-            STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-            STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
-            STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
-            STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-            STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
-            STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
-            STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-            STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
-            STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-            STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-            STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-            default: STBI_ASSERT(0);
-        }
-#undef STBI__CASE
-    }
+    for (j=0; j < (int) y; ++j)
+    stbi__convert_format16_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x);
     
     STBI_FREE(data);
     return good;
 }
 
 #ifndef STBI_NO_LINEAR
-static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
+static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp, stbi_load_options const *opt)
 {
     int i,k,n;
     float *output;
@@ -1679,7 +2914,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
     if (comp & 1) n = comp; else n = comp-1;
     for (i=0; i < x*y; ++i) {
         for (k=0; k < n; ++k) {
-            output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+            output[i*comp + k] = (float) (pow(data[i*comp+k]/255.0f, opt->ldr_to_hdr_gamma) * opt->ldr_to_hdr_scale);
         }
     }
     if (n < comp) {
@@ -1694,8 +2929,9 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 
 #ifndef STBI_NO_HDR
 #define stbi__float2int(x)   ((int) (x))
-static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
+static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp, stbi_load_options const *opt)
 {
+    float gamma_i = 1/opt->hdr_to_ldr_gamma, scale_i = 1/opt->hdr_to_ldr_scale;
     int i,k,n;
     stbi_uc *output;
     if (!data) return NULL;
@@ -1705,7 +2941,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
     if (comp & 1) n = comp; else n = comp-1;
     for (i=0; i < x*y; ++i) {
         for (k=0; k < n; ++k) {
-            float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 255 + 0.5f;
+            float z = (float) pow(data[i*comp+k]*scale_i, gamma_i) * 255 + 0.5f;
             if (z < 0) z = 0;
             if (z > 255) z = 255;
             output[i*comp + k] = (stbi_uc) stbi__float2int(z);
@@ -1782,6 +3018,9 @@ typedef struct
         int dc_pred;
         
         int x,y,w2,h2;
+        int ring_h; // rows of 'data' kept: h2, or two MCU rows when streaming
+        int hshift,vshift; // log2 of the pixels a block decodes to across and down
+        void (*idct)(stbi_uc *out, int out_stride, short data[64]); // NULL when they differ
         stbi_uc *data;
         void *raw_data, *raw_coeff;
         stbi_uc *linebuf;
@@ -1806,6 +3045,17 @@ typedef struct
     
     int scan_n, order[4];
     int restart_interval, todo;
+    int coefficients_only; // stbi_jpeg_coefficients: keep the raw blocks, no planes or idct
+    int block_shift;       // component shift at the largest sampling factors: 3, less when scaling
+    stbi__uint32 frame_y;  // height in the frame header; s->img_y is scaled down like the planes
+    
+    // stbi_load_region: only MCU columns [need_x0,need_x1) of rows
+    // [need_y0,need_y1) are idct'd, the rest just entropy decoded or, a
+    // restart interval at a time, skipped. output columns [out_x0,
+    // out_x0+out_w) are upsampled and converted. all of it otherwise
+    int need_x0, need_x1, need_y0, need_y1;
+    int skip_interval;     // passing over MCUs whose data was skipped
+    stbi__uint32 out_x0, out_w;
     
     // kernels
     void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2012,8 +3262,17 @@ static const stbi_uc stbi__jpeg_dezigzag[64+15] =
     63, 63, 63, 63, 63, 63, 63
 };
 
+// stbi_jpeg_coefficients decodes baseline blocks without dequantizing
+static const stbi__uint16 stbi__jpeg_unit_dequant[64] =
+{
+    1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1
+};
+
 // decode one 64-entry block--
-static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi__uint16 *dequant)
+static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, const stbi__uint16 *dequant)
 {
     int diff,dc,k;
     int t;
@@ -2322,6 +3581,134 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
     }
 }
 
+// reduced idcts for scaled decodes (stbi_load_options.jpeg_scale), as in
+// libjpeg's jidctred.c: each output pixel is the mean of the 2x2 or 4x4
+// pixels the full idct would make there, which works out to a 4- or
+// 2-point transform of all eight coefficients per axis (those whose basis
+// averages to zero drop out). Same fixed point as stbi__idct_block: the
+// column pass keeps 2 extra bits, the row pass takes them and the 2-d DC
+// gain of 8 back off
+static void stbi__idct_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+    int i,e,e0,e1,o0,o1,val[32],*v=val;
+    short *d = data;
+    
+    // columns, except 4, which no output uses
+    for (i=0; i < 8; ++i,++d,++v) {
+        if (i == 4) continue;
+        if (d[8]==0 && d[16]==0 && d[24]==0 && d[40]==0 && d[48]==0 && d[56]==0) {
+            v[0] = v[8] = v[16] = v[24] = d[0] * 4;
+            continue;
+        }
+        e  = d[16]*stbi__f2f(0.923879533f) + d[48]*stbi__f2f(-0.382683432f);
+        e0 = stbi__fsh(d[0]) + e + 512;
+        e1 = stbi__fsh(d[0]) - e + 512;
+        o0 = d[ 8]*stbi__f2f( 1.281457724f) + d[24]*stbi__f2f( 0.449988112f) + d[40]*stbi__f2f(-0.300672443f) + d[56]*stbi__f2f(-0.254897790f);
+        o1 = d[ 8]*stbi__f2f( 0.530797169f) + d[24]*stbi__f2f(-1.086367402f) + d[40]*stbi__f2f( 0.725887491f) + d[56]*stbi__f2f(-0.105582121f);
+        v[ 0] = (e0+o0) >> 10;
+        v[24] = (e0-o0) >> 10;
+        v[ 8] = (e1+o1) >> 10;
+        v[16] = (e1-o1) >> 10;
+    }
+    
+    for (i=0, v=val; i < 4; ++i,v+=8,out+=out_stride) {
+        e  = v[2]*stbi__f2f(0.923879533f) + v[6]*stbi__f2f(-0.382683432f);
+        e0 = stbi__fsh(v[0]) + e + 65536 + (128<<17);
+        e1 = stbi__fsh(v[0]) - e + 65536 + (128<<17);
+        o0 = v[1]*stbi__f2f( 1.281457724f) + v[3]*stbi__f2f( 0.449988112f) + v[5]*stbi__f2f(-0.300672443f) + v[7]*stbi__f2f(-0.254897790f);
+        o1 = v[1]*stbi__f2f( 0.530797169f) + v[3]*stbi__f2f(-1.086367402f) + v[5]*stbi__f2f( 0.725887491f) + v[7]*stbi__f2f(-0.105582121f);
+        out[0] = stbi__clamp((e0+o0) >> 17);
+        out[3] = stbi__clamp((e0-o0) >> 17);
+        out[1] = stbi__clamp((e1+o1) >> 17);
+        out[2] = stbi__clamp((e1-o1) >> 17);
+    }
+}
+
+static void stbi__idct_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+    int i,e,o,val[16],*v=val;
+    short *d = data;
+    
+    // columns 0, 1, 3, 5 and 7; the even ones past 0 average to zero
+    for (i=0; i < 8; ++i,++d,++v) {
+        if (i && !(i & 1)) continue;
+        e = stbi__fsh(d[0]) + 512;
+        o = d[8]*stbi__f2f(0.906127446f) + d[24]*stbi__f2f(-0.318189645f) + d[40]*stbi__f2f(0.212607524f) + d[56]*stbi__f2f(-0.180239956f);
+        v[0] = (e+o) >> 10;
+        v[8] = (e-o) >> 10;
+    }
+    
+    for (i=0, v=val; i < 2; ++i,v+=8,out+=out_stride) {
+        e = stbi__fsh(v[0]) + 65536 + (128<<17);
+        o = v[1]*stbi__f2f(0.906127446f) + v[3]*stbi__f2f(-0.318189645f) + v[5]*stbi__f2f(0.212607524f) + v[7]*stbi__f2f(-0.180239956f);
+        out[0] = stbi__clamp((e+o) >> 17);
+        out[1] = stbi__clamp((e-o) >> 17);
+    }
+}
+
+static void stbi__idct_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+    STBI_NOTUSED(out_stride);
+    out[0] = stbi__clamp((data[0] + 4 + (128<<3)) >> 3);
+}
+
+// the same box averages as rows of a matrix, for planes subsampled one way
+// only (4:2:2, 4:4:0) that need a different size across than down. rows for
+// 2, 4 and 8 outputs start at n/2-1; each row k also gives output n-1-k by
+// negating the odd terms
+static const int stbi__idct_scaled_basis[7][8] =
+{
+    { stbi__f2f(1), stbi__f2f( 0.906127446f), 0, stbi__f2f(-0.318189645f), 0, stbi__f2f( 0.212607524f), 0, stbi__f2f(-0.180239956f) },
+    { stbi__f2f(1), stbi__f2f( 1.281457724f), stbi__f2f( 0.923879533f), stbi__f2f( 0.449988112f), 0, stbi__f2f(-0.300672443f), stbi__f2f(-0.382683432f), stbi__f2f(-0.254897790f) },
+    { stbi__f2f(1), stbi__f2f( 0.530797169f), stbi__f2f(-0.923879533f), stbi__f2f(-1.086367402f), 0, stbi__f2f( 0.725887491f), stbi__f2f( 0.382683432f), stbi__f2f(-0.105582121f) },
+    { stbi__f2f(1), stbi__f2f( 1.387039845f), stbi__f2f( 1.306562965f), stbi__f2f( 1.175875602f), stbi__f2f( 1), stbi__f2f( 0.785694958f), stbi__f2f( 0.541196100f), stbi__f2f( 0.275899379f) },
+    { stbi__f2f(1), stbi__f2f( 1.175875602f), stbi__f2f( 0.541196100f), stbi__f2f(-0.275899379f), stbi__f2f(-1), stbi__f2f(-1.387039845f), stbi__f2f(-1.306562965f), stbi__f2f(-0.785694958f) },
+    { stbi__f2f(1), stbi__f2f( 0.785694958f), stbi__f2f(-0.541196100f), stbi__f2f(-1.387039845f), stbi__f2f(-1), stbi__f2f( 0.275899379f), stbi__f2f( 1.306562965f), stbi__f2f( 1.175875602f) },
+    { stbi__f2f(1), stbi__f2f( 0.275899379f), stbi__f2f(-1.306562965f), stbi__f2f(-0.785694958f), stbi__f2f( 1), stbi__f2f( 1.175875602f), stbi__f2f(-0.541196100f), stbi__f2f(-1.387039845f) },
+};
+
+// makes a (1<<hshift) x (1<<vshift) block
+static void stbi__idct_scaled(stbi_uc *out, int out_stride, short data[64], int hshift, int vshift)
+{
+    int i,k,u,e,o,val[64],*v;
+    int w = 1 << hshift, h = 1 << vshift;
+    const int *m;
+    
+    for (i=0; i < 8; ++i) {
+        short *d = data + i;
+        v = val + i;
+        if (h == 1) {
+            v[0] = d[0] * 4;
+            continue;
+        }
+        for (k=0; k < h/2; ++k) {
+            m = stbi__idct_scaled_basis[h/2-1 + k];
+            e = stbi__fsh(d[0]) + 512;
+            o = 0;
+            for (u=2; u < 8; u += 2) e += d[u*8] * m[u];
+            for (u=1; u < 8; u += 2) o += d[u*8] * m[u];
+            v[k*8] = (e+o) >> 10;
+            v[(h-1-k)*8] = (e-o) >> 10;
+        }
+    }
+    
+    for (i=0, v=val; i < h; ++i,v+=8,out+=out_stride) {
+        if (w == 1) {
+            out[0] = stbi__clamp((stbi__fsh(v[0]) + 65536 + (128<<17)) >> 17);
+            continue;
+        }
+        for (k=0; k < w/2; ++k) {
+            m = stbi__idct_scaled_basis[w/2-1 + k];
+            e = stbi__fsh(v[0]) + 65536 + (128<<17);
+            o = 0;
+            for (u=2; u < 8; u += 2) e += v[u] * m[u];
+            for (u=1; u < 8; u += 2) o += v[u] * m[u];
+            out[k] = stbi__clamp((e+o) >> 17);
+            out[w-1-k] = stbi__clamp((e-o) >> 17);
+        }
+    }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2741,10 +4128,111 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
     j->marker = STBI__MARKER_none;
     j->todo = j->restart_interval ? j->restart_interval : 0x7fffffff;
     j->eob_run = 0;
+    j->skip_interval = 0;
     // no more than 1<<31 MCUs if no restart_interal? that's plenty safe,
     // since we don't even allow 1<<30 pixels
 }
 
+// blocks across 'pixels' of a plane decoding 1<<shift pixels a block; the
+// same at every scale
+static int stbi__jpeg_blocks(int pixels, int shift)
+{
+    return (pixels + (1 << shift)-1) >> shift;
+}
+
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, stbi_uc *out, short data[64])
+{
+    if (z->img_comp[n].idct)
+    z->img_comp[n].idct(out, z->img_comp[n].w2, data);
+    else
+    stbi__idct_scaled(out, z->img_comp[n].w2, data, z->img_comp[n].hshift, z->img_comp[n].vshift);
+}
+
+// whether the restart interval starting at MCU 'first' (in raster order)
+// reaches any MCU that has to be idct'd
+static int stbi__jpeg_interval_needed(stbi__jpeg *z, int first)
+{
+    int last = first + z->restart_interval - 1;
+    int jf = first / z->img_mcu_x, jl = last / z->img_mcu_x;
+    if (jl < z->need_y0 || jf >= z->need_y1) return 0;
+    if (jf == jl) return first % z->img_mcu_x < z->need_x1 && last % z->img_mcu_x >= z->need_x0;
+    // a whole row in between, or the partial first or last one
+    if (jf+1 <= jl-1 && jf+1 < z->need_y1 && jl-1 >= z->need_y0) return 1;
+    return (jf >= z->need_y0 && first % z->img_mcu_x < z->need_x1)
+    || (jl < z->need_y1 && last % z->img_mcu_x >= z->need_x0);
+}
+
+// step over a restart interval's entropy-coded data without decoding it,
+// up to the marker that ends it; the MCUs are then passed over until the
+// usual countdown reaches that marker
+static void stbi__jpeg_skip_interval(stbi__jpeg *z)
+{
+    int c;
+    z->skip_interval = 1;
+    while (!stbi__at_eof(z->s)) {
+        if (stbi__get8(z->s) != 0xff) continue;
+        do c = stbi__get8(z->s); while (c == 0xff); // consume fill bytes
+        if (c != 0) {
+            z->marker = (unsigned char) c;
+            z->nomore = 1;
+            return;
+        }
+    }
+}
+
+// decode row j of interleaved MCUs into the component planes. returns 0 on
+// error, 2 if a restart marker is missing (the caller stops and keeps what
+// it has), 1 otherwise
+static int stbi__jpeg_decode_imcu_row(stbi__jpeg *z, int j)
+{
+    int i,k,x,y,idct;
+    STBI_SIMD_ALIGN(short, data[64]);
+    for (i=0; i < z->img_mcu_x; ++i) {
+        idct = j >= z->need_y0 && j < z->need_y1 && i >= z->need_x0 && i < z->need_x1;
+        // stbi_load_region: a restart interval of MCUs nobody needs is skipped
+        // in the byte stream, without decoding
+        if (z->todo == z->restart_interval && z->code_bits == 0 && !stbi__jpeg_interval_needed(z, j * z->img_mcu_x + i))
+        stbi__jpeg_skip_interval(z);
+        // scan an interleaved mcu... process scan_n components in order
+        for (k=0; k < z->scan_n && !z->skip_interval; ++k) {
+            int n = z->order[k];
+            // scan out an mcu's worth of this component; that's just determined
+            // by the basic H and V specified for the component
+            for (y=0; y < z->img_comp[n].v; ++y) {
+                for (x=0; x < z->img_comp[n].h; ++x) {
+                    int x2 = (i*z->img_comp[n].h + x) << z->img_comp[n].hshift;
+                    int y2 = ((j*z->img_comp[n].v + y) << z->img_comp[n].vshift) % z->img_comp[n].ring_h;
+                    int ha = z->img_comp[n].ha, ok;
+                    if (z->coefficients_only) {
+                        short *block = z->img_comp[n].coeff + 64 * (i*z->img_comp[n].h + x + (j*z->img_comp[n].v + y) * z->img_comp[n].coeff_w);
+                        STBI_PROFILE_BEGIN(entropy);
+                        ok = stbi__jpeg_decode_block(z, block, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, stbi__jpeg_unit_dequant);
+                        STBI_PROFILE_END(entropy);
+                        if (!ok) return 0;
+                        continue;
+                    }
+                    STBI_PROFILE_BEGIN(entropy);
+                    ok = stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]);
+                    STBI_PROFILE_END(entropy);
+                    if (!ok) return 0;
+                    if (!idct) continue;
+                    STBI_PROFILE_BEGIN(idct);
+                    stbi__jpeg_idct(z, n, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, data);
+                    STBI_PROFILE_END(idct);
+                }
+            }
+        }
+        // after all interleaved components, that's an interleaved MCU,
+        // so now count down the restart interval
+        if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker)) return 2;
+            stbi__jpeg_reset(z);
+        }
+    }
+    return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
     stbi__jpeg_reset(z);
@@ -2757,13 +4245,25 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             // in trivial scanline order
             // number of blocks to do just depends on how many actual "pixels" this
             // component has, independent of interleaved MCU blocking and such
-            int w = (z->img_comp[n].x+7) >> 3;
-            int h = (z->img_comp[n].y+7) >> 3;
+            int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].hshift);
+            int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].vshift);
             for (j=0; j < h; ++j) {
                 for (i=0; i < w; ++i) {
-                    int ha = z->img_comp[n].ha;
-                    if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                    z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+                    int ha = z->img_comp[n].ha, ok;
+                    if (z->coefficients_only) {
+                        STBI_PROFILE_BEGIN(entropy);
+                        ok = stbi__jpeg_decode_block(z, z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w), z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, stbi__jpeg_unit_dequant);
+                        STBI_PROFILE_END(entropy);
+                        if (!ok) return 0;
+                    } else {
+                        STBI_PROFILE_BEGIN(entropy);
+                        ok = stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]);
+                        STBI_PROFILE_END(entropy);
+                        if (!ok) return 0;
+                        STBI_PROFILE_BEGIN(idct);
+                        stbi__jpeg_idct(z, n, z->img_comp[n].data+z->img_comp[n].w2*(j << z->img_comp[n].vshift)+(i << z->img_comp[n].hshift), data);
+                        STBI_PROFILE_END(idct);
+                    }
                     // every data block is an MCU, so countdown the restart interval
                     if (--z->todo <= 0) {
                         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2776,33 +4276,10 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             }
             return 1;
         } else { // interleaved
-            int i,j,k,x,y;
-            STBI_SIMD_ALIGN(short, data[64]);
+            int j,r;
             for (j=0; j < z->img_mcu_y; ++j) {
-                for (i=0; i < z->img_mcu_x; ++i) {
-                    // scan an interleaved mcu... process scan_n components in order
-                    for (k=0; k < z->scan_n; ++k) {
-                        int n = z->order[k];
-                        // scan out an mcu's worth of this component; that's just determined
-                        // by the basic H and V specified for the component
-                        for (y=0; y < z->img_comp[n].v; ++y) {
-                            for (x=0; x < z->img_comp[n].h; ++x) {
-                                int x2 = (i*z->img_comp[n].h + x)*8;
-                                int y2 = (j*z->img_comp[n].v + y)*8;
-                                int ha = z->img_comp[n].ha;
-                                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                                z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                            }
-                        }
-                    }
-                    // after all interleaved components, that's an interleaved MCU,
-                    // so now count down the restart interval
-                    if (--z->todo <= 0) {
-                        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                        if (!STBI__RESTART(z->marker)) return 1;
-                        stbi__jpeg_reset(z);
-                    }
-                }
+                r = stbi__jpeg_decode_imcu_row(z, j);
+                if (r != 1) return r != 0;
             }
             return 1;
         }
@@ -2814,19 +4291,21 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             // in trivial scanline order
             // number of blocks to do just depends on how many actual "pixels" this
             // component has, independent of interleaved MCU blocking and such
-            int w = (z->img_comp[n].x+7) >> 3;
-            int h = (z->img_comp[n].y+7) >> 3;
+            int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].hshift);
+            int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].vshift);
             for (j=0; j < h; ++j) {
                 for (i=0; i < w; ++i) {
                     short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+                    int ok;
+                    STBI_PROFILE_BEGIN(entropy);
                     if (z->spec_start == 0) {
-                        if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
-                        return 0;
+                        ok = stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n);
                     } else {
                         int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
-                        return 0;
+                        ok = stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]);
                     }
+                    STBI_PROFILE_END(entropy);
+                    if (!ok) return 0;
                     // every data block is an MCU, so countdown the restart interval
                     if (--z->todo <= 0) {
                         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2850,8 +4329,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                                 int x2 = (i*z->img_comp[n].h + x);
                                 int y2 = (j*z->img_comp[n].v + y);
                                 short *data = z->img_comp[n].coeff + 64 * (x2 + y2 * z->img_comp[n].coeff_w);
-                                if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
-                                return 0;
+                                int ok;
+                                STBI_PROFILE_BEGIN(entropy);
+                                ok = stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n);
+                                STBI_PROFILE_END(entropy);
+                                if (!ok) return 0;
                             }
                         }
                     }
@@ -2882,19 +4364,44 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
         // dequantize and idct the data
         int i,j,n;
         for (n=0; n < z->s->img_n; ++n) {
-            int w = (z->img_comp[n].x+7) >> 3;
-            int h = (z->img_comp[n].y+7) >> 3;
+            int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].hshift);
+            int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].vshift);
             for (j=0; j < h; ++j) {
                 for (i=0; i < w; ++i) {
                     short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+                    STBI_PROFILE_BEGIN(idct);
                     stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-                    z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+                    stbi__jpeg_idct(z, n, z->img_comp[n].data+z->img_comp[n].w2*(j << z->img_comp[n].vshift)+(i << z->img_comp[n].hshift), data);
+                    STBI_PROFILE_END(idct);
                 }
             }
         }
     }
 }
 
+// streaming version of the above: dequantize and idct just the blocks in
+// row j of interleaved MCUs, for the first ncomp components
+static void stbi__jpeg_finish_imcu_row(stbi__jpeg *z, int j, int ncomp)
+{
+    int i,r,n;
+    if (j < z->need_y0 || j >= z->need_y1) return;
+    for (n=0; n < ncomp; ++n) {
+        int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].hshift);
+        int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].vshift);
+        if (w > z->need_x1 * z->img_comp[n].h) w = z->need_x1 * z->img_comp[n].h;
+        for (r=j*z->img_comp[n].v; r < (j+1)*z->img_comp[n].v && r < h; ++r) {
+            stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*((r << z->img_comp[n].vshift) % z->img_comp[n].ring_h);
+            for (i=z->need_x0 * z->img_comp[n].h; i < w; ++i) {
+                short *data = z->img_comp[n].coeff + 64 * (i + r * z->img_comp[n].coeff_w);
+                STBI_PROFILE_BEGIN(idct);
+                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+                stbi__jpeg_idct(z, n, out+(i << z->img_comp[n].hshift), data);
+                STBI_PROFILE_END(idct);
+            }
+        }
+    }
+}
+
 static int stbi__process_marker(stbi__jpeg *z, int m)
 {
     int L;
@@ -3042,17 +4549,18 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
     int i;
     for (i=0; i < ncomp; ++i) {
         if (z->img_comp[i].raw_data) {
-            STBI_FREE(z->img_comp[i].raw_data);
+            stbi__work_free(z->s, z->img_comp[i].raw_data);
             z->img_comp[i].raw_data = NULL;
             z->img_comp[i].data = NULL;
         }
         if (z->img_comp[i].raw_coeff) {
-            STBI_FREE(z->img_comp[i].raw_coeff);
+            if (z->coefficients_only) STBI_FREE(z->img_comp[i].raw_coeff);
+            else stbi__work_free(z->s, z->img_comp[i].raw_coeff);
             z->img_comp[i].raw_coeff = 0;
             z->img_comp[i].coeff = 0;
         }
         if (z->img_comp[i].linebuf) {
-            STBI_FREE(z->img_comp[i].linebuf);
+            stbi__work_free(z->s, z->img_comp[i].linebuf);
             z->img_comp[i].linebuf = NULL;
         }
     }
@@ -3062,7 +4570,7 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
 static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
     stbi__context *s = z->s;
-    int Lf,p,i,q, h_max=1,v_max=1,c;
+    int Lf,p,i,q, h_max=1,v_max=1,c,ring,scale;
     Lf = stbi__get16be(s);         if (Lf < 11) return stbi__err("bad SOF len","Corrupt JPEG"); // JPEG
     p  = stbi__get8(s);            if (p != 8) return stbi__err("only 8-bit","JPEG format not supported: 8-bit only"); // JPEG baseline
     s->img_y = stbi__get16be(s);   if (s->img_y == 0) return stbi__err("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
@@ -3093,6 +4601,20 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
     
     if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
     
+    // a scaled decode entropy decodes the same blocks, but each one's idct
+    // makes 8>>scale pixels a side and everything past that is smaller
+    z->frame_y = s->img_y;
+    z->block_shift = 3;
+    if (!z->coefficients_only && s->opt.jpeg_scale > 1) {
+        switch (s->opt.jpeg_scale) {
+            case 2: z->block_shift = 2; break;
+            case 4: z->block_shift = 1; break;
+            case 8: z->block_shift = 0; break;
+            default: return stbi__err("bad jpeg_scale", "JPEG scale must be 1, 2, 4 or 8");
+        }
+    }
+    scale = 3 - z->block_shift;
+    
     for (i=0; i < s->img_n; ++i) {
         if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
         if (z->img_comp[i].v > v_max) v_max = z->img_comp[i].v;
@@ -3101,16 +4623,41 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
     // compute interleaved mcu info
     z->img_h_max = h_max;
     z->img_v_max = v_max;
-    z->img_mcu_w = h_max * 8;
-    z->img_mcu_h = v_max * 8;
     // these sizes can't be more than 17 bits
-    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
-    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
+    z->img_mcu_x = (s->img_x + h_max*8-1) / (h_max*8);
+    z->img_mcu_y = (s->img_y + v_max*8-1) / (v_max*8);
+    z->img_mcu_w = h_max << z->block_shift;
+    z->img_mcu_h = v_max << z->block_shift;
+    
+    // stbi_load_rows keeps only two MCU rows of each plane, reused as a ring.
+    // the upsampler walks every plane in step only when the vertical
+    // factors divide evenly, so odd ones keep whole planes
+    ring = s->row_sink != NULL && z->img_mcu_y > 2;
+    for (i=0; i < s->img_n; ++i)
+    if (v_max % z->img_comp[i].v) ring = 0;
     
     for (i=0; i < s->img_n; ++i) {
+        // when scaling, a subsampled plane takes a bigger idct rather than
+        // being upsampled from one at the reduced size; e.g. 4:2:0 chroma at
+        // 1/8 decodes 2x2 per block, 4:2:2 chroma 2x1. factors that aren't a
+        // power of two leave the rest to the upsampler
+        int hs = h_max % z->img_comp[i].h ? 1 : h_max / z->img_comp[i].h;
+        int vs = v_max % z->img_comp[i].v ? 1 : v_max / z->img_comp[i].v;
+        int hshift = z->block_shift, vshift = z->block_shift;
+        for (; hs > 1 && !(hs & 1) && hshift < 3; hs >>= 1) ++hshift;
+        for (; vs > 1 && !(vs & 1) && vshift < 3; vs >>= 1) ++vshift;
+        z->img_comp[i].hshift = hshift;
+        z->img_comp[i].vshift = vshift;
+        switch (hshift != vshift ? -1 : hshift) {
+            case 0:  z->img_comp[i].idct = stbi__idct_1x1; break;
+            case 1:  z->img_comp[i].idct = stbi__idct_2x2; break;
+            case 2:  z->img_comp[i].idct = stbi__idct_4x4; break;
+            case 3:  z->img_comp[i].idct = z->idct_block_kernel; break;
+            default: z->img_comp[i].idct = NULL; break;
+        }
         // number of effective pixels (e.g. for non-interleaved MCU)
-        z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
-        z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max-1) / v_max;
+        z->img_comp[i].x = (s->img_x * z->img_comp[i].h + (h_max << (3-hshift))-1) / (h_max << (3-hshift));
+        z->img_comp[i].y = (s->img_y * z->img_comp[i].v + (v_max << (3-vshift))-1) / (v_max << (3-vshift));
         // to simplify generation, we'll allocate enough memory to decode
         // the bogus oversized data from using interleaved MCUs and their
         // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
@@ -3118,27 +4665,45 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
         //
         // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
         // so these muls can't overflow with 32-bit ints (which we require)
-        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+        z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+        z->img_comp[i].w2 = z->img_comp[i].coeff_w << hshift;
+        z->img_comp[i].h2 = z->img_comp[i].coeff_h << vshift;
+        z->img_comp[i].ring_h = ring ? (z->img_comp[i].v * 2) << vshift : z->img_comp[i].h2;
         z->img_comp[i].coeff = 0;
         z->img_comp[i].raw_coeff = 0;
         z->img_comp[i].linebuf = NULL;
-        z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+        if (z->coefficients_only) {
+            // every scan keeps its blocks, and they outlive the decoder
+            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w, z->img_comp[i].coeff_h, 64 * sizeof(short), 0);
+            if (z->img_comp[i].raw_coeff == NULL)
+            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+            z->img_comp[i].coeff = (short*) z->img_comp[i].raw_coeff;
+            // blocks the scans never reach (past the image in non-interleaved files) stay zero
+            memset(z->img_comp[i].coeff, 0, (size_t) z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short));
+            continue;
+        }
+        z->img_comp[i].raw_data = stbi__work_malloc_mad2(z->s, z->img_comp[i].w2, z->img_comp[i].ring_h, 15);
         if (z->img_comp[i].raw_data == NULL)
         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
         // align blocks for idct using mmx/sse
         z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
         if (z->progressive) {
-            // w2, h2 are multiples of 8 (see above)
-            z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-            z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-            z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+            z->img_comp[i].raw_coeff = stbi__work_malloc_mad3(z->s, z->img_comp[i].coeff_w, z->img_comp[i].coeff_h, 64 * sizeof(short), 15);
             if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
             z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
         }
     }
     
+    // the output is the scaled size too, rounded up like the planes
+    s->img_x = (s->img_x + (1 << scale)-1) >> scale;
+    s->img_y = (s->img_y + (1 << scale)-1) >> scale;
+    z->need_x0 = z->need_y0 = 0;
+    z->need_x1 = z->img_mcu_x;
+    z->need_y1 = z->img_mcu_y;
+    z->out_x0 = 0;
+    z->out_w = s->img_x;
     return 1;
 }
 
@@ -3205,13 +4770,13 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
             int Ld = stbi__get16be(j->s);
             stbi__uint32 NL = stbi__get16be(j->s);
             if (Ld != 4) return stbi__err("bad DNL len", "Corrupt JPEG");
-            if (NL != j->s->img_y) return stbi__err("bad DNL height", "Corrupt JPEG");
+            if (NL != j->frame_y) return stbi__err("bad DNL height", "Corrupt JPEG");
         } else {
             if (!stbi__process_marker(j, m)) return 0;
         }
         m = stbi__get_marker(j);
     }
-    if (j->progressive)
+    if (j->progressive && !j->coefficients_only)
     stbi__jpeg_finish(j);
     return 1;
 }
@@ -3261,7 +4826,7 @@ static stbi_uc*  stbi__resample_row_h_2(stbi_uc *out, stbi_uc *in_near, stbi_uc
         out[i*2+0] = stbi__div4(n+input[i-1]);
         out[i*2+1] = stbi__div4(n+input[i+1]);
     }
-    out[i*2+0] = stbi__div4(input[w-2]*3 + input[w-1] + 2);
+    out[i*2+0] = stbi__div4(input[w-1]*3 + input[w-2] + 2);
     out[i*2+1] = input[w-1];
     
     STBI_NOTUSED(in_far);
@@ -3590,6 +5155,7 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+    j->coefficients_only = 0;
     j->idct_block_kernel = stbi__idct_block;
     j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3632,6 +5198,153 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
     return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// number of components to upsample for an n-channel result; YCbCr to grey
+// only needs Y
+static int stbi__jpeg_decode_n(stbi__jpeg *z, int n, int *is_rgb)
+{
+    *is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+    
+    if (z->s->img_n == 3 && n < 3 && !*is_rgb)
+    return 1;
+    else
+    return z->s->img_n;
+}
+
+static int stbi__jpeg_resample_setup(stbi__jpeg *z, stbi__resample *res_comp, int decode_n)
+{
+    int k;
+    for (k=0; k < decode_n; ++k) {
+        stbi__resample *r = &res_comp[k];
+        
+        // allocate line buffer big enough for upsampling off the edges
+        // with upsample factor of 4
+        z->img_comp[k].linebuf = (stbi_uc *) stbi__work_malloc(z->s, z->out_w + 3);
+        if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+        
+        // out_x0 is a whole number of MCUs, so divides by hs. a plane
+        // decoded with a bigger idct than the largest one needs less
+        r->hs      = (z->img_h_max / z->img_comp[k].h) >> (z->img_comp[k].hshift - z->block_shift);
+        r->vs      = (z->img_v_max / z->img_comp[k].v) >> (z->img_comp[k].vshift - z->block_shift);
+        r->ystep   = r->vs >> 1;
+        r->w_lores = (z->out_w + r->hs-1) / r->hs;
+        r->ypos    = 0;
+        r->line0   = r->line1 = z->img_comp[k].data + z->out_x0 / r->hs;
+        
+        if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+        else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+        else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+        else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+        else                               r->resample = stbi__resample_row_generic;
+    }
+    return 1;
+}
+
+// upsample the next output row of each component into coutput[], or with
+// coutput NULL just step past it
+static void stbi__jpeg_resample_row(stbi__jpeg *z, stbi__resample *res_comp, int decode_n, stbi_uc *coutput[4])
+{
+    int k;
+    for (k=0; k < decode_n; ++k) {
+        stbi__resample *r = &res_comp[k];
+        int y_bot = r->ystep >= (r->vs >> 1);
+        if (coutput)
+        coutput[k] = r->resample(z->img_comp[k].linebuf,
+                                 y_bot ? r->line1 : r->line0,
+                                 y_bot ? r->line0 : r->line1,
+                                 r->w_lores, r->hs);
+        if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+            r->line1 = z->img_comp[k].data + (r->ypos % z->img_comp[k].ring_h) * z->img_comp[k].w2 + z->out_x0 / r->hs;
+        }
+    }
+}
+
+// color convert one upsampled row to n channels. with n==3 this stores one
+// byte past the end of the row
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi_uc *out, stbi_uc *coutput[4], int n, int is_rgb)
+{
+    unsigned int i;
+    if (n >= 3) {
+        stbi_uc *y = coutput[0];
+        if (z->s->img_n == 3) {
+            if (is_rgb) {
+                for (i=0; i < z->out_w; ++i) {
+                    out[0] = y[i];
+                    out[1] = coutput[1][i];
+                    out[2] = coutput[2][i];
+                    out[3] = 255;
+                    out += n;
+                }
+            } else {
+                z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->out_w, n);
+            }
+        } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+                for (i=0; i < z->out_w; ++i) {
+                    stbi_uc m = coutput[3][i];
+                    out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                    out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                    out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                    out[3] = 255;
+                    out += n;
+                }
+            } else if (z->app14_color_transform == 2) { // YCCK
+                z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->out_w, n);
+                for (i=0; i < z->out_w; ++i) {
+                    stbi_uc m = coutput[3][i];
+                    out[0] = stbi__blinn_8x8(255 - out[0], m);
+                    out[1] = stbi__blinn_8x8(255 - out[1], m);
+                    out[2] = stbi__blinn_8x8(255 - out[2], m);
+                    out += n;
+                }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+                z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->out_w, n);
+            }
+        } else
+        for (i=0; i < z->out_w; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+        }
+    } else {
+        if (is_rgb) {
+            if (n == 1)
+            for (i=0; i < z->out_w; ++i)
+            *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+                for (i=0; i < z->out_w; ++i, out += 2) {
+                    out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                    out[1] = 255;
+                }
+            }
+        } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->out_w; ++i) {
+                stbi_uc m = coutput[3][i];
+                stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+                stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+                stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+                out[0] = stbi__compute_y(r, g, b);
+                out[1] = 255;
+                out += n;
+            }
+        } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->out_w; ++i) {
+                out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+                out[1] = 255;
+                out += n;
+            }
+        } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+            for (i=0; i < z->out_w; ++i) out[i] = y[i];
+            else
+            for (i=0; i < z->out_w; ++i) { *out++ = y[i]; *out++ = 255; }
+        }
+    }
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
     int n, decode_n, is_rgb;
@@ -3646,142 +5359,52 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
     // determine actual number of components to generate
     n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
     
-    is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-    
-    if (z->s->img_n == 3 && n < 3 && !is_rgb)
-    decode_n = 1;
-    else
-    decode_n = z->s->img_n;
+    decode_n = stbi__jpeg_decode_n(z, n, &is_rgb);
     
     // resample and color-convert
     {
-        int k;
-        unsigned int i,j;
-        stbi_uc *output;
+        unsigned int j;
+        stbi_uc *output, *last_row = NULL;
+        size_t out_stride;
         stbi_uc *coutput[4];
         
         stbi__resample res_comp[4];
         
-        for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            
-            // allocate line buffer big enough for upsampling off the edges
-            // with upsample factor of 4
-            z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-            if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-            
-            r->hs      = z->img_h_max / z->img_comp[k].h;
-            r->vs      = z->img_v_max / z->img_comp[k].v;
-            r->ystep   = r->vs >> 1;
-            r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-            r->ypos    = 0;
-            r->line0   = r->line1 = z->img_comp[k].data;
-            
-            if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-            else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-            else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-            else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-            else                               r->resample = stbi__resample_row_generic;
-        }
+        if (!stbi__jpeg_resample_setup(z, res_comp, decode_n)) { stbi__cleanup_jpeg(z); return NULL; }
         
         // can't error after this so, this is safe
-        output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-        if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+        if (z->s->out_user) {
+            // stbi_load_into: write rows straight into the caller's buffer.
+            // the converters store a 4th byte even when n==3, which would run
+            // off the end of the buffer on the last row, so that one goes
+            // through a scratch row
+            if (!stbi__out_user_fits(z->s, z->s->img_x, z->s->img_y, n)) { stbi__cleanup_jpeg(z); return NULL; }
+            output = z->s->out_user;
+            out_stride = z->s->out_user_stride;
+            if (n == 3) {
+                last_row = (stbi_uc *) stbi__work_malloc_mad2(z->s, n, z->s->img_x, 1);
+                if (!last_row) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+            }
+        } else {
+            output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+            if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+            out_stride = n * z->s->img_x;
+        }
         
         // now go ahead and resample
         for (j=0; j < z->s->img_y; ++j) {
-            stbi_uc *out = output + n * z->s->img_x * j;
-            for (k=0; k < decode_n; ++k) {
-                stbi__resample *r = &res_comp[k];
-                int y_bot = r->ystep >= (r->vs >> 1);
-                coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                         y_bot ? r->line1 : r->line0,
-                                         y_bot ? r->line0 : r->line1,
-                                         r->w_lores, r->hs);
-                if (++r->ystep >= r->vs) {
-                    r->ystep = 0;
-                    r->line0 = r->line1;
-                    if (++r->ypos < z->img_comp[k].y)
-                    r->line1 += z->img_comp[k].w2;
-                }
-            }
-            if (n >= 3) {
-                stbi_uc *y = coutput[0];
-                if (z->s->img_n == 3) {
-                    if (is_rgb) {
-                        for (i=0; i < z->s->img_x; ++i) {
-                            out[0] = y[i];
-                            out[1] = coutput[1][i];
-                            out[2] = coutput[2][i];
-                            out[3] = 255;
-                            out += n;
-                        }
-                    } else {
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                    }
-                } else if (z->s->img_n == 4) {
-                    if (z->app14_color_transform == 0) { // CMYK
-                        for (i=0; i < z->s->img_x; ++i) {
-                            stbi_uc m = coutput[3][i];
-                            out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                            out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                            out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                            out[3] = 255;
-                            out += n;
-                        }
-                    } else if (z->app14_color_transform == 2) { // YCCK
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                        for (i=0; i < z->s->img_x; ++i) {
-                            stbi_uc m = coutput[3][i];
-                            out[0] = stbi__blinn_8x8(255 - out[0], m);
-                            out[1] = stbi__blinn_8x8(255 - out[1], m);
-                            out[2] = stbi__blinn_8x8(255 - out[2], m);
-                            out += n;
-                        }
-                    } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                    }
-                } else
-                for (i=0; i < z->s->img_x; ++i) {
-                    out[0] = out[1] = out[2] = y[i];
-                    out[3] = 255; // not used if n==3
-                    out += n;
-                }
-            } else {
-                if (is_rgb) {
-                    if (n == 1)
-                    for (i=0; i < z->s->img_x; ++i)
-                    *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                    else {
-                        for (i=0; i < z->s->img_x; ++i, out += 2) {
-                            out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                            out[1] = 255;
-                        }
-                    }
-                } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-                    for (i=0; i < z->s->img_x; ++i) {
-                        stbi_uc m = coutput[3][i];
-                        stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                        stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                        stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                        out[0] = stbi__compute_y(r, g, b);
-                        out[1] = 255;
-                        out += n;
-                    }
-                } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-                    for (i=0; i < z->s->img_x; ++i) {
-                        out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                        out[1] = 255;
-                        out += n;
-                    }
-                } else {
-                    stbi_uc *y = coutput[0];
-                    if (n == 1)
-                    for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-                    else
-                    for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-                }
-            }
+            stbi_uc *out = output + (size_t) out_stride * j;
+            if (last_row && j == z->s->img_y-1) out = last_row;
+            STBI_PROFILE_BEGIN(upsample);
+            stbi__jpeg_resample_row(z, res_comp, decode_n, coutput);
+            STBI_PROFILE_END(upsample);
+            STBI_PROFILE_BEGIN(convert);
+            stbi__jpeg_convert_row(z, out, coutput, n, is_rgb);
+            STBI_PROFILE_END(convert);
+        }
+        if (last_row) {
+            memcpy(output + (size_t) out_stride * (z->s->img_y-1), last_row, n * z->s->img_x);
+            stbi__work_free(z->s, last_row);
         }
         stbi__cleanup_jpeg(z);
         *out_x = z->s->img_x;
@@ -3791,27 +5414,246 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
     }
 }
 
-static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+// stbi_load_rows: go back to whole planes for scans that aren't a single
+// interleaved pass over every component. nothing has been decoded yet
+static int stbi__jpeg_unring(stbi__jpeg *z)
+{
+    int i;
+    for (i=0; i < z->s->img_n; ++i) {
+        if (z->img_comp[i].ring_h == z->img_comp[i].h2) continue;
+        stbi__work_free(z->s, z->img_comp[i].raw_data);
+        z->img_comp[i].ring_h = z->img_comp[i].h2;
+        z->img_comp[i].raw_data = stbi__work_malloc_mad2(z->s, z->img_comp[i].w2, z->img_comp[i].h2, 15);
+        z->img_comp[i].data = NULL;
+        if (z->img_comp[i].raw_data == NULL) return stbi__err("outofmem", "Out of memory");
+        z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+    }
+    return 1;
+}
+
+// output rows that can be produced once MCU row j is in the planes. row y
+// upsamples from plane row (y + vs/2) / vs and the one before it
+static int stbi__jpeg_rows_ready(stbi__jpeg *z, stbi__resample *res_comp, int decode_n, int j)
+{
+    int k, ready = z->s->img_y;
+    if (j == z->img_mcu_y-1) return ready;
+    for (k=0; k < decode_n; ++k) {
+        int have = ((j+1) * z->img_comp[k].v) << z->img_comp[k].vshift;
+        if (have < z->img_comp[k].y) {
+            int vs = res_comp[k].vs;
+            if (have * vs - (vs >> 1) < ready) ready = have * vs - (vs >> 1);
+        }
+    }
+    return ready;
+}
+
+// upsample, color convert and send rows up to 'limit', a band at a time
+static int stbi__jpeg_emit_rows(stbi__jpeg *z, stbi__resample *res_comp, int decode_n, int n, int is_rgb, stbi_uc *band, int *next_row, int limit)
+{
+    int j, count, row_bytes = z->out_w * n;
+    stbi_uc *coutput[4];
+    // rows outside stbi_load_region's rectangle aren't made
+    if (limit > z->s->row_sink->y1) limit = z->s->row_sink->y1;
+    for (; *next_row < limit && *next_row < z->s->row_sink->y0; ++*next_row)
+    stbi__jpeg_resample_row(z, res_comp, decode_n, NULL);
+    while (*next_row < limit) {
+        count = limit - *next_row;
+        if (count > z->img_mcu_h) count = z->img_mcu_h;
+        for (j=0; j < count; ++j) {
+            STBI_PROFILE_BEGIN(upsample);
+            stbi__jpeg_resample_row(z, res_comp, decode_n, coutput);
+            STBI_PROFILE_END(upsample);
+            STBI_PROFILE_BEGIN(convert);
+            stbi__jpeg_convert_row(z, band + (size_t) j * row_bytes, coutput, n, is_rgb);
+            STBI_PROFILE_END(convert);
+        }
+        if (!stbi__emit_rows(z->s->row_sink, band, *next_row, count)) return 0;
+        *next_row += count;
+    }
+    return 1;
+}
+
+// stbi_load_region: upsample and convert only the MCU columns around the
+// rectangle, keeping at least a pixel either side of it so the edge-of-row
+// filtering falls outside, and idct only the MCUs those rows read from
+static void stbi__jpeg_region(stbi__jpeg *z, stbi__row_sink *k)
+{
+    int x1;
+    if (!k->region) return;
+    z->need_x0 = k->left > 0 ? (k->left-1) / z->img_mcu_w : 0;
+    z->need_x1 = k->left + k->width < (int) z->s->img_x ? (k->left + k->width) / z->img_mcu_w + 1 : z->img_mcu_x;
+    z->need_y0 = k->y0 / z->img_mcu_h - 1;
+    z->need_y1 = (k->y1-1) / z->img_mcu_h + 2;
+    if (z->need_y0 < 0) z->need_y0 = 0;
+    if (z->need_y1 > z->img_mcu_y) z->need_y1 = z->img_mcu_y;
+    
+    x1 = z->need_x1 * z->img_mcu_w;
+    z->out_x0 = z->need_x0 * z->img_mcu_w;
+    z->out_w = (x1 < (int) z->s->img_x ? x1 : (int) z->s->img_x) - z->out_x0;
+    k->span_x0 = z->out_x0;
+    k->span_w = z->out_w;
+}
+
+// stbi_load_rows: a baseline image that is one interleaved scan is upsampled
+// and converted an MCU row at a time out of a two-row ring of planes.
+// progressive images keep their coefficients but also idct into the ring
+static int stbi__jpeg_stream_image(stbi__jpeg *z, int req_comp)
+{
+    stbi__resample res_comp[4];
+    stbi_uc *band = NULL;
+    int j, m, n, decode_n, is_rgb, r = 1, next_row = 0, ok = 0;
+    
+    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+    for (m = 0; m < 4; m++) {
+        z->img_comp[m].raw_data = NULL;
+        z->img_comp[m].raw_coeff = NULL;
+        z->img_comp[m].linebuf = NULL;
+    }
+    if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+    z->restart_interval = 0;
+    if (!stbi__decode_jpeg_header(z, STBI__SCAN_load)) goto done;
+    
+    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+    decode_n = stbi__jpeg_decode_n(z, n, &is_rgb);
+    if (!stbi__row_sink_begin(z->s->row_sink, z->s->img_x, z->s->img_y, z->s->img_n >= 3 ? 3 : 1, n)) goto done;
+    stbi__jpeg_region(z, z->s->row_sink);
+    band = (stbi_uc *) stbi__work_malloc_mad3(z->s, z->out_w, n, z->img_mcu_h, 1);
+    if (!band) { stbi__err("outofmem", "Out of memory"); goto done; }
+    
+    m = stbi__get_marker(z);
+    while (!stbi__EOI(m)) {
+        if (stbi__SOS(m)) {
+            if (!stbi__process_scan_header(z)) goto done;
+            if (!z->progressive && z->scan_n == z->s->img_n) {
+                if (!stbi__jpeg_resample_setup(z, res_comp, decode_n)) goto done;
+                stbi__jpeg_reset(z);
+                for (j=0; j < z->img_mcu_y && next_row < z->s->row_sink->y1; ++j) {
+                    // on a missing restart marker, keep going with what's there
+                    if (r == 1) r = stbi__jpeg_decode_imcu_row(z, j);
+                    if (r == 0) goto done;
+                    if (!stbi__jpeg_emit_rows(z, res_comp, decode_n, n, is_rgb, band, &next_row, stbi__jpeg_rows_ready(z, res_comp, decode_n, j))) goto done;
+                }
+                // every row has been delivered; ignore any further scans
+                ok = 1;
+                goto done;
+            }
+            if (!z->progressive && !stbi__jpeg_unring(z)) goto done;
+            if (!stbi__parse_entropy_coded_data(z)) goto done;
+            if (z->marker == STBI__MARKER_none ) {
+                // handle 0s at the end of image data from IP Kamera 9060
+                while (!stbi__at_eof(z->s)) {
+                    int x = stbi__get8(z->s);
+                    if (x == 255) {
+                        z->marker = stbi__get8(z->s);
+                        break;
+                    }
+                }
+            }
+        } else if (stbi__DNL(m)) {
+            int Ld = stbi__get16be(z->s);
+            stbi__uint32 NL = stbi__get16be(z->s);
+            if (Ld != 4) { stbi__err("bad DNL len", "Corrupt JPEG"); goto done; }
+            if (NL != z->frame_y) { stbi__err("bad DNL height", "Corrupt JPEG"); goto done; }
+        } else {
+            if (!stbi__process_marker(z, m)) goto done;
+        }
+        m = stbi__get_marker(z);
+    }
+    
+    if (!stbi__jpeg_resample_setup(z, res_comp, decode_n)) goto done;
+    if (z->progressive) {
+        for (j=0; j < z->img_mcu_y && next_row < z->s->row_sink->y1; ++j) {
+            stbi__jpeg_finish_imcu_row(z, j, decode_n);
+            if (!stbi__jpeg_emit_rows(z, res_comp, decode_n, n, is_rgb, band, &next_row, stbi__jpeg_rows_ready(z, res_comp, decode_n, j))) goto done;
+        }
+    } else {
+        // separate scans per component: the planes are whole
+        if (!stbi__jpeg_emit_rows(z, res_comp, decode_n, n, is_rgb, band, &next_row, z->s->img_y)) goto done;
+    }
+    ok = 1;
+
+done:
+    stbi__work_free(z->s, band);
+    stbi__cleanup_jpeg(z);
+    return ok;
+}
+
+static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+    unsigned char* result;
+    stbi__jpeg* j = (stbi__jpeg*) stbi__work_malloc(s, sizeof(stbi__jpeg));
+    STBI_NOTUSED(ri);
+    if (!j) return stbi__errpuc("outofmem", "Out of memory");
+    j->s = s;
+    stbi__setup_jpeg(j);
+    result = load_jpeg_image(j, x,y,comp,req_comp);
+    stbi__work_free(s, j);
+    return result;
+}
+
+static int stbi__jpeg_load_rows(stbi__context *s, int req_comp)
+{
+    int result;
+    stbi__jpeg* j = (stbi__jpeg*) stbi__work_malloc(s, sizeof(stbi__jpeg));
+    if (!j) return stbi__err("outofmem", "Out of memory");
+    j->s = s;
+    stbi__setup_jpeg(j);
+    result = stbi__jpeg_stream_image(j, req_comp);
+    stbi__work_free(s, j);
+    return result;
+}
+
+static int stbi__jpeg_load_coefficients(stbi__context *s, stbi_jpeg_coefficients *out)
 {
-    unsigned char* result;
-    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
-    STBI_NOTUSED(ri);
+    int i, ok = 0;
+    stbi__jpeg* j = (stbi__jpeg*) stbi__work_malloc(s, sizeof(stbi__jpeg));
+    if (!j) return stbi__err("outofmem", "Out of memory");
     j->s = s;
     stbi__setup_jpeg(j);
-    result = load_jpeg_image(j, x,y,comp,req_comp);
-    STBI_FREE(j);
-    return result;
+    j->coefficients_only = 1;
+    s->img_n = 0; // make stbi__cleanup_jpeg safe
+    if (stbi__decode_jpeg_image(j)) {
+        if (s->img_n == 4) {
+            stbi__err("CMYK", "JPEG format not supported: CMYK");
+        } else {
+            out->width = s->img_x;
+            out->height = s->img_y;
+            out->components = s->img_n;
+            out->h_max = j->img_h_max;
+            out->v_max = j->img_v_max;
+            stbi__jpeg_decode_n(j, s->img_n, &out->is_rgb);
+            for (i=0; i < s->img_n; ++i) {
+                stbi_jpeg_component *c = &out->comp[i];
+                c->h = j->img_comp[i].h;
+                c->v = j->img_comp[i].v;
+                c->width = j->img_comp[i].x;
+                c->height = j->img_comp[i].y;
+                c->blocks_w = j->img_comp[i].coeff_w;
+                c->blocks_h = j->img_comp[i].coeff_h;
+                memcpy(c->quant, j->dequant[j->img_comp[i].tq], sizeof(c->quant));
+                // the caller owns the blocks from here on
+                c->coeff = j->img_comp[i].coeff;
+                j->img_comp[i].raw_coeff = NULL;
+                j->img_comp[i].coeff = NULL;
+            }
+            ok = 1;
+        }
+    }
+    stbi__cleanup_jpeg(j);
+    stbi__work_free(s, j);
+    return ok;
 }
 
 static int stbi__jpeg_test(stbi__context *s)
 {
     int r;
-    stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+    stbi__jpeg* j = (stbi__jpeg*) stbi__work_malloc(s, sizeof(stbi__jpeg));
+    if (!j) return stbi__err("outofmem", "Out of memory");
     j->s = s;
     stbi__setup_jpeg(j);
     r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
     stbi__rewind(s);
-    STBI_FREE(j);
+    stbi__work_free(s, j);
     return r;
 }
 
@@ -3830,10 +5672,11 @@ static int stbi__jpeg_info_raw(stbi__jpeg *j, int *x, int *y, int *comp)
 static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 {
     int result;
-    stbi__jpeg* j = (stbi__jpeg*) (stbi__malloc(sizeof(stbi__jpeg)));
+    stbi__jpeg* j = (stbi__jpeg*) stbi__work_malloc(s, sizeof(stbi__jpeg));
+    if (!j) return stbi__err("outofmem", "Out of memory");
     j->s = s;
     result = stbi__jpeg_info_raw(j, x, y, comp);
-    STBI_FREE(j);
+    stbi__work_free(s, j);
     return result;
 }
 #endif
@@ -3943,6 +5786,13 @@ typedef struct
     char *zout_start;
     char *zout_end;
     int   z_expandable;
+    stbi_allocator const *alloc; // for growing the output buffer
+    
+    // streaming: output is handed to zflush as the window fills, instead of
+    // growing the buffer to hold everything
+    int (*zflush)(void *user, stbi_uc *data, int len);
+    void *zflush_user;
+    char *zout_flushed;
     
     stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
@@ -4004,18 +5854,40 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
     return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+#define STBI__ZWINDOW 32768 // furthest a match can reach back
+
+// streaming: pass everything inflated since the last flush to the consumer
+static int stbi__zflush(stbi__zbuf *z)
+{
+    int n = (int) (z->zout - z->zout_flushed);
+    if (n > 0 && !z->zflush(z->zflush_user, (stbi_uc *) z->zout_flushed, n)) return 0;
+    z->zout_flushed = z->zout;
+    return 1;
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
     char *q;
     int cur, limit, old_limit;
     z->zout = zout;
+    if (z->zflush) {
+        // flush, then slide down the last 32k for later matches. the buffer
+        // is 96k, so that always leaves room for the largest single write
+        // (a 64k stored block)
+        int keep;
+        if (!stbi__zflush(z)) return 0;
+        keep = (int) (z->zout - z->zout_start);
+        if (keep > STBI__ZWINDOW) keep = STBI__ZWINDOW;
+        memmove(z->zout_start, z->zout - keep, keep);
+        z->zout = z->zout_flushed = z->zout_start + keep;
+        return 1;
+    }
     if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
     cur   = (int) (z->zout     - z->zout_start);
     limit = old_limit = (int) (z->zout_end - z->zout_start);
     while (cur + n > limit)
     limit *= 2;
-    q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
-    STBI_NOTUSED(old_limit);
+    q = (char *) z->alloc->resize(z->alloc->user, z->zout_start, old_limit, limit);
     if (q == NULL) return stbi__err("outofmem", "Out of memory");
     z->zout_start = q;
     z->zout       = q + cur;
@@ -4229,30 +6101,65 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 
 static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
 {
+    int result;
     a->zout_start = obuf;
     a->zout       = obuf;
     a->zout_end   = obuf + olen;
     a->z_expandable = exp;
+    a->zflush = NULL;
     
-    return stbi__parse_zlib(a, parse_header);
+    STBI_PROFILE_BEGIN(inflate);
+    result = stbi__parse_zlib(a, parse_header);
+    STBI_PROFILE_END(inflate);
+    return result;
 }
 
-STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
+// inflate through a fixed sliding window, passing the output to 'flush' in
+// pieces; memory use doesn't depend on the size of the decompressed data
+static int stbi__zinflate_stream(stbi__context *s, stbi_uc const *buffer, int len, int parse_header, int (*flush)(void *user, stbi_uc *data, int len), void *user)
+{
+    int result;
+    stbi__zbuf a;
+    char *p = (char *) stbi__work_malloc(s, STBI__ZWINDOW * 3);
+    if (p == NULL) return stbi__err("outofmem", "Out of memory");
+    a.zbuffer = (stbi_uc *) buffer;
+    a.zbuffer_end = (stbi_uc *) buffer + len;
+    a.zout_start = a.zout = a.zout_flushed = p;
+    a.alloc = s->work;
+    a.zout_end = p + STBI__ZWINDOW * 3;
+    a.z_expandable = 1;
+    a.zflush = flush;
+    a.zflush_user = user;
+    STBI_PROFILE_BEGIN(inflate);
+    result = stbi__parse_zlib(&a, parse_header) && stbi__zflush(&a);
+    STBI_PROFILE_END(inflate);
+    stbi__work_free(s, a.zout_start);
+    return result;
+}
+
+// inflate into a buffer from 'alloc', which may be scratch memory
+static char *stbi__zinflate_alloc(stbi_allocator const *alloc, const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
     stbi__zbuf a;
-    char *p = (char *) stbi__malloc(initial_size);
+    char *p = (char *) alloc->alloc(alloc->user, initial_size);
     if (p == NULL) return NULL;
     a.zbuffer = (stbi_uc *) buffer;
     a.zbuffer_end = (stbi_uc *) buffer + len;
-    if (stbi__do_zlib(&a, p, initial_size, 1, 1)) {
+    a.alloc = alloc;
+    if (stbi__do_zlib(&a, p, initial_size, 1, parse_header)) {
         if (outlen) *outlen = (int) (a.zout - a.zout_start);
         return a.zout_start;
     } else {
-        STBI_FREE(a.zout_start);
+        alloc->release(alloc->user, a.zout_start);
         return NULL;
     }
 }
 
+STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
+{
+    return stbi__zinflate_alloc(&stbi__heap_allocator, buffer, len, initial_size, outlen, 1);
+}
+
 STBIDEF char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 {
     return stbi_zlib_decode_malloc_guesssize(buffer, len, 16384, outlen);
@@ -4260,18 +6167,7 @@ STBIDEF char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
-    stbi__zbuf a;
-    char *p = (char *) stbi__malloc(initial_size);
-    if (p == NULL) return NULL;
-    a.zbuffer = (stbi_uc *) buffer;
-    a.zbuffer_end = (stbi_uc *) buffer + len;
-    if (stbi__do_zlib(&a, p, initial_size, 1, parse_header)) {
-        if (outlen) *outlen = (int) (a.zout - a.zout_start);
-        return a.zout_start;
-    } else {
-        STBI_FREE(a.zout_start);
-        return NULL;
-    }
+    return stbi__zinflate_alloc(&stbi__heap_allocator, buffer, len, initial_size, outlen, parse_header);
 }
 
 STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int ilen)
@@ -4287,18 +6183,7 @@ STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer
 
 STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
-    stbi__zbuf a;
-    char *p = (char *) stbi__malloc(16384);
-    if (p == NULL) return NULL;
-    a.zbuffer = (stbi_uc *) buffer;
-    a.zbuffer_end = (stbi_uc *) buffer+len;
-    if (stbi__do_zlib(&a, p, 16384, 1, 0)) {
-        if (outlen) *outlen = (int) (a.zout - a.zout_start);
-        return a.zout_start;
-    } else {
-        STBI_FREE(a.zout_start);
-        return NULL;
-    }
+    return stbi__zinflate_alloc(&stbi__heap_allocator, buffer, len, 16384, outlen, 0);
 }
 
 STBIDEF int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen)
@@ -4352,8 +6237,21 @@ typedef struct
     stbi__context *s;
     stbi_uc *idata, *expanded, *out;
     int depth;
+    int out_direct; // unfilter straight into stbi__context.out_user
+    int out_work;   // 'out' is scratch memory, to be replaced by the palette expansion
 } stbi__png;
 
+static void stbi__png_free_out(stbi__png *p)
+{
+    if (p->out != p->s->out_user) {
+        if (p->out_work)
+        stbi__work_free(p->s, p->out);
+        else
+        STBI_FREE(p->out);
+    }
+    p->out = NULL;
+}
+
 
 enum {
     STBI__F_none=0,
@@ -4388,23 +6286,212 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+// unfilter one scanline of raw (filtered) bytes into cur, with prior the
+// previous unfiltered row. depth < 8 rows are stored packed at the right end
+// of the row so they can be expanded in place
+static void stbi__png_unfilter_row(stbi_uc *cur, stbi_uc *prior, stbi_uc *raw, int filter, stbi__uint32 x, int img_n, int out_n, int depth, stbi__uint32 img_width_bytes)
+{
+    int bytes = (depth == 16? 2 : 1);
+    int output_bytes = out_n*bytes;
+    int filter_bytes = img_n*bytes;
+    int width = x;
+    stbi_uc *row = cur;
+    stbi__uint32 i;
+    int k;
+    
+    if (depth < 8) {
+        STBI_ASSERT(img_width_bytes <= x);
+        cur += x*out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
+        prior += x*out_n - img_width_bytes;
+        filter_bytes = 1;
+        width = img_width_bytes;
+    }
+    
+    // handle first byte explicitly
+    for (k=0; k < filter_bytes; ++k) {
+        switch (filter) {
+            case STBI__F_none       : cur[k] = raw[k]; break;
+            case STBI__F_sub        : cur[k] = raw[k]; break;
+            case STBI__F_up         : cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
+            case STBI__F_avg        : cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1)); break;
+            case STBI__F_paeth      : cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0,prior[k],0)); break;
+            case STBI__F_avg_first  : cur[k] = raw[k]; break;
+            case STBI__F_paeth_first: cur[k] = raw[k]; break;
+        }
+    }
+    
+    if (depth == 8) {
+        if (img_n != out_n)
+        cur[img_n] = 255; // first pixel
+        raw += img_n;
+        cur += out_n;
+        prior += out_n;
+    } else if (depth == 16) {
+        if (img_n != out_n) {
+            cur[filter_bytes]   = 255; // first pixel top byte
+            cur[filter_bytes+1] = 255; // first pixel bottom byte
+        }
+        raw += filter_bytes;
+        cur += output_bytes;
+        prior += output_bytes;
+    } else {
+        raw += 1;
+        cur += 1;
+        prior += 1;
+    }
+    
+    // this is a little gross, so that we don't switch per-pixel or per-component
+    if (depth < 8 || img_n == out_n) {
+        int nk = (width - 1)*filter_bytes;
+#define STBI__CASE(f) \
+case f:     \
+for (k=0; k < nk; ++k)
+        switch (filter) {
+            // "none" filter turns into a memcpy here; make that explicit.
+            case STBI__F_none:         memcpy(cur, raw, nk); break;
+            STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]); } break;
+            STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+            STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1)); } break;
+            STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],prior[k],prior[k-filter_bytes])); } break;
+            STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1)); } break;
+            STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],0,0)); } break;
+        }
+#undef STBI__CASE
+        raw += nk;
+    } else {
+        STBI_ASSERT(img_n+1 == out_n);
+#define STBI__CASE(f) \
+case f:     \
+for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
+for (k=0; k < filter_bytes; ++k)
+        switch (filter) {
+            STBI__CASE(STBI__F_none)         { cur[k] = raw[k]; } break;
+            STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k- output_bytes]); } break;
+            STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+            STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k- output_bytes])>>1)); } break;
+            STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],prior[k],prior[k- output_bytes])); } break;
+            STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k- output_bytes] >> 1)); } break;
+            STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],0,0)); } break;
+        }
+#undef STBI__CASE
+
+        // the loop above sets the high byte of the pixels' alpha, but for
+        // 16 bit png files we also need the low byte set. we'll do that here.
+        if (depth == 16) {
+            cur = row; // start at the beginning of the row again
+            for (i=0; i < x; ++i,cur+=output_bytes) {
+                cur[filter_bytes+1] = 255;
+            }
+        }
+    }
+}
+
+// expand the packed 1/2/4-bit samples at the right end of row to 8 bits
+static void stbi__png_expand_row(stbi_uc *row, stbi__uint32 x, int img_n, int out_n, int depth, int color, stbi__uint32 img_width_bytes)
+{
+    stbi_uc *cur = row;
+    stbi_uc *in  = row + x*out_n - img_width_bytes;
+    int k;
+    // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
+    // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
+    stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+    
+    // note that the final byte might overshoot and write more data than desired.
+    // we can allocate enough data that this never writes out of memory, but it
+    // could also overwrite the next scanline. can it overwrite non-empty data
+    // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
+    // so we need to explicitly clamp the final ones
+    
+    if (depth == 4) {
+        for (k=x*img_n; k >= 2; k-=2, ++in) {
+            *cur++ = scale * ((*in >> 4)       );
+            *cur++ = scale * ((*in     ) & 0x0f);
+        }
+        if (k > 0) *cur++ = scale * ((*in >> 4)       );
+    } else if (depth == 2) {
+        for (k=x*img_n; k >= 4; k-=4, ++in) {
+            *cur++ = scale * ((*in >> 6)       );
+            *cur++ = scale * ((*in >> 4) & 0x03);
+            *cur++ = scale * ((*in >> 2) & 0x03);
+            *cur++ = scale * ((*in     ) & 0x03);
+        }
+        if (k > 0) *cur++ = scale * ((*in >> 6)       );
+        if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
+        if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
+    } else if (depth == 1) {
+        for (k=x*img_n; k >= 8; k-=8, ++in) {
+            *cur++ = scale * ((*in >> 7)       );
+            *cur++ = scale * ((*in >> 6) & 0x01);
+            *cur++ = scale * ((*in >> 5) & 0x01);
+            *cur++ = scale * ((*in >> 4) & 0x01);
+            *cur++ = scale * ((*in >> 3) & 0x01);
+            *cur++ = scale * ((*in >> 2) & 0x01);
+            *cur++ = scale * ((*in >> 1) & 0x01);
+            *cur++ = scale * ((*in     ) & 0x01);
+        }
+        if (k > 0) *cur++ = scale * ((*in >> 7)       );
+        if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
+        if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
+        if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
+        if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
+        if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
+        if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
+    }
+    if (img_n != out_n) {
+        int q;
+        // insert alpha = 255
+        cur = row;
+        if (img_n == 1) {
+            for (q=x-1; q >= 0; --q) {
+                cur[q*2+1] = 255;
+                cur[q*2+0] = cur[q];
+            }
+        } else {
+            STBI_ASSERT(img_n == 3);
+            for (q=x-1; q >= 0; --q) {
+                cur[q*4+3] = 255;
+                cur[q*4+2] = cur[q*3+2];
+                cur[q*4+1] = cur[q*3+1];
+                cur[q*4+0] = cur[q*3+0];
+            }
+        }
+    }
+}
+
+// force 16-bit samples from big-endian to platform-native
+static void stbi__png_swap16(stbi_uc *cur, stbi__uint32 count)
+{
+    stbi__uint16 *cur16 = (stbi__uint16*)cur;
+    stbi__uint32 i;
+    
+    for(i=0; i < count; ++i,cur16++,cur+=2) {
+        *cur16 = (cur[0] << 8) | cur[1];
+    }
+}
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
     int bytes = (depth == 16? 2 : 1);
     stbi__context *s = a->s;
-    stbi__uint32 i,j,stride = x*out_n*bytes;
+    stbi__uint32 j,stride = x*out_n*bytes;
     stbi__uint32 img_len, img_width_bytes;
-    int k;
     int img_n = s->img_n; // copy it into a local for later
     
     int output_bytes = out_n*bytes;
-    int filter_bytes = img_n*bytes;
-    int width = x;
     
     STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-    if (!a->out) return stbi__err("outofmem", "Out of memory");
+    if (a->out_direct) {
+        if (!stbi__out_user_fits(s, x, y, output_bytes)) return 0;
+        a->out = s->out_user;
+        stride = s->out_user_stride;
+    } else {
+        if (a->out_work)
+        a->out = (stbi_uc *) stbi__work_malloc_mad3(s, x, y, output_bytes, 0);
+        else
+        a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+        if (!a->out) return stbi__err("outofmem", "Out of memory");
+    }
     
     if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
     img_width_bytes = (((img_n * x * depth) + 7) >> 3);
@@ -4417,201 +6504,72 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
     
     for (j=0; j < y; ++j) {
         stbi_uc *cur = a->out + stride*j;
-        stbi_uc *prior;
         int filter = *raw++;
         
         if (filter > 4)
         return stbi__err("invalid filter","Corrupt PNG");
         
-        if (depth < 8) {
-            STBI_ASSERT(img_width_bytes <= x);
-            cur += x*out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
-            filter_bytes = 1;
-            width = img_width_bytes;
-        }
-        prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
-        
         // if first row, use special filter that doesn't sample previous row
         if (j == 0) filter = first_row_filter[filter];
         
-        // handle first byte explicitly
-        for (k=0; k < filter_bytes; ++k) {
-            switch (filter) {
-                case STBI__F_none       : cur[k] = raw[k]; break;
-                case STBI__F_sub        : cur[k] = raw[k]; break;
-                case STBI__F_up         : cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
-                case STBI__F_avg        : cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1)); break;
-                case STBI__F_paeth      : cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0,prior[k],0)); break;
-                case STBI__F_avg_first  : cur[k] = raw[k]; break;
-                case STBI__F_paeth_first: cur[k] = raw[k]; break;
-            }
-        }
-        
-        if (depth == 8) {
-            if (img_n != out_n)
-            cur[img_n] = 255; // first pixel
-            raw += img_n;
-            cur += out_n;
-            prior += out_n;
-        } else if (depth == 16) {
-            if (img_n != out_n) {
-                cur[filter_bytes]   = 255; // first pixel top byte
-                cur[filter_bytes+1] = 255; // first pixel bottom byte
-            }
-            raw += filter_bytes;
-            cur += output_bytes;
-            prior += output_bytes;
-        } else {
-            raw += 1;
-            cur += 1;
-            prior += 1;
-        }
-        
-        // this is a little gross, so that we don't switch per-pixel or per-component
-        if (depth < 8 || img_n == out_n) {
-            int nk = (width - 1)*filter_bytes;
-#define STBI__CASE(f) \
-case f:     \
-for (k=0; k < nk; ++k)
-            switch (filter) {
-                // "none" filter turns into a memcpy here; make that explicit.
-                case STBI__F_none:         memcpy(cur, raw, nk); break;
-                STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]); } break;
-                STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-                STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1)); } break;
-                STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],prior[k],prior[k-filter_bytes])); } break;
-                STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1)); } break;
-                STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],0,0)); } break;
-            }
-#undef STBI__CASE
-            raw += nk;
-        } else {
-            STBI_ASSERT(img_n+1 == out_n);
-#define STBI__CASE(f) \
-case f:     \
-for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
-for (k=0; k < filter_bytes; ++k)
-            switch (filter) {
-                STBI__CASE(STBI__F_none)         { cur[k] = raw[k]; } break;
-                STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k- output_bytes]); } break;
-                STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-                STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k- output_bytes])>>1)); } break;
-                STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],prior[k],prior[k- output_bytes])); } break;
-                STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k- output_bytes] >> 1)); } break;
-                STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],0,0)); } break;
-            }
-#undef STBI__CASE
-            
-            // the loop above sets the high byte of the pixels' alpha, but for
-            // 16 bit png files we also need the low byte set. we'll do that here.
-            if (depth == 16) {
-                cur = a->out + stride*j; // start at the beginning of the row again
-                for (i=0; i < x; ++i,cur+=output_bytes) {
-                    cur[filter_bytes+1] = 255;
-                }
-            }
-        }
+        STBI_PROFILE_BEGIN(unfilter);
+        stbi__png_unfilter_row(cur, cur - stride, raw, filter, x, img_n, out_n, depth, img_width_bytes);
+        STBI_PROFILE_END(unfilter);
+        raw += img_width_bytes;
     }
     
     // we make a separate pass to expand bits to pixels; for performance,
     // this could run two scanlines behind the above code, so it won't
     // intefere with filtering but will still be in the cache.
     if (depth < 8) {
-        for (j=0; j < y; ++j) {
-            stbi_uc *cur = a->out + stride*j;
-            stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
-            // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
-            // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
-            stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-            
-            // note that the final byte might overshoot and write more data than desired.
-            // we can allocate enough data that this never writes out of memory, but it
-            // could also overwrite the next scanline. can it overwrite non-empty data
-            // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
-            // so we need to explicitly clamp the final ones
-            
-            if (depth == 4) {
-                for (k=x*img_n; k >= 2; k-=2, ++in) {
-                    *cur++ = scale * ((*in >> 4)       );
-                    *cur++ = scale * ((*in     ) & 0x0f);
-                }
-                if (k > 0) *cur++ = scale * ((*in >> 4)       );
-            } else if (depth == 2) {
-                for (k=x*img_n; k >= 4; k-=4, ++in) {
-                    *cur++ = scale * ((*in >> 6)       );
-                    *cur++ = scale * ((*in >> 4) & 0x03);
-                    *cur++ = scale * ((*in >> 2) & 0x03);
-                    *cur++ = scale * ((*in     ) & 0x03);
-                }
-                if (k > 0) *cur++ = scale * ((*in >> 6)       );
-                if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
-                if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
-            } else if (depth == 1) {
-                for (k=x*img_n; k >= 8; k-=8, ++in) {
-                    *cur++ = scale * ((*in >> 7)       );
-                    *cur++ = scale * ((*in >> 6) & 0x01);
-                    *cur++ = scale * ((*in >> 5) & 0x01);
-                    *cur++ = scale * ((*in >> 4) & 0x01);
-                    *cur++ = scale * ((*in >> 3) & 0x01);
-                    *cur++ = scale * ((*in >> 2) & 0x01);
-                    *cur++ = scale * ((*in >> 1) & 0x01);
-                    *cur++ = scale * ((*in     ) & 0x01);
-                }
-                if (k > 0) *cur++ = scale * ((*in >> 7)       );
-                if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
-                if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
-                if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
-                if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
-                if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
-                if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
-            }
-            if (img_n != out_n) {
-                int q;
-                // insert alpha = 255
-                cur = a->out + stride*j;
-                if (img_n == 1) {
-                    for (q=x-1; q >= 0; --q) {
-                        cur[q*2+1] = 255;
-                        cur[q*2+0] = cur[q];
-                    }
-                } else {
-                    STBI_ASSERT(img_n == 3);
-                    for (q=x-1; q >= 0; --q) {
-                        cur[q*4+3] = 255;
-                        cur[q*4+2] = cur[q*3+2];
-                        cur[q*4+1] = cur[q*3+1];
-                        cur[q*4+0] = cur[q*3+0];
-                    }
-                }
-            }
-        }
+        for (j=0; j < y; ++j)
+        stbi__png_expand_row(a->out + stride*j, x, img_n, out_n, depth, color, img_width_bytes);
     } else if (depth == 16) {
-        // force the image data from big-endian to platform-native.
         // this is done in a separate pass due to the decoding relying
         // on the data being untouched, but could probably be done
         // per-line during decode if care is taken.
-        stbi_uc *cur = a->out;
-        stbi__uint16 *cur16 = (stbi__uint16*)cur;
-        
-        for(i=0; i < x*y*out_n; ++i,cur16++,cur+=2) {
-            *cur16 = (cur[0] << 8) | cur[1];
-        }
+        stbi__png_swap16(a->out, x*y*out_n);
     }
     
     return 1;
 }
 
+// the exact inflated size of an interlaced image; each pass has its own
+// filter bytes
+static stbi__uint32 stbi__png_interlaced_len(stbi__uint32 img_x, stbi__uint32 img_y, int img_n, int depth)
+{
+    static const int xorig[] = { 0,4,0,2,0,1,0 };
+    static const int yorig[] = { 0,0,4,0,2,0,1 };
+    static const int xspc[]  = { 8,8,4,4,2,2,1 };
+    static const int yspc[]  = { 8,8,8,4,4,2,2 };
+    stbi__uint32 len = 0, x, y;
+    int p;
+    for (p=0; p < 7; ++p) {
+        x = (img_x - xorig[p] + xspc[p]-1) / xspc[p];
+        y = (img_y - yorig[p] + yspc[p]-1) / yspc[p];
+        if (x && y)
+        len += ((((img_n * x * depth) + 7) >> 3) + 1) * y;
+    }
+    return len;
+}
+
 static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
     int bytes = (depth == 16 ? 2 : 1);
     int out_bytes = out_n * bytes;
+    int out_work = a->out_work;
     stbi_uc *final;
     int p;
     if (!interlaced)
     return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
     
     // de-interlacing
+    if (out_work)
+    final = (stbi_uc *) stbi__work_malloc_mad3(a->s, a->s->img_x, a->s->img_y, out_bytes, 0);
+    else
     final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+    if (!final) return stbi__err("outofmem", "Out of memory");
+    a->out_work = 1; // the passes are scratch
     for (p=0; p < 7; ++p) {
         int xorig[] = { 0,4,0,2,0,1,0 };
         int yorig[] = { 0,0,4,0,2,0,1 };
@@ -4624,6 +6582,9 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
         if (x && y) {
             stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
             if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
+                if (out_work)
+                stbi__work_free(a->s, final);
+                else
                 STBI_FREE(final);
                 return 0;
             }
@@ -4635,21 +6596,21 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                            a->out + (j*x+i)*out_bytes, out_bytes);
                 }
             }
-            STBI_FREE(a->out);
+            stbi__work_free(a->s, a->out);
+            a->out = NULL;
             image_data += img_len;
             image_data_len -= img_len;
         }
     }
     a->out = final;
+    a->out_work = out_work;
     
     return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static int stbi__compute_transparency(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-    stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-    stbi_uc *p = z->out;
+    stbi__uint32 i;
     
     // compute color-based transparency, assuming we've
     // already got 255 as the alpha value in the output
@@ -4670,11 +6631,9 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
     return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi__uint16 *p, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-    stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-    stbi__uint16 *p = (stbi__uint16*) z->out;
+    stbi__uint32 i;
     
     // compute color-based transparency, assuming we've
     // already got 65535 as the alpha value in the output
@@ -4695,17 +6654,9 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
     return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+static void stbi__expand_palette_row(stbi_uc *p, stbi_uc const *orig, stbi__uint32 pixel_count, stbi_uc *palette, int pal_img_n)
 {
-    stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-    stbi_uc *p, *temp_out, *orig = a->out;
-    
-    p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-    if (p == NULL) return stbi__err("outofmem", "Out of memory");
-    
-    // between here and free(out) below, exitting would leak
-    temp_out = p;
-    
+    stbi__uint32 i;
     if (pal_img_n == 3) {
         for (i=0; i < pixel_count; ++i) {
             int n = orig[i]*4;
@@ -4724,34 +6675,31 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
             p += 4;
         }
     }
-    STBI_FREE(a->out);
+}
+
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+{
+    stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+    stbi_uc *temp_out;
+    
+    temp_out = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+    if (temp_out == NULL) return stbi__err("outofmem", "Out of memory");
+    
+    stbi__expand_palette_row(temp_out, a->out, pixel_count, palette, pal_img_n);
+    stbi__png_free_out(a);
     a->out = temp_out;
+    a->out_work = 0;
     
     STBI_NOTUSED(len);
     
     return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
-
-STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
-{
-    stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
-}
-
-STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
-{
-    stbi__de_iphone_flag = flag_true_if_should_convert;
-}
-
-static void stbi__de_iphone(stbi__png *z)
+static void stbi__de_iphone(stbi_uc *p, stbi__uint32 pixel_count, int img_out_n, int unpremultiply)
 {
-    stbi__context *s = z->s;
-    stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-    stbi_uc *p = z->out;
+    stbi__uint32 i;
     
-    if (s->img_out_n == 3) {  // convert bgr to rgb
+    if (img_out_n == 3) {  // convert bgr to rgb
         for (i=0; i < pixel_count; ++i) {
             stbi_uc t = p[0];
             p[0] = p[2];
@@ -4759,8 +6707,8 @@ static void stbi__de_iphone(stbi__png *z)
             p += 3;
         }
     } else {
-        STBI_ASSERT(s->img_out_n == 4);
-        if (stbi__unpremultiply_on_load) {
+        STBI_ASSERT(img_out_n == 4);
+        if (unpremultiply) {
             // convert bgr to rgb and unpremultiply
             for (i=0; i < pixel_count; ++i) {
                 stbi_uc a = p[3];
@@ -4788,6 +6736,131 @@ static void stbi__de_iphone(stbi__png *z)
     }
 }
 
+// stbi_load_rows: a non-interlaced png is unfiltered and post-processed a
+// row at a time as zlib output arrives, keeping only two unfiltered rows
+typedef struct
+{
+    stbi__png *z;
+    stbi__uint32 x, y, row;      // size, and next row to finish
+    stbi__uint32 img_width_bytes;
+    stbi__uint32 fill;           // bytes of 'raw' received so far
+    int img_n, out_n, depth, color, req_comp;
+    int has_trans, is_iphone, pal_img_n, pal_out_n;
+    stbi_uc *tc, *palette;
+    stbi__uint16 *tc16;
+    stbi_uc *raw;                // filter byte plus one filtered row
+    stbi_uc *cur, *prior;        // unfiltered rows, out_n samples per pixel
+    stbi_uc *line, *pal, *conv;  // post-processing scratch
+} stbi__png_rows;
+
+static int stbi__png_finish_row(stbi__png_rows *r)
+{
+    stbi__context *s = r->z->s;
+    stbi__uint32 i, samples = r->x * r->out_n;
+    int filter = r->raw[0], n = r->out_n;
+    stbi_uc *p = r->line, *t;
+    
+    if (filter > 4) return stbi__err("invalid filter","Corrupt PNG");
+    if (r->row == 0) filter = first_row_filter[filter];
+    STBI_PROFILE_BEGIN(unfilter);
+    stbi__png_unfilter_row(r->cur, r->prior, r->raw+1, filter, r->x, r->img_n, r->out_n, r->depth, r->img_width_bytes);
+    STBI_PROFILE_END(unfilter);
+    
+    if (r->row < (stbi__uint32) s->row_sink->y0) {
+        // above stbi_load_region's rectangle: only the next row needs it
+        t = r->prior; r->prior = r->cur; r->cur = t;
+        ++r->row;
+        return 1;
+    }
+    
+    // the next row filters against cur, so post-process a copy
+    memcpy(p, r->cur, samples * (r->depth == 16 ? 2 : 1));
+    if (r->depth < 8) {
+        stbi__png_expand_row(p, r->x, r->img_n, r->out_n, r->depth, r->color, r->img_width_bytes);
+    } else if (r->depth == 16) {
+        stbi__uint16 *p16 = (stbi__uint16 *) p;
+        stbi__png_swap16(p, samples);
+        if (r->has_trans) stbi__compute_transparency16(p16, r->x, r->tc16, n);
+        if (r->req_comp && r->req_comp != n) {
+            p16 = (stbi__uint16 *) r->conv;
+            stbi__convert_format16_row((stbi__uint16 *) p, p16, n, r->req_comp, r->x);
+            n = r->req_comp;
+            samples = r->x * n;
+        }
+        // same as stbi__convert_16_to_8
+        for (i=0; i < samples; ++i) p[i] = (stbi_uc) ((p16[i] >> 8) & 0xFF);
+    }
+    if (r->depth != 16) {
+        if (r->has_trans) stbi__compute_transparency(p, r->x, r->tc, n);
+        if (r->is_iphone && s->opt.convert_iphone_png && n > 2) stbi__de_iphone(p, r->x, n, s->opt.unpremultiply);
+        if (r->pal_img_n) {
+            n = r->pal_out_n;
+            stbi__expand_palette_row(r->pal, p, r->x, r->palette, n);
+            p = r->pal;
+        }
+        if (r->req_comp && r->req_comp != n) {
+            stbi__convert_format_row(p, r->conv, n, r->req_comp, r->x);
+            p = r->conv;
+        }
+    }
+    
+    t = r->prior; r->prior = r->cur; r->cur = t;
+    return stbi__emit_rows(r->z->s->row_sink, p, r->row++, 1);
+}
+
+// zlib output consumer: gather filtered rows, ignoring trailing data
+static int stbi__png_rows_flush(void *user, stbi_uc *data, int len)
+{
+    stbi__png_rows *r = (stbi__png_rows *) user;
+    while (len > 0 && r->row < r->y) {
+        stbi__uint32 n = r->img_width_bytes + 1 - r->fill;
+        if (n > (stbi__uint32) len) n = len;
+        memcpy(r->raw + r->fill, data, n);
+        r->fill += n;
+        data += n;
+        len -= n;
+        if (r->fill == r->img_width_bytes + 1) {
+            r->fill = 0;
+            if (!stbi__png_finish_row(r)) return 0;
+            // stbi_load_region: stop inflating after the last row wanted
+            if (r->row == (stbi__uint32) r->z->s->row_sink->y1) return r->row == r->y;
+        }
+    }
+    return 1;
+}
+
+static int stbi__png_stream_image(stbi__png_rows *r, stbi_uc *idata, stbi__uint32 ilen, int parse_header)
+{
+    stbi__context *s = r->z->s;
+    int bytes = r->depth == 16 ? 2 : 1, ok;
+    stbi_uc *buf;
+    
+    if (!stbi__mad3sizes_valid(r->img_n, r->x, r->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+    r->img_width_bytes = (((r->img_n * r->x * r->depth) + 7) >> 3);
+    r->row = r->fill = 0;
+    
+    // cur, prior and line rows, conversion scratch for up to 4 channels of
+    // 16 bits, palette scratch, then the filtered row. 16-bit rows come first
+    // to keep them aligned
+    buf = (stbi_uc *) stbi__work_malloc_mad3(s, r->x, 3*r->out_n*bytes + 12, 1, r->img_width_bytes + 1);
+    if (!buf) return stbi__err("outofmem", "Out of memory");
+    r->cur   = buf;
+    r->prior = r->cur   + r->x * r->out_n * bytes;
+    r->line  = r->prior + r->x * r->out_n * bytes;
+    r->conv  = r->line  + r->x * r->out_n * bytes;
+    r->pal   = r->conv  + r->x * 8;
+    r->raw   = r->pal   + r->x * 4;
+    
+    ok = stbi__row_sink_begin(s->row_sink, r->x, r->y, s->img_n, r->req_comp ? r->req_comp : s->img_out_n);
+    if (ok) {
+        ok = stbi__zinflate_stream(s, idata, ilen, parse_header, stbi__png_rows_flush, r);
+        if (!ok && r->row == (stbi__uint32) s->row_sink->y1 && r->row < r->y) ok = 1; // stopped after a region
+        if (ok && r->row < (stbi__uint32) s->row_sink->y1) ok = stbi__err("not enough pixels","Corrupt PNG");
+    }
+    stbi__work_free(s, buf);
+    return ok;
+}
+
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
@@ -4802,6 +6875,8 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
     z->expanded = NULL;
     z->idata = NULL;
     z->out = NULL;
+    z->out_direct = 0;
+    z->out_work = 0;
     
     if (!stbi__check_png_header(s)) return 0;
     
@@ -4888,11 +6963,15 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                 if (ioff + c.length > idata_limit) {
                     stbi__uint32 idata_limit_old = idata_limit;
                     stbi_uc *p;
-                    if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
+                    if (idata_limit == 0) {
+                        idata_limit = c.length > 4096 ? c.length : 4096;
+                        // from memory, the rest of the file bounds the total so one allocation does
+                        if (!s->read_from_callbacks && (stbi__uint32) (s->img_buffer_end - s->img_buffer) > idata_limit)
+                        idata_limit = (stbi__uint32) (s->img_buffer_end - s->img_buffer);
+                    }
                     while (ioff + c.length > idata_limit)
                     idata_limit *= 2;
-                    STBI_NOTUSED(idata_limit_old);
-                    p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+                    p = (stbi_uc *) s->work->resize(s->work->user, z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                     z->idata = p;
                 }
                 if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -4905,26 +6984,63 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                 if (first) return stbi__err("first not IHDR", "Corrupt PNG");
                 if (scan != STBI__SCAN_load) return 1;
                 if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+                if (s->row_sink) {
+                    stbi__png_rows r;
+                    if (interlace) return stbi__err("interlaced", "Interlaced PNG can't be streamed");
+                    r.z = z;
+                    r.x = s->img_x;
+                    r.y = s->img_y;
+                    r.img_n = s->img_n;
+                    r.depth = z->depth;
+                    r.color = color;
+                    r.req_comp = req_comp;
+                    r.has_trans = has_trans;
+                    r.tc = tc;
+                    r.tc16 = tc16;
+                    r.is_iphone = is_iphone;
+                    r.pal_img_n = pal_img_n;
+                    r.palette = palette;
+                    // work out the channel counts the same way as below
+                    if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+                    s->img_out_n = s->img_n+1;
+                    else
+                    s->img_out_n = s->img_n;
+                    r.out_n = s->img_out_n;
+                    if (pal_img_n) {
+                        s->img_n = pal_img_n;
+                        s->img_out_n = r.pal_out_n = req_comp >= 3 ? req_comp : pal_img_n;
+                    } else if (has_trans) {
+                        ++s->img_n;
+                    }
+                    return stbi__png_stream_image(&r, z->idata, ioff, !is_iphone);
+                }
                 // initial guess for decoded data size to avoid unnecessary reallocs
                 bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
                 raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-                z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+                if (interlace) raw_len = stbi__png_interlaced_len(s->img_x, s->img_y, s->img_n, z->depth);
+                z->expanded = (stbi_uc *) stbi__zinflate_alloc(s->work, (char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
                 if (z->expanded == NULL) return 0; // zlib should set error
-                STBI_FREE(z->idata); z->idata = NULL;
+                stbi__work_free(s, z->idata); z->idata = NULL;
                 if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                 s->img_out_n = s->img_n+1;
                 else
                 s->img_out_n = s->img_n;
+                // stbi_load_into: images that need no post-pass after unfiltering
+                // can be written straight into the caller's buffer
+                z->out_direct = s->out_user && !interlace && !has_trans && !pal_img_n && !is_iphone && z->depth <= 8 &&
+                (req_comp == 0 || req_comp == s->img_out_n);
+                // indices only live until the palette is applied
+                z->out_work = pal_img_n != 0;
                 if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
                 if (has_trans) {
                     if (z->depth == 16) {
-                        if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
+                        if (!stbi__compute_transparency16((stbi__uint16 *) z->out, s->img_x * s->img_y, tc16, s->img_out_n)) return 0;
                     } else {
-                        if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
+                        if (!stbi__compute_transparency(z->out, s->img_x * s->img_y, tc, s->img_out_n)) return 0;
                     }
                 }
-                if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-                stbi__de_iphone(z);
+                if (is_iphone && s->opt.convert_iphone_png && s->img_out_n > 2)
+                stbi__de_iphone(z->out, s->img_x * s->img_y, s->img_out_n, s->opt.unpremultiply);
                 if (pal_img_n) {
                     // pal_img_n == 3 or 4
                     s->img_n = pal_img_n; // record the actual colors we had
@@ -4936,7 +7052,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                     // non-paletted image with tRNS -> source image has (constant) alpha
                     ++s->img_n;
                 }
-                STBI_FREE(z->expanded); z->expanded = NULL;
+                stbi__work_free(s, z->expanded); z->expanded = NULL;
                 return 1;
             }
             
@@ -4945,8 +7061,11 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if ((c.type & (1 << 29)) == 0) {
 #ifndef STBI_NO_FAILURE_STRINGS
-                // not threadsafe
+#ifdef STBI_THREAD_LOCAL
+                static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX PNG chunk not known";
+#else
                 static char invalid_chunk[] = "XXXX PNG chunk not known";
+#endif
                 invalid_chunk[0] = STBI__BYTECAST(c.type >> 24);
                 invalid_chunk[1] = STBI__BYTECAST(c.type >> 16);
                 invalid_chunk[2] = STBI__BYTECAST(c.type >>  8);
@@ -4985,9 +7104,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
         *y = p->s->img_y;
         if (n) *n = p->s->img_n;
     }
-    STBI_FREE(p->out);      p->out      = NULL;
-    STBI_FREE(p->expanded); p->expanded = NULL;
-    STBI_FREE(p->idata);    p->idata    = NULL;
+    stbi__png_free_out(p);
+    stbi__work_free(p->s, p->expanded); p->expanded = NULL;
+    stbi__work_free(p->s, p->idata);    p->idata    = NULL;
     
     return result;
 }
@@ -4999,6 +7118,35 @@ static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req
     return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
+static int stbi__png_load_rows(stbi__context *s, int req_comp)
+{
+    stbi__png p;
+    int result;
+    p.s = s;
+    if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+    result = stbi__parse_png_file(&p, STBI__SCAN_load, req_comp);
+    stbi__png_free_out(&p);
+    stbi__work_free(s, p.expanded);
+    stbi__work_free(s, p.idata);
+    return result;
+}
+
+// streaming needs a non-interlaced image; peek at the IHDR
+static int stbi__png_can_stream(stbi__context *s)
+{
+    stbi__pngchunk c;
+    int r = 0;
+    if (stbi__check_png_header(s)) {
+        c = stbi__get_chunk_header(s);
+        if (c.type == STBI__PNG_TYPE('I','H','D','R')) {
+            stbi__skip(s, 12);
+            r = stbi__get8(s) == 0;
+        }
+    }
+    stbi__rewind(s);
+    return r;
+}
+
 static int stbi__png_test(stbi__context *s)
 {
     int r;
@@ -5586,7 +7734,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
             //   any data to skip? (offset usually = 0)
             stbi__skip(s, tga_palette_start );
             //   load the palette
-            tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
+            tga_palette = (unsigned char*)stbi__work_malloc_mad2(s, tga_palette_len, tga_comp, 0);
             if (!tga_palette) {
                 STBI_FREE(tga_data);
                 return stbi__errpuc("outofmem", "Out of memory");
@@ -5600,7 +7748,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                 }
             } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
                 STBI_FREE(tga_data);
-                STBI_FREE(tga_palette);
+                stbi__work_free(s, tga_palette);
                 return stbi__errpuc("bad palette", "Corrupt TGA");
             }
         }
@@ -5681,7 +7829,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
         //   clear my palette, if I had one
         if ( tga_palette != NULL )
         {
-            STBI_FREE( tga_palette );
+            stbi__work_free(s, tga_palette);
         }
     }
     
@@ -6264,15 +8412,16 @@ static int stbi__gif_header(stbi__context *s, stbi__gif *g, int *comp, int is_in
 
 static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
 {
-    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
+    stbi__gif* g = (stbi__gif*) stbi__work_malloc(s, sizeof(stbi__gif));
+    if (!g) return stbi__err("outofmem", "Out of memory");
     if (!stbi__gif_header(s, g, comp, 1)) {
-        STBI_FREE(g);
+        stbi__work_free(s, g);
         stbi__rewind( s );
         return 0;
     }
     if (x) *x = g->w;
     if (y) *y = g->h;
-    STBI_FREE(g);
+    stbi__work_free(s, g);
     return 1;
 }
 
@@ -6413,9 +8562,9 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
     if (g->out == 0) {
         if (!stbi__gif_header(s, g, comp,0))     return 0; // stbi__g_failure_reason set by stbi__gif_header
         g->out = (stbi_uc *) stbi__malloc(4 * g->w * g->h);
-        g->background = (stbi_uc *) stbi__malloc(4 * g->w * g->h);
-        g->history = (stbi_uc *) stbi__malloc(g->w * g->h);
-        if (g->out == 0)                      return stbi__errpuc("outofmem", "Out of memory");
+        g->background = (stbi_uc *) stbi__work_malloc(s, 4 * g->w * g->h);
+        g->history = (stbi_uc *) stbi__work_malloc(s, g->w * g->h);
+        if (!g->out || !g->background || !g->history) return stbi__errpuc("outofmem", "Out of memory");
         
         // image is treated as "transparent" at the start - ie, nothing overwrites the current background;
         // background colour is only used for pixels that are not rendered first frame, after that "background"
@@ -6611,8 +8760,8 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
         
         // free temp buffer;
         STBI_FREE(g.out);
-        STBI_FREE(g.history);
-        STBI_FREE(g.background);
+        stbi__work_free(s, g.history);
+        stbi__work_free(s, g.background);
         
         // do the final conversion after loading everything;
         if (req_comp && req_comp != 4)
@@ -6645,8 +8794,8 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
     }
     
     // free buffers needed for multiple frame loading;
-    STBI_FREE(g.history);
-    STBI_FREE(g.background);
+    stbi__work_free(s, g.history);
+    stbi__work_free(s, g.background);
     
     return u;
 }
@@ -6732,6 +8881,74 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
     }
 }
 
+// convert a scanline held as four planes (all R, all G, all B, all E)
+static void stbi__hdr_convert_planar(float *output, stbi_uc const *planes, int width, int req_comp)
+{
+    int i = 0;
+    stbi_uc rgbe[4];
+#ifdef STBI_SSE2
+    // four pixels at a time. 2^(e-136) is built from the exponent bits, as
+    // 2^(e-128) * 2^-8 so it stays exact for the denormal results, and the
+    // mantissa product matches stbi__hdr_convert bit for bit. e == 1 would
+    // need a denormal 2^(e-128), so such groups take the scalar path.
+    // a 3-channel pixel is stored as 4 floats and the next pixel overwrites
+    // the extra one, so that loop stops a pixel short of the end
+    if (req_comp >= 3 && stbi__sse2_available()) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i one = _mm_set1_epi32(1);
+        __m128 post = _mm_set1_ps(1.0f / 256.0f);
+        __m128 alpha = _mm_set1_ps(1.0f);
+        int end = req_comp == 4 ? width - 3 : width - 4, k;
+        for (; i < end; i += 4) {
+            int v[4];
+            __m128i lanes[4], e;
+            __m128 r, g, b, a, scale;
+            for (k = 0; k < 4; ++k) {
+                memcpy(&v[k], planes + k * width + i, 4);
+                lanes[k] = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v[k]), zero), zero);
+            }
+            e = lanes[3];
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(e, one))) {
+                for (k = i; k < i + 4; ++k) {
+                    rgbe[0] = planes[k]; rgbe[1] = planes[width + k]; rgbe[2] = planes[2 * width + k]; rgbe[3] = planes[3 * width + k];
+                    stbi__hdr_convert(output + k * req_comp, rgbe, req_comp);
+                }
+                continue;
+            }
+            scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(e, one), 23));
+            scale = _mm_and_ps(_mm_mul_ps(scale, post), _mm_castsi128_ps(_mm_cmpgt_epi32(e, zero)));
+            r = _mm_mul_ps(_mm_cvtepi32_ps(lanes[0]), scale);
+            g = _mm_mul_ps(_mm_cvtepi32_ps(lanes[1]), scale);
+            b = _mm_mul_ps(_mm_cvtepi32_ps(lanes[2]), scale);
+            a = alpha;
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+            _mm_storeu_ps(output + (i + 0) * req_comp, r);
+            _mm_storeu_ps(output + (i + 1) * req_comp, g);
+            _mm_storeu_ps(output + (i + 2) * req_comp, b);
+            _mm_storeu_ps(output + (i + 3) * req_comp, a);
+        }
+    }
+#endif
+    for (; i < width; ++i) {
+        rgbe[0] = planes[i]; rgbe[1] = planes[width + i]; rgbe[2] = planes[2 * width + i]; rgbe[3] = planes[3 * width + i];
+        stbi__hdr_convert(output + i * req_comp, rgbe, req_comp);
+    }
+}
+
+// copy n bytes straight out of the buffer when they are all there, else a
+// byte at a time so refills and reads past the end behave as stbi__get8
+static void stbi__hdr_getn(stbi__context *s, stbi_uc *out, int n)
+{
+    if (s->img_buffer + n <= s->img_buffer_end) {
+        memcpy(out, s->img_buffer, n);
+        s->img_buffer += n;
+    } else {
+        int i;
+        for (i = 0; i < n; ++i)
+        out[i] = stbi__get8(s);
+    }
+}
+
 static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
     char buffer[STBI__HDR_BUFLEN];
@@ -6742,7 +8959,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
     float *hdr_data;
     int len;
     unsigned char count, value;
-    int i, j, k, c1,c2, z;
+    int i, j, k, c1,c2;
     const char *headerToken;
     STBI_NOTUSED(ri);
     
@@ -6816,21 +9033,24 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                 stbi__hdr_convert(hdr_data, rgbe, req_comp);
                 i = 1;
                 j = 0;
-                STBI_FREE(scanline);
+                stbi__work_free(s, scanline);
                 goto main_decode_loop; // yes, this makes no sense
             }
             len <<= 8;
             len |= stbi__get8(s);
-            if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+            if (len != width) { STBI_FREE(hdr_data); stbi__work_free(s, scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
             if (scanline == NULL) {
-                scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
+                scanline = (stbi_uc *) stbi__work_malloc_mad2(s, width, 4, 0);
                 if (!scanline) {
                     STBI_FREE(hdr_data);
                     return stbi__errpf("outofmem", "Out of memory");
                 }
             }
             
+            // each component is run-length coded separately, so decode
+            // them into planes
             for (k = 0; k < 4; ++k) {
+                stbi_uc *plane = scanline + k * width;
                 int nleft;
                 i = 0;
                 while ((nleft = width - i) > 0) {
@@ -6839,22 +9059,20 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                         // Run
                         value = stbi__get8(s);
                         count -= 128;
-                        if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                        for (z = 0; z < count; ++z)
-                        scanline[i++ * 4 + k] = value;
+                        if (count > nleft) { STBI_FREE(hdr_data); stbi__work_free(s, scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                        memset(plane + i, value, count);
                     } else {
-                        // Dump
-                        if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
-                        for (z = 0; z < count; ++z)
-                        scanline[i++ * 4 + k] = stbi__get8(s);
+                        // Dump; a zero count (also what reading past the end gives) would never finish
+                        if (count == 0 || count > nleft) { STBI_FREE(hdr_data); stbi__work_free(s, scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                        stbi__hdr_getn(s, plane + i, count);
                     }
+                    i += count;
                 }
             }
-            for (i=0; i < width; ++i)
-            stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
+            stbi__hdr_convert_planar(hdr_data + (size_t) j * width * req_comp, scanline, width, req_comp);
         }
         if (scanline)
-        STBI_FREE(scanline);
+        stbi__work_free(s, scanline);
     }
     
     return hdr_data;
@@ -7173,7 +9391,7 @@ static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp)
 }
 #endif
 
-static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
+static int stbi__info_format(stbi__context *s, int *x, int *y, int *comp)
 {
 #ifndef STBI_NO_JPEG
     if (stbi__jpeg_info(s, x, y, comp)) return 1;
@@ -7215,6 +9433,15 @@ static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
     return stbi__err("unknown image type", "Image not of any known type, or corrupt");
 }
 
+static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
+{
+    int result;
+    stbi__work_begin(s);
+    result = stbi__info_format(s, x, y, comp);
+    stbi__work_end(s);
+    return result;
+}
+
 static int stbi__is_16_main(stbi__context *s)
 {
 #ifndef STBI_NO_PNG
@@ -0,0 +1,200 @@
+//
+//  texture.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+
+/// A GL_TEXTURE_2D of 8-bit pixels, allocated once for its whole mip chain
+/// in the tightest format for the image's channel count: gray is R8 and
+/// gray with alpha RG8, swizzled so shaders still see gray. Storage is
+/// immutable where the GL has texture storage; elsewhere every level is
+/// defined up front and GL_TEXTURE_MAX_LEVEL pins the chain, so the
+/// driver never has to respecify it. It has no sampling state of its own:
+/// sample it through a sampler from a SamplerCache.
+///
+///     Texture albedo = Texture::load("albedo.png", true);
+///     albedo.bind(0);
+class Texture
+{
+public:
+    /// How an image with some number of channels is stored: the sized
+    /// format, the format and channel count pixels are given in, and where
+    /// each of r, g, b, a reads from
+    struct Format
+    {
+        GLenum internalFormat;
+        GLenum format;
+        int channels;
+        GLint swizzle[4];
+    };
+    
+    /// GL 4.1 has no one or two channel sRGB formats. sRGB gray goes up as
+    /// one channel into SRGB8 and is swizzled back to gray; sRGB gray with
+    /// alpha has to be given as RGBA, since the alpha can't sit in a
+    /// color channel that gets linearized
+    static Format formatFor(int channels, bool srgb)
+    {
+        switch (channels)
+        {
+            case 1: return { srgb ? (GLenum)GL_SRGB8 : (GLenum)GL_R8, GL_RED, 1, { GL_RED, GL_RED, GL_RED, GL_ONE } };
+            case 2: if (!srgb) return { GL_RG8, GL_RG, 2, { GL_RED, GL_RED, GL_RED, GL_GREEN } };
+                break;
+            case 3: return { srgb ? (GLenum)GL_SRGB8 : (GLenum)GL_RGB8, GL_RGB, 3, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE } };
+        }
+        return { srgb ? (GLenum)GL_SRGB8_ALPHA8 : (GLenum)GL_RGBA8, GL_RGBA, 4, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA } };
+    }
+    
+    /// Point the bound texture's swizzle at gray if its level 0 format is
+    /// one formatFor() gives gray, for textures defined elsewhere (the
+    /// texture cache, say) from a stored format
+    static void applySwizzle(GLenum internalFormat)
+    {
+        if (internalFormat != GL_R8 && internalFormat != GL_RED && internalFormat != GL_RG8 && internalFormat != GL_RG) return;
+        Format format = formatFor(internalFormat == GL_R8 || internalFormat == GL_RED ? 1 : 2, false);
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+    }
+    
+    /// Levels down to 1x1
+    static int mipLevels(int width, int height)
+    {
+        int levels = 1;
+        while ((std::max(width, height) >> levels) > 0) ++levels;
+        return levels;
+    }
+    
+    /// The largest GL_UNPACK_ALIGNMENT rows 'rowBytes' apart from 'pixels'
+    /// satisfy (a buffer offset when a pixel unpack buffer is bound)
+    static GLint unpackAlignment(const void* pixels, size_t rowBytes)
+    {
+        uintptr_t bits = (uintptr_t)pixels | rowBytes;
+        return (bits & 7) == 0 ? 8 : (bits & 3) == 0 ? 4 : (bits & 1) == 0 ? 2 : 1;
+    }
+    
+    Texture() = default;
+    
+    /// Allocate 'width' by 'height' for an image with 'channels' (1 to 4),
+    /// with a full mip chain or just level 0. Leaves it bound
+    Texture(int width, int height, int channels, bool srgb = false, bool mipmapped = true)
+        : textureWidth(width), textureHeight(height), levelCount(mipmapped ? mipLevels(width, height) : 1),
+          pixelFormat(formatFor(channels, srgb))
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (GLEW_ARB_texture_storage)
+        {
+            glTexStorage2D(GL_TEXTURE_2D, levelCount, pixelFormat.internalFormat, width, height);
+        }
+        else
+        {
+            for (int i = 0; i < levelCount; ++i)
+                glTexImage2D(GL_TEXTURE_2D, i, pixelFormat.internalFormat, std::max(width >> i, 1), std::max(height >> i, 1), 0,
+                             pixelFormat.format, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        }
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, pixelFormat.swizzle);
+    }
+    
+    ~Texture()
+    {
+        if (texture) glDeleteTextures(1, &texture);
+    }
+    
+    Texture(Texture&& other) { *this = std::move(other); }
+    
+    Texture& operator=(Texture&& other)
+    {
+        std::swap(texture, other.texture);
+        std::swap(textureWidth, other.textureWidth);
+        std::swap(textureHeight, other.textureHeight);
+        std::swap(levelCount, other.levelCount);
+        std::swap(pixelFormat, other.pixelFormat);
+        return *this;
+    }
+    
+    Texture(const Texture&) = delete;
+    Texture& operator=(const Texture&) = delete;
+    
+    /// Decode an image file with the channels it has, upload it and build
+    /// its mips. An empty texture if it can't be loaded
+    static Texture load(const char* path, bool srgb = false, bool mipmapped = true)
+    {
+        int width, height, channels;
+        stbi_uc* pixels = nullptr;
+        if (stbi_info(path, &width, &height, &channels))
+            pixels = stbi_load(path, &width, &height, &channels, formatFor(channels, srgb).channels);
+        if (!pixels)
+        {
+            std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return Texture();
+        }
+        Texture result(width, height, channels, srgb, mipmapped);
+        result.upload(pixels);
+        if (mipmapped) result.generateMipmaps();
+        stbi_image_free(pixels);
+        return result;
+    }
+    
+    explicit operator bool() const { return texture != 0; }
+    
+    /// Fill a mip level from rows of format().channels bytes a pixel, 'stride'
+    /// bytes apart (0 for tightly packed). A stride that is more than row
+    /// padding must be a whole number of pixels. Binds the texture
+    void upload(const unsigned char* pixels, int level = 0, size_t stride = 0) const
+    {
+        int width = std::max(textureWidth >> level, 1), height = std::max(textureHeight >> level, 1);
+        int channelCount = pixelFormat.channels;
+        size_t rowBytes = (size_t)width * channelCount;
+        if (stride == 0) stride = rowBytes;
+        GLint alignment = unpackAlignment(pixels, stride);
+        size_t paddedRow = (rowBytes + alignment - 1) / alignment * alignment;
+        
+        GLint previousAlignment, previousRowLength;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glGetIntegerv(GL_UNPACK_ROW_LENGTH, &previousRowLength);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride == paddedRow ? 0 : (GLint)(stride / channelCount));
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, pixelFormat.format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, previousRowLength);
+    }
+    
+    /// Fill the levels below 0 from it. Binds the texture
+    void generateMipmaps() const
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    
+    GLuint bind(int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        return texture;
+    }
+    
+    GLuint name() const { return texture; }
+    int width() const { return textureWidth; }
+    int height() const { return textureHeight; }
+    int levels() const { return levelCount; }
+    const Format& format() const { return pixelFormat; }
+
+private:
+    GLuint texture = 0;
+    int textureWidth = 0, textureHeight = 0;
+    int levelCount = 0;
+    Format pixelFormat = formatFor(4, false);
+};
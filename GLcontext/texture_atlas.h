@@ -0,0 +1,385 @@
+//
+//  texture_atlas.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// Packs many small RGBA images into the layers of one GL_TEXTURE_2D_ARRAY,
+/// so objects with different images can share a bind and a draw call. Each
+/// layer is skyline packed, so a large image can end up alone in its layer.
+///
+/// Images are padded by copies of their edge texels and placed on a grid of
+/// the padding, so mip levels down to log2(padding) never mix neighbours;
+/// the array only has those levels. Regions don't repeat: wrap modes clamp.
+///
+///     TextureAtlas atlas;
+///     int crate = atlas.add("crate.png");
+///     int grass = atlas.add("grass.png");
+///     atlas.build();
+///     // per vertex: texcoord = mix(region.uv0, region.uv1, uv), layer = region.layer
+///     atlas.bind(0);
+///
+///     // GLSL
+///     uniform sampler2DArray atlas;
+///     FragColor = texture(atlas, vec3(texcoord, layer));
+///
+/// Images can be added after build(); they show up at the next build(),
+/// which grows the array if they took new layers (the texture name changes)
+class TextureAtlas
+{
+public:
+    /// Where an image ended up. The UVs cover the image itself, not its
+    /// padding, with the first row of the file at uv0.y
+    struct Region
+    {
+        int layer = 0;
+        int x = 0, y = 0, width = 0, height = 0;    // texels in the layer
+        float uv0[2] = { 0, 0 };
+        float uv1[2] = { 0, 0 };
+    };
+    
+    struct Stats
+    {
+        size_t images = 0;
+        size_t layers = 0;
+        size_t pending = 0;         // added since the last build()
+        uint64_t usedTexels = 0;    // images and their padding
+        uint64_t layerTexels = 0;   // level 0 of every layer
+        uint64_t bytes = 0;         // the array with its mips
+    };
+    
+    /// 'padding' is rounded up to a power of two; 0 means no mips
+    TextureAtlas(int layerSize = 2048, int padding = 8, int maxLayers = 64)
+        : layerSize(layerSize), maxLayers(maxLayers)
+    {
+        while (grid < padding) grid <<= 1;
+        this->padding = padding > 0 ? grid : 0;
+        levels = 1;
+        while ((2 << (levels - 1)) <= this->padding && (layerSize >> levels) > 0) ++levels;
+    }
+    
+    ~TextureAtlas()
+    {
+        glDeleteTextures(1, &texture);
+    }
+    
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+    
+    /// Pack an image file, as RGBA. Returns its id, or -1 if it can't be
+    /// loaded or doesn't fit
+    int add(const std::string& path)
+    {
+        int width, height, channels;
+        if (!stbi_info(path.c_str(), &width, &height, &channels))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return -1;
+        }
+        
+        Pending image;
+        if (!measure(width, height, image)) return -1;
+        
+        // decode straight into the padded rectangle, and only then take
+        // room for it, so a file that fails leaves the layers as they were
+        size_t stride = (size_t)image.width * 4;
+        size_t offset = (size_t)padding * stride + (size_t)padding * 4;
+        image.pixels.resize(stride * image.height);
+        if (!stbi_load_into(path.c_str(), image.pixels.data() + offset, image.pixels.size() - offset, (int)stride, &width, &height, &channels, STBI_rgb_alpha))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return -1;
+        }
+        if (!reserve(width, height, image)) return -1;
+        return commit(image);
+    }
+    
+    /// Pack tightly packed RGBA8 pixels
+    int add(const unsigned char* pixels, int width, int height)
+    {
+        Pending image;
+        if (!measure(width, height, image) || !reserve(width, height, image)) return -1;
+        
+        size_t stride = (size_t)image.width * 4;
+        image.pixels.resize(stride * image.height);
+        for (int row = 0; row < height; ++row)
+            std::copy(pixels + (size_t)row * width * 4, pixels + (size_t)(row + 1) * width * 4,
+                      image.pixels.begin() + (size_t)(row + padding) * stride + (size_t)padding * 4);
+        return commit(image);
+    }
+    
+    /// Upload what was added since the last call and regenerate the mips.
+    /// Leaves the array bound to GL_TEXTURE_2D_ARRAY
+    void build()
+    {
+        if (!texture || allocatedLayers < (int)skylines.size()) grow();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        if (pending.empty()) return;
+        
+        for (const Pending& image : pending)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, image.x, image.y, image.layer, image.width, image.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+        pending.clear();
+        if (levels > 1) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    
+    const Region& region(int id) const { return regions[id]; }
+    size_t size() const { return regions.size(); }
+    
+    /// The array as of the last build()
+    GLuint name() const { return texture; }
+    
+    GLuint bind(int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        return texture;
+    }
+    
+    Stats stats() const
+    {
+        Stats result;
+        result.images = regions.size();
+        result.layers = skylines.size();
+        result.pending = pending.size();
+        result.usedTexels = usedTexels;
+        result.layerTexels = (uint64_t)layerSize * layerSize * skylines.size();
+        for (int i = 0; i < levels; ++i)
+            result.bytes += (uint64_t)std::max(layerSize >> i, 1) * std::max(layerSize >> i, 1) * 4 * allocatedLayers;
+        return result;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "TEXTURE_ATLAS: " << s.images << " images in " << s.layers << " layers of " << layerSize << "x" << layerSize
+            << " (" << (s.layerTexels ? 100 * s.usedTexels / s.layerTexels : 0) << "% used), "
+            << s.pending << " pending, " << s.bytes / 1024 << " KB" << std::endl;
+    }
+
+private:
+    /// The top edge of what is packed into a layer, as segments left to
+    /// right: new rectangles sit on it as low as they can
+    struct Segment
+    {
+        int x, y, width;
+    };
+    
+    /// An image waiting for build(), padding included
+    struct Pending
+    {
+        int layer = 0, x = 0, y = 0, width = 0, height = 0;
+        std::vector<unsigned char> pixels;
+    };
+    
+    int layerSize;
+    int maxLayers;
+    int padding = 0;
+    int grid = 1;               // placement granularity, the padding as a power of two
+    int levels = 1;
+    GLuint texture = 0;
+    int allocatedLayers = 0;
+    std::vector<std::vector<Segment>> skylines;
+    std::vector<Region> regions;
+    std::vector<Pending> pending;
+    uint64_t usedTexels = 0;
+    
+    /// Size the padded rectangle for a 'width' by 'height' image; false if
+    /// it is bigger than a layer
+    bool measure(int width, int height, Pending& image) const
+    {
+        image.width = roundUp(width + 2 * padding);
+        image.height = roundUp(height + 2 * padding);
+        if (width <= 0 || height <= 0 || image.width > layerSize || image.height > layerSize)
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::TOO_LARGE " << width << "x" << height << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    /// Find room for a measured image, opening a layer if none has it, and
+    /// record its region
+    bool reserve(int width, int height, Pending& image)
+    {
+        bool placed = false;
+        for (size_t i = 0; i < skylines.size() && !placed; ++i)
+            placed = place((int)i, image);
+        if (!placed)
+        {
+            if ((int)skylines.size() == maxLayers)
+            {
+                std::cout << "ERROR::TEXTURE_ATLAS::FULL " << maxLayers << " layers" << std::endl;
+                return false;
+            }
+            skylines.push_back({ { 0, 0, layerSize } });
+            place((int)skylines.size() - 1, image);
+        }
+        usedTexels += (uint64_t)image.width * image.height;
+        
+        Region region;
+        region.layer = image.layer;
+        region.x = image.x + padding;
+        region.y = image.y + padding;
+        region.width = width;
+        region.height = height;
+        region.uv0[0] = (float)region.x / layerSize;
+        region.uv0[1] = (float)region.y / layerSize;
+        region.uv1[0] = (float)(region.x + width) / layerSize;
+        region.uv1[1] = (float)(region.y + height) / layerSize;
+        regions.push_back(region);
+        return true;
+    }
+    
+    /// Fill the padding with the image's edges and queue it for build()
+    int commit(Pending& image)
+    {
+        const Region& region = regions.back();
+        unsigned char* pixels = image.pixels.data();
+        size_t stride = (size_t)image.width * 4;
+        int right = padding + region.width - 1, bottom = padding + region.height - 1;
+        for (int row = padding; row <= bottom; ++row)
+        {
+            unsigned char* line = pixels + row * stride;
+            for (int x = 0; x < padding; ++x) std::copy(line + padding * 4, line + padding * 4 + 4, line + x * 4);
+            for (int x = right + 1; x < image.width; ++x) std::copy(line + right * 4, line + right * 4 + 4, line + x * 4);
+        }
+        for (int row = 0; row < padding; ++row)
+            std::copy(pixels + padding * stride, pixels + (padding + 1) * stride, pixels + row * stride);
+        for (int row = bottom + 1; row < image.height; ++row)
+            std::copy(pixels + bottom * stride, pixels + (bottom + 1) * stride, pixels + row * stride);
+        
+        pending.push_back(std::move(image));
+        return (int)regions.size() - 1;
+    }
+    
+    int roundUp(int size) const
+    {
+        return (size + grid - 1) & ~(grid - 1);
+    }
+    
+    /// Put the image where its top edge would be lowest in a layer (the
+    /// narrowest spot on a tie) and raise the skyline under it
+    bool place(int layer, Pending& image)
+    {
+        std::vector<Segment>& skyline = skylines[layer];
+        int best = -1, bestTop = 0, bestWidth = 0;
+        for (size_t i = 0; i < skyline.size(); ++i)
+        {
+            int y = fit(skyline, i, image.width, image.height);
+            if (y < 0) continue;
+            int top = y + image.height;
+            if (best < 0 || top < bestTop || (top == bestTop && skyline[i].width < bestWidth))
+            {
+                best = (int)i;
+                bestTop = top;
+                bestWidth = skyline[i].width;
+            }
+        }
+        if (best < 0) return false;
+        
+        image.layer = layer;
+        image.x = skyline[best].x;
+        image.y = bestTop - image.height;
+        skyline.insert(skyline.begin() + best, Segment { image.x, bestTop, image.width });
+        
+        // trim what the new segment covers
+        for (size_t i = best + 1; i < skyline.size(); )
+        {
+            int end = skyline[i - 1].x + skyline[i - 1].width;
+            if (skyline[i].x >= end) break;
+            int covered = std::min(end - skyline[i].x, skyline[i].width);
+            skyline[i].x += covered;
+            skyline[i].width -= covered;
+            if (skyline[i].width > 0) break;
+            skyline.erase(skyline.begin() + i);
+        }
+        
+        // merge neighbours at the same height
+        for (size_t i = 1; i < skyline.size(); )
+        {
+            if (skyline[i - 1].y == skyline[i].y)
+            {
+                skyline[i - 1].width += skyline[i].width;
+                skyline.erase(skyline.begin() + i);
+            }
+            else ++i;
+        }
+        return true;
+    }
+    
+    /// The lowest y a rectangle starting at segment 'index' can sit at, or
+    /// -1 if it runs off the layer
+    int fit(const std::vector<Segment>& skyline, size_t index, int width, int height) const
+    {
+        if (skyline[index].x + width > layerSize) return -1;
+        int y = 0;
+        for (size_t i = index; width > 0; ++i)
+        {
+            y = std::max(y, skyline[i].y);
+            if (y + height > layerSize) return -1;
+            width -= skyline[i].width;
+        }
+        return y;
+    }
+    
+    /// New storage with room for every layer opened, holding what the old
+    /// array had. Level 0 is copied layer by layer through a framebuffer;
+    /// build() regenerates the mips afterwards
+    void grow()
+    {
+        int layers = (int)std::max<size_t>(skylines.size(), 1);
+        GLuint grown;
+        glGenTextures(1, &grown);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, grown);
+        if (GLEW_ARB_texture_storage)
+        {
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layerSize, layerSize, layers);
+        }
+        else
+        {
+            for (int i = 0; i < levels; ++i)
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, std::max(layerSize >> i, 1), std::max(layerSize >> i, 1), layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        
+        if (texture)
+        {
+            GLint previousFramebuffer;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            GLuint framebuffer;
+            glGenFramebuffers(1, &framebuffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            for (int layer = 0; layer < allocatedLayers; ++layer)
+            {
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+                glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, layerSize, layerSize);
+            }
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFramebuffer);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            
+            // the copies need their mips too
+            if (pending.empty() && levels > 1) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+        texture = grown;
+        allocatedLayers = layers;
+    }
+};
@@ -0,0 +1,501 @@
+//
+//  texture_cache.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "texture.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/// Keeps the final GPU-ready form of ad-hoc textures (format and full mip
+/// chain, exactly as the driver holds them) in a cache directory, so later
+/// launches skip decoding and mipmapping and upload straight from a mapping
+/// of the cached file.
+///
+///     TextureCache::Key key = cache.key(path, "rgb8 mipmapped");
+///     if (!cache.load(key))
+///     {
+///         ... decode into the bound GL_TEXTURE_2D, glGenerateMipmap ...
+///         cache.store(key);
+///     }
+///
+/// Entries are named by a hash of the source's contents and the options
+/// string, which should describe everything that shapes the result, so an
+/// edited source or a different load simply misses. Entries not used for a
+/// while are evicted once the directory grows past its budget.
+class TextureCache
+{
+    struct Header;
+    struct Level;
+
+public:
+    struct Key
+    {
+        std::string name;       // file name in the cache directory, empty if the source can't be read
+        uint64_t sourceHash = 0;
+        uint64_t sourceSize = 0;
+        uint64_t optionsHash = 0;
+    };
+    
+    explicit TextureCache(const std::string& directory, uint64_t maxBytes = 256ull << 20)
+        : directory(directory), maxBytes(maxBytes)
+    {
+        if (!makeDirectories(directory))
+            std::cout << "ERROR::TEXTURE_CACHE::NO_DIRECTORY " << directory << ": " << strerror(errno) << std::endl;
+    }
+    
+    /// The per-user cache location: ~/Library/Caches on macOS, otherwise
+    /// $XDG_CACHE_HOME or ~/.cache
+    static std::string defaultDirectory()
+    {
+        const char* home = getenv("HOME");
+        std::string base = home ? home : "/tmp";
+#ifdef __APPLE__
+        base += "/Library/Caches";
+#else
+        const char* xdg = getenv("XDG_CACHE_HOME");
+        base = xdg && *xdg ? xdg : base + "/.cache";
+#endif
+        return base + "/GLcontext/textures";
+    }
+    
+    /// Hash the source file's contents together with the options
+    Key key(const char* sourcePath, const std::string& options) const
+    {
+        Key key;
+        int fd = open(sourcePath, O_RDONLY);
+        if (fd < 0) return key;
+        struct stat info;
+        if (fstat(fd, &info) == 0)
+        {
+            key.sourceSize = (uint64_t)info.st_size;
+            void* bytes = info.st_size > 0 ? mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            if (bytes != MAP_FAILED)
+            {
+                key.sourceHash = hash(bytes, (size_t)info.st_size, key.sourceSize);
+                if (bytes) munmap(bytes, (size_t)info.st_size);
+                key.optionsHash = hash(options.data(), options.size(), Version);
+                
+                char name[48];
+                snprintf(name, sizeof(name), "%016llx%016llx.tex", (unsigned long long)key.sourceHash, (unsigned long long)key.optionsHash);
+                key.name = name;
+            }
+        }
+        close(fd);
+        return key;
+    }
+    
+    /// A cache entry mapped into memory, for uploading levels one at a time.
+    /// Level 0 is the largest
+    class Blob
+    {
+    public:
+        Blob() = default;
+        Blob(Blob&& other) { *this = std::move(other); }
+        ~Blob() { if (mapping) munmap(mapping, size); }
+        
+        Blob& operator=(Blob&& other)
+        {
+            std::swap(mapping, other.mapping);
+            std::swap(size, other.size);
+            return *this;
+        }
+        
+        Blob(const Blob&) = delete;
+        Blob& operator=(const Blob&) = delete;
+        
+        explicit operator bool() const { return mapping != nullptr; }
+        
+        int levels() const { return (int)header().levels; }
+        int width(int level) const { return (int)entry(level).width; }
+        int height(int level) const { return (int)entry(level).height; }
+        uint64_t bytes(int level) const { return entry(level).size; }
+        
+        /// Sized, as texture storage needs
+        GLenum internalFormat() const
+        {
+            switch (header().internalFormat)
+            {
+                case GL_RED: return GL_R8;
+                case GL_RG: return GL_RG8;
+                case GL_RGB: return GL_RGB8;
+                case GL_RGBA: return GL_RGBA8;
+            }
+            return header().internalFormat;
+        }
+        
+        /// Define mip 'target' of the bound GL_TEXTURE_2D as 'level'
+        void define(int level, int target) const
+        {
+            const Header& h = header();
+            const Level& l = entry(level);
+            GLint previousAlignment;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, RowAlignment);
+            if (h.compressed)
+                glCompressedTexImage2D(GL_TEXTURE_2D, target, h.internalFormat, l.width, l.height, 0, (GLsizei)l.size, data(level));
+            else
+                glTexImage2D(GL_TEXTURE_2D, target, h.internalFormat, l.width, l.height, 0, h.format, h.type, data(level));
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        }
+        
+        /// Fill mip 'target' of the bound GL_TEXTURE_2D, whose storage is
+        /// already allocated, with 'level'
+        void upload(int level, int target) const
+        {
+            const Header& h = header();
+            const Level& l = entry(level);
+            GLint previousAlignment;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, RowAlignment);
+            if (h.compressed)
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, l.width, l.height, h.internalFormat, (GLsizei)l.size, data(level));
+            else
+                glTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, l.width, l.height, h.format, h.type, data(level));
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        }
+        
+        /// Give the bound GL_TEXTURE_2D storage for levels 'first' and
+        /// smaller, as its mips 0 and up: immutable where the GL has
+        /// texture storage, otherwise each level defined empty
+        void allocate(int first) const
+        {
+            const Header& h = header();
+            if (GLEW_ARB_texture_storage)
+            {
+                glTexStorage2D(GL_TEXTURE_2D, levels() - first, internalFormat(), width(first), height(first));
+            }
+            else
+            {
+                for (int i = first; i < levels(); ++i)
+                {
+                    const Level& l = entry(i);
+                    if (h.compressed)
+                        glCompressedTexImage2D(GL_TEXTURE_2D, i - first, h.internalFormat, l.width, l.height, 0, (GLsizei)l.size, nullptr);
+                    else
+                        glTexImage2D(GL_TEXTURE_2D, i - first, internalFormat(), l.width, l.height, 0, h.format, h.type, nullptr);
+                }
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels() - first - 1);
+            }
+            Texture::applySwizzle(internalFormat());
+        }
+    
+    private:
+        friend class TextureCache;
+        void* mapping = nullptr;
+        size_t size = 0;
+        
+        const Header& header() const { return *(const Header*)mapping; }
+        const Level& entry(int level) const { return ((const Level*)(&header() + 1))[level]; }
+        const unsigned char* data(int level) const { return (const unsigned char*)mapping + entry(level).offset; }
+    };
+    
+    /// Map the entry for 'key' if there is a valid one. A stale or torn
+    /// entry is deleted
+    bool map(const Key& key, Blob& blob)
+    {
+        blob = Blob();
+        if (key.name.empty()) return false;
+        std::string path = directory + "/" + key.name;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        
+        struct stat info;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(Header))
+            mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) return false;
+        
+        const Header* header = (const Header*)mapping;
+        const Level* levels = (const Level*)(header + 1);
+        bool valid = header->magic == Magic && header->version == Version
+            && header->sourceHash == key.sourceHash && header->sourceSize == key.sourceSize && header->optionsHash == key.optionsHash
+            && header->levels > 0 && header->levels <= MaxLevels
+            && sizeof(Header) + header->levels * sizeof(Level) <= (size_t)info.st_size;
+        for (uint32_t i = 0; valid && i < header->levels; ++i)
+            valid = levels[i].offset <= (uint64_t)info.st_size && levels[i].size <= (uint64_t)info.st_size - levels[i].offset
+                && (header->compressed || levels[i].size >= levelBytes(header->format, header->type, levels[i].width, levels[i].height));
+        if (!valid)
+        {
+            munmap(mapping, (size_t)info.st_size);
+            unlink(path.c_str());
+            return false;
+        }
+        
+        blob.mapping = mapping;
+        blob.size = (size_t)info.st_size;
+        // the modification time is the last use, for eviction
+        utimes(path.c_str(), nullptr);
+        return true;
+    }
+    
+    /// On a hit, define every level of the bound GL_TEXTURE_2D from the cache.
+    /// With 'firstLevel', that many of the largest levels are left out (never
+    /// the 1x1) and any levels the texture had beyond the new chain are freed
+    bool load(const Key& key, int firstLevel = 0)
+    {
+        Blob blob;
+        if (!map(key, blob)) return false;
+        int first = std::min(std::max(firstLevel, 0), blob.levels() - 1);
+        for (int i = first; i < blob.levels(); ++i)
+            blob.define(i, i - first);
+        freeLevels(blob.levels() - first);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, blob.levels() - first - 1);
+        Texture::applySwizzle(blob.internalFormat());
+        return true;
+    }
+    
+    /// Read the bound GL_TEXTURE_2D's levels back and save them under 'key',
+    /// then evict the least recently used entries over the budget
+    bool store(const Key& key)
+    {
+        if (key.name.empty()) return false;
+        
+        GLint internalFormat, compressed, maxLevel;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        
+        Header header = {};
+        header.magic = Magic;
+        header.version = Version;
+        header.sourceHash = key.sourceHash;
+        header.sourceSize = key.sourceSize;
+        header.optionsHash = key.optionsHash;
+        header.internalFormat = (uint32_t)internalFormat;
+        header.compressed = compressed ? 1 : 0;
+        if (!compressed && !readFormat(internalFormat, header.format, header.type))
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::UNSUPPORTED_FORMAT 0x" << std::hex << internalFormat << std::dec << std::endl;
+            return false;
+        }
+        
+        // every level that is defined, up to the 1x1
+        std::vector<Level> levels;
+        uint64_t offset = 0;
+        for (GLint i = 0; i <= maxLevel && (int)levels.size() < MaxLevels; ++i)
+        {
+            Level level = {};
+            GLint width, height, size = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &height);
+            if (width == 0 || height == 0) break;
+            if (compressed) glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            level.width = (uint32_t)width;
+            level.height = (uint32_t)height;
+            level.size = compressed ? (uint64_t)size : levelBytes(header.format, header.type, width, height);
+            levels.push_back(level);
+            if (width == 1 && height == 1) break;
+        }
+        if (levels.empty()) return false;
+        
+        header.levels = (uint32_t)levels.size();
+        offset = align(sizeof(Header) + levels.size() * sizeof(Level));
+        for (Level& level : levels)
+        {
+            level.offset = offset;
+            offset = align(offset + level.size);
+        }
+        if (offset > maxBytes) return false;
+        
+        std::vector<unsigned char> blob(offset, 0);
+        memcpy(blob.data(), &header, sizeof(Header));
+        memcpy(blob.data() + sizeof(Header), levels.data(), levels.size() * sizeof(Level));
+        
+        GLint previousAlignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_PACK_ALIGNMENT, RowAlignment);
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            if (compressed)
+                glGetCompressedTexImage(GL_TEXTURE_2D, (GLint)i, blob.data() + levels[i].offset);
+            else
+                glGetTexImage(GL_TEXTURE_2D, (GLint)i, header.format, header.type, blob.data() + levels[i].offset);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, previousAlignment);
+        
+        // readers only ever see a complete file
+        std::string path = directory + "/" + key.name;
+        std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        bool written = file && fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+        if (file) written = fclose(file) == 0 && written;
+        if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::WRITE_FAILED " << path << ": " << strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        
+        evict(key.name);
+        return true;
+    }
+    
+    /// Release the bound GL_TEXTURE_2D's storage from level 'from' up; the
+    /// texture object and its parameters stay
+    static void freeLevels(GLint from)
+    {
+        GLint width = 0;
+        for (GLint i = from; i < MaxLevels; ++i)
+        {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &width);
+            if (width == 0) break;
+            glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    
+    /// 64-bit hash, 8 bytes a step
+    static uint64_t hash(const void* data, size_t size, uint64_t seed)
+    {
+        const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+        const unsigned char* bytes = (const unsigned char*)data;
+        uint64_t h = seed ^ (size * multiplier);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i, 8);
+            h = mix(h ^ word);
+        }
+        uint64_t tail = 0;
+        if (i < size) memcpy(&tail, bytes + i, size - i);
+        return mix(mix(h ^ tail) ^ size);
+    }
+
+private:
+    static constexpr uint32_t Magic = 0x43544c47; // "GLTC"
+    static constexpr uint32_t Version = 1;
+    static constexpr int MaxLevels = 32;
+    static constexpr int RowAlignment = 4;
+    
+    struct Header
+    {
+        uint32_t magic, version;
+        uint64_t sourceHash, sourceSize, optionsHash;
+        uint32_t internalFormat, format, type, compressed;
+        uint32_t levels, reserved;
+    };
+    
+    struct Level
+    {
+        uint32_t width, height;
+        uint64_t offset, size;
+    };
+    
+    std::string directory;
+    uint64_t maxBytes;
+    
+    static uint64_t mix(uint64_t h)
+    {
+        h *= 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+    
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 15) & ~(uint64_t)15;
+    }
+    
+    static bool makeDirectories(const std::string& path)
+    {
+        for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+        {
+            std::string prefix = path.substr(0, slash);
+            if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) return false;
+            if (slash == std::string::npos) return true;
+        }
+    }
+    
+    /// The format and type that read an internal format back without conversion
+    static bool readFormat(GLint internalFormat, uint32_t& format, uint32_t& type)
+    {
+        switch (internalFormat)
+        {
+            case GL_RED: case GL_R8: format = GL_RED; type = GL_UNSIGNED_BYTE; return true;
+            case GL_RG: case GL_RG8: format = GL_RG; type = GL_UNSIGNED_BYTE; return true;
+            case GL_RGB: case GL_RGB8: case GL_SRGB8: format = GL_RGB; type = GL_UNSIGNED_BYTE; return true;
+            case GL_RGBA: case GL_RGBA8: case GL_SRGB8_ALPHA8: format = GL_RGBA; type = GL_UNSIGNED_BYTE; return true;
+            case GL_RGB16F: format = GL_RGB; type = GL_HALF_FLOAT; return true;
+            case GL_RGBA16F: format = GL_RGBA; type = GL_HALF_FLOAT; return true;
+            case GL_RGB32F: format = GL_RGB; type = GL_FLOAT; return true;
+            case GL_RGBA32F: format = GL_RGBA; type = GL_FLOAT; return true;
+            case GL_R11F_G11F_B10F: format = GL_RGB; type = GL_UNSIGNED_INT_10F_11F_11F_REV; return true;
+            case GL_RGB9_E5: format = GL_RGB; type = GL_UNSIGNED_INT_5_9_9_9_REV; return true;
+        }
+        return false;
+    }
+    
+    static uint64_t levelBytes(uint32_t format, uint32_t type, uint64_t width, uint64_t height)
+    {
+        int channels = format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGB ? 3 : 4;
+        int pixelBytes;
+        switch (type)
+        {
+            case GL_UNSIGNED_BYTE: pixelBytes = channels; break;
+            case GL_HALF_FLOAT: pixelBytes = channels * 2; break;
+            case GL_FLOAT: pixelBytes = channels * 4; break;
+            default: pixelBytes = 4; break; // packed
+        }
+        uint64_t row = (width * pixelBytes + RowAlignment - 1) & ~(uint64_t)(RowAlignment - 1);
+        return row * height;
+    }
+    
+    /// Drop the least recently used entries until the directory fits the
+    /// budget, never the one just written
+    void evict(const std::string& keep)
+    {
+        struct Entry
+        {
+            std::string path;
+            time_t used;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        
+        DIR* dir = opendir(directory.c_str());
+        if (!dir) return;
+        while (struct dirent* item = readdir(dir))
+        {
+            std::string name = item->d_name;
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".tex") != 0) continue;
+            struct stat info;
+            std::string path = directory + "/" + name;
+            if (stat(path.c_str(), &info) != 0) continue;
+            total += (uint64_t)info.st_size;
+            if (name != keep) entries.push_back({ path, info.st_mtime, (uint64_t)info.st_size });
+        }
+        closedir(dir);
+        
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        for (size_t i = 0; i < entries.size() && total > maxBytes; ++i)
+        {
+            if (unlink(entries[i].path.c_str()) == 0) total -= entries[i].size;
+        }
+    }
+};
@@ -0,0 +1,527 @@
+//
+//  texture_manager.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "hdr_texture.h"
+#include "jpeg_gpu.h"
+#include "stb_image.h"
+#include "texture.h"
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Owns every GL_TEXTURE_2D loaded from a file. The same image is only ever
+/// loaded once, whether asked for by the same path, another path to the same
+/// file or a copy of it, and lives while any Handle to it does.
+///
+/// Resident textures are kept within a byte budget: textures bound in
+/// neither the current frame nor the previous one are evicted, least
+/// recently bound first, and if that is not enough the largest mips of the
+/// ones in use are dropped. Both come back from the texture cache when
+/// there is room again, evicted ones as soon as they are bound, dropped
+/// mips at a later beginFrame().
+///
+/// Textures carry no sampling state; sample them through a SamplerCache.
+class TextureManager
+{
+public:
+    /// A counted reference to a managed texture. Must not outlive the manager
+    class Handle
+    {
+    public:
+        Handle() = default;
+        Handle(const Handle& other) : manager(other.manager), id(other.id) { if (manager) manager->retain(id); }
+        Handle(Handle&& other) : manager(other.manager), id(other.id) { other.manager = nullptr; }
+        ~Handle() { reset(); }
+        
+        Handle& operator=(Handle other)
+        {
+            std::swap(manager, other.manager);
+            std::swap(id, other.id);
+            return *this;
+        }
+        
+        explicit operator bool() const { return manager != nullptr; }
+        
+        /// Bind to GL_TEXTURE_2D on the given texture unit, reloading the
+        /// texture if it was evicted. Returns the texture name
+        GLuint bind(int unit = 0) const { return manager ? manager->bind(id, unit) : 0; }
+        
+        void reset()
+        {
+            if (manager) manager->release(id);
+            manager = nullptr;
+        }
+    
+    private:
+        friend class TextureManager;
+        Handle(TextureManager* manager, uint32_t id) : manager(manager), id(id) {}
+        
+        TextureManager* manager = nullptr;
+        uint32_t id = 0;
+    };
+    
+    struct Stats
+    {
+        size_t textures = 0;        // distinct images
+        size_t references = 0;      // live handles
+        size_t resident = 0;        // textures with any level in memory
+        size_t reduced = 0;         // of those, ones missing their largest mips
+        uint64_t residentBytes = 0;
+        uint64_t fullBytes = 0;     // if every texture were fully resident
+        uint64_t budget = 0;
+        uint64_t loads = 0;         // decodes or cache loads
+        uint64_t shared = 0;        // acquires answered by an existing texture
+        uint64_t evictions = 0;
+        uint64_t mipDrops = 0;      // levels dropped
+    };
+    
+    /// 'shaderDirectory' is for the GPU JPEG decoder, see JpegGpuDecoder
+    TextureManager(const std::string& shaderDirectory, uint64_t budgetBytes,
+                   const std::string& cacheDirectory = TextureCache::defaultDirectory())
+        : jpegDecoder(shaderDirectory), cache(cacheDirectory), budget(budgetBytes)
+    {
+    }
+    
+    ~TextureManager()
+    {
+        for (Entry& entry : entries)
+            if (entry.texture) glDeleteTextures(1, &entry.texture);
+    }
+    
+    TextureManager(const TextureManager&) = delete;
+    TextureManager& operator=(const TextureManager&) = delete;
+    
+    /// The texture for an image file, loading it if nobody holds it yet. An
+    /// empty handle if the file can't be loaded
+    Handle acquire(const std::string& path)
+    {
+        char resolved[PATH_MAX];
+        if (!realpath(path.c_str(), resolved))
+        {
+            std::cout << "ERROR::TEXTURE_MANAGER::NOT_FOUND " << path << std::endl;
+            return Handle();
+        }
+        std::string canonical = resolved;
+        
+        auto known = byPath.find(canonical);
+        if (known != byPath.end())
+        {
+            ++statistics.shared;
+            return share(known->second);
+        }
+        
+        Entry identified = identify(canonical);
+        
+        // another path to the same contents
+        auto same = byKey.find(identified.key.name);
+        if (!identified.key.name.empty() && same != byKey.end())
+        {
+            ++statistics.shared;
+            entries[same->second].paths.push_back(canonical);
+            byPath[canonical] = same->second;
+            return share(same->second);
+        }
+        
+        uint32_t id = allocate();
+        Entry& entry = entries[id];
+        entry = identified;
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        entry.lastBound = ++bindCount;
+        entry.lastFrame = frame;
+        if (!upload(entry))
+        {
+            std::cout << "ERROR::TEXTURE_MANAGER::LOAD_FAILED " << path << std::endl;
+            glDeleteTextures(1, &entry.texture);
+            entry = Entry();
+            freeIds.push_back(id);
+            return Handle();
+        }
+        
+        byPath[canonical] = id;
+        if (!entry.key.name.empty()) byKey[entry.key.name] = id;
+        Handle handle = share(id);
+        enforceBudget();
+        return handle;
+    }
+    
+    /// Make sure the texture cache holds the finished texture for an image
+    /// file and map it, without keeping a texture: for TextureStreamer,
+    /// which uploads the levels itself
+    bool bake(const std::string& path, TextureCache::Blob& blob)
+    {
+        char resolved[PATH_MAX];
+        if (!realpath(path.c_str(), resolved))
+        {
+            std::cout << "ERROR::TEXTURE_MANAGER::NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        Entry entry = identify(resolved);
+        if (cache.map(entry.key, blob)) return true;
+        
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glGenTextures(1, &entry.texture);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        ++statistics.loads;
+        bool baked = decode(entry) && cache.store(entry.key) && cache.map(entry.key, blob);
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+        glDeleteTextures(1, &entry.texture);
+        if (!baked) std::cout << "ERROR::TEXTURE_MANAGER::BAKE_FAILED " << path << std::endl;
+        return baked;
+    }
+    
+    /// Call once per frame, before drawing: evicts what went unused in the
+    /// frame just finished if over budget, and brings back dropped mips if under
+    void beginFrame()
+    {
+        ++frame;
+        enforceBudget();
+        restoreMips();
+    }
+    
+    void setBudget(uint64_t bytes)
+    {
+        budget = bytes;
+        enforceBudget();
+    }
+    
+    Stats stats() const
+    {
+        Stats result = statistics;
+        result.budget = budget;
+        for (const Entry& entry : entries)
+        {
+            if (entry.references == 0) continue;
+            ++result.textures;
+            result.references += entry.references;
+            result.fullBytes += entry.chainBytes(0);
+            if (!entry.resident) continue;
+            ++result.resident;
+            if (entry.dropped) ++result.reduced;
+            result.residentBytes += entry.chainBytes(entry.dropped);
+        }
+        return result;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "TEXTURE_MANAGER: " << s.textures << " textures (" << s.references << " handles, "
+            << s.shared << " shared loads), " << s.resident << " resident (" << s.reduced << " reduced), "
+            << s.residentBytes / 1024 << " of " << s.budget / 1024 << " KB budget, " << s.fullBytes / 1024 << " KB at full size, "
+            << s.loads << " loads, " << s.evictions << " evictions, " << s.mipDrops << " mips dropped" << std::endl;
+    }
+
+private:
+    struct Entry
+    {
+        std::vector<std::string> paths;     // canonical paths that resolved here
+        TextureCache::Key key;
+        bool hdr = false;
+        int channels = 3;                   // in the file; says the format, see Texture::formatFor
+        GLuint texture = 0;
+        int references = 0;
+        bool resident = false;
+        int dropped = 0;                    // largest levels not in memory
+        bool reducible = true;              // false if the cache can't hold it to reload from
+        std::vector<uint64_t> levelBytes;   // full chain, largest first
+        uint64_t lastBound = 0;
+        uint64_t lastFrame = 0;
+        
+        uint64_t chainBytes(int from) const
+        {
+            uint64_t total = 0;
+            for (size_t i = from; i < levelBytes.size(); ++i) total += levelBytes[i];
+            return total;
+        }
+    };
+    
+    JpegGpuDecoder jpegDecoder;
+    TextureCache cache;
+    uint64_t budget;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeIds;
+    std::unordered_map<std::string, uint32_t> byPath, byKey;
+    uint64_t frame = 0, bindCount = 0;
+    Stats statistics;
+    
+    /// An entry for a canonical path, with its format and cache key
+    Entry identify(const std::string& canonical)
+    {
+        Entry entry;
+        entry.paths.push_back(canonical);
+        entry.hdr = stbi_is_hdr(canonical.c_str()) != 0;
+        int width, height;
+        stbi_info(canonical.c_str(), &width, &height, &entry.channels);
+        static const char* const formats[] = { "r8, mipmapped", "rg8, mipmapped", "rgb8, mipmapped", "rgba8, mipmapped" };
+        entry.key = cache.key(canonical.c_str(), entry.hdr ? "packed float, mipmapped" : formats[std::min(std::max(entry.channels, 1), 4) - 1]);
+        return entry;
+    }
+    
+    uint32_t allocate()
+    {
+        if (freeIds.empty())
+        {
+            entries.emplace_back();
+            return (uint32_t)entries.size() - 1;
+        }
+        uint32_t id = freeIds.back();
+        freeIds.pop_back();
+        return id;
+    }
+    
+    Handle share(uint32_t id)
+    {
+        retain(id);
+        return Handle(this, id);
+    }
+    
+    void retain(uint32_t id)
+    {
+        ++entries[id].references;
+    }
+    
+    void release(uint32_t id)
+    {
+        Entry& entry = entries[id];
+        if (--entry.references > 0) return;
+        for (const std::string& path : entry.paths) byPath.erase(path);
+        if (!entry.key.name.empty()) byKey.erase(entry.key.name);
+        glDeleteTextures(1, &entry.texture);
+        entry = Entry();
+        freeIds.push_back(id);
+    }
+    
+    GLuint bind(uint32_t id, int unit)
+    {
+        Entry& entry = entries[id];
+        entry.lastBound = ++bindCount;
+        entry.lastFrame = frame;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        if (!entry.resident && upload(entry)) enforceBudget();
+        return entry.texture;
+    }
+    
+    /// Define the bound texture from its levels 'dropped' and up: from the
+    /// cache when it has them, otherwise by decoding the source again
+    bool upload(Entry& entry)
+    {
+        int dropped = entry.dropped;
+        ++statistics.loads;
+        if (!cache.load(entry.key, dropped))
+        {
+            // decodes the full chain
+            if (!decode(entry)) return false;
+            entry.reducible = cache.store(entry.key);
+            if (dropped && entry.reducible && cache.load(entry.key, dropped)) entry.dropped = dropped;
+        }
+        if (entry.levelBytes.empty()) measure(entry);
+        entry.resident = true;
+        return true;
+    }
+    
+    /// Radiance files become packed floats; color JPEGs go through the GPU
+    /// decoder when it can take them, everything else decodes on the CPU
+    /// straight into a mapped pixel unpack buffer, keeping the channels it
+    /// has (gray stays one channel)
+    bool decode(Entry& entry)
+    {
+        const char* path = entry.paths.front().c_str();
+        int width, height, channels;
+        bool loaded = false;
+        if (entry.hdr)
+        {
+            loaded = HdrTexture::load(path, HdrTexture::Packed, &width, &height);
+        }
+        else if (entry.channels == 3 && jpegDecoder.valid())
+        {
+            stbi_jpeg_coefficients coefficients;
+            if (stbi_jpeg_coefficients_load(path, &coefficients))
+            {
+                loaded = jpegDecoder.decode(coefficients, entry.texture);
+                stbi_jpeg_coefficients_free(&coefficients);
+            }
+        }
+        
+        if (!entry.hdr && !loaded && stbi_info(path, &width, &height, &channels))
+        {
+            Texture::Format format = Texture::formatFor(entry.channels, false);
+            int stride = width * format.channels;
+            GLsizeiptr imageSize = (GLsizeiptr)stride * height;
+            
+            GLuint pbo;
+            glGenBuffers(1, &pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, imageSize, nullptr, GL_STREAM_DRAW);
+            
+            stbi_uc* pixels = (stbi_uc*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (pixels)
+            {
+                loaded = stbi_load_into(path, pixels, imageSize, stride, &width, &height, &channels, format.channels);
+                loaded = (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE) && loaded;
+            }
+            if (loaded)
+            {
+                // the manager drops and restores mips by respecifying, so
+                // this texture stays mutable; Texture gives the format
+                GLint previousAlignment;
+                glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, Texture::unpackAlignment(nullptr, stride));
+                glTexImage2D(GL_TEXTURE_2D, 0, format.internalFormat, width, height, 0, format.format, GL_UNSIGNED_BYTE, nullptr);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+                glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+            }
+            
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &pbo);
+        }
+        
+        if (loaded)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            entry.dropped = 0;
+        }
+        return loaded;
+    }
+    
+    /// Sizes of the full chain, just defined on the bound texture, as the
+    /// format specifies them; drivers may pad (RGB8 to 4 bytes, say)
+    static void measure(Entry& entry)
+    {
+        GLint compressed;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+        for (GLint i = 0; i < 32; ++i)
+        {
+            GLint width, height;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &height);
+            if (width == 0) break;
+            if (compressed)
+            {
+                GLint size;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                entry.levelBytes.push_back((uint64_t)size);
+                continue;
+            }
+            GLint bits = 0, size;
+            const GLenum components[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+            for (GLenum component : components)
+            {
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, i, component, &size);
+                bits += size;
+            }
+            entry.levelBytes.push_back((uint64_t)width * height * ((bits + 7) / 8));
+        }
+    }
+    
+    uint64_t residentBytes() const
+    {
+        uint64_t total = 0;
+        for (const Entry& entry : entries)
+            if (entry.references && entry.resident) total += entry.chainBytes(entry.dropped);
+        return total;
+    }
+    
+    /// Resident entries, least recently bound first
+    std::vector<uint32_t> residentByBinding() const
+    {
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (entries[i].references && entries[i].resident) ids.push_back((uint32_t)i);
+        std::sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) { return entries[a].lastBound < entries[b].lastBound; });
+        return ids;
+    }
+    
+    void enforceBudget()
+    {
+        uint64_t used = residentBytes();
+        if (used <= budget) return;
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        std::vector<uint32_t> ids = residentByBinding();
+        
+        // textures bound in neither this frame nor the last go first
+        for (uint32_t id : ids)
+        {
+            Entry& entry = entries[id];
+            if (used <= budget) break;
+            if (entry.lastFrame + 1 >= frame) continue;
+            glBindTexture(GL_TEXTURE_2D, entry.texture);
+            TextureCache::freeLevels(0);
+            used -= entry.chainBytes(entry.dropped);
+            entry.resident = false;
+            ++statistics.evictions;
+        }
+        
+        // then the largest levels of the ones in use, least recently bound
+        // first, keeping the 1x1. each loses all it has to in one reload
+        for (uint32_t id : ids)
+        {
+            Entry& entry = entries[id];
+            if (used <= budget) break;
+            if (!entry.resident || !entry.reducible) continue;
+            int dropped = entry.dropped;
+            uint64_t freed = 0;
+            while (used - freed > budget && dropped + 1 < (int)entry.levelBytes.size())
+                freed += entry.levelBytes[dropped++];
+            if (dropped == entry.dropped) continue;
+            glBindTexture(GL_TEXTURE_2D, entry.texture);
+            if (!cache.load(entry.key, dropped))
+            {
+                entry.reducible = false;
+                continue;
+            }
+            used -= freed;
+            statistics.mipDrops += dropped - entry.dropped;
+            entry.dropped = dropped;
+        }
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+    }
+    
+    /// Bring back as many levels as fit, most recently bound texture first,
+    /// each in one reload
+    void restoreMips()
+    {
+        uint64_t used = residentBytes();
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        std::vector<uint32_t> ids = residentByBinding();
+        for (auto id = ids.rbegin(); id != ids.rend(); ++id)
+        {
+            Entry& entry = entries[*id];
+            int dropped = entry.dropped;
+            uint64_t added = 0;
+            while (dropped > 0 && used + added + entry.levelBytes[dropped - 1] <= budget)
+                added += entry.levelBytes[--dropped];
+            if (dropped == entry.dropped) continue;
+            glBindTexture(GL_TEXTURE_2D, entry.texture);
+            if (!cache.load(entry.key, dropped))
+            {
+                entry.reducible = false;
+                continue;
+            }
+            used += added;
+            entry.dropped = dropped;
+        }
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+    }
+};
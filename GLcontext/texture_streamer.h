@@ -0,0 +1,257 @@
+//
+//  texture_streamer.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "texture_cache.h"
+#include "texture_manager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+/// Streams textures in a mip level at a time. A texture starts with only its
+/// small levels, usable at once, and the larger ones follow as its size on
+/// screen asks for them, most blurred first, within an upload budget per
+/// frame. The levels come from a mapping of the texture cache entry.
+///
+/// Storage only covers the levels wanted: it is allocated (immutable where
+/// the GL has texture storage) for the wanted range and GL_TEXTURE_BASE_LEVEL
+/// tracks how much of it is loaded. A texture that wants more detail gets
+/// larger storage, its loaded levels uploaded again (a third of the next
+/// level at most); one that wants less gets smaller storage straight away.
+/// Like the manager's, the textures carry no sampling state.
+///
+///     int crate = streamer.add("crate.jpg");
+///     ...
+///     // each frame
+///     streamer.request(crate, TextureStreamer::projectedSize(1.0f, distance, fovY, viewportHeight));
+///     streamer.update();
+///     streamer.bind(crate, 0);
+class TextureStreamer
+{
+public:
+    struct Stats
+    {
+        size_t textures = 0;
+        size_t pending = 0;             // textures missing levels they want
+        uint64_t allocatedBytes = 0;    // storage for the wanted levels
+        uint64_t fullBytes = 0;         // if every texture had its full chain
+        uint64_t uploadedBytes = 0;     // in the last update()
+    };
+    
+    /// 'uploadBytesPerFrame' caps what update() sends (one level always goes,
+    /// however big); textures start with the levels up to 'startSize' across
+    TextureStreamer(TextureManager& manager, uint64_t uploadBytesPerFrame = 4 << 20, int startSize = 64)
+        : manager(manager), uploadBudget(uploadBytesPerFrame), startSize(startSize)
+    {
+    }
+    
+    ~TextureStreamer()
+    {
+        for (Stream& stream : streams)
+            glDeleteTextures(1, &stream.texture);
+    }
+    
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+    
+    /// Start streaming an image file; its small levels are uploaded now.
+    /// Returns its id, or -1 if it can't be loaded
+    int add(const std::string& path)
+    {
+        Stream stream;
+        if (!manager.bake(path, stream.blob)) return -1;
+        
+        int levels = stream.blob.levels();
+        stream.baseLevel = levels - 1;
+        while (stream.baseLevel > 0 && std::max(stream.blob.width(stream.baseLevel - 1), stream.blob.height(stream.baseLevel - 1)) <= startSize)
+            --stream.baseLevel;
+        stream.wanted = stream.baseLevel;
+        
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        reallocate(stream, stream.baseLevel);
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+        
+        streams.push_back(std::move(stream));
+        return (int)streams.size() - 1;
+    }
+    
+    /// How big the texture is on screen this frame: the pixels its longest
+    /// edge covers. Textures not requested for a while go back to their
+    /// starting levels
+    void request(int id, float screenSize)
+    {
+        Stream& stream = streams[id];
+        stream.screenSize = std::max(stream.requestFrame == frame ? stream.screenSize : 0.0f, screenSize);
+        stream.requestFrame = frame;
+    }
+    
+    /// Once per frame: resize storage to what is wanted and upload levels,
+    /// most blurred texture first, until the budget is spent
+    void update()
+    {
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        uploaded = 0;
+        
+        std::priority_queue<std::pair<float, int>> queue;
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            Stream& stream = streams[i];
+            bool forgotten = frame - stream.requestFrame > ForgetFrames;
+            if (forgotten) stream.wanted = stream.baseLevel;
+            else if (stream.requestFrame == frame) stream.wanted = wantedLevel(stream);
+            
+            // detail is given up with a level of slack, so it doesn't flicker
+            if (stream.wanted > stream.storageTop + (forgotten ? 0 : 1))
+                reallocate(stream, stream.wanted);
+            if (stream.loadedTop > stream.wanted) queue.push({ blur(stream), (int)i });
+        }
+        
+        while (!queue.empty())
+        {
+            int index = queue.top().second;
+            Stream& stream = streams[index];
+            queue.pop();
+            int level = stream.loadedTop - 1;
+            uint64_t cost = stream.blob.bytes(level);
+            if (stream.storageTop > level) cost += chainBytes(stream, stream.loadedTop);
+            if (uploaded > 0 && uploaded + cost > uploadBudget) break;
+            
+            if (stream.storageTop > level)
+            {
+                // grow the storage to everything wanted; the rest of it
+                // streams in on later pops and frames
+                reallocate(stream, stream.wanted);
+            }
+            glBindTexture(GL_TEXTURE_2D, stream.texture);
+            stream.blob.upload(level, level - stream.storageTop);
+            stream.loadedTop = level;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, stream.loadedTop - stream.storageTop);
+            uploaded += stream.blob.bytes(level);
+            if (stream.loadedTop > stream.wanted) queue.push({ blur(stream), index });
+        }
+        
+        // the bound texture may have been one replaced above
+        glBindTexture(GL_TEXTURE_2D, glIsTexture(previousTexture) ? previousTexture : 0);
+        ++frame;
+    }
+    
+    /// The texture as it stands; the name changes when storage is resized,
+    /// so ask again each frame
+    GLuint texture(int id) const { return streams[id].texture; }
+    
+    GLuint bind(int id, int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, streams[id].texture);
+        return streams[id].texture;
+    }
+    
+    Stats stats() const
+    {
+        Stats result;
+        result.textures = streams.size();
+        result.uploadedBytes = uploaded;
+        for (const Stream& stream : streams)
+        {
+            if (stream.loadedTop > stream.wanted) ++result.pending;
+            result.allocatedBytes += chainBytes(stream, stream.storageTop);
+            result.fullBytes += chainBytes(stream, 0);
+        }
+        return result;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "TEXTURE_STREAMER: " << s.textures << " textures, " << s.pending << " streaming, "
+            << s.allocatedBytes / 1024 << " KB allocated of " << s.fullBytes / 1024 << " KB at full size, "
+            << s.uploadedBytes / 1024 << " KB uploaded last frame" << std::endl;
+    }
+    
+    /// Pixels covered on screen by 'worldSize' units facing the camera at
+    /// 'distance', with a vertical field of view of 'fovY' radians
+    static float projectedSize(float worldSize, float distance, float fovY, int viewportHeight)
+    {
+        return worldSize / (2.0f * std::max(distance, 1e-4f) * std::tan(fovY * 0.5f)) * viewportHeight;
+    }
+
+private:
+    /// Unrequested for this long, a texture goes back to its starting levels
+    static constexpr uint64_t ForgetFrames = 120;
+    
+    struct Stream
+    {
+        TextureCache::Blob blob;
+        GLuint texture = 0;
+        int baseLevel = 0;      // the largest of the levels it starts with, which always stay
+        int storageTop = 0;     // largest level storage is allocated for
+        int loadedTop = 0;      // largest level uploaded; the GL base level
+        int wanted = 0;         // largest level its screen size calls for
+        float screenSize = 0;
+        uint64_t requestFrame = 0;
+    };
+    
+    TextureManager& manager;
+    uint64_t uploadBudget;
+    int startSize;
+    std::vector<Stream> streams;
+    uint64_t frame = 1, uploaded = 0;
+    
+    static uint64_t chainBytes(const Stream& stream, int from)
+    {
+        uint64_t total = 0;
+        for (int i = from; i < stream.blob.levels(); ++i) total += stream.blob.bytes(i);
+        return total;
+    }
+    
+    /// The smallest level still at least as big as the texture on screen
+    static int wantedLevel(const Stream& stream)
+    {
+        int level = stream.baseLevel;
+        while (level > 0 && std::max(stream.blob.width(level), stream.blob.height(level)) < stream.screenSize) --level;
+        return level;
+    }
+    
+    /// Screen pixels per texel of the largest loaded level: how magnified,
+    /// so how blurred, the texture is
+    static float blur(const Stream& stream)
+    {
+        return stream.screenSize / std::max(stream.blob.width(stream.loadedTop), stream.blob.height(stream.loadedTop));
+    }
+    
+    /// New storage for levels 'top' and smaller, filled with whatever of it
+    /// is already loaded. Leaves the texture bound
+    void reallocate(Stream& stream, int top)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        stream.blob.allocate(top);
+        
+        int loaded = stream.texture ? std::max(stream.loadedTop, top) : stream.baseLevel;
+        for (int i = loaded; i < stream.blob.levels(); ++i)
+            stream.blob.upload(i, i - top);
+        if (stream.texture) uploaded += chainBytes(stream, loaded);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, loaded - top);
+        
+        glDeleteTextures(1, &stream.texture);
+        stream.texture = texture;
+        stream.storageTop = top;
+        stream.loadedTop = loaded;
+    }
+};
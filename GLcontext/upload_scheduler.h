@@ -0,0 +1,337 @@
+//
+//  upload_scheduler.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Spreads uploads over frames so loading a lot at once doesn't hitch.
+/// Loaders queue texture regions and buffer ranges with a priority; each
+/// frame update() issues the most urgent ones until a byte budget or a time
+/// budget runs out, splitting textures into bands of rows and buffers into
+/// ranges to fit. The time budget follows the frame's headroom: the time
+/// between beginFrame() and update() against the target frame time. It
+/// grows a little each frame there is room and halves when a frame runs
+/// long, so uploads take what the frame leaves and no more.
+///
+/// Time is measured on the CPU, around the GL calls: the driver's copy and
+/// validation, which is what stalls the main thread.
+///
+///     uint64_t id = uploads.texture(texture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+///                                   std::move(pixels), priority, [&] { ready = true; });
+///     ...
+///     // each frame
+///     uploads.beginFrame();
+///     ... draw ...
+///     uploads.update();
+///     SDL_GL_SwapWindow(window);
+class UploadScheduler
+{
+public:
+    struct Stats
+    {
+        size_t queued = 0;              // uploads not finished
+        uint64_t queuedBytes = 0;
+        uint64_t uploadedBytes = 0;     // in the last update()
+        double uploadMs = 0;            // spent issuing them
+        double budgetMs = 0;            // the time budget for the next update()
+        double workMs = 0;              // the last frame's, without uploads
+        uint64_t bands = 0;             // GL calls made, all frames
+        uint64_t totalBytes = 0;
+    };
+    
+    /// 'bytesPerFrame' caps each update(); the time budget stays between
+    /// 'minBudgetMs' and 'maxBudgetMs' of a 'targetFrameMs' frame
+    UploadScheduler(uint64_t bytesPerFrame = 16 << 20, double targetFrameMs = 1000.0 / 60.0,
+                    double minBudgetMs = 0.25, double maxBudgetMs = 6.0)
+        : bytesPerFrame(bytesPerFrame), targetMs(targetFrameMs), minBudgetMs(minBudgetMs), maxBudgetMs(maxBudgetMs),
+          budgetMs(minBudgetMs)
+    {
+    }
+    
+    UploadScheduler(const UploadScheduler&) = delete;
+    UploadScheduler& operator=(const UploadScheduler&) = delete;
+    
+    /// Queue a region of a GL_TEXTURE_2D level. 'pixels' holds its rows
+    /// 'stride' bytes apart (0 for tightly packed); 'done' runs once the
+    /// last row is issued. Returns an id to cancel or reprioritize it by
+    uint64_t texture(GLuint texture, int level, int x, int y, int width, int height, GLenum format, GLenum type,
+                     std::vector<unsigned char> pixels, int priority = 0, std::function<void()> done = nullptr,
+                     size_t stride = 0)
+    {
+        Upload upload;
+        upload.texture = texture;
+        upload.level = level;
+        upload.x = x;
+        upload.y = y;
+        upload.width = width;
+        upload.height = height;
+        upload.format = format;
+        upload.type = type;
+        upload.stride = stride ? stride : (size_t)width * pixelBytes(format, type);
+        upload.size = upload.stride * height;
+        upload.data = std::move(pixels);
+        upload.done = std::move(done);
+        return enqueue(std::move(upload), priority);
+    }
+    
+    /// Queue bytes for a buffer at 'offset'
+    uint64_t buffer(GLuint buffer, GLintptr offset, std::vector<unsigned char> data, int priority = 0,
+                    std::function<void()> done = nullptr)
+    {
+        Upload upload;
+        upload.buffer = buffer;
+        upload.offset = offset;
+        upload.size = data.size();
+        upload.data = std::move(data);
+        upload.done = std::move(done);
+        return enqueue(std::move(upload), priority);
+    }
+    
+    /// Drop an upload, say because its texture is going away. What is
+    /// already issued stays. False if it had finished
+    bool cancel(uint64_t id)
+    {
+        auto found = priorities.find(id);
+        if (found == priorities.end()) return false;
+        auto upload = queue.find({ -found->second, id });
+        queuedBytes -= upload->second.size - upload->second.issued;
+        queue.erase(upload);
+        priorities.erase(found);
+        return true;
+    }
+    
+    /// Move a queued upload ahead of or behind others
+    void setPriority(uint64_t id, int priority)
+    {
+        auto found = priorities.find(id);
+        if (found == priorities.end() || found->second == priority) return;
+        auto upload = queue.find({ -found->second, id });
+        Upload moved = std::move(upload->second);
+        queue.erase(upload);
+        queue.emplace(std::make_pair(-priority, id), std::move(moved));
+        found->second = priority;
+    }
+    
+    bool pending(uint64_t id) const { return priorities.count(id) != 0; }
+    
+    /// Start of the frame's work, for measuring its headroom
+    void beginFrame()
+    {
+        frameStart = Clock::now();
+        started = true;
+    }
+    
+    /// Once per frame, after drawing: adapt the budget to how long the frame
+    /// took and issue uploads within it
+    void update()
+    {
+        // the frame's own work ran from beginFrame() to here, without the
+        // uploads; a frame that came late (a missed swap, say) counts as
+        // having no room whatever the work took
+        Clock::time_point now = Clock::now();
+        double interval = lastUpdate == Clock::time_point() ? 0 : std::chrono::duration<double, std::milli>(now - lastUpdate).count();
+        workMs = started ? std::chrono::duration<double, std::milli>(now - frameStart).count() : 0;
+        double headroom = started ? targetMs - workMs : maxBudgetMs;
+        if (interval > targetMs * LateFactor || headroom < budgetMs) budgetMs *= 0.5;
+        else budgetMs += GrowMs;
+        budgetMs = std::max(minBudgetMs, std::min(std::min(budgetMs, headroom), maxBudgetMs));
+        started = false;
+        lastUpdate = now;
+        
+        uploadedBytes = 0;
+        uploadMs = 0;
+        if (queue.empty()) return;
+        
+        GLint previousTexture, previousBuffer, previousUnpackBuffer, previousAlignment, previousRowLength;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glGetIntegerv(GL_COPY_WRITE_BUFFER_BINDING, &previousBuffer);
+        glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &previousUnpackBuffer);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glGetIntegerv(GL_UNPACK_ROW_LENGTH, &previousRowLength);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        Clock::time_point start = Clock::now();
+        while (!queue.empty())
+        {
+            double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            uint64_t bytesLeft = bytesPerFrame > uploadedBytes ? bytesPerFrame - uploadedBytes : 0;
+            uint64_t timeLeft = (uint64_t)std::max(0.0, (budgetMs - elapsed) * bytesPerMs);
+            uint64_t allowed = std::min(bytesLeft, timeLeft);
+            if (allowed > BandBytes) allowed = BandBytes;
+            auto top = queue.begin();
+            Upload& upload = top->second;
+            
+            // at least a row a frame, however small the budget, so nothing starves
+            uint64_t issued = issue(upload, allowed, uploadedBytes == 0);
+            if (issued == 0) break;
+            uploadedBytes += issued;
+            queuedBytes -= issued;
+            
+            if (upload.issued == upload.size)
+            {
+                std::function<void()> done = std::move(upload.done);
+                priorities.erase(top->first.second);
+                queue.erase(top);
+                if (done) done();
+            }
+        }
+        uploadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (uploadedBytes >= MeasureBytes && uploadMs > 0)
+            bytesPerMs += (uploadedBytes / uploadMs - bytesPerMs) * 0.25;
+        totalBytes += uploadedBytes;
+        
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, previousBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, previousUnpackBuffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, previousRowLength);
+    }
+    
+    Stats stats() const
+    {
+        Stats s;
+        s.queued = queue.size();
+        s.queuedBytes = queuedBytes;
+        s.uploadedBytes = uploadedBytes;
+        s.uploadMs = uploadMs;
+        s.budgetMs = budgetMs;
+        s.workMs = workMs;
+        s.bands = bands;
+        s.totalBytes = totalBytes;
+        return s;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "UPLOAD_SCHEDULER: " << s.queued << " queued (" << s.queuedBytes / 1024 << " KB), "
+            << s.uploadedBytes / 1024 << " KB in " << s.uploadMs << " ms last frame, budget " << s.budgetMs << " ms, "
+            << s.totalBytes / 1024 << " KB in " << s.bands << " bands in all" << std::endl;
+    }
+    
+    /// Bytes a pixel of 'format' and 'type' takes in client memory
+    static int pixelBytes(GLenum format, GLenum type)
+    {
+        switch (type)
+        {
+            case GL_UNSIGNED_INT_10F_11F_11F_REV: case GL_UNSIGNED_INT_5_9_9_9_REV:
+            case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_8_8_8_8: case GL_UNSIGNED_INT_8_8_8_8_REV:
+                return 4;
+            case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1:
+                return 2;
+        }
+        int channels = 4;
+        switch (format)
+        {
+            case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: channels = 1; break;
+            case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: channels = 2; break;
+            case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: channels = 3; break;
+        }
+        int size = 1;
+        switch (type)
+        {
+            case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: size = 2; break;
+            case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: size = 4; break;
+        }
+        return channels * size;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    static constexpr double GrowMs = 0.25;              // budget added each frame with room
+    static constexpr double LateFactor = 1.5;           // frames this much over the target are late
+    static constexpr uint64_t MeasureBytes = 64 << 10;  // enough uploaded to time the copy by
+    static constexpr uint64_t BandBytes = 1 << 20;      // most a GL call takes, so the clock is read often
+    
+    struct Upload
+    {
+        GLuint texture = 0, buffer = 0;
+        int level = 0, x = 0, y = 0, width = 0, height = 0;
+        GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+        size_t stride = 0;
+        GLintptr offset = 0;
+        size_t size = 0;            // bytes in all
+        size_t issued = 0;          // bytes handed to the GL so far
+        std::vector<unsigned char> data;
+        std::function<void()> done;
+    };
+    
+    uint64_t bytesPerFrame;
+    double targetMs, minBudgetMs, maxBudgetMs;
+    double budgetMs;
+    double bytesPerMs = 1 << 20;    // copy speed, measured as uploads go
+    double workMs = 0;
+    bool started = false;
+    Clock::time_point frameStart, lastUpdate;
+    
+    // most urgent first: by priority, then in the order queued
+    std::map<std::pair<int, uint64_t>, Upload> queue;
+    std::unordered_map<uint64_t, int> priorities;
+    uint64_t nextId = 1;
+    uint64_t queuedBytes = 0;
+    uint64_t uploadedBytes = 0, totalBytes = 0, bands = 0;
+    double uploadMs = 0;
+    
+    uint64_t enqueue(Upload upload, int priority)
+    {
+        uint64_t id = nextId++;
+        queuedBytes += upload.size;
+        priorities[id] = priority;
+        queue.emplace(std::make_pair(-priority, id), std::move(upload));
+        return id;
+    }
+    
+    /// Hand up to 'allowed' bytes of the upload to the GL: whole rows of a
+    /// texture, any range of a buffer. Returns the bytes issued
+    uint64_t issue(Upload& upload, uint64_t allowed, bool atLeastOne)
+    {
+        if (upload.buffer)
+        {
+            size_t bytes = std::min<size_t>(upload.size - upload.issued, allowed);
+            if (bytes == 0 && atLeastOne) bytes = upload.size - upload.issued < MeasureBytes ? upload.size - upload.issued : MeasureBytes;
+            if (bytes == 0) return 0;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, upload.buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, upload.offset + upload.issued, bytes, upload.data.data() + upload.issued);
+            upload.issued += bytes;
+            ++bands;
+            return bytes;
+        }
+        
+        int row = (int)(upload.issued / upload.stride);
+        int rows = (int)std::min<uint64_t>(upload.height - row, allowed / upload.stride);
+        if (rows == 0 && atLeastOne) rows = 1;
+        if (rows == 0) return 0;
+        
+        const unsigned char* pixels = upload.data.data() + upload.issued;
+        int rowBytes = upload.width * pixelBytes(upload.format, upload.type);
+        GLint alignment = Texture::unpackAlignment(pixels, upload.stride);
+        size_t paddedRow = ((size_t)rowBytes + alignment - 1) / alignment * alignment;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, upload.stride == paddedRow ? 0 : (GLint)(upload.stride / pixelBytes(upload.format, upload.type)));
+        glBindTexture(GL_TEXTURE_2D, upload.texture);
+        glTexSubImage2D(GL_TEXTURE_2D, upload.level, upload.x, upload.y + row, upload.width, rows, upload.format, upload.type, pixels);
+        size_t bytes = (size_t)rows * upload.stride;
+        upload.issued += bytes;
+        ++bands;
+        return bytes;
+    }
+};
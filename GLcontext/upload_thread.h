@@ -0,0 +1,293 @@
+//
+//  upload_thread.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+#include <SDL2/SDL.h>
+
+#include "texture.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// A loading thread with a GL context of its own, shared with the main one,
+/// so creating textures and buffers and copying into them (the driver's
+/// validation and copies) happens on another core. Work runs there in the
+/// order it was submitted; a fence follows each piece, and poll() on the
+/// render thread hands the results over once their fence has signalled, so
+/// the render thread never waits on the copies.
+///
+///     UploadThread loader(window);
+///     loader.texture(path, true, true, [&](Texture loaded) { albedo = std::move(loaded); });
+///     ...
+///     // each frame, on the render thread
+///     loader.poll();
+///
+/// Textures, buffers, shaders and syncs are shared between the contexts;
+/// vertex arrays and framebuffers are not, so make those on the render
+/// thread from what the loader hands over. Where a second context can't be
+/// made, the work runs in poll() instead, a piece a frame.
+class UploadThread
+{
+public:
+    struct Stats
+    {
+        size_t queued = 0;          // submitted, not yet handed over
+        uint64_t finished = 0;      // handed over, all frames
+        uint64_t bytes = 0;         // uploaded by texture() and buffer()
+        double workMs = 0;          // on the loading thread (or in poll() without one)
+        double pollMs = 0;          // on the render thread, in the last poll()
+        bool threaded = false;
+    };
+    
+    /// Make the loading context and start the thread. Call it on the render
+    /// thread, with the main context current on 'window'; it is current
+    /// again afterwards
+    explicit UploadThread(SDL_Window* window)
+        : window(window)
+    {
+        SDL_GLContext mainContext = SDL_GL_GetCurrentContext();
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        context = SDL_GL_CreateContext(window);
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+        SDL_GL_MakeCurrent(window, mainContext);
+        if (!context)
+        {
+            std::cout << "ERROR::UPLOAD_THREAD::NO_SHARED_CONTEXT loading on the render thread: " << SDL_GetError() << std::endl;
+            return;
+        }
+        worker = std::thread([this] { work(); });
+    }
+    
+    /// Stops the thread; work not handed over yet is dropped. What the work
+    /// that did run made is deleted with the render thread's context
+    /// current: textures and buffers, and results of submit() that free
+    /// themselves when destroyed
+    ~UploadThread()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+        for (Item& item : finished)
+        {
+            if (item.fence) glDeleteSync(item.fence);
+            if (item.drop) item.drop();
+        }
+        if (context) SDL_GL_DeleteContext(context);
+    }
+    
+    UploadThread(const UploadThread&) = delete;
+    UploadThread& operator=(const UploadThread&) = delete;
+    
+    /// Run 'work' with the loading context current, then 'done' with what it
+    /// returned on the render thread, once the GL has finished with it.
+    /// What 'work' returns must be default-constructible and movable
+    template <typename Work, typename Done>
+    void submit(Work work, Done done)
+    {
+        typedef decltype(work()) Result;
+        std::shared_ptr<Result> result = std::make_shared<Result>();
+        Item item;
+        item.work = [result, work]() mutable { *result = work(); };
+        item.done = [result, done]() mutable { done(std::move(*result)); };
+        push(std::move(item));
+    }
+    
+    /// Decode and upload an image file, building its mips, on the loading
+    /// thread. 'done' gets an empty texture if it couldn't be loaded
+    void texture(const std::string& path, bool srgb, bool mipmapped, std::function<void(Texture)> done)
+    {
+        submit([this, path, srgb, mipmapped]
+        {
+            Texture loaded = Texture::load(path.c_str(), srgb, mipmapped);
+            if (loaded) countBytes((uint64_t)loaded.width() * loaded.height() * loaded.format().channels);
+            return loaded;
+        }, std::move(done));
+    }
+    
+    /// A buffer holding 'data', made on the loading thread. 'done' gets its
+    /// name, which it then owns
+    void buffer(std::vector<unsigned char> data, GLenum usage, std::function<void(GLuint)> done)
+    {
+        std::shared_ptr<std::vector<unsigned char>> bytes = std::make_shared<std::vector<unsigned char>>(std::move(data));
+        std::shared_ptr<GLuint> name = std::make_shared<GLuint>(0);
+        Item item;
+        item.work = [this, bytes, usage, name]
+        {
+            glGenBuffers(1, name.get());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, *name);
+            glBufferData(GL_COPY_WRITE_BUFFER, bytes->size(), bytes->data(), usage);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            countBytes(bytes->size());
+            bytes->clear();
+            bytes->shrink_to_fit();
+        };
+        item.done = [name, done] { done(*name); };
+        item.drop = [name] { glDeleteBuffers(1, name.get()); };
+        push(std::move(item));
+    }
+    
+    /// Once a frame on the render thread: hand over what the GL has finished
+    /// with, in the order it was submitted, without waiting on the rest
+    void poll()
+    {
+        Clock::time_point start = Clock::now();
+        if (!context)
+        {
+            // no loading thread: a piece of work a frame, here
+            Item item;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!queue.empty())
+                {
+                    item = std::move(queue.front());
+                    queue.pop_front();
+                }
+            }
+            if (item.work)
+            {
+                item.work();
+                item.done();
+                std::lock_guard<std::mutex> lock(mutex);
+                ++statistics.finished;
+                statistics.workMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            }
+        }
+        else
+        {
+            std::vector<Item> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                while (!finished.empty())
+                {
+                    GLenum status = glClientWaitSync(finished.front().fence, 0, 0);
+                    if (status == GL_TIMEOUT_EXPIRED) break;
+                    if (status == GL_WAIT_FAILED)
+                        std::cout << "ERROR::UPLOAD_THREAD::WAIT_FAILED 0x" << std::hex << glGetError() << std::dec << std::endl;
+                    glDeleteSync(finished.front().fence);
+                    ready.push_back(std::move(finished.front()));
+                    finished.pop_front();
+                }
+                statistics.finished += ready.size();
+            }
+            // outside the lock, so 'done' may submit more
+            for (Item& item : ready)
+                item.done();
+        }
+        statistics.pollMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    
+    /// Whether the work runs on a thread of its own
+    bool threaded() const { return context != nullptr; }
+    
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = statistics;
+        s.queued = queue.size() + finished.size() + (busy ? 1 : 0);
+        s.threaded = threaded();
+        return s;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "UPLOAD_THREAD: " << (s.threaded ? "threaded" : "on the render thread") << ", " << s.queued << " queued, "
+            << s.finished << " finished, " << s.bytes / 1024 << " KB in " << s.workMs << " ms of work, "
+            << s.pollMs << " ms last poll" << std::endl;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    struct Item
+    {
+        std::function<void()> work;     // on the loading thread
+        std::function<void()> done;     // on the render thread
+        std::function<void()> drop;     // on the render thread, for work run but never handed over
+        GLsync fence = nullptr;         // after the work's commands
+    };
+    
+    SDL_Window* window;
+    SDL_GLContext context = nullptr;
+    
+    // shared with the loading thread
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Item> queue;         // waiting to run
+    std::deque<Item> finished;      // run, waiting on their fences
+    bool busy = false;
+    bool stopping = false;
+    Stats statistics;
+    
+    void push(Item item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(item));
+        }
+        wake.notify_one();
+    }
+    
+    void countBytes(uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        statistics.bytes += bytes;
+    }
+    
+    /// The loading thread. The fence is flushed so the render thread's
+    /// context sees it signal without this one doing anything more
+    void work()
+    {
+        SDL_GL_MakeCurrent(window, context);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) break;
+            Item item = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+            
+            Clock::time_point start = Clock::now();
+            item.work();
+            item.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            
+            lock.lock();
+            busy = false;
+            statistics.workMs += ms;
+            finished.push_back(std::move(item));
+        }
+        lock.unlock();
+        SDL_GL_MakeCurrent(window, nullptr);
+        // texture() decodes here, into this thread's stb_image scratch
+        // arena, which nothing else would free
+        stbi_thread_arena_free();
+    }
+};
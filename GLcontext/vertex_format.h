@@ -0,0 +1,322 @@
+//
+//  vertex_format.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "hdr_texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+/// Ways an attribute can be stored. Each gives what glVertexAttribPointer
+/// wants (components as the shader sees them, GL type, whether normalized),
+/// how many floats it is made from, its size in the vertex, rounded up to
+/// four bytes so the next attribute stays aligned, and how to pack floats
+/// into it.
+///
+/// Normalized encodings hold values in [-1, 1] (or [0, 1]); positions stored
+/// that way are relative to the mesh's bounds, which the vertex shader scales
+/// back. Signed ones are encoded for c / (2^(b-1) - 1), which is what GL 4.2
+/// made the rule and what hardware does; 4.1's older rule reads them half a
+/// step off.
+struct VertexEncoding
+{
+    template <int N>
+    struct Float
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_FLOAT;
+        static constexpr GLboolean normalized = GL_FALSE;
+        static constexpr size_t size = 4 * N;
+        
+        static void encode(const float* in, void* out) { memcpy(out, in, size); }
+    };
+    
+    template <int N>
+    struct Half
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_HALF_FLOAT;
+        static constexpr GLboolean normalized = GL_FALSE;
+        static constexpr size_t size = (2 * N + 3) & ~3;
+        
+        static void encode(const float* in, void* out)
+        {
+            uint16_t packed[size / 2] = {};
+            for (int i = 0; i < N; ++i) packed[i] = HdrTexture::halfFromFloat(in[i]);
+            memcpy(out, packed, size);
+        }
+    };
+    
+    template <int N>
+    struct Snorm16
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_SHORT;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = (2 * N + 3) & ~3;
+        
+        static void encode(const float* in, void* out)
+        {
+            int16_t packed[size / 2] = {};
+            for (int i = 0; i < N; ++i) packed[i] = (int16_t)snorm(in[i], 32767);
+            memcpy(out, packed, size);
+        }
+    };
+    
+    template <int N>
+    struct Unorm16
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_UNSIGNED_SHORT;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = (2 * N + 3) & ~3;
+        
+        static void encode(const float* in, void* out)
+        {
+            uint16_t packed[size / 2] = {};
+            for (int i = 0; i < N; ++i) packed[i] = (uint16_t)unorm(in[i], 65535);
+            memcpy(out, packed, size);
+        }
+    };
+    
+    template <int N>
+    struct Snorm8
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_BYTE;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = (N + 3) & ~3;
+        
+        static void encode(const float* in, void* out)
+        {
+            int8_t packed[size] = {};
+            for (int i = 0; i < N; ++i) packed[i] = (int8_t)snorm(in[i], 127);
+            memcpy(out, packed, size);
+        }
+    };
+    
+    template <int N>
+    struct Unorm8
+    {
+        static constexpr int inputs = N, components = N;
+        static constexpr GLenum type = GL_UNSIGNED_BYTE;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = (N + 3) & ~3;
+        
+        static void encode(const float* in, void* out)
+        {
+            uint8_t packed[size] = {};
+            for (int i = 0; i < N; ++i) packed[i] = (uint8_t)unorm(in[i], 255);
+            memcpy(out, packed, size);
+        }
+    };
+    
+    /// A unit vector from three floats, folded onto an octahedron and stored
+    /// as two snorm16s. The shader unfolds it:
+    ///
+    ///     vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    ///     float t = max(-n.z, 0.0);
+    ///     n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    ///     n = normalize(n);
+    struct Octahedral
+    {
+        static constexpr int inputs = 3, components = 2;
+        static constexpr GLenum type = GL_SHORT;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = 4;
+        
+        static void encode(const float* in, void* out)
+        {
+            float length = std::fabs(in[0]) + std::fabs(in[1]) + std::fabs(in[2]);
+            float x = length > 0 ? in[0] / length : 0, y = length > 0 ? in[1] / length : 0;
+            if (in[2] < 0)
+            {
+                float folded = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+                y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+                x = folded;
+            }
+            int16_t packed[2] = { (int16_t)snorm(x, 32767), (int16_t)snorm(y, 32767) };
+            memcpy(out, packed, size);
+        }
+    };
+    
+    /// Four floats as GL_INT_2_10_10_10_REV: xyz in ten bits each and w in
+    /// two, for a tangent and the sign of its bitangent
+    struct Packed1010102
+    {
+        static constexpr int inputs = 4, components = 4;
+        static constexpr GLenum type = GL_INT_2_10_10_10_REV;
+        static constexpr GLboolean normalized = GL_TRUE;
+        static constexpr size_t size = 4;
+        
+        static void encode(const float* in, void* out)
+        {
+            uint32_t packed = ((uint32_t)snorm(in[0], 511) & 0x3ff) | ((uint32_t)snorm(in[1], 511) & 0x3ff) << 10
+                | ((uint32_t)snorm(in[2], 511) & 0x3ff) << 20 | ((uint32_t)snorm(in[3], 1) & 0x3) << 30;
+            memcpy(out, &packed, size);
+        }
+    };
+    
+    /// The first 'count' of 'values' added up, for laying formats out
+    template <typename T>
+    static constexpr T total(std::initializer_list<T> values, size_t count)
+    {
+        T sum = 0;
+        for (const T* value = values.begin(); value != values.end() && count > 0; ++value, --count) sum += *value;
+        return sum;
+    }
+    
+    static int snorm(float value, int scale)
+    {
+        return (int)std::lround(std::max(-1.0f, std::min(value, 1.0f)) * scale);
+    }
+    
+    static int unorm(float value, int scale)
+    {
+        return (int)std::lround(std::max(0.0f, std::min(value, 1.0f)) * scale);
+    }
+};
+
+/// An attribute of a vertex format: the shader location it feeds and how
+/// it is stored
+template <GLuint Location, typename Encoding_>
+struct Attribute
+{
+    static_assert(Location < 16, "GL 4.1 guarantees 16 vertex attributes");
+    static constexpr GLuint location = Location;
+    typedef Encoding_ Encoding;
+};
+
+/// One attribute of a VertexLayout
+struct VertexAttribute
+{
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    size_t offset;                              // from the start of the vertex
+    int inputs;                                 // floats encode() reads
+    void (*encode)(const float* in, void* out);
+};
+
+/// A vertex format as data: what a VertexFormat makes, and what loaders that
+/// only learn the format at run time write through
+struct VertexLayout
+{
+    GLsizei stride = 0;
+    std::vector<VertexAttribute> attributes;
+    
+    /// Point the bound vertex array's attributes at 'buffer', with the first
+    /// vertex 'offset' bytes in. Leaves 'buffer' bound to GL_ARRAY_BUFFER
+    void apply(GLuint buffer, GLintptr offset = 0) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (const VertexAttribute& attribute : attributes)
+        {
+            glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, stride,
+                                  (const void*)(offset + attribute.offset));
+            glEnableVertexAttribArray(attribute.location);
+        }
+    }
+    
+    /// The attribute feeding 'location', or null
+    const VertexAttribute* find(GLuint location) const
+    {
+        for (const VertexAttribute& attribute : attributes)
+            if (attribute.location == location) return &attribute;
+        return nullptr;
+    }
+};
+
+/// A vertex format from a list of attributes, laid out in that order at
+/// compile time, so nothing hand-counts strides and offsets.
+///
+///     typedef VertexFormat<Attribute<0, VertexEncoding::Snorm16<3>>,     //  8 bytes
+///                          Attribute<1, VertexEncoding::Octahedral>,     //  4
+///                          Attribute<2, VertexEncoding::Unorm16<2>>>     //  4
+///             MeshVertex;                                                // 16, not 32
+///     std::vector<unsigned char> vertices = MeshVertex::pack(floats, count);
+///     glBindVertexArray(vao);
+///     MeshVertex::layout().apply(vbo);
+template <typename... Attributes>
+struct VertexFormat
+{
+    static constexpr size_t count = sizeof...(Attributes);
+    static constexpr size_t stride = VertexEncoding::total<size_t>({ Attributes::Encoding::size... }, count);
+    static constexpr int inputs = VertexEncoding::total<int>({ Attributes::Encoding::inputs... }, count);
+    
+    /// Bytes from the start of the vertex to attribute 'index'
+    static constexpr size_t offset(size_t index)
+    {
+        return VertexEncoding::total<size_t>({ Attributes::Encoding::size... }, index);
+    }
+    
+    static VertexLayout layout()
+    {
+        return layout(std::index_sequence_for<Attributes...>());
+    }
+    
+    /// Encode one vertex from a float array per attribute
+    template <typename... Values>
+    static void write(void* vertex, const Values*... values)
+    {
+        static_assert(sizeof...(Values) == count, "one array of floats per attribute");
+        write(vertex, std::index_sequence_for<Attributes...>(), values...);
+    }
+    
+    /// Encode 'vertexCount' vertices from floats interleaved in attribute
+    /// order, 'inputs' a vertex, like the hand-written arrays
+    static std::vector<unsigned char> pack(const float* interleaved, size_t vertexCount)
+    {
+        std::vector<unsigned char> vertices(vertexCount * stride);
+        for (size_t i = 0; i < vertexCount; ++i)
+            packVertex(&vertices[i * stride], interleaved + i * inputs, std::index_sequence_for<Attributes...>());
+        return vertices;
+    }
+
+private:
+    template <size_t... I>
+    static VertexLayout layout(std::index_sequence<I...>)
+    {
+        VertexLayout result;
+        result.stride = (GLsizei)stride;
+        result.attributes = { VertexAttribute{ Attributes::location, Attributes::Encoding::components, Attributes::Encoding::type,
+                                               Attributes::Encoding::normalized, offset(I), Attributes::Encoding::inputs,
+                                               &Attributes::Encoding::encode }... };
+        return result;
+    }
+    
+    template <size_t... I, typename... Values>
+    static void write(void* vertex, std::index_sequence<I...>, const Values*... values)
+    {
+        int expand[] = { 0, (Attributes::Encoding::encode(values, (unsigned char*)vertex + offset(I)), 0)... };
+        (void)expand;
+    }
+    
+    template <size_t... I>
+    static void packVertex(unsigned char* vertex, const float* floats, std::index_sequence<I...>)
+    {
+        int expand[] = { 0, (Attributes::Encoding::encode(floats + inputOffset(I), vertex + offset(I)), 0)... };
+        (void)expand;
+    }
+    
+    /// Floats before attribute 'index' in an interleaved vertex
+    static constexpr int inputOffset(size_t index)
+    {
+        return VertexEncoding::total<int>({ Attributes::Encoding::inputs... }, index);
+    }
+};
@@ -0,0 +1,639 @@
+//
+//  virtual_texture.h
+//  GLcontext
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/// An image far bigger than video memory, shown through a fixed-size cache
+/// of tiles. The image is split into square tiles at every mip level; a
+/// page table texture (one texel per tile, one level per mip) points each
+/// page at the finest tile over it that is resident in the tile cache.
+///
+/// Each frame the scene is drawn small into a feedback target with
+/// virtualFeedback.frag, which writes the tile every pixel wants; the
+/// readback, a frame later, queues the missing tiles for a loading thread
+/// and keeps the visible ones from being replaced. Decoded tiles go up a
+/// few per frame into the least recently seen slots. Until a tile arrives
+/// its page shows the nearest coarser one, down to the whole image in one
+/// tile, which never leaves.
+///
+/// Video memory is the tile cache and page table, whatever the image size.
+/// Tiles come from stbi_load_region, one tile's worth of the image at a
+/// time; the levels no bigger than 'tailSize' are built once up front, by
+/// streaming the image through stbi_load_rows, and tiles there are cut
+/// from that. Baseline JPEGs with restart markers give the cheapest tiles.
+///
+///     VirtualTexture terrain(path);
+///     // drawing, with vertShader.vert + virtualTexture.frag
+///     terrain.use(program, 0);
+///     // feedback, with vertShader.vert + virtualFeedback.frag
+///     terrain.beginFeedback(viewportWidth, viewportHeight);
+///     terrain.use(feedbackProgram, 0);
+///     ... draw the same geometry ...
+///     terrain.endFeedback();
+///     terrain.update();
+class VirtualTexture
+{
+public:
+    struct Stats
+    {
+        size_t resident = 0;        // tiles in the cache
+        size_t slots = 0;
+        size_t visible = 0;         // distinct tiles in the last feedback
+        size_t pending = 0;         // queued, decoding or decoded but not uploaded
+        uint64_t uploads = 0;       // tiles uploaded, in all
+        uint64_t replaced = 0;      // tiles replaced by others
+        uint64_t starved = 0;       // decoded tiles dropped for want of a free slot
+        uint64_t bytes = 0;         // tile cache and page table
+    };
+    
+    /// The tile cache holds 'cacheTiles' squared tiles of 'tileSize' plus a
+    /// border on each side for filtering; at most 'uploadsPerFrame' go up
+    /// per update()
+    explicit VirtualTexture(const std::string& path, int tileSize = 128, int cacheTiles = 16,
+                            int tailSize = 512, int feedbackScale = 8, int uploadsPerFrame = 8)
+        : path(path), tileSize(tileSize), cacheTiles(std::min(cacheTiles, 256)),
+          tailSize(std::max(tailSize, tileSize)), feedbackScale(feedbackScale), uploadsPerFrame(uploadsPerFrame)
+    {
+        int channels;
+        if (!stbi_info(path.c_str(), &width, &height, &channels))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return;
+        }
+        pages = 1;
+        while (pages * tileSize < std::max(width, height)) pages <<= 1;
+        while ((1 << maxLevel) < pages) ++maxLevel;
+        while (std::max(levelSize(width, tailLevel), levelSize(height, tailLevel)) > this->tailSize) ++tailLevel;
+        
+        if (!buildTail()) return;
+        createTextures();
+        
+        // the whole image in one tile, so every page has something to show
+        Tile top = decode(key(maxLevel, 0, 0));
+        slots[0].key = top.key;
+        slots[0].pinned = true;
+        resident[top.key] = 0;
+        upload(top.pixels, 0);
+        writePageTable();
+        
+        worker = std::thread([this] { work(); });
+        ready = true;
+    }
+    
+    ~VirtualTexture()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+        glDeleteTextures(1, &pageTable);
+        glDeleteTextures(1, &tileCache);
+        glDeleteTextures(1, &feedbackColor);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+        glDeleteFramebuffers(1, &feedbackFramebuffer);
+        glDeleteBuffers(2, feedbackBuffers);
+    }
+    
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+    
+    /// False if the image couldn't be read
+    bool valid() const { return ready; }
+    int imageWidth() const { return width; }
+    int imageHeight() const { return height; }
+    
+    /// Make 'program' current and point it at this texture: the page table
+    /// on texture unit 'unit', the tile cache on the next one
+    void use(GLuint program, int unit) const
+    {
+        glUseProgram(program);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        
+        float virtualSize = (float)pages * tileSize;
+        glUniform1i(glGetUniformLocation(program, "pageTable"), unit);
+        glUniform1i(glGetUniformLocation(program, "tileCache"), unit + 1);
+        glUniform2f(glGetUniformLocation(program, "imageScale"), width / virtualSize, height / virtualSize);
+        glUniform1f(glGetUniformLocation(program, "virtualSize"), virtualSize);
+        glUniform1f(glGetUniformLocation(program, "tileSize"), (float)tileSize);
+        glUniform1f(glGetUniformLocation(program, "tileBorder"), (float)Border);
+        glUniform1f(glGetUniformLocation(program, "cacheSize"), (float)cacheTiles * slotSize());
+        glUniform1f(glGetUniformLocation(program, "maxLevel"), (float)maxLevel);
+        glUniform1f(glGetUniformLocation(program, "feedbackBias"), std::log2((float)feedbackScale));
+        
+        // a 4x4 grid over the feedback pixel, edges included, every point
+        // once in 16 frames
+        static const int order[16] = { 0, 10, 2, 8, 5, 15, 7, 13, 1, 11, 3, 9, 4, 14, 6, 12 };
+        int point = order[feedbackFrames % 16];
+        glUniform2f(glGetUniformLocation(program, "feedbackJitter"), point % 4 / 3.0f - 0.5f, point / 4 / 3.0f - 0.5f);
+    }
+    
+    /// Bind and clear the feedback target, 1/feedbackScale of the viewport
+    /// each way, for drawing the scene with the feedback program
+    void beginFeedback(int viewportWidth, int viewportHeight)
+    {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        
+        int w = std::max(viewportWidth / feedbackScale, 1), h = std::max(viewportHeight / feedbackScale, 1);
+        if (w != feedbackWidth || h != feedbackHeight) createFeedback(w, h);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, w, h);
+        const GLuint none[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, none);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+    
+    /// Start reading the feedback back, for the next update() but one, and
+    /// restore the framebuffer and viewport
+    void endFeedback()
+    {
+        int index = feedbackFrames & 1;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[index]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackSize[index] = feedbackWidth * feedbackHeight;
+        ++feedbackFrames;
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    }
+    
+    /// Once per frame, after endFeedback(): read the last frame's feedback,
+    /// queue what it is missing, upload what has been decoded
+    void update()
+    {
+        if (!ready) return;
+        ++frame;
+        std::vector<uint64_t> missing = readFeedback();
+        
+        // no point decoding more than can go anywhere: a cache too small
+        // for the view keeps its coarsest wants and shows the rest blurred
+        size_t room = 0;
+        for (const Slot& slot : slots)
+            if (slot.key == Empty || (!slot.pinned && slot.lastSeen < frame)) ++room;
+        if (missing.size() > room) missing.resize(room);
+        
+        std::vector<Tile> decoded;
+        bool queued;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // the new feedback replaces whatever was still waiting
+            queue.clear();
+            for (uint64_t wanted : missing)
+            {
+                bool inFlight = wanted == decoding;
+                for (const Tile& tile : finished) inFlight = inFlight || tile.key == wanted;
+                if (!inFlight) queue.push_back(wanted);
+            }
+            size_t count = std::min(finished.size(), (size_t)uploadsPerFrame);
+            std::move(finished.begin(), finished.begin() + count, std::back_inserter(decoded));
+            finished.erase(finished.begin(), finished.begin() + count);
+            pending = queue.size() + finished.size() + (decoding != Empty);
+            queued = !queue.empty();
+        }
+        if (queued) wake.notify_one();
+        
+        bool changed = false;
+        for (Tile& tile : decoded)
+        {
+            if (tile.pixels.empty())
+            {
+                failed.insert(tile.key);
+                continue;
+            }
+            if (resident.count(tile.key)) continue;
+            int slot = freeSlot();
+            if (slot < 0)
+            {
+                ++statistics.starved;
+                continue;
+            }
+            if (slots[slot].key != Empty)
+            {
+                resident.erase(slots[slot].key);
+                ++statistics.replaced;
+            }
+            slots[slot].key = tile.key;
+            slots[slot].lastSeen = frame;
+            resident[tile.key] = slot;
+            upload(tile.pixels, slot);
+            changed = true;
+        }
+        if (changed) writePageTable();
+    }
+    
+    Stats stats() const
+    {
+        Stats result = statistics;
+        result.resident = resident.size();
+        result.slots = slots.size();
+        result.visible = visible;
+        result.pending = pending;
+        uint64_t pageTexels = 0;
+        for (int level = 0; level <= maxLevel; ++level) pageTexels += (uint64_t)(pages >> level) * (pages >> level);
+        result.bytes = (uint64_t)cacheTiles * slotSize() * cacheTiles * slotSize() * 4 + pageTexels * 4;
+        return result;
+    }
+    
+    void printStats() const
+    {
+        Stats s = stats();
+        std::cout << "VIRTUAL_TEXTURE: " << width << "x" << height << " in " << s.resident << " of " << s.slots << " tiles, "
+            << s.visible << " visible, " << s.pending << " pending, " << s.uploads << " uploads, " << s.replaced << " replaced, "
+            << s.starved << " starved, " << s.bytes / 1024 << " KB" << std::endl;
+    }
+
+private:
+    /// Texels of neighbouring tiles around each tile in the cache, for
+    /// bilinear filtering across tile edges
+    static constexpr int Border = 1;
+    static constexpr uint64_t Empty = ~0ull;
+    
+    struct Tile
+    {
+        uint64_t key = Empty;
+        std::vector<unsigned char> pixels;  // RGBA, slotSize() squared; empty if it failed
+    };
+    
+    struct Slot
+    {
+        uint64_t key = Empty;
+        uint64_t lastSeen = 0;
+        bool pinned = false;
+    };
+    
+    std::string path;
+    int width = 0, height = 0;
+    int tileSize, cacheTiles, tailSize, feedbackScale, uploadsPerFrame;
+    int pages = 1;              // across level 0; a power of two
+    int maxLevel = 0;           // where one tile covers the image
+    int tailLevel = 0;          // the first level built up front
+    std::vector<unsigned char> tail;
+    bool ready = false;
+    
+    GLuint pageTable = 0, tileCache = 0;
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, int> resident;
+    std::unordered_set<uint64_t> failed;
+    uint64_t frame = 0;
+    size_t visible = 0, pending = 0;
+    Stats statistics;
+    
+    GLuint feedbackFramebuffer = 0, feedbackColor = 0, feedbackDepth = 0;
+    GLuint feedbackBuffers[2] = { 0, 0 };
+    int feedbackSize[2] = { 0, 0 };
+    int feedbackWidth = 0, feedbackHeight = 0;
+    uint64_t feedbackFrames = 0;
+    GLint previousFramebuffer = 0, previousViewport[4] = { 0, 0, 0, 0 };
+    
+    // shared with the loading thread
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint64_t> queue;
+    uint64_t decoding = Empty;
+    std::vector<Tile> finished;
+    bool stopping = false;
+    
+    static uint64_t key(int level, int x, int y) { return (uint64_t)level << 48 | (uint64_t)y << 24 | (uint64_t)x; }
+    static int keyLevel(uint64_t key) { return (int)(key >> 48); }
+    static int keyX(uint64_t key) { return (int)(key & 0xffffff); }
+    static int keyY(uint64_t key) { return (int)(key >> 24 & 0xffffff); }
+    
+    static int levelSize(int size, int level) { return std::max((size + (1 << level) - 1) >> level, 1); }
+    int slotSize() const { return tileSize + 2 * Border; }
+    
+    /// Average 'factor' squared blocks of a source level into one tile,
+    /// clamping at the image edge. The source is the part of level
+    /// 'sourceLevel' at 'left', 'top', 'stride' texels wide
+    void downsample(const unsigned char* source, int left, int top, int stride, int sourceLevel, uint64_t tileKey, unsigned char* out) const
+    {
+        int level = keyLevel(tileKey), factor = 1 << (level - sourceLevel);
+        int sourceWidth = levelSize(width, sourceLevel), sourceHeight = levelSize(height, sourceLevel);
+        int lastX = levelSize(width, level) - 1, lastY = levelSize(height, level) - 1;
+        int originX = keyX(tileKey) * tileSize - Border, originY = keyY(tileKey) * tileSize - Border;
+        for (int j = 0; j < slotSize(); ++j)
+        {
+            int y = std::min(std::max(originY + j, 0), lastY);
+            int y0 = y * factor, y1 = std::min(y0 + factor, sourceHeight);
+            for (int i = 0; i < slotSize(); ++i)
+            {
+                int x = std::min(std::max(originX + i, 0), lastX);
+                int x0 = x * factor, x1 = std::min(x0 + factor, sourceWidth);
+                uint32_t sum[4] = { 0, 0, 0, 0 };
+                for (int sy = y0; sy < y1; ++sy)
+                {
+                    const unsigned char* row = source + ((size_t)(sy - top) * stride + (x0 - left)) * 4;
+                    for (int sx = x0; sx < x1; ++sx, row += 4)
+                        for (int c = 0; c < 4; ++c) sum[c] += row[c];
+                }
+                uint32_t count = (uint32_t)(x1 - x0) * (y1 - y0);
+                unsigned char* texel = out + ((size_t)j * slotSize() + i) * 4;
+                for (int c = 0; c < 4; ++c) texel[c] = (unsigned char)((sum[c] + count / 2) / count);
+            }
+        }
+    }
+    
+    struct TailSums
+    {
+        uint32_t* sums;
+        int imageWidth, tailWidth, factor;
+    };
+    
+    static int accumulateRows(void* user, stbi_uc const* rows, int y, int count, int stride)
+    {
+        TailSums& tail = *(TailSums*)user;
+        for (int r = 0; r < count; ++r, rows += stride)
+        {
+            uint32_t* out = tail.sums + (size_t)((y + r) / tail.factor) * tail.tailWidth * 4;
+            for (int x = 0; x < tail.imageWidth; ++x)
+                for (int c = 0; c < 4; ++c) out[(x / tail.factor) * 4 + c] += rows[x * 4 + c];
+        }
+        return 1;
+    }
+    
+    /// Stream the whole image once to build level 'tailLevel', summing
+    /// rows into it as they are decoded
+    bool buildTail()
+    {
+        int tailWidth = levelSize(width, tailLevel), tailHeight = levelSize(height, tailLevel);
+        int factor = 1 << tailLevel;
+        std::vector<uint32_t> sums((size_t)tailWidth * tailHeight * 4);
+        TailSums accumulated = { sums.data(), width, tailWidth, factor };
+        int x, y, channels;
+        if (!stbi_load_rows(path.c_str(), &x, &y, &channels, STBI_rgb_alpha, accumulateRows, &accumulated))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::LOAD_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+        
+        tail.resize(sums.size());
+        for (int ty = 0; ty < tailHeight; ++ty)
+            for (int tx = 0; tx < tailWidth; ++tx)
+            {
+                uint32_t count = (uint32_t)(std::min((tx + 1) * factor, width) - tx * factor) * (std::min((ty + 1) * factor, height) - ty * factor);
+                size_t index = ((size_t)ty * tailWidth + tx) * 4;
+                for (int c = 0; c < 4; ++c) tail[index + c] = (unsigned char)((sums[index + c] + count / 2) / count);
+            }
+        return true;
+    }
+    
+    /// Decode a tile: from the built levels, or a region of the image. On
+    /// the loading thread, apart from the top tile
+    Tile decode(uint64_t tileKey) const
+    {
+        Tile tile;
+        tile.key = tileKey;
+        int level = keyLevel(tileKey);
+        if (level >= tailLevel)
+        {
+            tile.pixels.resize((size_t)slotSize() * slotSize() * 4);
+            downsample(tail.data(), 0, 0, levelSize(width, tailLevel), tailLevel, tileKey, tile.pixels.data());
+            return tile;
+        }
+        
+        // the level 0 texels under the tile and its border, clipped
+        int factor = 1 << level;
+        int lastX = levelSize(width, level) - 1, lastY = levelSize(height, level) - 1;
+        int x0 = std::min(std::max(keyX(tileKey) * tileSize - Border, 0), lastX);
+        int y0 = std::min(std::max(keyY(tileKey) * tileSize - Border, 0), lastY);
+        int x1 = std::min((keyX(tileKey) + 1) * tileSize + Border, lastX + 1);
+        int y1 = std::min((keyY(tileKey) + 1) * tileSize + Border, lastY + 1);
+        int left = x0 * factor, top = y0 * factor;
+        int right = std::min(x1 * factor, width), bottom = std::min(y1 * factor, height);
+        
+        int w, h, channels;
+        stbi_uc* region = stbi_load_region(path.c_str(), left, top, right - left, bottom - top, &w, &h, &channels, STBI_rgb_alpha);
+        if (!region)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TILE_FAILED " << path << ": " << stbi_failure_reason() << std::endl;
+            return tile;
+        }
+        tile.pixels.resize((size_t)slotSize() * slotSize() * 4);
+        downsample(region, left, top, w, 0, tileKey, tile.pixels.data());
+        stbi_image_free(region);
+        return tile;
+    }
+    
+    /// The loading thread: coarsest queued tile first
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) break;
+            decoding = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            Tile tile = decode(decoding);
+            lock.lock();
+            finished.push_back(std::move(tile));
+            decoding = Empty;
+        }
+        lock.unlock();
+        // the decoder's scratch arena is per thread; tiles reuse it, and it
+        // would outlive the thread
+        stbi_thread_arena_free();
+    }
+    
+    void createTextures()
+    {
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        
+        glGenTextures(1, &tileCache);
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheTiles * slotSize(), cacheTiles * slotSize(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        slots.resize((size_t)cacheTiles * cacheTiles);
+        
+        glGenTextures(1, &pageTable);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        for (int level = 0; level <= maxLevel; ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, pages >> level, pages >> level, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+    }
+    
+    void createFeedback(int w, int h)
+    {
+        if (!feedbackFramebuffer)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenTextures(1, &feedbackColor);
+            glGenRenderbuffers(1, &feedbackDepth);
+            glGenBuffers(2, feedbackBuffers);
+        }
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glBindTexture(GL_TEXTURE_2D, feedbackColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16UI, w, h, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        
+        for (int i = 0; i < 2; ++i)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4 * sizeof(GLushort), nullptr, GL_STREAM_READ);
+            feedbackSize[i] = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackWidth = w;
+        feedbackHeight = h;
+    }
+    
+    /// Mark what the older feedback buffer saw as in use and return the
+    /// tiles it wants that aren't resident, coarsest and most seen first
+    std::vector<uint64_t> readFeedback()
+    {
+        std::vector<uint64_t> missing;
+        if (feedbackFrames < 2) return missing;
+        int index = feedbackFrames & 1;
+        if (!feedbackSize[index]) return missing;
+        
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[index]);
+        const GLushort* texels = (const GLushort*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)feedbackSize[index] * 4 * sizeof(GLushort), GL_MAP_READ_BIT);
+        std::unordered_map<uint64_t, int> seen;
+        if (texels)
+        {
+            uint64_t last = Empty;
+            for (int i = 0; i < feedbackSize[index]; ++i, texels += 4)
+            {
+                if (!texels[3]) continue;
+                uint64_t wanted = key(std::min((int)texels[2], maxLevel), texels[0], texels[1]);
+                if (wanted != last) ++seen[wanted];
+                last = wanted;
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackSize[index] = 0;
+        visible = seen.size();
+        
+        std::vector<std::pair<int, uint64_t>> order;
+        for (const auto& wanted : seen)
+        {
+            auto found = resident.find(wanted.first);
+            if (found != resident.end()) slots[found->second].lastSeen = frame;
+            else if (!failed.count(wanted.first)) order.push_back({ wanted.second, wanted.first });
+        }
+        std::sort(order.begin(), order.end(), [](const std::pair<int, uint64_t>& a, const std::pair<int, uint64_t>& b)
+        {
+            if (keyLevel(a.second) != keyLevel(b.second)) return keyLevel(a.second) > keyLevel(b.second);
+            return a.first > b.first;
+        });
+        for (const auto& wanted : order) missing.push_back(wanted.second);
+        return missing;
+    }
+    
+    /// An empty slot, or the one seen least recently if not this frame
+    int freeSlot() const
+    {
+        int best = -1;
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const Slot& slot = slots[i];
+            if (slot.key == Empty) return (int)i;
+            if (slot.pinned || slot.lastSeen >= frame) continue;
+            if (best < 0 || slot.lastSeen < slots[best].lastSeen) best = (int)i;
+        }
+        return best;
+    }
+    
+    void upload(const std::vector<unsigned char>& pixels, int slot)
+    {
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheTiles) * slotSize(), (slot / cacheTiles) * slotSize(),
+                        slotSize(), slotSize(), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+        ++statistics.uploads;
+    }
+    
+    /// Every page points at its own tile if resident, else at what its
+    /// parent page points at; the top level is always resident
+    void writePageTable()
+    {
+        std::vector<unsigned char> above, entries;
+        GLint previousTexture;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        for (int level = maxLevel; level >= 0; --level)
+        {
+            int count = pages >> level;
+            entries.assign((size_t)count * count * 4, 0);
+            for (int y = 0; y < count; ++y)
+                for (int x = 0; x < count; ++x)
+                {
+                    unsigned char* entry = &entries[((size_t)y * count + x) * 4];
+                    auto found = resident.find(key(level, x, y));
+                    if (found != resident.end())
+                    {
+                        entry[0] = (unsigned char)(found->second % cacheTiles);
+                        entry[1] = (unsigned char)(found->second / cacheTiles);
+                        entry[2] = (unsigned char)level;
+                        entry[3] = 255;
+                    }
+                    else if (level < maxLevel)
+                    {
+                        std::copy_n(&above[((size_t)(y / 2) * (count / 2) + x / 2) * 4], 4, entry);
+                    }
+                }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, count, count, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+            above.swap(entries);
+        }
+        glBindTexture(GL_TEXTURE_2D, previousTexture);
+    }
+};
@@ -0,0 +1,262 @@
+//
+//  corpus.h
+//  ImageBench
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include "encoders.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/// Small deterministic generator so the corpus is identical everywhere
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : state(seed ? seed : 0x9e3779b9u) {}
+    
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    
+    int range(int lo, int hi) { return lo + (int) (next() % (uint32_t) (hi - lo + 1)); }
+
+private:
+    uint32_t state;
+};
+
+/// Photo-like RGBA test pattern: a smooth colour field, hard-edged shapes
+/// and a little per-pixel noise, all in integer arithmetic
+inline Image synthesize(int width, int height, uint32_t seed)
+{
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.channels = 4;
+    image.data.resize((size_t) width * height * 4);
+    Random random(seed);
+    
+    // bilinear interpolation between colours on a coarse lattice
+    const int cells = 6;
+    int lattice[cells + 1][cells + 1][3];
+    for (int j = 0; j <= cells; ++j)
+        for (int i = 0; i <= cells; ++i)
+            for (int c = 0; c < 3; ++c)
+                lattice[j][i][c] = random.range(16, 240);
+    for (int y = 0; y < height; ++y) {
+        int fy = (int) ((int64_t) y * cells * 256 / height), cy = fy >> 8, wy = fy & 255;
+        uint8_t* p = &image.data[(size_t) y * width * 4];
+        for (int x = 0; x < width; ++x, p += 4) {
+            int fx = (int) ((int64_t) x * cells * 256 / width), cx = fx >> 8, wx = fx & 255;
+            for (int c = 0; c < 3; ++c) {
+                int top = lattice[cy][cx][c] * (256 - wx) + lattice[cy][cx + 1][c] * wx;
+                int bottom = lattice[cy + 1][cx][c] * (256 - wx) + lattice[cy + 1][cx + 1][c] * wx;
+                p[c] = (uint8_t) ((top * (256 - wy) + bottom * wy) >> 16);
+            }
+            int dx = std::abs(2 * x - width), dy = std::abs(2 * y - height);
+            p[3] = (uint8_t) (255 - (int64_t) (dx + dy) * 255 / (width + height));
+        }
+    }
+    
+    // rectangles and discs at resolution independent positions
+    for (int shape = 0; shape < 24; ++shape) {
+        int x0 = random.range(0, 1023) * width / 1024, y0 = random.range(0, 1023) * height / 1024;
+        int size = random.range(16, 256) * std::min(width, height) / 1024 + 1;
+        bool disc = random.next() & 1;
+        uint8_t colour[3] = { (uint8_t) random.range(0, 255), (uint8_t) random.range(0, 255), (uint8_t) random.range(0, 255) };
+        for (int y = std::max(0, y0 - size); y < std::min(height, y0 + size); ++y)
+            for (int x = std::max(0, x0 - size); x < std::min(width, x0 + size); ++x) {
+                if (disc && (int64_t) (x - x0) * (x - x0) + (int64_t) (y - y0) * (y - y0) > (int64_t) size * size) continue;
+                memcpy(&image.data[((size_t) y * width + x) * 4], colour, 3);
+            }
+    }
+    
+    for (size_t i = 0; i < image.data.size(); i += 4)
+        for (int c = 0; c < 3; ++c) {
+            int v = image.data[i + c] + (int) (random.next() % 9) - 4;
+            image.data[i + c] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+        }
+    return image;
+}
+
+/// Reduce the RGBA pattern to a channel count and bit depth
+inline Image convert(const Image& rgba, int channels, int depth)
+{
+    Image image;
+    image.width = rgba.width;
+    image.height = rgba.height;
+    image.channels = channels;
+    image.depth = depth;
+    image.data.resize(image.rowBytes() * image.height);
+    size_t pixels = (size_t) rgba.width * rgba.height;
+    Random random(depth);
+    uint8_t* out = image.data.data();
+    for (size_t i = 0; i < pixels; ++i) {
+        const uint8_t* p = &rgba.data[i * 4];
+        uint8_t gray = (uint8_t) ((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+        uint8_t samples[4] = { p[0], p[1], p[2], p[3] };
+        if (channels <= 2) {
+            samples[0] = gray;
+            samples[1] = p[3];
+        }
+        for (int c = 0; c < channels; ++c) {
+            if (depth == 16) {
+                // fill the low byte so the extra precision is not free to compress
+                *out++ = samples[c];
+                *out++ = (uint8_t) random.next();
+            } else {
+                *out++ = (uint8_t) (samples[c] >> (8 - depth));
+            }
+        }
+    }
+    return image;
+}
+
+/// Linear light version of the pattern spanning a few stops
+inline HdrImage convertHdr(const Image& rgba)
+{
+    float table[256];
+    for (int i = 0; i < 256; ++i) table[i] = std::pow(i / 255.0f, 2.2f) * 16.0f;
+    HdrImage image;
+    image.width = rgba.width;
+    image.height = rgba.height;
+    image.data.resize((size_t) rgba.width * rgba.height * 3);
+    for (size_t i = 0, n = (size_t) rgba.width * rgba.height; i < n; ++i)
+        for (int c = 0; c < 3; ++c)
+            image.data[i * 3 + c] = table[rgba.data[i * 4 + c]];
+    return image;
+}
+
+/// One kind of file in the corpus
+struct CorpusFormat
+{
+    std::string name;
+    std::string extension;
+    int maxSize; // largest edge generated
+    std::vector<uint8_t> (*encode)(const Image& rgba);
+};
+
+/// A generated file on disk
+struct CorpusFile
+{
+    std::string format;
+    std::string path;
+    int size;
+    size_t fileBytes;
+};
+
+namespace corpus
+{
+    inline std::vector<uint8_t> jpeg(const Image& rgba, int channels, JpegEncoder::Subsampling subsampling, bool progressive, int restart)
+    {
+        JpegEncoder encoder;
+        encoder.subsampling = subsampling;
+        encoder.progressive = progressive;
+        encoder.restartInterval = restart;
+        return encoder.encode(convert(rgba, channels, 8));
+    }
+    
+    inline std::vector<uint8_t> png(const Image& rgba, int channels, int depth, PngEncoder::Filter filter, bool interlaced = false, bool palette = false)
+    {
+        PngEncoder encoder;
+        encoder.filter = filter;
+        encoder.interlaced = interlaced;
+        encoder.palette = palette;
+        return encoder.encode(convert(rgba, channels, depth));
+    }
+    
+    inline std::vector<uint8_t> tga(const Image& rgba, int channels, bool rle)
+    {
+        TgaEncoder encoder;
+        encoder.rle = rle;
+        return encoder.encode(convert(rgba, channels, 8));
+    }
+    
+    /// Everything the benchmark knows how to generate
+    inline const std::vector<CorpusFormat>& formats()
+    {
+        typedef JpegEncoder J;
+        typedef PngEncoder P;
+        static const std::vector<CorpusFormat> list = {
+            { "jpeg-444",             "jpg", 4096, [](const Image& i) { return jpeg(i, 3, J::s444, false, 0); } },
+            { "jpeg-422",             "jpg", 4096, [](const Image& i) { return jpeg(i, 3, J::s422, false, 0); } },
+            { "jpeg-420",             "jpg", 8192, [](const Image& i) { return jpeg(i, 3, J::s420, false, 0); } },
+            { "jpeg-gray",            "jpg", 4096, [](const Image& i) { return jpeg(i, 1, J::s444, false, 0); } },
+            { "jpeg-420-restart",     "jpg", 4096, [](const Image& i) { return jpeg(i, 3, J::s420, false, 16); } },
+            { "jpeg-progressive-444", "jpg", 4096, [](const Image& i) { return jpeg(i, 3, J::s444, true, 0); } },
+            { "jpeg-progressive-420", "jpg", 8192, [](const Image& i) { return jpeg(i, 3, J::s420, true, 0); } },
+            { "png-rgb8",             "png", 8192, [](const Image& i) { return png(i, 3, 8, P::adaptive); } },
+            { "png-rgb8-none",        "png", 1024, [](const Image& i) { return png(i, 3, 8, P::none); } },
+            { "png-rgb8-sub",         "png", 1024, [](const Image& i) { return png(i, 3, 8, P::sub); } },
+            { "png-rgb8-up",          "png", 1024, [](const Image& i) { return png(i, 3, 8, P::up); } },
+            { "png-rgb8-average",     "png", 1024, [](const Image& i) { return png(i, 3, 8, P::average); } },
+            { "png-rgb8-paeth",       "png", 1024, [](const Image& i) { return png(i, 3, 8, P::paeth); } },
+            { "png-rgba8",            "png", 4096, [](const Image& i) { return png(i, 4, 8, P::adaptive); } },
+            { "png-gray8",            "png", 4096, [](const Image& i) { return png(i, 1, 8, P::adaptive); } },
+            { "png-gray4",            "png", 4096, [](const Image& i) { return png(i, 1, 4, P::adaptive); } },
+            { "png-gray1",            "png", 4096, [](const Image& i) { return png(i, 1, 1, P::adaptive); } },
+            { "png-palette8",         "png", 4096, [](const Image& i) { return png(i, 3, 8, P::adaptive, false, true); } },
+            { "png-rgb16",            "png", 4096, [](const Image& i) { return png(i, 3, 16, P::adaptive); } },
+            { "png-rgba8-interlaced", "png", 4096, [](const Image& i) { return png(i, 4, 8, P::adaptive, true); } },
+            { "tga-rgb",              "tga", 4096, [](const Image& i) { return tga(i, 3, false); } },
+            { "tga-rgba-rle",         "tga", 4096, [](const Image& i) { return tga(i, 4, true); } },
+            { "bmp-rgb",              "bmp", 4096, [](const Image& i) { BmpEncoder e; return e.encode(convert(i, 3, 8)); } },
+            { "hdr-rle",              "hdr", 4096, [](const Image& i) { HdrEncoder e; return e.encode(convertHdr(i)); } },
+        };
+        return list;
+    }
+    
+    inline bool exists(const std::string& path, size_t& bytes)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) return false;
+        bytes = (size_t) info.st_size;
+        return true;
+    }
+    
+    /// Write any missing files for the given edge sizes and list the corpus.
+    /// Files are only ever generated once per directory
+    inline std::vector<CorpusFile> generate(const std::string& directory, const std::vector<int>& sizes, const std::string& filter)
+    {
+        mkdir(directory.c_str(), 0755);
+        std::vector<CorpusFile> files;
+        for (int size : sizes) {
+            Image rgba;
+            for (const CorpusFormat& format : formats()) {
+                if (size > format.maxSize) continue;
+                if (!filter.empty() && format.name.find(filter) == std::string::npos) continue;
+                CorpusFile file;
+                file.format = format.name;
+                file.size = size;
+                file.path = directory + "/" + format.name + "-" + std::to_string(size) + "." + format.extension;
+                if (!exists(file.path, file.fileBytes)) {
+                    if (rgba.data.empty()) {
+                        std::cout << "generating " << size << "x" << size << " corpus..." << std::endl;
+                        rgba = synthesize(size, size, 1234);
+                    }
+                    std::vector<uint8_t> bytes = format.encode(rgba);
+                    std::ofstream stream(file.path, std::ios::binary);
+                    stream.write((const char*) bytes.data(), bytes.size());
+                    if (!stream) {
+                        std::cout << "ERROR::CORPUS::WRITE_FAILED " << file.path << std::endl;
+                        continue;
+                    }
+                    file.fileBytes = bytes.size();
+                }
+                files.push_back(file);
+            }
+        }
+        return files;
+    }
+}
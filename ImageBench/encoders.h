@@ -0,0 +1,952 @@
+//
+//  encoders.h
+//  ImageBench
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// Uncompressed image: one sample per byte, or two big-endian bytes per
+/// sample when depth is 16. Samples below 8 bits are stored unpacked
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int depth = 8;
+    std::vector<uint8_t> data;
+    
+    int bytesPerSample() const { return depth == 16 ? 2 : 1; }
+    size_t rowBytes() const { return (size_t) width * channels * bytesPerSample(); }
+};
+
+/// Floating point RGB image for the HDR writer
+struct HdrImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> data;
+};
+
+/// Byte sink shared by the writers
+class ByteWriter
+{
+public:
+    std::vector<uint8_t> bytes;
+    
+    void put8(int v) { bytes.push_back((uint8_t) v); }
+    void put16be(int v) { put8(v >> 8); put8(v); }
+    void put16le(int v) { put8(v); put8(v >> 8); }
+    void put32be(uint32_t v) { put16be(v >> 16); put16be(v & 0xffff); }
+    void put32le(uint32_t v) { put16le(v & 0xffff); put16le(v >> 16); }
+    void put(const void* data, size_t size)
+    {
+        const uint8_t* p = (const uint8_t*) data;
+        bytes.insert(bytes.end(), p, p + size);
+    }
+};
+
+/// Baseline or progressive (spectral selection only) JPEG writer with the
+/// example tables from the JPEG spec
+class JpegEncoder
+{
+public:
+    enum Subsampling { s444, s422, s420 };
+    
+    int quality = 90;
+    Subsampling subsampling = s420;
+    bool progressive = false;
+    int restartInterval = 0; // in MCUs; 0 for none
+    
+    std::vector<uint8_t> encode(const Image& image)
+    {
+        setupTables();
+        setupComponents(image);
+        out = ByteWriter();
+        
+        static const uint8_t jfif[] = { 'J','F','I','F',0, 1,1, 0, 0,1, 0,1, 0,0 };
+        out.put16be(0xffd8);
+        out.put16be(0xffe0);
+        out.put16be(2 + sizeof(jfif));
+        out.put(jfif, sizeof(jfif));
+        writeQuantTables();
+        
+        out.put16be(progressive ? 0xffc2 : 0xffc0);
+        out.put16be(8 + 3 * (int) components.size());
+        out.put8(8);
+        out.put16be(image.height);
+        out.put16be(image.width);
+        out.put8((int) components.size());
+        for (size_t c = 0; c < components.size(); ++c) {
+            out.put8((int) c + 1);
+            out.put8(components[c].h << 4 | components[c].v);
+            out.put8(c ? 1 : 0);
+        }
+        writeHuffmanTables();
+        if (restartInterval) {
+            out.put16be(0xffdd);
+            out.put16be(4);
+            out.put16be(restartInterval);
+        }
+        
+        if (!progressive) {
+            writeScan(allComponents(), 0, 63);
+        } else {
+            // DC for everything, then two AC bands per component
+            writeScan(allComponents(), 0, 0);
+            for (int c = 0; c < (int) components.size(); ++c) {
+                writeScan({ c }, 1, 5);
+                writeScan({ c }, 6, 63);
+            }
+        }
+        out.put16be(0xffd9);
+        return out.bytes;
+    }
+
+private:
+    struct Component
+    {
+        int h, v;
+        int blocksWide, blocksHigh;   // padded out to whole MCUs
+        int usedWide, usedHigh;       // blocks covering the component's own size
+        std::vector<int16_t> coeffs;  // quantized, zigzag order, 64 per block
+        int predictor;
+    };
+    
+    struct HuffmanTable
+    {
+        uint16_t code[256];
+        uint8_t size[256];
+    };
+    
+    ByteWriter out;
+    std::vector<Component> components;
+    int mcusWide = 0, mcusHigh = 0;
+    uint8_t quant[2][64];       // zigzag order
+    HuffmanTable dcTable[2], acTable[2];
+    uint32_t bitBuffer = 0;
+    int bitCount = 0;
+    
+    static const uint8_t* zigzag()
+    {
+        static const uint8_t z[64] = {
+            0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,
+            12,19,26,33,40,48,41,34,27,20,13, 6, 7,14,21,28,
+            35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,
+            58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
+        return z;
+    }
+    
+    static const uint8_t* dcBits(int t)
+    {
+        static const uint8_t b[2][16] = {
+            { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 },
+            { 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 } };
+        return b[t];
+    }
+    
+    static const uint8_t* dcValues(int)
+    {
+        static const uint8_t v[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+        return v;
+    }
+    
+    static const uint8_t* acBits(int t)
+    {
+        static const uint8_t b[2][16] = {
+            { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d },
+            { 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 } };
+        return b[t];
+    }
+    
+    static const uint8_t* acValues(int t)
+    {
+        static const uint8_t v[2][162] = { {
+            0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,
+            0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,
+            0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+            0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,
+            0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,
+            0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+            0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,
+            0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,
+            0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+            0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+            0xf9,0xfa }, {
+            0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,
+            0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,
+            0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+            0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,
+            0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,
+            0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+            0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,
+            0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,
+            0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+            0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+            0xf9,0xfa } };
+        return v[t];
+    }
+    
+    static void buildHuffman(HuffmanTable& table, const uint8_t* bits, const uint8_t* values)
+    {
+        int code = 0, k = 0;
+        memset(&table, 0, sizeof(table));
+        for (int length = 1; length <= 16; ++length) {
+            for (int i = 0; i < bits[length - 1]; ++i, ++k) {
+                table.code[values[k]] = (uint16_t) code++;
+                table.size[values[k]] = (uint8_t) length;
+            }
+            code <<= 1;
+        }
+    }
+    
+    void setupTables()
+    {
+        static const uint8_t luma[64] = {
+            16,11,10,16, 24, 40, 51, 61, 12,12,14,19, 26, 58, 60, 55,
+            14,13,16,24, 40, 57, 69, 56, 14,17,22,29, 51, 87, 80, 62,
+            18,22,37,56, 68,109,103, 77, 24,35,55,64, 81,104,113, 92,
+            49,64,78,87,103,121,120,101, 72,92,95,98,112,100,103, 99 };
+        static const uint8_t chroma[64] = {
+            17,18,24,47,99,99,99,99, 18,21,26,66,99,99,99,99,
+            24,26,56,99,99,99,99,99, 47,66,99,99,99,99,99,99,
+            99,99,99,99,99,99,99,99, 99,99,99,99,99,99,99,99,
+            99,99,99,99,99,99,99,99, 99,99,99,99,99,99,99,99 };
+        int q = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+        int scale = q < 50 ? 5000 / q : 200 - 2 * q;
+        for (int i = 0; i < 64; ++i) {
+            int natural = zigzag()[i];
+            int l = (luma[natural] * scale + 50) / 100;
+            int c = (chroma[natural] * scale + 50) / 100;
+            quant[0][i] = (uint8_t) (l < 1 ? 1 : l > 255 ? 255 : l);
+            quant[1][i] = (uint8_t) (c < 1 ? 1 : c > 255 ? 255 : c);
+        }
+        for (int t = 0; t < 2; ++t) {
+            buildHuffman(dcTable[t], dcBits(t), dcValues(t));
+            buildHuffman(acTable[t], acBits(t), acValues(t));
+        }
+    }
+    
+    /// Colour convert, subsample, DCT and quantize everything up front
+    void setupComponents(const Image& image)
+    {
+        int count = image.channels >= 3 ? 3 : 1;
+        int hmax = count == 3 && subsampling != s444 ? 2 : 1;
+        int vmax = count == 3 && subsampling == s420 ? 2 : 1;
+        mcusWide = (image.width + 8 * hmax - 1) / (8 * hmax);
+        mcusHigh = (image.height + 8 * vmax - 1) / (8 * vmax);
+        
+        components.assign(count, Component());
+        for (int c = 0; c < count; ++c) {
+            Component& comp = components[c];
+            comp.h = c == 0 ? hmax : 1;
+            comp.v = c == 0 ? vmax : 1;
+            comp.blocksWide = mcusWide * comp.h;
+            comp.blocksHigh = mcusHigh * comp.v;
+            int compWidth = (image.width * comp.h + hmax - 1) / hmax;
+            int compHeight = (image.height * comp.v + vmax - 1) / vmax;
+            comp.usedWide = (compWidth + 7) / 8;
+            comp.usedHigh = (compHeight + 7) / 8;
+            
+            // full resolution plane, then box-filter it down
+            int planeWidth = comp.blocksWide * 8, planeHeight = comp.blocksHigh * 8;
+            int sx = hmax / comp.h, sy = vmax / comp.v;
+            std::vector<uint8_t> plane((size_t) planeWidth * planeHeight);
+            for (int y = 0; y < planeHeight; ++y) {
+                for (int x = 0; x < planeWidth; ++x) {
+                    int sum = 0;
+                    for (int j = 0; j < sy; ++j) {
+                        for (int i = 0; i < sx; ++i) {
+                            int px = x * sx + i, py = y * sy + j;
+                            if (px >= image.width) px = image.width - 1;
+                            if (py >= image.height) py = image.height - 1;
+                            sum += sample(image, px, py, c);
+                        }
+                    }
+                    plane[(size_t) y * planeWidth + x] = (uint8_t) ((sum + sx * sy / 2) / (sx * sy));
+                }
+            }
+            
+            comp.coeffs.resize((size_t) comp.blocksWide * comp.blocksHigh * 64);
+            for (int by = 0; by < comp.blocksHigh; ++by) {
+                for (int bx = 0; bx < comp.blocksWide; ++bx) {
+                    int16_t* block = &comp.coeffs[((size_t) by * comp.blocksWide + bx) * 64];
+                    forwardDct(&plane[(size_t) by * 8 * planeWidth + bx * 8], planeWidth, quant[c ? 1 : 0], block);
+                }
+            }
+        }
+    }
+    
+    static int sample(const Image& image, int x, int y, int c)
+    {
+        const uint8_t* p = &image.data[((size_t) y * image.width + x) * image.channels];
+        if (image.channels < 3) return p[0];
+        int r = p[0], g = p[1], b = p[2];
+        switch (c) {
+            case 0:  return (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+            case 1:  return (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32767) >> 16;
+            default: return (32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32767) >> 16;
+        }
+    }
+    
+    static void forwardDct(const uint8_t* pixels, int stride, const uint8_t* q, int16_t* out)
+    {
+        static double cosTable[8][8];
+        static bool ready = false;
+        if (!ready) {
+            for (int u = 0; u < 8; ++u)
+                for (int x = 0; x < 8; ++x)
+                    cosTable[u][x] = (u ? 0.5 : 0.5 / std::sqrt(2.0)) * std::cos((2 * x + 1) * u * M_PI / 16);
+            ready = true;
+        }
+        double rows[8][8], result[64];
+        for (int y = 0; y < 8; ++y)
+            for (int u = 0; u < 8; ++u) {
+                double sum = 0;
+                for (int x = 0; x < 8; ++x) sum += cosTable[u][x] * (pixels[y * stride + x] - 128);
+                rows[y][u] = sum;
+            }
+        for (int v = 0; v < 8; ++v)
+            for (int u = 0; u < 8; ++u) {
+                double sum = 0;
+                for (int y = 0; y < 8; ++y) sum += cosTable[v][y] * rows[y][u];
+                result[v * 8 + u] = sum;
+            }
+        for (int i = 0; i < 64; ++i)
+            out[i] = (int16_t) std::lround(result[zigzag()[i]] / q[i]);
+    }
+    
+    std::vector<int> allComponents() const
+    {
+        std::vector<int> list;
+        for (int c = 0; c < (int) components.size(); ++c) list.push_back(c);
+        return list;
+    }
+    
+    void writeQuantTables()
+    {
+        out.put16be(0xffdb);
+        out.put16be(2 + 65 * 2);
+        for (int t = 0; t < 2; ++t) {
+            out.put8(t);
+            out.put(quant[t], 64);
+        }
+    }
+    
+    void writeHuffmanTables()
+    {
+        out.put16be(0xffc4);
+        out.put16be(2 + 2 * (17 + 12) + 2 * (17 + 162));
+        for (int t = 0; t < 2; ++t) {
+            out.put8(t);
+            out.put(dcBits(t), 16);
+            out.put(dcValues(t), 12);
+            out.put8(0x10 | t);
+            out.put(acBits(t), 16);
+            out.put(acValues(t), 162);
+        }
+    }
+    
+    void putBits(uint32_t value, int count)
+    {
+        bitBuffer = (bitBuffer << count) | (value & ((1u << count) - 1));
+        bitCount += count;
+        while (bitCount >= 8) {
+            int byte = (bitBuffer >> (bitCount - 8)) & 255;
+            out.put8(byte);
+            if (byte == 0xff) out.put8(0); // byte stuffing
+            bitCount -= 8;
+        }
+    }
+    
+    void flushBits()
+    {
+        if (bitCount) putBits(0x7f, 8 - bitCount); // pad with ones
+        bitBuffer = 0;
+    }
+    
+    static int magnitude(int v, int& bits)
+    {
+        int a = v < 0 ? -v : v, size = 0;
+        while (a) { ++size; a >>= 1; }
+        bits = v < 0 ? v + (1 << size) - 1 : v;
+        return size;
+    }
+    
+    void encodeBlock(Component& comp, int table, const int16_t* block, int start, int end)
+    {
+        int bits, size;
+        if (start == 0) {
+            size = magnitude(block[0] - comp.predictor, bits);
+            comp.predictor = block[0];
+            putBits(dcTable[table].code[size], dcTable[table].size[size]);
+            if (size) putBits(bits, size);
+            if (end == 0) return;
+            start = 1;
+        }
+        int run = 0;
+        for (int k = start; k <= end; ++k) {
+            if (block[k] == 0) { ++run; continue; }
+            while (run > 15) {
+                putBits(acTable[table].code[0xf0], acTable[table].size[0xf0]);
+                run -= 16;
+            }
+            size = magnitude(block[k], bits);
+            int symbol = run << 4 | size;
+            putBits(acTable[table].code[symbol], acTable[table].size[symbol]);
+            putBits(bits, size);
+            run = 0;
+        }
+        if (run) putBits(acTable[table].code[0], acTable[table].size[0]); // EOB
+    }
+    
+    void writeScan(const std::vector<int>& scan, int start, int end)
+    {
+        out.put16be(0xffda);
+        out.put16be(6 + 2 * (int) scan.size());
+        out.put8((int) scan.size());
+        for (int c : scan) {
+            out.put8(c + 1);
+            out.put8(c ? 0x11 : 0x00);
+        }
+        out.put8(start);
+        out.put8(end);
+        out.put8(0);
+        
+        for (Component& comp : components) comp.predictor = 0;
+        bitBuffer = 0;
+        bitCount = 0;
+        int mcu = 0, restart = 0;
+        auto nextMcu = [&](bool last)
+        {
+            ++mcu;
+            if (restartInterval && mcu % restartInterval == 0 && !last) {
+                flushBits();
+                out.put16be(0xffd0 + (restart++ & 7));
+                for (Component& comp : components) comp.predictor = 0;
+            }
+        };
+        
+        if (scan.size() == 1) {
+            // non-interleaved: every block is an MCU, and only blocks inside
+            // the component count
+            Component& comp = components[scan[0]];
+            for (int by = 0; by < comp.usedHigh; ++by)
+                for (int bx = 0; bx < comp.usedWide; ++bx) {
+                    encodeBlock(comp, scan[0] ? 1 : 0, &comp.coeffs[((size_t) by * comp.blocksWide + bx) * 64], start, end);
+                    nextMcu(by == comp.usedHigh - 1 && bx == comp.usedWide - 1);
+                }
+        } else {
+            for (int my = 0; my < mcusHigh; ++my)
+                for (int mx = 0; mx < mcusWide; ++mx) {
+                    for (int c : scan) {
+                        Component& comp = components[c];
+                        for (int y = 0; y < comp.v; ++y)
+                            for (int x = 0; x < comp.h; ++x) {
+                                size_t block = (size_t) (my * comp.v + y) * comp.blocksWide + mx * comp.h + x;
+                                encodeBlock(comp, c ? 1 : 0, &comp.coeffs[block * 64], start, end);
+                            }
+                    }
+                    nextMcu(my == mcusHigh - 1 && mx == mcusWide - 1);
+                }
+        }
+        flushBits();
+    }
+};
+
+/// CRC and Adler checksums for PNG and zlib
+inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        ready = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t adler32(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; ++i) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+/// zlib stream with a greedy LZ77 matcher and the fixed Huffman codes. Real
+/// encoders use dynamic codes, but decoding either goes through the same
+/// table lookups
+class DeflateEncoder
+{
+public:
+    int maxChain = 16;
+    
+    std::vector<uint8_t> compress(const std::vector<uint8_t>& input)
+    {
+        out.clear();
+        bitBuffer = 0;
+        bitCount = 0;
+        out.push_back(0x78);
+        out.push_back(0x01);
+        putBits(1, 1); // final block
+        putBits(1, 2); // fixed codes
+        
+        const int hashSize = 1 << 15, window = 32768;
+        std::vector<int32_t> head(hashSize, -1), prev(window, -1);
+        size_t n = input.size(), i = 0;
+        auto hash = [&](size_t p) { return (int) (((input[p] << 10) ^ (input[p + 1] << 5) ^ input[p + 2]) & (hashSize - 1)); };
+        auto insert = [&](size_t p)
+        {
+            if (p + 2 >= n) return;
+            int h = hash(p);
+            prev[p & (window - 1)] = head[h];
+            head[h] = (int32_t) p;
+        };
+        
+        while (i < n) {
+            int bestLength = 0, bestDistance = 0;
+            if (i + 2 < n) {
+                int32_t candidate = head[hash(i)];
+                for (int chain = 0; candidate >= 0 && chain < maxChain; ++chain) {
+                    size_t distance = i - candidate;
+                    if (distance > (size_t) window - 1) break;
+                    int length = 0, limit = (int) (n - i < 258 ? n - i : 258);
+                    while (length < limit && input[candidate + length] == input[i + length]) ++length;
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = (int) distance;
+                        if (length == 258) break;
+                    }
+                    int32_t next = prev[candidate & (window - 1)];
+                    if (next >= candidate) break;
+                    candidate = next;
+                }
+            }
+            if (bestLength >= 3) {
+                putLength(bestLength);
+                putDistance(bestDistance);
+                for (int k = 0; k < bestLength; ++k) insert(i + k);
+                i += bestLength;
+            } else {
+                putLiteral(input[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        putLiteral(256);
+        if (bitCount) out.push_back((uint8_t) bitBuffer);
+        uint32_t adler = adler32(input.data(), input.size());
+        for (int s = 24; s >= 0; s -= 8) out.push_back((uint8_t) (adler >> s));
+        return out;
+    }
+
+private:
+    std::vector<uint8_t> out;
+    uint32_t bitBuffer = 0;
+    int bitCount = 0;
+    
+    void putBits(uint32_t value, int count)
+    {
+        bitBuffer |= value << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            out.push_back((uint8_t) bitBuffer);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+    
+    /// Huffman codes go out most significant bit first
+    void putCode(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        putBits(reversed, length);
+    }
+    
+    void putLiteral(int symbol)
+    {
+        if (symbol < 144)      putCode(0x30 + symbol, 8);
+        else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280) putCode(symbol - 256, 7);
+        else                   putCode(0xc0 + symbol - 280, 8);
+    }
+    
+    void putLength(int length)
+    {
+        static const int base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+        static const int extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+        int code = 28;
+        while (base[code] > length) --code;
+        putLiteral(257 + code);
+        if (extra[code]) putBits(length - base[code], extra[code]);
+    }
+    
+    void putDistance(int distance)
+    {
+        static const int base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+        static const int extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+        int code = 29;
+        while (base[code] > distance) --code;
+        putCode(code, 5);
+        if (extra[code]) putBits(distance - base[code], extra[code]);
+    }
+};
+
+/// PNG writer: any bit depth, a fixed filter or the usual minimum-sum
+/// heuristic, optionally Adam7 interlaced. A 3-channel 8-bit image can be
+/// written through a 6x6x6 palette
+class PngEncoder
+{
+public:
+    enum Filter { none, sub, up, average, paeth, adaptive };
+    
+    Filter filter = adaptive;
+    bool interlaced = false;
+    bool palette = false;
+    
+    std::vector<uint8_t> encode(const Image& image)
+    {
+        Image source = palette ? quantize(image) : image;
+        std::vector<uint8_t> raw;
+        if (!interlaced) {
+            filterImage(source, raw);
+        } else {
+            static const int xorig[] = { 0,4,0,2,0,1,0 }, yorig[] = { 0,0,4,0,2,0,1 };
+            static const int xspc[]  = { 8,8,4,4,2,2,1 }, yspc[]  = { 8,8,8,4,4,2,2 };
+            for (int p = 0; p < 7; ++p) {
+                Image pass;
+                pass.width = (source.width - xorig[p] + xspc[p] - 1) / xspc[p];
+                pass.height = (source.height - yorig[p] + yspc[p] - 1) / yspc[p];
+                if (pass.width <= 0 || pass.height <= 0) continue;
+                pass.channels = source.channels;
+                pass.depth = source.depth;
+                size_t sampleBytes = (size_t) source.channels * source.bytesPerSample();
+                pass.data.resize(pass.rowBytes() * pass.height);
+                for (int y = 0; y < pass.height; ++y)
+                    for (int x = 0; x < pass.width; ++x)
+                        memcpy(&pass.data[((size_t) y * pass.width + x) * sampleBytes],
+                               &source.data[((size_t) (y * yspc[p] + yorig[p]) * source.width + x * xspc[p] + xorig[p]) * sampleBytes],
+                               sampleBytes);
+                filterImage(pass, raw);
+            }
+        }
+        
+        ByteWriter file;
+        static const uint8_t signature[8] = { 137,80,78,71,13,10,26,10 };
+        file.put(signature, 8);
+        ByteWriter header;
+        header.put32be(source.width);
+        header.put32be(source.height);
+        header.put8(source.depth);
+        header.put8(palette ? 3 : colorType(source.channels));
+        header.put8(0);
+        header.put8(0);
+        header.put8(interlaced ? 1 : 0);
+        putChunk(file, "IHDR", header.bytes);
+        if (palette) putChunk(file, "PLTE", paletteEntries());
+        DeflateEncoder deflate;
+        putChunk(file, "IDAT", deflate.compress(raw));
+        putChunk(file, "IEND", std::vector<uint8_t>());
+        return file.bytes;
+    }
+
+private:
+    static int colorType(int channels)
+    {
+        static const int types[5] = { 0, 0, 4, 2, 6 };
+        return types[channels];
+    }
+    
+    static void putChunk(ByteWriter& file, const char* type, const std::vector<uint8_t>& data)
+    {
+        file.put32be((uint32_t) data.size());
+        size_t start = file.bytes.size();
+        file.put(type, 4);
+        file.put(data.data(), data.size());
+        file.put32be(crc32(&file.bytes[start], file.bytes.size() - start));
+    }
+    
+    static std::vector<uint8_t> paletteEntries()
+    {
+        std::vector<uint8_t> entries;
+        for (int i = 0; i < 216; ++i) {
+            entries.push_back((uint8_t) (i / 36 * 51));
+            entries.push_back((uint8_t) (i / 6 % 6 * 51));
+            entries.push_back((uint8_t) (i % 6 * 51));
+        }
+        return entries;
+    }
+    
+    static Image quantize(const Image& image)
+    {
+        Image indexed;
+        indexed.width = image.width;
+        indexed.height = image.height;
+        indexed.channels = 1;
+        indexed.depth = 8;
+        indexed.data.resize((size_t) image.width * image.height);
+        for (size_t i = 0; i < indexed.data.size(); ++i) {
+            const uint8_t* p = &image.data[i * image.channels];
+            indexed.data[i] = (uint8_t) ((p[0] + 25) / 51 * 36 + (p[1] + 25) / 51 * 6 + (p[2] + 25) / 51);
+        }
+        return indexed;
+    }
+    
+    /// Pack one row to PNG's byte layout
+    static void packRow(const Image& image, int y, std::vector<uint8_t>& row)
+    {
+        size_t samples = (size_t) image.width * image.channels;
+        row.assign((samples * image.depth + 7) / 8, 0);
+        const uint8_t* p = &image.data[y * image.rowBytes()];
+        if (image.depth >= 8) {
+            memcpy(row.data(), p, row.size());
+            return;
+        }
+        for (size_t i = 0; i < samples; ++i) {
+            size_t bit = i * image.depth;
+            row[bit / 8] |= (uint8_t) (p[i] << (8 - image.depth - bit % 8));
+        }
+    }
+    
+    static int predict(int type, int a, int b, int c)
+    {
+        switch (type) {
+            case sub:     return a;
+            case up:      return b;
+            case average: return (a + b) / 2;
+            case paeth: {
+                int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            }
+            default:      return 0;
+        }
+    }
+    
+    void filterImage(const Image& image, std::vector<uint8_t>& raw)
+    {
+        int bpp = image.channels * image.depth / 8;
+        if (bpp < 1) bpp = 1;
+        std::vector<uint8_t> row, prior, best, trial;
+        for (int y = 0; y < image.height; ++y) {
+            packRow(image, y, row);
+            if (prior.empty()) prior.assign(row.size(), 0);
+            int first = filter == adaptive ? none : filter, last = filter == adaptive ? paeth : filter;
+            long bestScore = -1;
+            int bestType = first;
+            for (int type = first; type <= last; ++type) {
+                trial.resize(row.size());
+                long score = 0;
+                for (size_t i = 0; i < row.size(); ++i) {
+                    int a = i >= (size_t) bpp ? row[i - bpp] : 0;
+                    int c = i >= (size_t) bpp ? prior[i - bpp] : 0;
+                    trial[i] = (uint8_t) (row[i] - predict(type, a, prior[i], c));
+                    score += trial[i] < 128 ? trial[i] : 256 - trial[i];
+                }
+                if (bestScore < 0 || score < bestScore) {
+                    bestScore = score;
+                    bestType = type;
+                    best.swap(trial);
+                }
+            }
+            raw.push_back((uint8_t) bestType);
+            raw.insert(raw.end(), best.begin(), best.end());
+            prior.swap(row);
+        }
+    }
+};
+
+/// Truecolour TGA, raw or run-length encoded, stored top-down
+class TgaEncoder
+{
+public:
+    bool rle = false;
+    
+    std::vector<uint8_t> encode(const Image& image)
+    {
+        ByteWriter file;
+        int n = image.channels;
+        file.put8(0);
+        file.put8(0);
+        file.put8(rle ? 10 : 2);
+        for (int i = 0; i < 5; ++i) file.put8(0);
+        file.put16le(0);
+        file.put16le(0);
+        file.put16le(image.width);
+        file.put16le(image.height);
+        file.put8(n * 8);
+        file.put8((n == 4 ? 8 : 0) | 0x20);
+        
+        auto pixel = [&](size_t i, uint8_t* bgra)
+        {
+            const uint8_t* p = &image.data[i * n];
+            bgra[0] = p[2]; bgra[1] = p[1]; bgra[2] = p[0]; bgra[3] = n == 4 ? p[3] : 255;
+        };
+        for (int y = 0; y < image.height; ++y) {
+            size_t rowStart = (size_t) y * image.width;
+            int x = 0;
+            while (x < image.width) {
+                uint8_t a[4], b[4];
+                pixel(rowStart + x, a);
+                if (!rle) {
+                    file.put(a, n);
+                    ++x;
+                    continue;
+                }
+                // a run of identical pixels, or a stretch of differing ones
+                int run = 1;
+                while (x + run < image.width && run < 128) {
+                    pixel(rowStart + x + run, b);
+                    if (memcmp(a, b, n)) break;
+                    ++run;
+                }
+                if (run > 1) {
+                    file.put8(0x80 | (run - 1));
+                    file.put(a, n);
+                    x += run;
+                    continue;
+                }
+                int count = 1;
+                while (x + count < image.width && count < 128) {
+                    pixel(rowStart + x + count - 1, a);
+                    pixel(rowStart + x + count, b);
+                    if (!memcmp(a, b, n)) { --count; break; }
+                    ++count;
+                }
+                if (count < 1) count = 1;
+                file.put8(count - 1);
+                for (int i = 0; i < count; ++i) {
+                    pixel(rowStart + x + i, a);
+                    file.put(a, n);
+                }
+                x += count;
+            }
+        }
+        return file.bytes;
+    }
+};
+
+/// Uncompressed 24- or 32-bit BMP, stored bottom-up
+class BmpEncoder
+{
+public:
+    std::vector<uint8_t> encode(const Image& image)
+    {
+        int n = image.channels == 4 ? 4 : 3;
+        int stride = (image.width * n + 3) & ~3;
+        uint32_t dataSize = (uint32_t) stride * image.height;
+        ByteWriter file;
+        file.put8('B');
+        file.put8('M');
+        file.put32le(54 + dataSize);
+        file.put32le(0);
+        file.put32le(54);
+        file.put32le(40);
+        file.put32le(image.width);
+        file.put32le(image.height);
+        file.put16le(1);
+        file.put16le(n * 8);
+        file.put32le(0);
+        file.put32le(dataSize);
+        file.put32le(2835);
+        file.put32le(2835);
+        file.put32le(0);
+        file.put32le(0);
+        for (int y = image.height - 1; y >= 0; --y) {
+            const uint8_t* p = &image.data[(size_t) y * image.width * image.channels];
+            for (int x = 0; x < image.width; ++x, p += image.channels) {
+                file.put8(p[2]);
+                file.put8(p[1]);
+                file.put8(p[0]);
+                if (n == 4) file.put8(p[3]);
+            }
+            for (int pad = image.width * n; pad < stride; ++pad) file.put8(0);
+        }
+        return file.bytes;
+    }
+};
+
+/// Radiance RGBE with the run-length encoded scanline format
+class HdrEncoder
+{
+public:
+    std::vector<uint8_t> encode(const HdrImage& image)
+    {
+        ByteWriter file;
+        const char header[] = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n";
+        file.put(header, sizeof(header) - 1);
+        std::string size = "-Y " + std::to_string(image.height) + " +X " + std::to_string(image.width) + "\n";
+        file.put(size.data(), size.size());
+        
+        std::vector<uint8_t> rgbe((size_t) image.width * 4);
+        for (int y = 0; y < image.height; ++y) {
+            for (int x = 0; x < image.width; ++x)
+                toRgbe(&image.data[((size_t) y * image.width + x) * 3], &rgbe[x * 4]);
+            file.put8(2);
+            file.put8(2);
+            file.put16be(image.width);
+            for (int c = 0; c < 4; ++c) putChannel(file, rgbe, c, image.width);
+        }
+        return file.bytes;
+    }
+
+private:
+    static void toRgbe(const float* rgb, uint8_t* out)
+    {
+        float v = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+        if (v < 1e-32f) {
+            out[0] = out[1] = out[2] = out[3] = 0;
+            return;
+        }
+        int e;
+        float scale = std::frexp(v, &e) * 256.0f / v;
+        out[0] = (uint8_t) (rgb[0] * scale);
+        out[1] = (uint8_t) (rgb[1] * scale);
+        out[2] = (uint8_t) (rgb[2] * scale);
+        out[3] = (uint8_t) (e + 128);
+    }
+    
+    /// Runs of 3 or more become run packets, everything else goes out raw
+    static void putChannel(ByteWriter& file, const std::vector<uint8_t>& rgbe, int c, int width)
+    {
+        auto at = [&](int x) { return rgbe[x * 4 + c]; };
+        int x = 0;
+        while (x < width) {
+            int run = 1;
+            while (x + run < width && run < 127 && at(x + run) == at(x)) ++run;
+            if (run >= 3) {
+                file.put8(128 + run);
+                file.put8(at(x));
+                x += run;
+                continue;
+            }
+            int count = 0;
+            while (x + count < width && count < 128) {
+                if (x + count + 2 < width && at(x + count) == at(x + count + 1) && at(x + count) == at(x + count + 2)) break;
+                ++count;
+            }
+            file.put8(count);
+            for (int i = 0; i < count; ++i) file.put8(at(x + i));
+            x += count;
+        }
+    }
+};
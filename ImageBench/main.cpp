@@ -0,0 +1,448 @@
+//
+//  main.cpp
+//  ImageBench
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Decode throughput for the stb_image loaders over a generated corpus.
+//  Reports images/s and MB/s of decoded pixels on one thread and on all
+//  cores, plus where the time goes inside the JPEG and PNG decoders.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+/// Stage timers behind stb_image's profiling hooks. Time is exclusive: a
+/// stage that runs inside another is not counted twice
+namespace profile
+{
+    enum Stage { entropy, idct, upsample, convert, inflate, unfilter, stageCount };
+    const char* const names[stageCount] = { "entropy", "idct", "upsample", "convert", "inflate", "unfilter" };
+    
+    struct State
+    {
+        double seconds[stageCount];
+        long calls[stageCount];
+        int stack[16];
+        int depth;
+        Clock::time_point mark;
+    };
+    
+    std::atomic<bool> enabled(false);
+    thread_local State state;
+    
+    inline void begin(Stage stage)
+    {
+        Clock::time_point now = Clock::now();
+        if (state.depth)
+            state.seconds[state.stack[state.depth - 1]] += std::chrono::duration<double>(now - state.mark).count();
+        state.stack[state.depth++] = stage;
+        state.calls[stage]++;
+        state.mark = now;
+    }
+    
+    inline void end(Stage)
+    {
+        Clock::time_point now = Clock::now();
+        state.seconds[state.stack[--state.depth]] += std::chrono::duration<double>(now - state.mark).count();
+        state.mark = now;
+    }
+    
+    inline void reset()
+    {
+        state = State();
+    }
+    
+    /// Cost of reading the clock, taken off every timed interval
+    inline double clockCost()
+    {
+        const int count = 1 << 20;
+        Clock::time_point start = Clock::now(), last = start;
+        for (int i = 0; i < count; ++i) last = Clock::now();
+        return std::chrono::duration<double>(last - start).count() / count;
+    }
+}
+
+#define STBI_PROFILE_BEGIN(stage) (profile::enabled.load(std::memory_order_relaxed) ? profile::begin(profile::stage) : (void) 0)
+#define STBI_PROFILE_END(stage)   (profile::enabled.load(std::memory_order_relaxed) ? profile::end(profile::stage) : (void) 0)
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../GLcontext/stb_image.h"
+
+#include "corpus.h"
+
+/// Command line settings
+struct Options
+{
+    std::string corpus = "imagebench-corpus";
+    std::vector<int> sizes = { 64, 256, 1024, 4096, 8192 };
+    std::string filter;
+    std::vector<std::string> apis = { "memory" };
+    int threads = 0;
+    double seconds = 0.5;
+    bool profile = true;
+    std::string csv;
+    std::string baseline;
+    double threshold = 5.0;
+};
+
+/// A corpus file loaded into memory with its decoded size
+struct Sample
+{
+    CorpusFile file;
+    std::vector<uint8_t> bytes;
+    int width, height, channels;
+    
+    size_t decodedBytes() const { return (size_t) width * height * channels; }
+};
+
+/// Throughput of one API on one file
+struct Result
+{
+    std::string format;
+    int size;
+    std::string api;
+    int threads;
+    double imagesPerSecond;
+    double megabytesPerSecond;
+    
+    std::string key() const
+    {
+        return format + "," + std::to_string(size) + "," + api + "," + std::to_string(threads);
+    }
+};
+
+static int discardRows(void*, stbi_uc const*, int, int, int)
+{
+    return 1;
+}
+
+/// Decode a sample once through the named entry point
+static bool decode(const std::string& api, const Sample& sample)
+{
+    int x, y, n;
+    if (api == "memory") {
+        stbi_uc* pixels = stbi_load_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, 0);
+        stbi_image_free(pixels);
+        return pixels != NULL;
+    }
+    if (api == "file") {
+        stbi_uc* pixels = stbi_load(sample.file.path.c_str(), &x, &y, &n, 0);
+        stbi_image_free(pixels);
+        return pixels != NULL;
+    }
+    if (api == "into") {
+        thread_local std::vector<stbi_uc> output;
+        output.resize(sample.decodedBytes());
+        return stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), output.data(), output.size(), 0, &x, &y, &n, sample.channels) != 0;
+    }
+    if (api == "rows") {
+        return stbi_load_rows_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, sample.channels, discardRows, NULL) != 0;
+    }
+    if (api == "preview") {
+        // 1/8 size through the DC-only idct
+        stbi_load_options options;
+        stbi_load_options_default(&options);
+        options.jpeg_scale = 8;
+        stbi_uc* pixels = stbi_load_from_memory_ex(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, 0, &options);
+        stbi_image_free(pixels);
+        return pixels != NULL;
+    }
+    if (api == "tile") {
+        // the bottom-right 256x256, the worst case for a tiled viewer
+        int left = sample.file.size > 256 ? sample.file.size - 256 : 0;
+        stbi_uc* pixels = stbi_load_region_from_memory(sample.bytes.data(), (int) sample.bytes.size(), left, left, 256, 256, &x, &y, &n, 0);
+        stbi_image_free(pixels);
+        return pixels != NULL;
+    }
+    if (api == "coefficients") {
+        // the CPU's share of the GPU-assisted JPEG path
+        stbi_jpeg_coefficients coefficients;
+        bool ok = stbi_jpeg_coefficients_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &coefficients) != 0;
+        stbi_jpeg_coefficients_free(&coefficients);
+        return ok;
+    }
+    return false;
+}
+
+/// Decode repeatedly for at least the given time; returns images/s
+static double run(const std::string& api, const Sample& sample, double seconds)
+{
+    decode(api, sample); // warm up caches and the scratch arena
+    long count = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds || count < 3) {
+        decode(api, sample);
+        ++count;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    return count / elapsed;
+}
+
+static double runParallel(const std::string& api, const Sample& sample, double seconds, int threads)
+{
+    std::vector<double> rates(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]()
+        {
+            rates[t] = run(api, sample, seconds);
+            stbi_thread_arena_free();
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+    double total = 0;
+    for (double rate : rates) total += rate;
+    return total;
+}
+
+/// Share of each stage in one decode. The hooks slow the profiled run down,
+/// so shares come from that run with the clock reads taken back off (about
+/// one per interval, two per hook pair overall); the ms column is the
+/// unprofiled time. The first writes to a fresh output buffer page fault,
+/// and that lands in whichever stage writes it (usually convert)
+static void profileSample(const Sample& sample, double seconds, double clockCost, double imagesPerSecond)
+{
+    profile::reset();
+    profile::enabled = true;
+    decode("memory", sample);
+    profile::reset();
+    long count = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds || count < 3) {
+        decode("memory", sample);
+        ++count;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    profile::enabled = false;
+    
+    double stages[profile::stageCount], total = elapsed, staged = 0;
+    for (int s = 0; s < profile::stageCount; ++s) {
+        stages[s] = std::max(0.0, profile::state.seconds[s] - profile::state.calls[s] * clockCost);
+        staged += stages[s];
+        total -= profile::state.calls[s] * 2 * clockCost;
+    }
+    total = std::max(total, staged);
+    
+    std::cout << std::left << std::setw(24) << sample.file.format << std::right << std::setw(6) << sample.file.size
+              << std::fixed << std::setprecision(3) << std::setw(10) << 1000.0 / imagesPerSecond << std::setprecision(1);
+    for (int s = 0; s < profile::stageCount; ++s) {
+        if (profile::state.calls[s])
+            std::cout << std::setw(9) << 100.0 * stages[s] / total << "%";
+        else
+            std::cout << std::setw(10) << "-";
+    }
+    std::cout << std::setw(9) << 100.0 * (total - staged) / total << "%" << std::endl;
+}
+
+static std::vector<std::string> split(const std::string& text)
+{
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, ','))
+        if (!part.empty()) parts.push_back(part);
+    return parts;
+}
+
+static void usage()
+{
+    std::cout <<
+        "usage: ImageBench [options]\n"
+        "  --corpus DIR        where the generated corpus lives (default imagebench-corpus)\n"
+        "  --sizes LIST        edge sizes, e.g. 64,256 (default 64,256,1024,4096,8192)\n"
+        "  --filter TEXT       only formats whose name contains TEXT, e.g. jpeg or png-rgb8\n"
+        "  --api LIST          memory,file,into,rows,preview,tile,coefficients or all\n"
+        "                      (default memory); preview decodes JPEGs at 1/8 size, tile\n"
+        "                      the bottom-right 256x256, coefficients is JPEG entropy\n"
+        "                      decoding only\n"
+        "  --threads N         threads for the parallel run, 0 for all cores, 1 to skip it\n"
+        "  --time SECONDS      minimum time per measurement (default 0.5)\n"
+        "  --no-profile        skip the per-stage breakdown\n"
+        "  --csv FILE          write the results as CSV\n"
+        "  --baseline FILE     compare against an earlier --csv file\n"
+        "  --threshold PCT     slowdown that counts as a regression (default 5)\n";
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--no-profile") {
+            options.profile = false;
+        } else if (arg == "--help" || arg == "-h" || !hasValue) {
+            return false;
+        } else if (arg == "--corpus") {
+            options.corpus = argv[++i];
+        } else if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const std::string& size : split(argv[++i])) options.sizes.push_back(std::stoi(size));
+        } else if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--api") {
+            std::string apis = argv[++i];
+            options.apis = split(apis == "all" ? "memory,file,into,rows,preview,tile,coefficients" : apis);
+        } else if (arg == "--threads") {
+            options.threads = std::stoi(argv[++i]);
+        } else if (arg == "--time") {
+            options.seconds = std::stod(argv[++i]);
+        } else if (arg == "--csv") {
+            options.csv = argv[++i];
+        } else if (arg == "--baseline") {
+            options.baseline = argv[++i];
+        } else if (arg == "--threshold") {
+            options.threshold = std::stod(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool loadSample(const CorpusFile& file, Sample& sample)
+{
+    std::ifstream stream(file.path, std::ios::binary);
+    sample.file = file;
+    sample.bytes.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    if (!stbi_info_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &sample.width, &sample.height, &sample.channels)) {
+        std::cout << "ERROR::IMAGEBENCH::INFO_FAILED " << file.path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    if (!decode("memory", sample)) {
+        std::cout << "ERROR::IMAGEBENCH::DECODE_FAILED " << file.path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void writeCsv(const std::string& path, const std::vector<Result>& results)
+{
+    std::ofstream stream(path);
+    stream << "format,size,api,threads,images_per_s,mb_per_s\n";
+    for (const Result& result : results)
+        stream << result.key() << "," << result.imagesPerSecond << "," << result.megabytesPerSecond << "\n";
+    if (!stream) std::cout << "ERROR::IMAGEBENCH::CSV_WRITE_FAILED " << path << std::endl;
+}
+
+/// Compare MB/s against a baseline CSV; returns the number of regressions
+static int compareBaseline(const std::string& path, const std::vector<Result>& results, double threshold)
+{
+    std::ifstream stream(path);
+    if (!stream) {
+        std::cout << "ERROR::IMAGEBENCH::BASELINE_NOT_FOUND " << path << std::endl;
+        return 1;
+    }
+    std::map<std::string, double> baseline;
+    std::string line;
+    std::getline(stream, line);
+    while (std::getline(stream, line)) {
+        std::vector<std::string> fields = split(line);
+        if (fields.size() != 6) continue;
+        baseline[fields[0] + "," + fields[1] + "," + fields[2] + "," + fields[3]] = std::stod(fields[5]);
+    }
+    
+    int regressions = 0;
+    std::cout << "\nAgainst " << path << " (threshold " << threshold << "%):" << std::endl;
+    for (const Result& result : results) {
+        auto found = baseline.find(result.key());
+        if (found == baseline.end() || found->second <= 0) continue;
+        double change = 100.0 * (result.megabytesPerSecond / found->second - 1.0);
+        if (change < -threshold) {
+            std::cout << "  REGRESSION " << std::left << std::setw(40) << result.key() << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(8) << change << "%" << std::endl;
+            ++regressions;
+        }
+    }
+    if (!regressions) std::cout << "  no regressions" << std::endl;
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
+    int threads = options.threads > 0 ? options.threads : (int) std::max(1u, std::thread::hardware_concurrency());
+    
+    std::vector<Sample> samples;
+    for (const CorpusFile& file : corpus::generate(options.corpus, options.sizes, options.filter)) {
+        Sample sample;
+        if (loadSample(file, sample)) samples.push_back(std::move(sample));
+    }
+    if (samples.empty()) {
+        std::cout << "ERROR::IMAGEBENCH::EMPTY_CORPUS" << std::endl;
+        return 1;
+    }
+    
+    std::cout << "\nMB/s counts decoded pixels";
+    if (threads > 1) std::cout << "; " << threads << " threads for the parallel run";
+    std::cout << "\n\n" << std::left << std::setw(24) << "format" << std::right << std::setw(6) << "size" << std::setw(10) << "file KB"
+              << "  " << std::left << std::setw(13) << "api" << std::right
+              << std::setw(12) << "img/s" << std::setw(10) << "MB/s";
+    if (threads > 1) std::cout << std::setw(12) << "img/s x" + std::to_string(threads) << std::setw(10) << "MB/s";
+    std::cout << std::endl;
+    
+    std::vector<Result> results;
+    std::vector<double> memoryRates(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const Sample& sample = samples[i];
+        double megabytes = sample.decodedBytes() / 1e6;
+        for (const std::string& api : options.apis) {
+            if ((api == "preview" || api == "coefficients") && sample.file.format.compare(0, 4, "jpeg") != 0) continue;
+            Result single = { sample.file.format, sample.file.size, api, 1, 0, 0 };
+            single.imagesPerSecond = run(api, sample, options.seconds);
+            single.megabytesPerSecond = single.imagesPerSecond * megabytes;
+            results.push_back(single);
+            if (api == "memory") memoryRates[i] = single.imagesPerSecond;
+            
+            std::cout << std::left << std::setw(24) << sample.file.format << std::right << std::setw(6) << sample.file.size
+                      << std::setw(10) << sample.file.fileBytes / 1024 << "  " << std::left << std::setw(13) << api << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(12) << single.imagesPerSecond << std::setw(10) << single.megabytesPerSecond;
+            if (threads > 1) {
+                Result parallel = single;
+                parallel.threads = threads;
+                parallel.imagesPerSecond = runParallel(api, sample, options.seconds, threads);
+                parallel.megabytesPerSecond = parallel.imagesPerSecond * megabytes;
+                results.push_back(parallel);
+                std::cout << std::setw(12) << parallel.imagesPerSecond << std::setw(10) << parallel.megabytesPerSecond;
+            }
+            std::cout << std::endl;
+        }
+    }
+    
+    if (options.profile) {
+        double clockCost = profile::clockCost();
+        std::cout << "\nStage breakdown of stbi_load_from_memory (share of ms/image, approximate)\n\n"
+                  << std::left << std::setw(24) << "format" << std::right << std::setw(6) << "size" << std::setw(10) << "ms";
+        for (int s = 0; s < profile::stageCount; ++s) std::cout << std::setw(10) << profile::names[s];
+        std::cout << std::setw(10) << "other" << std::endl;
+        for (size_t i = 0; i < samples.size(); ++i) {
+            const Sample& sample = samples[i];
+            if (sample.file.format.compare(0, 4, "jpeg") && sample.file.format.compare(0, 3, "png")) continue;
+            double rate = memoryRates[i] ? memoryRates[i] : run("memory", sample, options.seconds);
+            profileSample(sample, options.seconds, clockCost, rate);
+        }
+    }
+    
+    if (!options.csv.empty()) writeCsv(options.csv, results);
+    if (!options.baseline.empty() && compareBaseline(options.baseline, results, options.threshold))
+        return 1;
+    return 0;
+}
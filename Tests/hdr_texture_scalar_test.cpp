@@ -0,0 +1,13 @@
+//
+//  hdr_texture_scalar_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  hdr_texture_test with the SSE2 and F16C conversions compiled out, as
+//  they are on CPUs other than x86.
+//
+
+#define HDR_TEXTURE_NO_SIMD
+#include "hdr_texture_test.cpp"
@@ -0,0 +1,233 @@
+//
+//  hdr_texture_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  HdrTexture's float conversions against exact references computed in
+//  double, the SIMD paths against the scalar ones (and halves against F16C
+//  where the CPU has it), and a small .hdr file through load().
+//  hdr_texture_scalar_test runs the same cases with the SIMD compiled out.
+//
+
+#include "test.h"
+
+#include "hdr_texture.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    float fromBits(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, 4);
+        return value;
+    }
+    
+    /// An unsigned float with 'mantissaBits' and the half's exponent range,
+    /// rounded to nearest even from 'value' (not negative, not NaN), with
+    /// 'overflow' for whatever rounds past the largest finite one
+    uint32_t roundedFloat(double value, int mantissaBits, uint32_t overflow)
+    {
+        if (value == 0) return 0;
+        int exponent;
+        std::frexp(value, &exponent);
+        exponent = std::max(exponent - 1, -14);
+        double ulp = std::ldexp(1.0, exponent - mantissaBits);
+        double steps = std::nearbyint(value / ulp);
+        uint32_t bits = (uint32_t) ((exponent + 15) << mantissaBits) + (uint32_t) steps - (1u << mantissaBits);
+        return bits >= (31u << mantissaBits) ? overflow : bits;
+    }
+    
+    /// IEEE half of 'value', worked out in double
+    uint16_t referenceHalf(float value)
+    {
+        uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+        if (std::isnan(value)) return sign | 0x7e00;
+        if (std::isinf(value)) return sign | 0x7c00;
+        return sign | (uint16_t) roundedFloat(std::fabs((double) value), 10, 0x7c00);
+    }
+    
+    /// The 11- or 10-bit float of GL_R11F_G11F_B10F: no sign, so negatives
+    /// and NaN are 0, and the largest finite value for anything past it
+    uint32_t referenceSmall(float value, int mantissaBits)
+    {
+        uint32_t largest = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+        if (!(value > 0)) return 0;
+        if (std::isinf(value)) return largest;
+        return roundedFloat(value, mantissaBits, largest);
+    }
+    
+    /// A spread of floats over every exponent, and those just either side
+    /// of every point halfway between two halves, or two of the 11- or
+    /// 10-bit floats, where rounding decides
+    std::vector<float> samples()
+    {
+        std::vector<float> values;
+        for (uint64_t bits = 0; bits < (1ull << 32); bits += 4093) values.push_back(fromBits((uint32_t) bits));
+        for (int mantissaBits : { 10, 6, 5 })
+            for (uint32_t code = 0; code < (31u << mantissaBits); ++code) {
+                int exponent = (int) (code >> mantissaBits);
+                uint32_t mantissa = code & ((1u << mantissaBits) - 1);
+                double low = std::ldexp((double) ((exponent ? 1u << mantissaBits : 0) + mantissa), std::max(exponent, 1) - 15 - mantissaBits);
+                float middle = (float) (low + std::ldexp(1.0, std::max(exponent, 1) - 16 - mantissaBits));
+                uint32_t bits;
+                memcpy(&bits, &middle, 4);
+                for (int step = -2; step <= 2; ++step) {
+                    values.push_back(fromBits(bits + step));
+                    values.push_back(-fromBits(bits + step));
+                }
+            }
+        const float special[] = { 0.0f, -0.0f, INFINITY, -INFINITY, NAN, -NAN, 65504.0f, 65519.99f, 65520.0f, 65024.0f, 65535.0f,
+                                  64512.0f, 64513.0f, 6.103515625e-05f, 6.0e-05f, 5.96e-08f, 2.98e-08f, 1e-10f, -1.0f, -1e-10f, 1e30f };
+        values.insert(values.end(), std::begin(special), std::end(special));
+        return values;
+    }
+
+#ifdef HDR_TEXTURE_X86
+    __attribute__((target("f16c")))
+    uint16_t hardwareHalf(float value)
+    {
+        return (uint16_t) _mm_extract_epi16(_mm_cvtps_ph(_mm_set_ss(value), _MM_FROUND_TO_NEAREST_INT), 0);
+    }
+#endif
+}
+
+TEST(halves_round_to_nearest_even)
+{
+    std::vector<float> values = samples();
+    size_t wrong = 0, unlikeHardware = 0;
+#ifdef HDR_TEXTURE_X86
+    bool f16c = __builtin_cpu_supports("f16c");
+#endif
+    for (float value : values) {
+        uint16_t half = HdrTexture::halfFromFloat(value);
+        wrong += half != referenceHalf(value);
+#ifdef HDR_TEXTURE_X86
+        // NaNs keep some of their payload in hardware; only the quiet bit
+        // and sign have to agree
+        uint16_t hardware = f16c ? hardwareHalf(value) : half;
+        if (std::isnan(value)) hardware = (hardware & 0xfe00) | (half & 0x1ff);
+        unlikeHardware += hardware != half;
+#endif
+    }
+    CHECK(wrong == 0);
+    CHECK(unlikeHardware == 0);
+    CHECK(HdrTexture::halfFromFloat(65504.0f) == 0x7bff && HdrTexture::halfFromFloat(65520.0f) == 0x7c00);
+    CHECK(HdrTexture::halfFromFloat(5.9604645e-08f) == 0x0001 && HdrTexture::halfFromFloat(-2.9802322e-08f) == 0x8000);
+    CHECK(HdrTexture::halfFromFloat(NAN) == 0x7e00 && HdrTexture::halfFromFloat(-0.0f) == 0x8000);
+}
+
+TEST(small_floats_clamp_to_their_range)
+{
+    std::vector<float> values = samples();
+    size_t wrong = 0;
+    for (float value : values)
+        for (int mantissaBits : { 6, 5 }) wrong += HdrTexture::smallFloat(value, mantissaBits) != referenceSmall(value, mantissaBits);
+    CHECK(wrong == 0);
+    
+    // no sign: negatives, -0 and NaN are 0, and there is no infinity
+    CHECK(HdrTexture::smallFloat(-1.0f, 6) == 0 && HdrTexture::smallFloat(-0.0f, 5) == 0 && HdrTexture::smallFloat(NAN, 6) == 0);
+    CHECK(HdrTexture::smallFloat(INFINITY, 6) == 0x7bf && HdrTexture::smallFloat(INFINITY, 5) == 0x3df);
+    CHECK(HdrTexture::smallFloat(1e30f, 6) == 0x7bf && HdrTexture::smallFloat(65024.0f, 6) == 0x7bf);
+    CHECK(HdrTexture::smallFloat(1.0f, 6) == 15 << 6 && HdrTexture::smallFloat(1.0f, 5) == 15 << 5);
+    
+    // the smallest denormals, and half of them going to even
+    CHECK(HdrTexture::smallFloat(std::ldexp(1.0f, -20), 6) == 1 && HdrTexture::smallFloat(std::ldexp(1.0f, -21), 6) == 0);
+    CHECK(HdrTexture::smallFloat(std::ldexp(3.0f, -21), 6) == 2 && HdrTexture::smallFloat(std::ldexp(1.0f, -19), 5) == 1);
+}
+
+TEST(whole_images_match_the_scalar_conversions)
+{
+    // every count up to a few past the SIMD widths, so each tail is taken
+    std::vector<float> values = samples();
+    for (size_t count = 0; count < 12; ++count)
+        for (size_t start : { (size_t) 0, values.size() / 2, values.size() - 3 * 12 }) {
+            const float* rgb = &values[start];
+            std::vector<uint16_t> halves(count * 4 + 1, 0xabcd);
+            std::vector<uint32_t> packed(count + 1, 0xabcdef01);
+            HdrTexture::toHalf(halves.data(), rgb, count);
+            HdrTexture::toPacked(packed.data(), rgb, count);
+            bool same = halves[count * 4] == 0xabcd && packed[count] == 0xabcdef01;
+            for (size_t i = 0; i < count; ++i) {
+                for (int c = 0; c < 3; ++c) same = same && halves[i * 4 + c] == HdrTexture::halfFromFloat(rgb[i * 3 + c]);
+                same = same && halves[i * 4 + 3] == 0x3c00;
+                same = same && packed[i] == (HdrTexture::smallFloat(rgb[i * 3], 6) | HdrTexture::smallFloat(rgb[i * 3 + 1], 6) << 11 |
+                                             HdrTexture::smallFloat(rgb[i * 3 + 2], 5) << 22);
+            }
+            CHECK(same);
+        }
+    
+    // and over all the samples, most of them down the SIMD paths
+    size_t count = values.size() / 3;
+    std::vector<uint16_t> halves(count * 4);
+    std::vector<uint32_t> packed(count);
+    HdrTexture::toHalf(halves.data(), values.data(), count);
+    HdrTexture::toPacked(packed.data(), values.data(), count);
+    size_t wrongHalves = 0, wrongPacked = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float* rgb = &values[i * 3];
+        for (int c = 0; c < 3; ++c) {
+            uint16_t expected = referenceHalf(rgb[c]);
+            wrongHalves += std::isnan(rgb[c]) ? (halves[i * 4 + c] & 0x7e00) != 0x7e00 : halves[i * 4 + c] != expected;
+        }
+        wrongPacked += packed[i] != (referenceSmall(rgb[0], 6) | referenceSmall(rgb[1], 6) << 11 | referenceSmall(rgb[2], 5) << 22);
+    }
+    CHECK(wrongHalves == 0 && wrongPacked == 0);
+}
+
+TEST(hdr_files_upload_in_either_format)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // flat RGBE, which Radiance readers take below 8 pixels a row
+    const int width = 5, height = 3;
+    std::string path = test::temporaryPath("small.hdr");
+    std::string file = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 3 +X 5\n";
+    std::vector<float> expected;
+    for (int i = 0; i < width * height; ++i) {
+        // mantissas and exponents that are exact in every format
+        unsigned char rgbe[4] = { (unsigned char) (128 + i * 8), (unsigned char) (64 + i * 4), (unsigned char) (i * 8), (unsigned char) (120 + i % 16) };
+        file.append((const char*) rgbe, 4);
+        for (int c = 0; c < 3; ++c) expected.push_back(std::ldexp((float) rgbe[c], rgbe[3] - 136));
+    }
+    FILE* out = fopen(path.c_str(), "wb");
+    fwrite(file.data(), 1, file.size(), out);
+    fclose(out);
+    
+    for (HdrTexture::Format format : { HdrTexture::Half, HdrTexture::Packed }) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        int w = 0, h = 0;
+        CHECK(HdrTexture::load(path.c_str(), format, &w, &h));
+        CHECK(w == width && h == height);
+        GLint internalFormat;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        CHECK(internalFormat == (format == HdrTexture::Half ? GL_RGBA16F : GL_R11F_G11F_B10F));
+        std::vector<float> got(width * height * 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, got.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        
+        // within what each format keeps of the mantissa
+        float tolerance = format == HdrTexture::Half ? 1.0f / 2048 : 1.0f / 64;
+        bool close = true;
+        for (size_t i = 0; i < got.size(); ++i) close = close && std::fabs(got[i] - expected[i]) <= tolerance * expected[i] + 1e-7f;
+        CHECK(close);
+        glDeleteTextures(1, &texture);
+    }
+    int w, h;
+    CHECK(!HdrTexture::load(test::temporaryPath("missing.hdr").c_str(), HdrTexture::Half, &w, &h));
+    unlink(path.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
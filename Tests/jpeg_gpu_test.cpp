@@ -0,0 +1,115 @@
+//
+//  jpeg_gpu_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  JpegGpuDecoder against stb_image's own decode of the same file. The GPU
+//  works in float and rounds differently, so the two only have to agree
+//  within a small tolerance.
+//
+
+#include "test.h"
+
+#include "jpeg_gpu.h"
+#include "sampler_cache.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    JpegGpuDecoder& decoder()
+    {
+        static JpegGpuDecoder instance("../GLcontext/shaders/");
+        return instance;
+    }
+    
+    /// Decode on the GPU and read the texture back as RGB
+    bool decodeOnGpu(const std::vector<uint8_t>& file, std::vector<uint8_t>& pixels)
+    {
+        stbi_jpeg_coefficients jpeg;
+        if (!stbi_jpeg_coefficients_from_memory(file.data(), (int) file.size(), &jpeg)) return false;
+        GLuint texture;
+        glGenTextures(1, &texture);
+        bool decoded = decoder().decode(jpeg, texture);
+        if (decoded) {
+            pixels.resize((size_t) jpeg.width * jpeg.height * 3);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        glDeleteTextures(1, &texture);
+        stbi_jpeg_coefficients_free(&jpeg);
+        return decoded;
+    }
+    
+    /// Whether the GPU decode of 'file' is within tolerance of stb_image's
+    bool matchesStbImage(const std::string& name, const std::vector<uint8_t>& file)
+    {
+        int width, height, channels;
+        stbi_uc* expected = stbi_load_from_memory(file.data(), (int) file.size(), &width, &height, &channels, 3);
+        std::vector<uint8_t> pixels;
+        bool decoded = decodeOnGpu(file, pixels);
+        bool close = false;
+        if (expected && decoded) {
+            size_t count = (size_t) width * height * 3;
+            double mean = test::meanError(expected, pixels.data(), count);
+            int worst = test::maxError(expected, pixels.data(), count);
+            close = worst <= 8 && mean < 0.75;
+            if (!close) std::printf("    %s %dx%d: max error %d, mean %.3f\n", name.c_str(), width, height, worst, mean);
+        }
+        stbi_image_free(expected);
+        return decoded && close;
+    }
+}
+
+TEST(gpu_decode_matches_stb_image)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    if (!CHECK(decoder().valid())) return;
+    const int sizes[][2] = { { 1, 1 }, { 7, 5 }, { 33, 17 }, { 100, 75 }, { 257, 129 }, { 640, 480 } };
+    for (const auto& size : sizes) {
+        Image rgba = synthesize(size[0], size[1], 99);
+        for (const CorpusFormat& format : corpus::formats())
+            if (format.extension == "jpg")
+                CHECK(matchesStbImage(format.name, format.encode(rgba)));
+    }
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(gpu_decode_ignores_bound_samplers)
+{
+    // a mipmapped sampler left on the units the decoder reads its planes
+    // from, as a frame drawn through a SamplerCache leaves them, must not
+    // make the planes incomplete; and it is still there afterwards
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    if (!CHECK(decoder().valid())) return;
+    SamplerCache samplers;
+    GLuint mipmapped = samplers.get(SamplerState());
+    for (GLuint unit = 0; unit < 4; ++unit) samplers.bind(unit, mipmapped);
+    glActiveTexture(GL_TEXTURE2);
+    
+    Image rgba = synthesize(100, 75, 5);
+    for (const CorpusFormat& format : corpus::formats())
+        if (format.extension == "jpg")
+            CHECK(matchesStbImage(format.name, format.encode(rgba)));
+    
+    GLint unit, sampler;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+    CHECK(unit == GL_TEXTURE2);
+    for (GLuint i = 0; i < 4; ++i) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glGetIntegerv(GL_SAMPLER_BINDING, &sampler);
+        CHECK((GLuint) sampler == mipmapped);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    for (GLuint i = 0; i < 4; ++i) samplers.bind(i, 0);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
@@ -0,0 +1,331 @@
+//
+//  mesh_codec_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  MeshCodec round trips over awkward vertex counts and strides, block and
+//  segment at a time, what damaged data decodes to, and meshes baked by
+//  MeshLoader coming back as they went.
+//
+
+#include "test.h"
+
+#include "mesh_loader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <random>
+
+namespace
+{
+    /// Triangles of a sphere grid, in the order the rows make them, which
+    /// is close to cache order
+    std::vector<uint32_t> grid(int columns, int rows)
+    {
+        std::vector<uint32_t> indices;
+        auto id = [&](int i, int j) { return (uint32_t) ((i % columns) * (rows + 1) + j); };
+        for (int i = 0; i < columns; ++i)
+            for (int j = 0; j < rows; ++j)
+                indices.insert(indices.end(), { id(i, j), id(i, j + 1), id(i + 1, j), id(i + 1, j), id(i, j + 1), id(i + 1, j + 1) });
+        return indices;
+    }
+    
+    /// Whether 'got' has the triangles of 'expected' in the same order,
+    /// each the same or turned round
+    template <typename Index>
+    bool sameTriangles(const std::vector<uint32_t>& expected, const std::vector<Index>& got)
+    {
+        if (got.size() != expected.size()) return false;
+        for (size_t t = 0; t < expected.size(); t += 3) {
+            bool same = false;
+            for (int r = 0; r < 3; ++r)
+                same = same || (got[t] == expected[t + r] && got[t + 1] == expected[t + (r + 1) % 3] && got[t + 2] == expected[t + (r + 2) % 3]);
+            if (!same) return false;
+        }
+        return true;
+    }
+    
+    void write(const std::string& path, const std::vector<unsigned char>& bytes)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    }
+    
+    std::vector<unsigned char> read(const std::string& path)
+    {
+        std::vector<unsigned char> bytes;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) return bytes;
+        for (int c; (c = fgetc(file)) != EOF;) bytes.push_back((unsigned char) c);
+        fclose(file);
+        return bytes;
+    }
+    
+    /// A bumpy sphere with texture coords, enough of it for coarser levels
+    std::string sphereObj(int columns, int rows)
+    {
+        std::string obj;
+        char line[256];
+        for (int i = 0; i <= columns; ++i)
+            for (int j = 0; j <= rows; ++j) {
+                float u = i * 6.2831853f / columns, v = j * 3.14159265f / rows;
+                float r = 1 + 0.05f * std::sin(5 * u) * std::sin(4 * v);
+                snprintf(line, sizeof(line), "v %.5f %.5f %.5f\nvt %.4f %.4f\n", r * std::sin(v) * std::cos(u), r * std::sin(v) * std::sin(u),
+                         r * std::cos(v), (float) i / columns, (float) j / rows);
+                obj += line;
+            }
+        for (int i = 0; i < columns; ++i)
+            for (int j = 0; j < rows; ++j) {
+                int a = i * (rows + 1) + j + 1, b = a + 1, c = a + rows + 1, d = c + 1;
+                snprintf(line, sizeof(line), "f %d/%d %d/%d %d/%d\nf %d/%d %d/%d %d/%d\n", a, a, b, b, c, c, c, c, b, b, d, d);
+                obj += line;
+            }
+        return obj;
+    }
+    
+    std::vector<unsigned char> bufferContents(GLuint buffer, size_t size)
+    {
+        std::vector<unsigned char> bytes(size);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, bytes.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return bytes;
+    }
+    
+    std::vector<uint32_t> indices(const Mesh& mesh)
+    {
+        std::vector<unsigned char> bytes = bufferContents(mesh.indexBuffer, mesh.indexCount * mesh.indexSize());
+        std::vector<uint32_t> result(mesh.indexCount);
+        for (size_t i = 0; i < mesh.indexCount; ++i) {
+            uint16_t index16;
+            if (mesh.indexType == GL_UNSIGNED_SHORT) memcpy(&index16, &bytes[i * 2], 2), result[i] = index16;
+            else memcpy(&result[i], &bytes[i * 4], 4);
+        }
+        return result;
+    }
+    
+    /// Whether 'got' is what 'expected' was when it was saved: the same
+    /// buffers, triangles perhaps turned round, parts, levels and clusters
+    bool sameMesh(const Mesh& expected, const Mesh& got)
+    {
+        if (!got || got.vertexCount != expected.vertexCount || got.indexCount != expected.indexCount || got.indexType != expected.indexType ||
+            got.layout.stride != expected.layout.stride || got.scale != expected.scale || memcmp(got.center, expected.center, 12) ||
+            memcmp(got.boundsMin, expected.boundsMin, 12) || memcmp(got.boundsMax, expected.boundsMax, 12) ||
+            got.lodErrors != expected.lodErrors || got.parts.size() != expected.parts.size() || got.meshlets.size() != expected.meshlets.size())
+            return false;
+        for (size_t p = 0; p < expected.parts.size(); ++p) {
+            const Mesh::Part& a = expected.parts[p];
+            const Mesh::Part& b = got.parts[p];
+            if (a.firstIndex != b.firstIndex || a.indexCount != b.indexCount || a.lods.size() != b.lods.size()) return false;
+            for (size_t l = 0; l < a.lods.size(); ++l)
+                if (a.lods[l].firstIndex != b.lods[l].firstIndex || a.lods[l].indexCount != b.lods[l].indexCount || a.lods[l].error != b.lods[l].error)
+                    return false;
+        }
+        for (size_t m = 0; m < expected.meshlets.size(); ++m) {
+            Meshlets::Meshlet a = expected.meshlets.meshlet(m), b = got.meshlets.meshlet(m);
+            if (memcmp(&a, &b, sizeof(a))) return false;
+        }
+        size_t vertexBytes = expected.vertexCount * expected.layout.stride;
+        return bufferContents(expected.vertexBuffer, vertexBytes) == bufferContents(got.vertexBuffer, vertexBytes) &&
+            sameTriangles(indices(expected), indices(got));
+    }
+}
+
+TEST(vertices_come_back_exactly)
+{
+    // every channel, on random bits and on smooth data, which is what
+    // they are made for
+    std::mt19937 random(1);
+    struct Case { size_t stride; std::vector<unsigned char> channels; };
+    std::vector<Case> cases = {
+        { 4, { MeshCodec::Delta8 } },
+        { 12, { MeshCodec::Xor32, MeshCodec::Xor32, MeshCodec::Xor32 } },
+        { 32, { MeshCodec::Xor32, MeshCodec::Xor32, MeshCodec::Xor32, MeshCodec::Delta16, MeshCodec::Delta16, MeshCodec::Delta8,
+                MeshCodec::Xor32, MeshCodec::Delta8 } },
+    };
+    for (const Case& c : cases)
+        for (size_t count : { 0, 1, 15, 16, 17, 255, 256, 257, 1000, 4099 })
+            for (bool smooth : { false, true }) {
+                std::vector<unsigned char> vertices(count * c.stride);
+                for (size_t i = 0; i < vertices.size(); ++i) vertices[i] = (unsigned char) random();
+                if (smooth)
+                    for (size_t v = 0; v < count; ++v)
+                        for (size_t w = 0; w < c.stride / 4; ++w) {
+                            float value = std::sin(v * 0.01f + w);
+                            memcpy(&vertices[v * c.stride + w * 4], &value, 4);
+                        }
+                std::vector<unsigned char> packed = MeshCodec::encodeVertices(vertices.data(), count, c.stride, c.channels);
+                CHECK(!packed.empty());
+                
+                // and nothing written past the end
+                std::vector<unsigned char> decoded(count * c.stride + 1, 0xcd);
+                CHECK(MeshCodec::decodeVertices(decoded.data(), count, c.stride, packed.data(), packed.size()));
+                CHECK(decoded.back() == 0xcd);
+                decoded.pop_back();
+                CHECK(decoded == vertices);
+                if (smooth && count >= 1000 && c.stride == 12) CHECK(packed.size() < vertices.size());
+            }
+    
+    // strides that aren't whole words, or whose channels don't match
+    float vertex[3] = { 1, 2, 3 };
+    CHECK(MeshCodec::encodeVertices(vertex, 1, 6, { MeshCodec::Xor32 }).empty());
+    CHECK(MeshCodec::encodeVertices(vertex, 1, 12, { MeshCodec::Xor32 }).empty());
+}
+
+TEST(vertex_blocks_decode_alone)
+{
+    const size_t count = 1000, stride = 12;
+    std::vector<float> vertices(count * 3);
+    for (size_t i = 0; i < vertices.size(); ++i) vertices[i] = std::cos(i * 0.37f);
+    std::vector<unsigned char> packed = MeshCodec::encodeVertices(vertices.data(), count, stride, std::vector<unsigned char>(3, MeshCodec::Xor32));
+    size_t blocks = MeshCodec::vertexBlocks(count);
+    CHECK(blocks == 4);
+    for (size_t block = 0; block < blocks; ++block) {
+        std::vector<float> decoded(vertices.size(), -7.0f);
+        CHECK(MeshCodec::decodeVertices(decoded.data(), count, stride, packed.data(), packed.size(), block, block + 1));
+        size_t first = block * MeshCodec::BlockVertices * 3, end = std::min(first + MeshCodec::BlockVertices * 3, vertices.size());
+        bool untouched = true;
+        for (size_t i = 0; i < decoded.size(); ++i)
+            if (i < first || i >= end) untouched = untouched && decoded[i] == -7.0f;
+        CHECK(untouched);
+        CHECK(std::equal(decoded.begin() + first, decoded.begin() + end, vertices.begin() + first));
+    }
+    std::vector<float> decoded(vertices.size());
+    CHECK(!MeshCodec::decodeVertices(decoded.data(), count, stride, packed.data(), packed.size(), 2, blocks + 1));
+}
+
+TEST(indices_come_back_in_order_at_either_size)
+{
+    std::vector<uint32_t> indices = grid(200, 120);
+    size_t vertexCount = 200 * 121;
+    CHECK(MeshCodec::indexSegments(indices.size()) == 3);
+    std::vector<unsigned char> packed = MeshCodec::encodeIndices(indices.data(), indices.size());
+    CHECK(packed.size() < indices.size());
+    
+    std::vector<uint32_t> wide(indices.size() + 1, 0xdeadbeef);
+    CHECK(MeshCodec::decodeIndices(wide.data(), 4, indices.size(), vertexCount, packed.data(), packed.size()));
+    CHECK(wide.back() == 0xdeadbeef);
+    wide.pop_back();
+    CHECK(sameTriangles(indices, wide));
+    std::vector<uint16_t> narrow(indices.size());
+    CHECK(MeshCodec::decodeIndices(narrow.data(), 2, indices.size(), vertexCount, packed.data(), packed.size()));
+    CHECK(sameTriangles(indices, narrow));
+    
+    // segments alone, in any order
+    std::vector<uint32_t> pieces(indices.size());
+    for (size_t segment : { 2, 0, 1 })
+        CHECK(MeshCodec::decodeIndices(pieces.data(), 4, indices.size(), vertexCount, packed.data(), packed.size(), segment, segment + 1));
+    CHECK(pieces == wide);
+    
+    // triangles in no order at all, and none
+    std::mt19937 random(2);
+    std::vector<uint32_t> scattered(3 * 5000);
+    for (uint32_t& index : scattered) index = random() % 70000;
+    packed = MeshCodec::encodeIndices(scattered.data(), scattered.size());
+    std::vector<uint32_t> decoded(scattered.size());
+    CHECK(MeshCodec::decodeIndices(decoded.data(), 4, scattered.size(), 70000, packed.data(), packed.size()));
+    CHECK(sameTriangles(scattered, decoded));
+    packed = MeshCodec::encodeIndices(nullptr, 0);
+    CHECK(MeshCodec::decodeIndices(decoded.data(), 4, 0, 0, packed.data(), packed.size()));
+}
+
+TEST(damaged_data_is_refused_or_stays_in_range)
+{
+    std::vector<uint32_t> indices = grid(40, 20);
+    size_t vertexCount = 40 * 21;
+    std::vector<unsigned char> packedIndices = MeshCodec::encodeIndices(indices.data(), indices.size());
+    std::vector<float> vertices(vertexCount * 3);
+    for (size_t i = 0; i < vertices.size(); ++i) vertices[i] = std::sin(i * 0.1f);
+    std::vector<unsigned char> packedVertices = MeshCodec::encodeVertices(vertices.data(), vertexCount, 12, std::vector<unsigned char>(3, MeshCodec::Xor32));
+    
+    // cut short anywhere: refused
+    std::vector<uint32_t> decoded(indices.size());
+    std::vector<float> decodedVertices(vertices.size());
+    bool refused = true;
+    for (size_t size = 0; size < packedIndices.size(); ++size)
+        refused = refused && !MeshCodec::decodeIndices(decoded.data(), 4, indices.size(), vertexCount, packedIndices.data(), size);
+    for (size_t size = 0; size < packedVertices.size(); ++size)
+        refused = refused && !MeshCodec::decodeVertices(decodedVertices.data(), vertexCount, 12, packedVertices.data(), size);
+    CHECK(refused);
+    
+    // a few bits flipped: whatever decodes names only vertices there are
+    std::mt19937 random(3);
+    int accepted = 0, outOfRange = 0;
+    for (int trial = 0; trial < 2000; ++trial) {
+        std::vector<unsigned char> damaged = packedIndices;
+        for (int flip = 0; flip < 1 + trial % 4; ++flip) damaged[random() % damaged.size()] ^= 1 << random() % 8;
+        std::fill(decoded.begin(), decoded.end(), 0);
+        if (!MeshCodec::decodeIndices(decoded.data(), 4, indices.size(), vertexCount, damaged.data(), damaged.size())) continue;
+        ++accepted;
+        for (uint32_t index : decoded) outOfRange += index >= vertexCount;
+    }
+    CHECK(outOfRange == 0);
+    CHECK(accepted < 2000);
+    
+    // vertices have nothing to check but their bounds, which the sanitizer
+    // builds do
+    for (int trial = 0; trial < 500; ++trial) {
+        std::vector<unsigned char> damaged = packedVertices;
+        damaged[random() % damaged.size()] ^= 1 << random() % 8;
+        MeshCodec::decodeVertices(decodedVertices.data(), vertexCount, 12, damaged.data(), damaged.size());
+    }
+}
+
+TEST(baked_meshes_load_as_they_were_saved)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    typedef VertexFormat<Attribute<MeshAttribute::Position, VertexEncoding::Float<3>>,
+                         Attribute<MeshAttribute::TexCoord, VertexEncoding::Float<2>>,
+                         Attribute<MeshAttribute::Normal, VertexEncoding::Float<3>>> FloatVertex;
+    typedef VertexFormat<Attribute<MeshAttribute::Position, VertexEncoding::Snorm16<3>>,
+                         Attribute<MeshAttribute::TexCoord, VertexEncoding::Half<2>>,
+                         Attribute<MeshAttribute::Normal, VertexEncoding::Octahedral>> PackedVertex;
+    std::string obj = test::temporaryPath("sphere.obj"), baked = test::temporaryPath("sphere.mesh"), damaged = test::temporaryPath("damaged.mesh");
+    std::string text = sphereObj(64, 32);
+    write(obj, std::vector<unsigned char>(text.begin(), text.end()));
+    MeshLod::Settings lods;
+    lods.levels = 3;
+    
+    for (bool packed : { false, true }) {
+        VertexLayout layout = packed ? PackedVertex::layout() : FloatVertex::layout();
+        MeshLoader loader(layout, true, 0, lods);
+        Mesh mesh = loader.load(obj);
+        if (!CHECK((bool) mesh)) continue;
+        CHECK(mesh.parts.size() == 1 && mesh.parts[0].lods.size() > 1 && !mesh.meshlets.empty());
+        CHECK(loader.save(mesh, baked));
+        MeshLoader reader(layout, true, 0, lods);
+        CHECK(sameMesh(mesh, reader.load(baked)));
+        CHECK(loader.stats().saved == 1 && reader.stats().baked == 1);
+        size_t raw = mesh.vertexCount * mesh.layout.stride + mesh.indexCount * mesh.indexSize();
+        CHECK(read(baked).size() < raw);
+    }
+    
+    // baked for the packed layout, so the float one can't take it
+    MeshLoader other(FloatVertex::layout());
+    CHECK(!other.load(baked));
+    
+    // damaged files are refused or load whole, never past their buffers
+    std::vector<unsigned char> bytes = read(baked);
+    std::mt19937 random(4);
+    MeshLoader loader(PackedVertex::layout(), true, 0, lods);
+    for (int trial = 0; trial < 60; ++trial) {
+        std::vector<unsigned char> broken = bytes;
+        if (trial % 2) broken.resize(random() % broken.size());
+        else for (int flip = 0; flip < 4; ++flip) broken[random() % broken.size()] ^= 1 << random() % 8;
+        write(damaged, broken);
+        Mesh mesh = loader.load(damaged);
+        if (!mesh) continue;
+        std::vector<uint32_t> got = indices(mesh);
+        CHECK(std::all_of(got.begin(), got.end(), [&](uint32_t index) { return index < mesh.vertexCount; }));
+    }
+    unlink(obj.c_str());
+    unlink(baked.c_str());
+    unlink(damaged.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
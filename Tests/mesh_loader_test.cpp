@@ -0,0 +1,355 @@
+//
+//  mesh_loader_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  MeshLoader on OBJ and .glb files written here, read back from the GPU
+//  buffers as triangles of attribute values and compared with what the
+//  files say, whatever order the loader put vertices and triangles in.
+//
+
+#include "test.h"
+
+#include "mesh_loader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <array>
+#include <random>
+#include <set>
+
+namespace
+{
+    typedef VertexFormat<Attribute<MeshAttribute::Position, VertexEncoding::Float<3>>,
+                         Attribute<MeshAttribute::Color, VertexEncoding::Float<3>>,
+                         Attribute<MeshAttribute::TexCoord, VertexEncoding::Float<2>>,
+                         Attribute<MeshAttribute::Normal, VertexEncoding::Float<3>>> FullVertex;
+    
+    /// A vertex's position, color, texture coords and normal, in thousandths
+    typedef std::array<long, 11> Corner;
+    typedef std::array<Corner, 3> Triangle;
+    typedef std::multiset<Triangle> Triangles;
+    
+    long rounded(float value) { return std::lround(value * 1000); }
+    
+    /// Rotated to start at its least corner, keeping the winding
+    Triangle canonical(const Triangle& t)
+    {
+        int least = 0;
+        for (int c = 1; c < 3; ++c)
+            if (t[c] < t[least]) least = c;
+        return Triangle { { t[least], t[(least + 1) % 3], t[(least + 2) % 3] } };
+    }
+    
+    std::vector<uint32_t> indices(const Mesh& mesh)
+    {
+        std::vector<uint32_t> result(mesh.indexCount);
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.indexBuffer);
+        if (mesh.indexType == GL_UNSIGNED_SHORT) {
+            std::vector<uint16_t> shorts(mesh.indexCount);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, shorts.size() * 2, shorts.data());
+            result.assign(shorts.begin(), shorts.end());
+        } else {
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, result.size() * 4, result.data());
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return result;
+    }
+    
+    /// The full parts' triangles as the GPU has them; false in 'inRange' if
+    /// an index is past the vertices
+    Triangles triangles(const Mesh& mesh, bool& inRange)
+    {
+        size_t stride = mesh.layout.stride;
+        std::vector<unsigned char> vertices(mesh.vertexCount * stride);
+        glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertices.size(), vertices.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        std::vector<uint32_t> all = indices(mesh);
+        Triangles result;
+        inRange = true;
+        for (const Mesh::Part& part : mesh.parts)
+            for (size_t i = part.firstIndex; i < part.firstIndex + part.indexCount; i += 3) {
+                Triangle triangle;
+                for (int c = 0; c < 3; ++c) {
+                    uint32_t v = all[i + c];
+                    if (v >= mesh.vertexCount) {
+                        inRange = false;
+                        v = 0;
+                    }
+                    const float* f = (const float*) &vertices[v * stride];
+                    for (int k = 0; k < 11; ++k) triangle[c][k] = rounded(k < 3 ? mesh.center[k] + mesh.scale * f[k] : f[k]);
+                }
+                result.insert(canonical(triangle));
+            }
+        return result;
+    }
+    
+    void write(const std::string& path, const std::string& bytes)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    }
+    
+    /// A grid of quads with colored positions, texture coords of their own at
+    /// every corner and a normal a quad, half of them named by negative
+    /// indices, with CRLF and LF line ends mixed. 'expected' gets its triangles
+    std::string gridObj(int size, Triangles& expected)
+    {
+        std::mt19937 random(1);
+        auto unit = [&] { return (int) (random() % 2001) / 1000.0f - 1.0f; };
+        std::vector<std::array<float, 6>> points;
+        for (int i = 0; i <= size; ++i)
+            for (int j = 0; j <= size; ++j)
+                points.push_back({ { i * 0.01f, j * 0.01f, unit(), (i % 8) / 8.0f, (j % 5) / 5.0f, 0.5f } });
+        
+        std::string obj = "# grid\r\nmtllib grid.mtl\n";
+        char line[256];
+        for (const auto& p : points) {
+            snprintf(line, sizeof(line), "v %.4f %.4f %.4f %.4f %.4f %.4f\r\n", p[0], p[1], p[2], p[3], p[4], p[5]);
+            obj += line;
+        }
+        int texCoords = 0, normals = 0;
+        for (int i = 0; i < size; ++i)
+            for (int j = 0; j < size; ++j) {
+                int corners[4] = { i * (size + 1) + j, (i + 1) * (size + 1) + j, (i + 1) * (size + 1) + j + 1, i * (size + 1) + j + 1 };
+                float uv[4][2];
+                for (int k = 0; k < 4; ++k) {
+                    uv[k][0] = random() % 1000 / 1000.0f;
+                    uv[k][1] = random() % 1000 / 1000.0f;
+                    snprintf(line, sizeof(line), "vt %.4f %.4f\n", uv[k][0], uv[k][1]);
+                    obj += line;
+                }
+                float normal[3] = { unit(), unit(), unit() };
+                snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", normal[0], normal[1], normal[2]);
+                obj += line;
+                texCoords += 4;
+                normals += 1;
+                
+                bool relative = (i + j) % 2 == 1;
+                obj += "f";
+                for (int k = 0; k < 4; ++k) {
+                    if (relative) snprintf(line, sizeof(line), " %d/%d/%d", corners[k] - (int) points.size(), k - 4, -1);
+                    else snprintf(line, sizeof(line), " %d/%d/%d", corners[k] + 1, texCoords - 4 + k + 1, normals);
+                    obj += line;
+                }
+                obj += j % 3 == 0 ? "\r\n" : "\n";
+                
+                // texture coords flipped to v down
+                auto corner = [&](int k) {
+                    Corner c;
+                    for (int a = 0; a < 6; ++a) c[a] = rounded(points[corners[k]][a]);
+                    c[6] = rounded(uv[k][0]);
+                    c[7] = rounded(1 - uv[k][1]);
+                    for (int a = 0; a < 3; ++a) c[8 + a] = rounded(normal[a]);
+                    return c;
+                };
+                expected.insert(canonical(Triangle { { corner(0), corner(1), corner(2) } }));
+                expected.insert(canonical(Triangle { { corner(0), corner(2), corner(3) } }));
+            }
+        return obj;
+    }
+    
+    /// A .glb of two meshes' worth of primitives in one mesh: indexed
+    /// triangles with normalized byte colors and short texture coords, then
+    /// unindexed triangles with positions and normals interleaved, then a
+    /// line list to be skipped
+    std::string twoPrimitiveGlb(Triangles& expected)
+    {
+        std::mt19937 random(2);
+        auto unit = [&] { return (int) (random() % 2001) / 1000.0f - 1.0f; };
+        const int count = 5000, triangleCount = 12000, loose = 300;
+        std::vector<float> positions, interleaved;
+        std::vector<uint8_t> colors;
+        std::vector<uint16_t> texCoords;
+        std::vector<uint32_t> indices;
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) positions.push_back(unit());
+            for (int k = 0; k < 4; ++k) colors.push_back((uint8_t) random());
+            for (int k = 0; k < 2; ++k) texCoords.push_back((uint16_t) random());
+        }
+        for (int i = 0; i < triangleCount * 3; ++i) indices.push_back(random() % count);
+        for (int i = 0; i < loose * 6; ++i) interleaved.push_back(unit());
+        
+        std::string bin;
+        auto put = [&](const void* data, size_t size) {
+            size_t offset = bin.size();
+            bin.append((const char*) data, size);
+            while (bin.size() % 4) bin += '\0';
+            return offset;
+        };
+        size_t positionOffset = put(positions.data(), positions.size() * 4);
+        size_t colorOffset = put(colors.data(), colors.size());
+        size_t texCoordOffset = put(texCoords.data(), texCoords.size() * 2);
+        size_t indexOffset = put(indices.data(), indices.size() * 4);
+        size_t interleavedOffset = put(interleaved.data(), interleaved.size() * 4);
+        
+        char json[4096];
+        snprintf(json, sizeof(json), R"({"asset":{"version":"2.0"},"buffers":[{"byteLength":%zu}],
+"bufferViews":[{"buffer":0,"byteOffset":%zu,"byteLength":%zu},{"buffer":0,"byteOffset":%zu,"byteLength":%zu},
+{"buffer":0,"byteOffset":%zu,"byteLength":%zu},{"buffer":0,"byteOffset":%zu,"byteLength":%zu},
+{"buffer":0,"byteOffset":%zu,"byteLength":%zu,"byteStride":24}],
+"accessors":[{"bufferView":0,"componentType":5126,"count":%d,"type":"VEC3"},
+{"bufferView":1,"componentType":5121,"normalized":true,"count":%d,"type":"VEC4"},
+{"bufferView":2,"componentType":5123,"normalized":true,"count":%d,"type":"VEC2"},
+{"bufferView":3,"componentType":5125,"count":%d,"type":"SCALAR"},
+{"bufferView":4,"componentType":5126,"count":%d,"type":"VEC3"},
+{"bufferView":4,"byteOffset":12,"componentType":5126,"count":%d,"type":"VEC3"}],
+"meshes":[{"name":"quoted \"name\"","primitives":[{"attributes":{"POSITION":0,"COLOR_0":1,"TEXCOORD_0":2},"indices":3,"mode":4},
+{"attributes":{"POSITION":4,"NORMAL":5}},{"attributes":{"POSITION":4},"mode":1}]}]})",
+                 bin.size(), positionOffset, positions.size() * 4, colorOffset, colors.size(), texCoordOffset, texCoords.size() * 2,
+                 indexOffset, indices.size() * 4, interleavedOffset, interleaved.size() * 4,
+                 count, count, count, triangleCount * 3, loose, loose);
+        std::string text = json;
+        while (text.size() % 4) text += ' ';
+        
+        std::string glb = "glTF";
+        auto word = [&](uint32_t value) { glb.append((const char*) &value, 4); };
+        word(2);
+        word((uint32_t) (12 + 8 + text.size() + 8 + bin.size()));
+        word((uint32_t) text.size());
+        word(0x4E4F534A);
+        glb += text;
+        word((uint32_t) bin.size());
+        word(0x004E4942);
+        glb += bin;
+        
+        // no normal reads as +z, no color as white, no texture coords as 0
+        auto indexed = [&](int i) {
+            Corner c;
+            for (int a = 0; a < 3; ++a) c[a] = rounded(positions[i * 3 + a]);
+            for (int a = 0; a < 3; ++a) c[3 + a] = rounded(colors[i * 4 + a] / 255.0f);
+            c[6] = rounded(texCoords[i * 2] / 65535.0f);
+            c[7] = rounded(texCoords[i * 2 + 1] / 65535.0f);
+            c[8] = c[9] = 0;
+            c[10] = 1000;
+            return c;
+        };
+        for (size_t i = 0; i < indices.size(); i += 3)
+            expected.insert(canonical(Triangle { { indexed(indices[i]), indexed(indices[i + 1]), indexed(indices[i + 2]) } }));
+        auto unindexed = [&](int i) {
+            Corner c;
+            for (int a = 0; a < 3; ++a) c[a] = rounded(interleaved[i * 6 + a]);
+            for (int a = 3; a < 6; ++a) c[a] = 1000;
+            c[6] = c[7] = 0;
+            for (int a = 0; a < 3; ++a) c[8 + a] = rounded(interleaved[i * 6 + 3 + a]);
+            return c;
+        };
+        for (int i = 0; i < loose; i += 3)
+            expected.insert(canonical(Triangle { { unindexed(i), unindexed(i + 1), unindexed(i + 2) } }));
+        return glb;
+    }
+}
+
+TEST(obj_triangles_come_through_on_any_thread_count)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Triangles expected;
+    std::string path = test::temporaryPath("grid.obj");
+    write(path, gridObj(150, expected));
+    
+    // a file of several runs, so relative indices cross between them
+    for (int threads : { 1, 3, 8 })
+        for (bool optimize : { false, true }) {
+            MeshLoader loader(FullVertex::layout(), optimize, threads);
+            Mesh mesh = loader.load(path);
+            bool inRange;
+            if (!CHECK((bool) mesh)) continue;
+            CHECK(triangles(mesh, inRange) == expected);
+            CHECK(inRange);
+            CHECK(mesh.indexCount == expected.size() * 3 && mesh.parts.size() == 1);
+            CHECK(loader.stats().meshes == 1 && loader.stats().failed == 0);
+        }
+    unlink(path.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(welded_obj_keeps_one_vertex_a_position)
+{
+    // every corner naming the same position, texture coord and normal: the
+    // positions are the vertices
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    std::string path = test::temporaryPath("quad.obj");
+    write(path, "v 0.5 0.5 0 1 0 0\nv 0.5 -0.5 0 0 1 0\nv -0.5 -0.5 0 0 0 1\nv -0.5 0.5 0 1 1 0\n"
+                "vt 1 0\nvt 1 1\nvt 0 1\nvt 0 0\n"
+                "vn 0 0 1\nvn 0 0 1\nvn 0 0 1\nvn 0 0 1\n"
+                "f 1/1/1 4/4/4 2/2/2\nf 4/4/4 3/3/3 2/2/2\n");
+    MeshLoader loader(FullVertex::layout());
+    Mesh mesh = loader.load(path);
+    bool inRange;
+    CHECK(mesh && mesh.vertexCount == 4 && mesh.indexCount == 6);
+    Triangles got = triangles(mesh, inRange);
+    CHECK(inRange && got.size() == 2);
+    
+    // the first corner: red, at the top right of the image
+    Corner first = { { 500, 500, 0, 1000, 0, 0, 1000, 1000, 0, 0, 1000 } };
+    int uses = 0;
+    for (const Triangle& triangle : got) uses += (int) std::count(triangle.begin(), triangle.end(), first);
+    CHECK(uses == 1);
+    unlink(path.c_str());
+}
+
+TEST(normalized_positions_are_relative_to_the_bounds)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    std::string path = test::temporaryPath("box.obj");
+    write(path, "v 1 2 3\nv 5 2 3\nv 1 4 3\nv 1 2 -1\nf 1 2 3\nf 1 3 4\n");
+    typedef VertexFormat<Attribute<MeshAttribute::Position, VertexEncoding::Snorm16<3>>> PackedVertex;
+    MeshLoader loader(PackedVertex::layout());
+    Mesh mesh = loader.load(path);
+    CHECK((bool) mesh);
+    CHECK(mesh.boundsMin[0] == 1 && mesh.boundsMin[1] == 2 && mesh.boundsMin[2] == -1);
+    CHECK(mesh.boundsMax[0] == 5 && mesh.boundsMax[1] == 4 && mesh.boundsMax[2] == 3);
+    CHECK(mesh.center[0] == 3 && mesh.center[1] == 3 && mesh.center[2] == 1 && mesh.scale == 2);
+    unlink(path.c_str());
+}
+
+TEST(glb_primitives_come_through_and_lines_are_skipped)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Triangles expected;
+    std::string path = test::temporaryPath("primitives.glb");
+    write(path, twoPrimitiveGlb(expected));
+    for (bool optimize : { false, true }) {
+        MeshLoader loader(FullVertex::layout(), optimize, 6);
+        Mesh mesh = loader.load(path);
+        bool inRange;
+        if (!CHECK((bool) mesh)) continue;
+        CHECK(mesh.parts.size() == 2);
+        CHECK(triangles(mesh, inRange) == expected);
+        CHECK(inRange);
+    }
+    unlink(path.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(unreadable_files_give_empty_meshes)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    MeshLoader loader(FullVertex::layout());
+    std::string glb = test::temporaryPath("bad.glb"), obj = test::temporaryPath("bad.obj"), other = test::temporaryPath("mesh.ply");
+    write(glb, "glTF" + std::string(24, 'x'));
+    write(other, "ply\n");
+    CHECK(!loader.load(test::temporaryPath("missing.obj")));
+    CHECK(!loader.load(glb));
+    CHECK(!loader.load(other));
+    CHECK(loader.stats().failed == 3);
+    
+    // malformed lines and indices past the end lose what they must, and no
+    // index that reaches the GPU is out of range
+    write(obj, "v 1 2\nv 0 0 0\nv 1 0 0\nv 0 1 0\nf 2 3 4\nf 9 1 x\nf 2/7/9 3 4\n");
+    Mesh mesh = loader.load(obj);
+    bool inRange = false;
+    if (CHECK((bool) mesh)) triangles(mesh, inRange);
+    CHECK(inRange);
+    unlink(glb.c_str());
+    unlink(obj.c_str());
+    unlink(other.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
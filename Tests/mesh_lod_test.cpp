@@ -0,0 +1,270 @@
+//
+//  mesh_lod_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  MeshLod chains of a bumpy sphere with texture seams and of an open
+//  heightfield, checked for holes, flips and what the settings promise,
+//  and level selection as a camera moves.
+//
+
+#include "test.h"
+
+#include "mesh_lod.h"
+
+#include <map>
+#include <set>
+#include <utility>
+
+namespace
+{
+    /// Positions and texture coords, five floats a vertex
+    struct Surface
+    {
+        std::vector<float> vertices;
+        std::vector<uint32_t> indices;
+        size_t vertexCount() const { return vertices.size() / 5; }
+    };
+    
+    /// A unit sphere with bumps, a column of vertices a longitude. The last
+    /// column is the first again with u = 1, and each column has its own
+    /// vertex at each pole, so both are seams
+    Surface sphere(int columns, int rows)
+    {
+        Surface s;
+        for (int i = 0; i <= columns; ++i)
+            for (int j = 0; j <= rows; ++j) {
+                float u = (i % columns) * 6.2831853f / columns, v = j * 3.14159265f / rows;
+                float r = 1 + 0.03f * std::sin(9 * u) * std::sin(7 * v);
+                float p[3] = { r * std::sin(v) * std::cos(u), r * std::sin(v) * std::sin(u), r * std::cos(v) };
+                if (j == 0 || j == rows) p[0] = p[1] = 0, p[2] = j == 0 ? 1 : -1;
+                s.vertices.insert(s.vertices.end(), { p[0], p[1], p[2], (float) i / columns, (float) j / rows });
+            }
+        auto id = [&](int i, int j) { return (uint32_t) (i * (rows + 1) + j); };
+        for (int i = 0; i < columns; ++i)
+            for (int j = 0; j < rows; ++j) {
+                if (j > 0) s.indices.insert(s.indices.end(), { id(i, j), id(i, j + 1), id(i + 1, j) });
+                if (j < rows - 1) s.indices.insert(s.indices.end(), { id(i + 1, j), id(i, j + 1), id(i + 1, j + 1) });
+            }
+        return s;
+    }
+    
+    /// A square of rolling hills, open all round
+    Surface heightfield(int size)
+    {
+        Surface s;
+        for (int i = 0; i <= size; ++i)
+            for (int j = 0; j <= size; ++j) {
+                float x = (float) i / size, y = (float) j / size;
+                s.vertices.insert(s.vertices.end(), { x, y, 0.05f * std::sin(6 * x) * std::cos(5 * y), x, y });
+            }
+        auto id = [&](int i, int j) { return (uint32_t) (i * (size + 1) + j); };
+        for (int i = 0; i < size; ++i)
+            for (int j = 0; j < size; ++j)
+                s.indices.insert(s.indices.end(), { id(i, j), id(i + 1, j), id(i + 1, j + 1), id(i, j), id(i + 1, j + 1), id(i, j + 1) });
+        return s;
+    }
+    
+    /// The triangles' edges between positions (not vertices, so seams
+    /// join), with how many triangles have each one way round
+    std::map<std::pair<int, int>, int> edges(const Surface& s, const std::vector<uint32_t>& indices)
+    {
+        std::map<std::vector<float>, int> positions;
+        std::vector<int> id(s.vertexCount());
+        for (size_t v = 0; v < id.size(); ++v) {
+            std::vector<float> key(&s.vertices[v * 5], &s.vertices[v * 5] + 3);
+            id[v] = positions.emplace(key, (int) positions.size()).first->second;
+        }
+        std::map<std::pair<int, int>, int> result;
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int c = 0; c < 3; ++c) ++result[std::make_pair(id[indices[i + c]], id[indices[i + (c + 1) % 3]])];
+        return result;
+    }
+    
+    /// Edges no triangle has the other way round
+    std::set<std::pair<int, int>> border(const std::map<std::pair<int, int>, int>& edges)
+    {
+        std::set<std::pair<int, int>> result;
+        for (const auto& edge : edges)
+            if (!edges.count(std::make_pair(edge.first.second, edge.first.first))) result.insert(edge.first);
+        return result;
+    }
+    
+    /// Every edge once each way round: no holes, no folds
+    bool closed(const std::map<std::pair<int, int>, int>& edges)
+    {
+        for (const auto& edge : edges) {
+            auto back = edges.find(std::make_pair(edge.first.second, edge.first.first));
+            if (edge.second != 1 || back == edges.end() || back->second != 1) return false;
+        }
+        return true;
+    }
+    
+    /// How much of the sphere's area faces in rather than out, as a fraction
+    /// of all of it
+    float inward(const Surface& s, const std::vector<uint32_t>& indices)
+    {
+        float in = 0, all = 0;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const float* p[3] = { &s.vertices[indices[i] * 5], &s.vertices[indices[i + 1] * 5], &s.vertices[indices[i + 2] * 5] };
+            float u[3], v[3], centroid[3];
+            for (int k = 0; k < 3; ++k) {
+                u[k] = p[1][k] - p[0][k];
+                v[k] = p[2][k] - p[0][k];
+                centroid[k] = p[0][k] + p[1][k] + p[2][k];
+            }
+            float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            all += area;
+            if (n[0] * centroid[0] + n[1] * centroid[1] + n[2] * centroid[2] <= 0) in += area;
+        }
+        return in / all;
+    }
+    
+    /// The furthest apart two corners of a triangle are in texture space
+    float widestTexCoords(const Surface& s, const std::vector<uint32_t>& indices)
+    {
+        float widest = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int c = 0; c < 3; ++c) {
+                const float* a = &s.vertices[indices[i + c] * 5 + 3];
+                const float* b = &s.vertices[indices[i + (c + 1) % 3] * 5 + 3];
+                widest = std::max(widest, std::max(std::fabs(a[0] - b[0]), std::fabs(a[1] - b[1])));
+            }
+        return widest;
+    }
+}
+
+TEST(sphere_levels_stay_closed_and_facing_out)
+{
+    Surface s = sphere(128, 64);
+    MeshLod::Settings settings;
+    settings.levels = 6;
+    settings.maxError = 0.05f;
+    std::vector<float> attributes;
+    for (size_t v = 0; v < s.vertexCount(); ++v)
+        attributes.insert(attributes.end(), { s.vertices[v * 5 + 3], s.vertices[v * 5 + 4] });
+    std::vector<float> errors;
+    std::vector<std::vector<uint32_t>> levels = MeshLod::chain(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                               sizeof(float) * 5, attributes.data(), 2, settings, errors);
+    CHECK(levels.size() >= 4 && levels.size() <= 7);
+    CHECK(errors.size() == levels.size() && errors[0] == 0);
+    CHECK(levels[0] == s.indices);
+    for (size_t l = 1; l < levels.size(); ++l) {
+        const std::vector<uint32_t>& level = levels[l];
+        CHECK(level.size() % 3 == 0 && level.size() / 3 >= settings.minTriangles);
+        CHECK(level.size() <= levels[l - 1].size() * 9 / 10);
+        CHECK(errors[l] >= errors[l - 1]);
+        CHECK(std::all_of(level.begin(), level.end(), [&](uint32_t v) { return v < s.vertexCount(); }));
+        CHECK(closed(edges(s, level)));
+        // a sliver may end up folded near a pole, where the columns crowd
+        // together, but nothing that shows
+        CHECK(inward(s, level) < 1e-3f);
+        
+        // the u = 0 and u = 1 columns move together but keep apart in
+        // texture space: no triangle reaches across the seam
+        CHECK(widestTexCoords(s, level) < 0.5f);
+    }
+    
+    // no level is further off than 5% of the widest side of the box
+    float low[3] = { INFINITY, INFINITY, INFINITY }, high[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t v = 0; v < s.vertexCount(); ++v)
+        for (int k = 0; k < 3; ++k) {
+            low[k] = std::min(low[k], s.vertices[v * 5 + k]);
+            high[k] = std::max(high[k], s.vertices[v * 5 + k]);
+        }
+    float extent = std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+    CHECK(errors.back() > 0 && errors.back() <= 0.05f * extent);
+}
+
+TEST(simplify_stops_at_the_error_asked_for)
+{
+    Surface s = sphere(64, 32);
+    float coarse = 0, fine = 0;
+    std::vector<uint32_t> few = MeshLod::simplify(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                  sizeof(float) * 5, nullptr, 0, 0, 0.05f, true, &coarse);
+    std::vector<uint32_t> many = MeshLod::simplify(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                   sizeof(float) * 5, nullptr, 0, 0, 0.005f, true, &fine);
+    CHECK(coarse <= 0.05f && fine <= 0.005f);
+    CHECK(few.size() < many.size() && many.size() < s.indices.size());
+    CHECK(closed(edges(s, few)) && closed(edges(s, many)));
+    
+    // nothing to lose within no error at all on a curved surface
+    float none = 1;
+    std::vector<uint32_t> same = MeshLod::simplify(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                   sizeof(float) * 5, nullptr, 0, 0, 0.0f, true, &none);
+    CHECK(same == s.indices && none == 0);
+}
+
+TEST(locked_borders_keep_their_edges)
+{
+    Surface s = heightfield(48);
+    std::set<std::pair<int, int>> outline = border(edges(s, s.indices));
+    CHECK(outline.size() == 4 * 48);
+    
+    MeshLod::Settings settings;
+    settings.levels = 4;
+    settings.maxError = 0.05f;
+    std::vector<float> errors;
+    std::vector<std::vector<uint32_t>> levels = MeshLod::chain(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                               sizeof(float) * 5, nullptr, 0, settings, errors);
+    CHECK(levels.size() >= 3);
+    for (size_t l = 1; l < levels.size(); ++l) {
+        std::map<std::pair<int, int>, int> levelEdges = edges(s, levels[l]);
+        CHECK(border(levelEdges) == outline);
+        CHECK(std::all_of(levelEdges.begin(), levelEdges.end(), [](const std::pair<const std::pair<int, int>, int>& edge) { return edge.second == 1; }));
+    }
+    
+    // unlocked, the border goes too, and further
+    std::vector<uint32_t> locked = MeshLod::simplify(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                     sizeof(float) * 5, nullptr, 0, 0, 0.01f, true);
+    std::vector<uint32_t> unlocked = MeshLod::simplify(s.indices.data(), s.indices.size(), s.vertexCount(), s.vertices.data(),
+                                                       sizeof(float) * 5, nullptr, 0, 0, 0.01f, false);
+    CHECK(unlocked.size() < locked.size());
+    CHECK(border(edges(s, unlocked)).size() < outline.size());
+}
+
+TEST(selection_holds_a_level_near_where_it_switches)
+{
+    std::vector<float> errors = { 0, 0.01f, 0.02f, 0.04f };
+    float pixelsPerUnit = MeshLod::pixelsPerUnit(1.0f, 1000);
+    CHECK(std::fabs(pixelsPerUnit - 1000 / (2 * std::tan(0.5f))) < 1e-3f);
+    
+    // coarser going away, finer coming back, never skipping back a level
+    size_t level = 0;
+    for (float distance = 1; distance < 200; distance *= 1.5f) {
+        size_t next = MeshLod::select(errors, level, distance, pixelsPerUnit);
+        CHECK(next >= level);
+        CHECK(errors[next] * pixelsPerUnit / distance <= 1);
+        level = next;
+    }
+    CHECK(level == 3);
+    for (float distance = 200; distance > 1; distance /= 1.5f) {
+        size_t next = MeshLod::select(errors, level, distance, pixelsPerUnit);
+        CHECK(next <= level);
+        CHECK(errors[next] * pixelsPerUnit / distance <= 1);
+        level = next;
+    }
+    CHECK(level == 0);
+    
+    // wobbling around the distance level 1 starts to fit at: it switches
+    // once, going out, and then holds
+    float edge = errors[1] * pixelsPerUnit;
+    level = 0;
+    int switches = 0;
+    for (int frame = 0; frame < 100; ++frame) {
+        float distance = edge * (1.5f + 0.1f * std::sin((float) frame));
+        size_t next = MeshLod::select(errors, level, distance, pixelsPerUnit);
+        switches += next != level;
+        level = next;
+    }
+    CHECK(switches == 1 && level == 1);
+    level = 0;
+    for (int frame = 0; frame < 100; ++frame) level = MeshLod::select(errors, level, edge * (1 + 0.05f * std::sin((float) frame)), pixelsPerUnit);
+    CHECK(level == 0);
+    CHECK(MeshLod::select(std::vector<float>(), 3, 10, pixelsPerUnit) == 0);
+}
+
+TEST_MAIN()
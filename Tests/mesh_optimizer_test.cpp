@@ -0,0 +1,269 @@
+//
+//  mesh_optimizer_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  MeshOptimizer's FIFO cache analysis on hand-counted streams, Tipsify on
+//  grids in good and shuffled orders, and the whole pipeline on a closed
+//  mesh: the same triangles, wound the same way, vertices renumbered in the
+//  order they are first fetched, and the indices uploaded at the size that
+//  fits.
+//
+
+#include "test.h"
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <random>
+
+namespace
+{
+    /// A grid of 'size' x 'size' quads, two triangles each, row by row
+    std::vector<uint32_t> grid(int size)
+    {
+        std::vector<uint32_t> indices;
+        auto id = [&](int i, int j) { return (uint32_t) (j * (size + 1) + i); };
+        for (int j = 0; j < size; ++j)
+            for (int i = 0; i < size; ++i)
+                indices.insert(indices.end(), { id(i, j), id(i + 1, j), id(i + 1, j + 1), id(i, j), id(i + 1, j + 1), id(i, j + 1) });
+        return indices;
+    }
+    
+    /// The same triangles in a random order, each started at a random corner
+    std::vector<uint32_t> shuffled(const std::vector<uint32_t>& indices, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<size_t> order(indices.size() / 3);
+        for (size_t t = 0; t < order.size(); ++t) order[t] = t;
+        std::shuffle(order.begin(), order.end(), random);
+        std::vector<uint32_t> result;
+        for (size_t t : order) {
+            size_t turn = random() % 3;
+            for (size_t c = 0; c < 3; ++c) result.push_back(indices[t * 3 + (c + turn) % 3]);
+        }
+        return result;
+    }
+    
+    /// The triangles, each turned to start at its smallest vertex so
+    /// winding counts but the starting corner doesn't, sorted
+    std::vector<std::array<uint32_t, 3>> triangles(const std::vector<uint32_t>& indices)
+    {
+        std::vector<std::array<uint32_t, 3>> result;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            size_t smallest = std::min_element(&indices[i], &indices[i] + 3) - &indices[i];
+            result.push_back({ indices[i + smallest], indices[i + (smallest + 1) % 3], indices[i + (smallest + 2) % 3] });
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+    
+    /// Tipsify on 'indices' into a new list
+    std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize,
+                                  std::vector<uint32_t>* clusters = nullptr)
+    {
+        std::vector<uint32_t> result(indices.size());
+        MeshOptimizer::optimizeVertexCache(result.data(), indices.data(), indices.size(), vertexCount, cacheSize, clusters);
+        return result;
+    }
+    
+    float acmr(const std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize)
+    {
+        return MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize).acmr;
+    }
+    
+    /// A closed box of 'size' x 'size' quads a face, corners and edges shared,
+    /// positions three floats a vertex, plus 'unused' vertices no triangle
+    /// uses spread among them
+    struct Box
+    {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        size_t vertexCount() const { return positions.size() / 3; }
+    };
+    
+    Box box(int size, int unused)
+    {
+        Box b;
+        std::vector<std::array<int, 3>> points;
+        auto id = [&](std::array<int, 3> p) {
+            auto found = std::find(points.begin(), points.end(), p);
+            if (found != points.end()) return (uint32_t) (found - points.begin());
+            if ((int) points.size() % 7 == 3 && unused-- > 0) points.push_back({ -99, -99, -99 });
+            points.push_back(p);
+            return (uint32_t) points.size() - 1;
+        };
+        // each face by the axis it faces along and which way
+        for (int axis = 0; axis < 3; ++axis)
+            for (int side : { 0, size }) {
+                int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                if (side == 0) std::swap(u, v);
+                auto corner = [&](int i, int j) {
+                    std::array<int, 3> p;
+                    p[axis] = side, p[u] = i, p[v] = j;
+                    return id(p);
+                };
+                for (int j = 0; j < size; ++j)
+                    for (int i = 0; i < size; ++i)
+                        b.indices.insert(b.indices.end(), { corner(i, j), corner(i + 1, j), corner(i + 1, j + 1),
+                                                            corner(i, j), corner(i + 1, j + 1), corner(i, j + 1) });
+            }
+        for (const std::array<int, 3>& p : points)
+            for (int c : p) b.positions.push_back(c == -99 ? 0.0f : (float) c / size - 0.5f);
+        return b;
+    }
+}
+
+TEST(analysis_counts_a_fifo_cache)
+{
+    // two triangles sharing an edge: four misses, each vertex once
+    const uint32_t quad[] = { 0, 1, 2, 2, 1, 3 };
+    MeshOptimizer::CacheStats stats = MeshOptimizer::analyzeVertexCache(quad, 6, 4, 3);
+    CHECK(stats.acmr == 2.0f && stats.atvr == 1.0f);
+    
+    // a hit doesn't keep a vertex in, as it would in an LRU cache: 0 goes
+    // when 3 comes in and misses again
+    const uint32_t fifo[] = { 0, 1, 2, 0, 3, 0 };
+    stats = MeshOptimizer::analyzeVertexCache(fifo, 6, 4, 3);
+    CHECK(stats.acmr == 2.5f && stats.atvr == 1.25f);
+    stats = MeshOptimizer::analyzeVertexCache(fifo, 6, 4, 4);
+    CHECK(stats.acmr == 2.0f && stats.atvr == 1.0f);
+    
+    stats = MeshOptimizer::analyzeVertexCache(nullptr, 0, 0, 16);
+    CHECK(stats.acmr == 0 && stats.atvr == 0);
+}
+
+TEST(tipsify_is_no_worse_on_a_grid)
+{
+    // row by row is already fair, a shuffle as bad as it gets. Tipsify
+    // beats a shuffle, and rows too once two don't fit in the cache; where
+    // they do, optimize() keeps them. Every triangle stays as it was wound
+    for (int cacheSize : { 8, 16, 32 })
+        for (int size : { 1, 7, 40 }) {
+            std::vector<uint32_t> rows = grid(size), random = shuffled(rows, 900 + size);
+            size_t vertexCount = (size_t) (size + 1) * (size + 1);
+            for (const std::vector<uint32_t>* indices : { &rows, &random }) {
+                std::vector<uint32_t> clusters;
+                std::vector<uint32_t> optimized = tipsify(*indices, vertexCount, cacheSize, &clusters);
+                float given = acmr(*indices, vertexCount, cacheSize);
+                if (indices == &random || 2 * (size + 1) > cacheSize) CHECK(acmr(optimized, vertexCount, cacheSize) <= given);
+                CHECK(triangles(optimized) == triangles(*indices));
+                
+                MeshOptimizer optimizer(cacheSize);
+                std::vector<uint32_t> whole = *indices;
+                optimizer.optimize(whole, vertexCount, nullptr, 0);
+                CHECK(optimizer.stats().after.acmr <= given && optimizer.stats().before.acmr == given);
+                
+                // clusters start at the first triangle and go up triangle by triangle
+                bool ordered = !clusters.empty() && clusters[0] == 0;
+                for (size_t k = 1; k < clusters.size(); ++k) ordered = ordered && clusters[k] > clusters[k - 1] && clusters[k] % 3 == 0;
+                CHECK(ordered && clusters.back() < optimized.size());
+            }
+        }
+    
+    // and well on a large one, a quad costing about one new vertex, only
+    // going cold at the few dead ends a connected grid has
+    std::vector<uint32_t> big = shuffled(grid(100), 950), bigClusters;
+    float before = acmr(big, 101 * 101, 16), after = acmr(tipsify(big, 101 * 101, 16, &bigClusters), 101 * 101, 16);
+    CHECK(before > 2.5f && after < 0.8f);
+    CHECK(bigClusters.size() < big.size() / 3 / 100);
+    
+    // nothing to do with no triangles
+    std::vector<uint32_t> clusters(3, 7);
+    MeshOptimizer::optimizeVertexCache(nullptr, nullptr, 0, 0, 16, &clusters);
+    CHECK(clusters.empty());
+}
+
+TEST(optimize_keeps_the_triangles_and_compacts_the_fetch)
+{
+    Box mesh = box(12, 20);
+    std::vector<uint32_t> original = shuffled(mesh.indices, 960);
+    size_t vertexCount = mesh.vertexCount();
+    MeshOptimizer optimizer;
+    std::vector<uint32_t> indices = original;
+    std::vector<uint32_t> remap = optimizer.optimize(indices, vertexCount, mesh.positions.data(), sizeof(float) * 3);
+    
+    // used vertices numbered 0 up, one each; the rest Unused
+    std::vector<uint32_t> inverse(vertexCount, MeshOptimizer::Unused);
+    std::vector<char> used(vertexCount, 0);
+    for (uint32_t v : original) used[v] = 1;
+    size_t usedCount = std::count(used.begin(), used.end(), 1);
+    bool bijective = remap.size() == vertexCount && usedCount == vertexCount - 20;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        if (!used[v]) {
+            bijective = bijective && remap[v] == MeshOptimizer::Unused;
+            continue;
+        }
+        bijective = bijective && remap[v] < usedCount && inverse[remap[v]] == MeshOptimizer::Unused;
+        if (remap[v] < usedCount) inverse[remap[v]] = (uint32_t) v;
+    }
+    CHECK(bijective);
+    
+    // the indices take each new number first in turn, so fetches go forward
+    uint32_t next = 0;
+    bool compacted = indices.size() == original.size();
+    for (uint32_t v : indices) {
+        compacted = compacted && v <= next;
+        if (v == next) ++next;
+    }
+    CHECK(compacted && next == usedCount);
+    
+    // numbered back, the same triangles wound the same way
+    std::vector<uint32_t> back;
+    for (uint32_t v : indices) back.push_back(inverse[v]);
+    CHECK(triangles(back) == triangles(original));
+    
+    // and the vertex data follows them
+    std::vector<float> moved(usedCount * 3, NAN);
+    CHECK(MeshOptimizer::remapVertices(moved.data(), mesh.positions.data(), vertexCount, sizeof(float) * 3, remap) == usedCount);
+    bool follows = true;
+    for (size_t i = 0; i < indices.size(); ++i)
+        for (int c = 0; c < 3; ++c) follows = follows && moved[indices[i] * 3 + c] == mesh.positions[back[i] * 3 + c];
+    CHECK(follows);
+    
+    // overdraw sorting keeps what Tipsify won, near enough
+    MeshOptimizer::Stats stats = optimizer.stats();
+    CHECK(stats.meshes == 1 && stats.triangles == original.size() / 3 && stats.shortIndexMeshes == 1 && stats.clusters >= 1);
+    CHECK(stats.before.acmr == acmr(original, vertexCount, 16) && stats.after.acmr == acmr(indices, vertexCount, 16));
+    CHECK(stats.after.acmr < stats.before.acmr * 0.5f && stats.after.atvr < stats.before.atvr * 0.5f);
+    
+    // without positions it is Tipsify and the renumbering alone
+    MeshOptimizer plain;
+    std::vector<uint32_t> withoutOverdraw = original;
+    std::vector<uint32_t> plainRemap = plain.optimize(withoutOverdraw, vertexCount, nullptr, 0);
+    std::vector<uint32_t> expected = tipsify(original, vertexCount, 16);
+    std::vector<uint32_t> expectedRemap = MeshOptimizer::optimizeVertexFetch(expected.data(), expected.size(), vertexCount);
+    CHECK(withoutOverdraw == expected && plainRemap == expectedRemap && plain.stats().clusters >= 1);
+}
+
+TEST(indices_upload_as_shorts_where_they_fit)
+{
+    CHECK(MeshOptimizer::fitsShort(65536) && !MeshOptimizer::fitsShort(65537));
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    std::vector<uint32_t> indices = { 0, 65535, 7, 1, 2, 3 };
+    CHECK(MeshOptimizer::uploadIndices(GL_ARRAY_BUFFER, indices, 65536, GL_STATIC_DRAW) == GL_UNSIGNED_SHORT);
+    GLint size;
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+    uint16_t shorts[6];
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(shorts), shorts);
+    CHECK(size == 12 && std::equal(indices.begin(), indices.end(), shorts));
+    
+    indices[1] = 65536;
+    CHECK(MeshOptimizer::uploadIndices(GL_ARRAY_BUFFER, indices, 65537, GL_STATIC_DRAW) == GL_UNSIGNED_INT);
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+    uint32_t ints[6];
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(ints), ints);
+    CHECK(size == 24 && std::equal(indices.begin(), indices.end(), ints));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
@@ -0,0 +1,297 @@
+//
+//  meshlets_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Meshlets built over a sphere: the clusters keep every triangle and stay
+//  within their limits and bounds, and culling over random views, mirrored
+//  and parallel ones too, never leaves out a triangle GL would have drawn.
+//
+
+#include "test.h"
+
+#include "meshlets.h"
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+namespace
+{
+    struct Sphere
+    {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        size_t vertexCount() const { return positions.size() / 3; }
+    };
+    
+    /// A unit sphere, counterclockwise from outside, its triangles shuffled
+    /// so clustering has to find the neighbours itself
+    Sphere sphere(int columns, int rows, unsigned seed)
+    {
+        Sphere s;
+        for (int i = 0; i < columns; ++i)
+            for (int j = 0; j <= rows; ++j) {
+                float u = i * 6.2831853f / columns, v = j * 3.14159265f / rows;
+                s.positions.insert(s.positions.end(), { std::sin(v) * std::cos(u), std::sin(v) * std::sin(u), std::cos(v) });
+            }
+        auto id = [&](int i, int j) { return (uint32_t) ((i % columns) * (rows + 1) + j); };
+        std::vector<std::vector<uint32_t>> triangles;
+        for (int i = 0; i < columns; ++i)
+            for (int j = 0; j < rows; ++j) {
+                if (j > 0) triangles.push_back({ id(i, j), id(i, j + 1), id(i + 1, j) });
+                if (j < rows - 1) triangles.push_back({ id(i + 1, j), id(i, j + 1), id(i + 1, j + 1) });
+            }
+        std::shuffle(triangles.begin(), triangles.end(), std::mt19937(seed));
+        for (const std::vector<uint32_t>& triangle : triangles) s.indices.insert(s.indices.end(), triangle.begin(), triangle.end());
+        return s;
+    }
+    
+    /// A triangle turned round to start at its lowest corner
+    std::vector<uint32_t> canonical(const uint32_t* corners)
+    {
+        std::vector<uint32_t> triangle(corners, corners + 3);
+        std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+        return triangle;
+    }
+    
+    /// Triangles as canonical() has them, so reordering them, or turning
+    /// one round, leaves the set the same
+    std::multiset<std::vector<uint32_t>> triangleSet(const uint32_t* indices, size_t count)
+    {
+        std::multiset<std::vector<uint32_t>> result;
+        for (size_t i = 0; i < count; i += 3) result.insert(canonical(indices + i));
+        return result;
+    }
+    
+    /// Column-major 4x4 matrices, as Meshlets::view() takes them
+    typedef std::vector<float> Matrix;
+    
+    Matrix multiply(const Matrix& a, const Matrix& b)
+    {
+        Matrix m(16, 0.0f);
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                for (int k = 0; k < 4; ++k) m[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+        return m;
+    }
+    
+    Matrix lookAt(const float* eye, const float* target)
+    {
+        float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+        float up[3] = { 0, 0, 1 };
+        if (std::fabs(f[2]) > 0.9f * std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2])) up[2] = 0, up[1] = 1;
+        float length = std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+        for (float& c : f) c /= length;
+        float s[3] = { f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0] };
+        length = std::sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+        for (float& c : s) c /= length;
+        float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+        Matrix m = { s[0], u[0], -f[0], 0, s[1], u[1], -f[1], 0, s[2], u[2], -f[2], 0, 0, 0, 0, 1 };
+        for (int r = 0; r < 3; ++r) m[12 + r] = -(m[r] * eye[0] + m[4 + r] * eye[1] + m[8 + r] * eye[2]);
+        return m;
+    }
+    
+    Matrix perspective(float fovY, float aspect, float near, float far)
+    {
+        float f = 1 / std::tan(fovY / 2);
+        return { f / aspect, 0, 0, 0, 0, f, 0, 0, 0, 0, (far + near) / (near - far), -1, 0, 0, 2 * far * near / (near - far), 0 };
+    }
+    
+    Matrix orthographic(float width, float height, float near, float far)
+    {
+        return { 2 / width, 0, 0, 0, 0, 2 / height, 0, 0, 0, 0, -2 / (far - near), 0, 0, 0, -(far + near) / (far - near), 1 };
+    }
+    
+    /// Whether GL draws any of the triangle: not wholly past one of the clip
+    /// planes, and, in front of the camera, counterclockwise on screen. Edge-on
+    /// and grazing ones count as not drawn
+    bool drawn(const Matrix& mvp, const float* a, const float* b, const float* c)
+    {
+        const float* corners[3] = { a, b, c };
+        double clip[3][4];
+        for (int k = 0; k < 3; ++k)
+            for (int r = 0; r < 4; ++r)
+                clip[k][r] = mvp[r] * corners[k][0] + mvp[4 + r] * corners[k][1] + mvp[8 + r] * corners[k][2] + mvp[12 + r];
+        for (int axis = 0; axis < 3; ++axis)
+            for (double sign : { -1.0, 1.0 }) {
+                bool past = true;
+                for (int k = 0; k < 3; ++k) past = past && sign * clip[k][axis] > clip[k][3] * (1 + 1e-5) + 1e-6;
+                if (past) return false;
+            }
+        if (clip[0][3] <= 0 || clip[1][3] <= 0 || clip[2][3] <= 0) return true;
+        double x[3], y[3];
+        for (int k = 0; k < 3; ++k) x[k] = clip[k][0] / clip[k][3], y[k] = clip[k][1] / clip[k][3];
+        return (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]) > 1e-6;
+    }
+    
+    /// The indices a cull() left in, in the order it gave them
+    std::vector<uint32_t> culled(const std::vector<uint32_t>& indices, const std::vector<GLsizei>& counts, const std::vector<const void*>& offsets)
+    {
+        std::vector<uint32_t> result;
+        for (size_t r = 0; r < counts.size(); ++r) {
+            size_t first = (size_t) offsets[r] / sizeof(uint32_t);
+            result.insert(result.end(), indices.begin() + first, indices.begin() + first + counts[r]);
+        }
+        return result;
+    }
+}
+
+TEST(clusters_keep_every_triangle_within_their_limits)
+{
+    Sphere s = sphere(96, 48, 1);
+    std::multiset<std::vector<uint32_t>> before = triangleSet(s.indices.data(), s.indices.size());
+    for (size_t maxVertices : { 64, 24 })
+        for (size_t maxTriangles : { 124, 30 }) {
+            std::vector<uint32_t> indices = s.indices;
+            Meshlets::Settings settings;
+            settings.maxVertices = maxVertices;
+            settings.maxTriangles = maxTriangles;
+            Meshlets meshlets;
+            meshlets.build(indices.data(), indices.size(), 0, s.positions.data(), sizeof(float) * 3, s.vertexCount(), settings);
+            CHECK(triangleSet(indices.data(), indices.size()) == before);
+            CHECK(meshlets.size() >= indices.size() / 3 / maxTriangles);
+            
+            uint32_t next = 0;
+            for (size_t m = 0; m < meshlets.size(); ++m) {
+                Meshlets::Meshlet meshlet = meshlets.meshlet(m);
+                CHECK(meshlet.firstIndex == next && meshlet.indexCount % 3 == 0 && meshlet.indexCount > 0);
+                next = meshlet.firstIndex + meshlet.indexCount;
+                std::set<uint32_t> vertices(indices.begin() + meshlet.firstIndex, indices.begin() + next);
+                CHECK(vertices.size() <= maxVertices && meshlet.indexCount / 3 <= maxTriangles);
+                
+                // the sphere holds every corner, and is no bigger than the
+                // cluster's own spread needs
+                float furthest = 0;
+                for (uint32_t v : vertices) {
+                    const float* p = &s.positions[v * 3];
+                    float x = p[0] - meshlet.center[0], y = p[1] - meshlet.center[1], z = p[2] - meshlet.center[2];
+                    furthest = std::max(furthest, std::sqrt(x * x + y * y + z * z));
+                }
+                CHECK(furthest <= meshlet.radius * 1.0001f + 1e-6f);
+                CHECK(meshlet.radius <= 0.5f);
+            }
+            CHECK(next == indices.size());
+        }
+}
+
+TEST(parts_add_clusters_after_the_ones_before)
+{
+    Sphere a = sphere(32, 16, 2), b = sphere(40, 20, 3);
+    size_t offset = a.vertexCount();
+    std::vector<float> positions = a.positions;
+    positions.insert(positions.end(), b.positions.begin(), b.positions.end());
+    std::vector<uint32_t> indices = a.indices;
+    for (uint32_t v : b.indices) indices.push_back(v + (uint32_t) offset);
+    std::multiset<std::vector<uint32_t>> first = triangleSet(indices.data(), a.indices.size());
+    std::multiset<std::vector<uint32_t>> second = triangleSet(indices.data() + a.indices.size(), b.indices.size());
+    
+    Meshlets meshlets;
+    meshlets.build(indices.data(), a.indices.size(), 0, positions.data(), sizeof(float) * 3, positions.size() / 3, Meshlets::Settings());
+    size_t built = meshlets.size();
+    meshlets.build(indices.data() + a.indices.size(), b.indices.size(), a.indices.size(), positions.data(), sizeof(float) * 3,
+                   positions.size() / 3, Meshlets::Settings());
+    CHECK(built > 0 && meshlets.size() > built);
+    CHECK(meshlets.meshlet(built).firstIndex == a.indices.size());
+    CHECK(triangleSet(indices.data(), a.indices.size()) == first);
+    CHECK(triangleSet(indices.data() + a.indices.size(), b.indices.size()) == second);
+    
+    // no settings for triangles makes no clusters
+    Meshlets::Settings none;
+    none.maxTriangles = 0;
+    Meshlets empty;
+    empty.build(indices.data(), indices.size(), 0, positions.data(), sizeof(float) * 3, positions.size() / 3, none);
+    CHECK(empty.empty());
+}
+
+TEST(culling_never_drops_what_gl_would_draw)
+{
+    Sphere s = sphere(96, 48, 4);
+    Meshlets meshlets;
+    meshlets.build(s.indices.data(), s.indices.size(), 0, s.positions.data(), sizeof(float) * 3, s.vertexCount(), Meshlets::Settings());
+    
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    size_t dropped = 0, kept = 0, wrong = 0, mirrored = 0, parallel = 0;
+    for (int v = 0; v < 400; ++v) {
+        // from inside the sphere to well out, looking near its middle or
+        // anywhere at all
+        float eye[3], target[3];
+        float length;
+        do {
+            for (float& c : eye) c = unit(random);
+            length = std::sqrt(eye[0] * eye[0] + eye[1] * eye[1] + eye[2] * eye[2]);
+        } while (length < 0.1f || length > 1);
+        float distance = v % 10 == 0 ? 0.5f : 1.2f + 5 * (unit(random) + 1) / 2;
+        for (float& c : eye) c *= distance / length;
+        for (float& c : target) c = v % 4 == 0 ? 3 * unit(random) : 0.8f * unit(random);
+        Matrix projection = v % 3 == 0 ? orthographic(1 + 2 * (unit(random) + 1), 1 + 2 * (unit(random) + 1), 0.1f, 20)
+                                       : perspective(0.5f + (unit(random) + 1), 1 + unit(random) * 0.5f, 0.1f, 20);
+        Matrix model = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+        if (v % 5 == 1) model[0] = -1;
+        Matrix mvp = multiply(multiply(projection, lookAt(eye, target)), model);
+        mirrored += model[0] < 0;
+        parallel += v % 3 == 0;
+        
+        meshlets.cull(Meshlets::view(mvp.data()), sizeof(uint32_t), counts, offsets);
+        std::vector<uint32_t> visible = culled(s.indices, counts, offsets);
+        std::multiset<std::vector<uint32_t>> left = triangleSet(visible.data(), visible.size());
+        for (size_t i = 0; i < s.indices.size(); i += 3) {
+            const uint32_t* t = &s.indices[i];
+            if (left.count(canonical(t))) {
+                ++kept;
+                continue;
+            }
+            ++dropped;
+            wrong += drawn(mvp, &s.positions[t[0] * 3], &s.positions[t[1] * 3], &s.positions[t[2] * 3]);
+        }
+        
+        // the ranges are in order and never overlap, neighbours merged
+        for (size_t r = 1; r < counts.size(); ++r)
+            CHECK((size_t) offsets[r] > (size_t) offsets[r - 1] + counts[r - 1] * sizeof(uint32_t));
+    }
+    CHECK(wrong == 0);
+    CHECK(mirrored > 0 && parallel > 0);
+    
+    // and it is worth doing: a fair share drops out
+    CHECK(dropped > (dropped + kept) / 4);
+    Meshlets::Stats stats = meshlets.stats();
+    CHECK(stats.frames == 400 && stats.tested == 400 * meshlets.size());
+    CHECK(stats.outside > 0 && stats.backfacing > 0);
+    CHECK(stats.triangles == kept);
+}
+
+TEST(added_clusters_cull_like_built_ones)
+{
+    Sphere s = sphere(64, 32, 6);
+    Meshlets built;
+    built.build(s.indices.data(), s.indices.size(), 0, s.positions.data(), sizeof(float) * 3, s.vertexCount(), Meshlets::Settings());
+    Meshlets added;
+    for (size_t m = 0; m < built.size(); ++m) added.add(built.meshlet(m));
+    CHECK(added.size() == built.size());
+    for (size_t m = 0; m < built.size(); ++m) {
+        Meshlets::Meshlet a = built.meshlet(m), b = added.meshlet(m);
+        CHECK(a.firstIndex == b.firstIndex && a.indexCount == b.indexCount && a.radius == b.radius && a.cutoff == b.cutoff);
+        CHECK(std::equal(a.center, a.center + 3, b.center) && std::equal(a.axis, a.axis + 3, b.axis));
+    }
+    
+    float eye[3] = { 3, 1, 0.5f }, target[3] = { 0, 0, 0 };
+    Meshlets::View view = Meshlets::view(multiply(perspective(0.8f, 1.5f, 0.1f, 20), lookAt(eye, target)).data());
+    std::vector<GLsizei> countsA, countsB;
+    std::vector<const void*> offsetsA, offsetsB;
+    size_t ranges = built.cull(view, 2, countsA, offsetsA);
+    CHECK(ranges > 0 && ranges == added.cull(view, 2, countsB, offsetsB));
+    CHECK(countsA == countsB && offsetsA == offsetsB);
+    
+    // without back faces culled, only the frustum counts
+    Meshlets::View frustum = Meshlets::view(multiply(perspective(0.8f, 1.5f, 0.1f, 20), lookAt(eye, target)).data(), false);
+    CHECK(frustum.facing == 0);
+    built.cull(frustum, 2, countsA, offsetsA);
+    CHECK(countsA.size() == 1 && countsA[0] == (GLsizei) s.indices.size() && offsetsA[0] == nullptr);
+}
+
+TEST_MAIN()
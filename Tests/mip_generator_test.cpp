@@ -0,0 +1,344 @@
+//
+//  mip_generator_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  MipGenerator's levels read back and compared with the same filters run
+//  on the CPU, level by level, for the formats it filters itself.
+//
+
+#include "test.h"
+
+#include "mip_generator.h"
+#include "sampler_cache.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace
+{
+    MipGenerator& generator()
+    {
+        static MipGenerator instance("../GLcontext/shaders/");
+        return instance;
+    }
+    
+    struct Level
+    {
+        int width = 0, height = 0;
+        std::vector<float> rgba;
+    };
+    
+    /// A texture with random level 0 contents; 'halves' for the float formats
+    struct Fixture
+    {
+        GLuint texture = 0;
+        GLenum format;
+        bool halves, srgb;
+        
+        Fixture(GLenum format, int width, int height, bool immutable, unsigned seed)
+            : format(format), halves(format == GL_RGBA16F || format == GL_R11F_G11F_B10F), srgb(format == GL_SRGB8_ALPHA8)
+        {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            if (immutable) glTexStorage2D(GL_TEXTURE_2D, Texture::mipLevels(width, height), format, width, height);
+            srand(seed);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            if (halves) {
+                std::vector<float> pixels((size_t) width * height * 4);
+                for (float& value : pixels) value = rand() % 4000 / 1000.0f;
+                if (immutable) glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, pixels.data());
+                else glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, pixels.data());
+            } else {
+                // a gradient with noise on it, so both smooth areas and edges count
+                std::vector<uint8_t> pixels((size_t) width * height * 4);
+                for (size_t i = 0; i < pixels.size(); ++i)
+                    pixels[i] = (uint8_t) (i / 4 % width * 7 + i / 4 / width * 3 + rand() % 40);
+                if (immutable) glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+                else glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+        
+        ~Fixture() { glDeleteTextures(1, &texture); }
+        
+        Level read(int level) const
+        {
+            Level out;
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &out.width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &out.height);
+            out.rgba.resize((size_t) out.width * out.height * 4);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            if (halves) {
+                glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, out.rgba.data());
+            } else {
+                std::vector<uint8_t> bytes(out.rgba.size());
+                glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, bytes.data());
+                for (size_t i = 0; i < bytes.size(); ++i) out.rgba[i] = bytes[i] / 255.0f;
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            return out;
+        }
+    };
+    
+    float decodeSrgb(float c) { return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f); }
+    float encodeSrgb(float c) { return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f; }
+    
+    /// The generator's Kaiser taps, worked out again
+    const float* kaiserWeights()
+    {
+        static float weights[12];
+        static bool made = false;
+        if (!made) {
+            auto besselI0 = [](double x) {
+                double sum = 1.0, term = 1.0;
+                for (int k = 1; k < 32; ++k) {
+                    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                    sum += term;
+                }
+                return sum;
+            };
+            double total = 0.0;
+            for (int i = 0; i < 12; ++i) {
+                double d = (i - 5.5) / 2.0;
+                weights[i] = (float) (std::sin(M_PI * d) / (M_PI * d) * besselI0(4.0 * std::sqrt(1.0 - d * d / 9.0)) / besselI0(4.0));
+                total += weights[i];
+            }
+            for (float& weight : weights) weight = (float) (weight / total);
+            made = true;
+        }
+        return weights;
+    }
+    
+    /// One level down from 'in', in linear values, clamping at the edges
+    Level downsample(const Level& in, int width, int height, bool kaiser)
+    {
+        Level out;
+        out.width = width;
+        out.height = height;
+        out.rgba.assign((size_t) width * height * 4, 0.0f);
+        auto at = [&](int x, int y, int c) {
+            x = std::min(std::max(x, 0), in.width - 1);
+            y = std::min(std::max(y, 0), in.height - 1);
+            return in.rgba[((size_t) y * in.width + x) * 4 + c];
+        };
+        const float* weights = kaiserWeights();
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                for (int c = 0; c < 4; ++c) {
+                    float value = 0.0f;
+                    if (kaiser) {
+                        for (int j = 0; j < 12; ++j) {
+                            float row = 0.0f;
+                            for (int i = 0; i < 12; ++i) row += weights[i] * at(2 * x + i - 5, 2 * y + j - 5, c);
+                            value += weights[j] * row;
+                        }
+                        value = std::max(value, 0.0f);
+                    } else {
+                        value = 0.25f * (at(2 * x, 2 * y, c) + at(2 * x + 1, 2 * y, c) + at(2 * x, 2 * y + 1, c) + at(2 * x + 1, 2 * y + 1, c));
+                    }
+                    out.rgba[((size_t) y * width + x) * 4 + c] = value;
+                }
+        return out;
+    }
+    
+    /// Whether every level below 'base' is the CPU filter's within rounding.
+    /// Box levels are made from the exact level above, as the shaders carry
+    /// them in float; Kaiser levels from the stored level above, as each is
+    /// its own pass
+    bool matchesReference(const Fixture& fixture, MipGenerator::Filter filter, const char* name, int base = 0)
+    {
+        bool decode = fixture.srgb || (filter == MipGenerator::Srgb && !fixture.halves);
+        auto linear = [&](Level level) {
+            if (decode)
+                for (size_t i = 0; i < level.rgba.size(); ++i)
+                    if (i % 4 != 3) level.rgba[i] = decodeSrgb(level.rgba[i]);
+            return level;
+        };
+        Level exact = linear(fixture.read(base));
+        double worst = 0.0;
+        int levels = 0;
+        for (int l = base + 1; ; ++l) {
+            Level got = fixture.read(l);
+            if (got.width == 0) break;
+            ++levels;
+            Level expected = filter == MipGenerator::Kaiser ? downsample(linear(fixture.read(l - 1)), got.width, got.height, true)
+                                                            : downsample(exact, got.width, got.height, false);
+            exact = expected;
+            for (size_t i = 0; i < got.rgba.size(); ++i) {
+                int c = i % 4;
+                float value = expected.rgba[i];
+                if (!fixture.halves) {
+                    value = std::min(std::max(value, 0.0f), 1.0f);
+                    if (decode && c != 3) value = encodeSrgb(value);
+                }
+                // channels the format doesn't store read back as 0, alpha as 1
+                if (fixture.format == GL_R8 && c > 0) value = c == 3 ? 1.0f : 0.0f;
+                if (fixture.format == GL_RG8 && c > 1) value = c == 3 ? 1.0f : 0.0f;
+                if (fixture.format == GL_R11F_G11F_B10F && c == 3) value = 1.0f;
+                double error = fixture.halves ? std::fabs(got.rgba[i] - value) / std::max(1.0f, std::fabs(value))
+                                              : std::fabs(got.rgba[i] - value) * 255.0;
+                worst = std::max(worst, error);
+            }
+        }
+        // half floats keep 10 bits of mantissa, the packed format's blue 5
+        double tolerance = fixture.format == GL_R11F_G11F_B10F ? 1.0 / 32 : fixture.halves ? 0.02 : fixture.srgb ? 2.0 : 1.6;
+        bool close = levels > 0 && worst <= tolerance;
+        if (!close) std::printf("    %s: %d levels, worst error %.3f\n", name, levels, worst);
+        return close;
+    }
+    
+    /// Without compute shaders, box filtering of linear formats is the
+    /// driver's, which rounds and treats odd sizes its own way
+    bool filteredByDriver(const Fixture& fixture, MipGenerator::Filter filter)
+    {
+        return !generator().usesCompute() && filter == MipGenerator::Box && !fixture.srgb;
+    }
+    
+    struct Case
+    {
+        GLenum format;
+        int width, height;
+        bool immutable;
+        const char* name;
+    };
+    
+    /// Make the cases' textures, generate them in one call and check each
+    bool generatesLikeReference(const std::vector<Case>& cases, MipGenerator::Filter filter)
+    {
+        std::vector<std::unique_ptr<Fixture>> fixtures;
+        std::vector<GLuint> textures;
+        for (const Case& c : cases) {
+            fixtures.emplace_back(new Fixture(c.format, c.width, c.height, c.immutable, c.width * 31 + c.height));
+            textures.push_back(fixtures.back()->texture);
+        }
+        generator().generate(textures.data(), textures.size(), filter);
+        bool all = true;
+        for (size_t i = 0; i < cases.size(); ++i)
+            if (!filteredByDriver(*fixtures[i], filter))
+                all = CHECK(matchesReference(*fixtures[i], filter, cases[i].name)) && all;
+        return all;
+    }
+}
+
+TEST(box_levels_average_the_level_above)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    generatesLikeReference({
+        { GL_RGBA8, 256, 256, false, "rgba8 256x256" },
+        { GL_RGBA8, 300, 171, false, "rgba8 300x171" },
+        { GL_RGBA8, 1023, 3, true, "rgba8 1023x3 immutable" },
+        { GL_RGBA8, 8200, 5, false, "rgba8 8200x5" },
+        { GL_R8, 97, 61, false, "r8 97x61" },
+        { GL_RG8, 64, 200, true, "rg8 64x200 immutable" },
+        { GL_SRGB8_ALPHA8, 129, 77, true, "srgb8 alpha8 129x77 immutable" },
+        { GL_RGBA16F, 200, 120, false, "rgba16f 200x120" },
+        { GL_R11F_G11F_B10F, 70, 70, true, "r11f g11f b10f 70x70 immutable" },
+    }, MipGenerator::Box);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(srgb_filter_averages_in_linear_light)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    generatesLikeReference({
+        { GL_RGBA8, 150, 90, false, "rgba8 150x90" },
+        { GL_RGBA8, 1, 77, true, "rgba8 1x77 immutable" },
+        { GL_SRGB8_ALPHA8, 64, 64, false, "srgb8 alpha8 64x64" },
+    }, MipGenerator::Srgb);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(kaiser_levels_match_a_cpu_reference)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    generatesLikeReference({
+        { GL_RGBA8, 181, 67, false, "rgba8 181x67" },
+        { GL_SRGB8_ALPHA8, 100, 100, true, "srgb8 alpha8 100x100 immutable" },
+        { GL_RGBA16F, 90, 33, false, "rgba16f 90x33" },
+    }, MipGenerator::Kaiser);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(many_textures_in_one_call)
+{
+    // more than one batch's worth, of mixed sizes and storage
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    std::vector<Case> cases;
+    for (int i = 0; i < 40; ++i) cases.push_back({ GL_RGBA8, 33 + i, 20 + 2 * i, i % 2 == 1, "batch of 40" });
+    generatesLikeReference(cases, MipGenerator::Srgb);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(levels_start_from_the_base_level)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Fixture fixture(GL_RGBA8, 64, 64, false, 5);
+    generator().generate(fixture.texture, MipGenerator::Srgb);
+    Level top = fixture.read(0);
+    
+    // a flat level 1 as the base makes a flat chain below it; level 0 is
+    // left alone
+    std::vector<uint8_t> flat(32 * 32 * 4, 200);
+    glBindTexture(GL_TEXTURE_2D, fixture.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 1, 0, 0, 32, 32, GL_RGBA, GL_UNSIGNED_BYTE, flat.data());
+    generator().generate(fixture.texture, MipGenerator::Srgb);
+    CHECK(matchesReference(fixture, MipGenerator::Srgb, "base level 1", 1));
+    Level last = fixture.read(6);
+    CHECK(last.width == 1 && last.height == 1 && std::lround(last.rgba[0] * 255) == 200);
+    CHECK(fixture.read(0).rgba == top.rgba);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(bound_samplers_and_textures_are_left_alone)
+{
+    // a mipmapped sampler on the units the generator reads from, as a frame
+    // drawn through a SamplerCache leaves them, would make the levels being
+    // made incomplete; they go without for the call and get it back after
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    SamplerCache samplers;
+    GLuint mipmapped = samplers.get(SamplerState());
+    const GLuint units = 16;
+    for (GLuint unit = 0; unit < units; ++unit) samplers.bind(unit, mipmapped);
+    GLuint other;
+    glGenTextures(1, &other);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, other);
+    glActiveTexture(GL_TEXTURE5);
+    
+    for (MipGenerator::Filter filter : { MipGenerator::Srgb, MipGenerator::Kaiser }) {
+        Fixture first(GL_RGBA8, 50, 50, false, 1), second(GL_SRGB8_ALPHA8, 70, 30, true, 2);
+        GLuint textures[2] = { first.texture, second.texture };
+        glActiveTexture(GL_TEXTURE5);
+        GLint before;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &before);
+        generator().generate(textures, 2, filter);
+        
+        GLint unit, bound;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+        CHECK(unit == GL_TEXTURE5 && bound == before);
+        CHECK(matchesReference(first, filter, "rgba8 under a mipmapped sampler"));
+        CHECK(matchesReference(second, filter, "srgb8 alpha8 under a mipmapped sampler"));
+    }
+    
+    GLint bound, sampler;
+    glActiveTexture(GL_TEXTURE3);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    CHECK((GLuint) bound == other);
+    for (GLuint i = 0; i < units; ++i) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glGetIntegerv(GL_SAMPLER_BINDING, &sampler);
+        CHECK((GLuint) sampler == mipmapped);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    for (GLuint i = 0; i < units; ++i) samplers.bind(i, 0);
+    glDeleteTextures(1, &other);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
@@ -0,0 +1,192 @@
+//
+//  stb_image_arena_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  The per-thread scratch arena, watched through a counting STBI_MALLOC.
+//  Kept apart from stb_image_test so the counting hooks stay out of there.
+//
+
+#include "test.h"
+
+#include <map>
+
+namespace heap
+{
+    /// Blocks stb_image holds right now, and how many it has asked for
+    std::map<void*, size_t> live;
+    long mallocs = 0;
+    
+    void* allocate(size_t size)
+    {
+        void* p = malloc(size);
+        if (p) live[p] = size;
+        ++mallocs;
+        return p;
+    }
+    
+    void* reallocate(void* p, size_t size)
+    {
+        if (p) live.erase(p);
+        void* q = realloc(p, size);
+        if (q) live[q] = size;
+        ++mallocs;
+        return q;
+    }
+    
+    void release(void* p)
+    {
+        if (p) live.erase(p);
+        free(p);
+    }
+    
+    size_t liveBytes()
+    {
+        size_t total = 0;
+        for (const auto& block : live) total += block.second;
+        return total;
+    }
+}
+
+#define STBI_MALLOC(size)     heap::allocate(size)
+#define STBI_REALLOC(p, size) heap::reallocate(p, size)
+#define STBI_FREE(p)          heap::release(p)
+#define STBI_ARENA_KEEP       (1 << 20)
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    std::vector<uint8_t> decode(const std::vector<uint8_t>& bytes)
+    {
+        int x, y, n;
+        stbi_uc* data = stbi_load_from_memory(bytes.data(), (int) bytes.size(), &x, &y, &n, 4);
+        std::vector<uint8_t> pixels;
+        if (data) pixels.assign(data, data + (size_t) x * y * 4);
+        stbi_image_free(data);
+        return pixels;
+    }
+    
+    const std::vector<uint8_t>& jpeg()
+    {
+        static std::vector<uint8_t> bytes = corpus::jpeg(synthesize(160, 120, 3), 3, JpegEncoder::s420, false, 0);
+        return bytes;
+    }
+    
+    const std::vector<uint8_t>& png()
+    {
+        static std::vector<uint8_t> bytes = corpus::png(synthesize(160, 120, 3), 4, 8, PngEncoder::adaptive);
+        return bytes;
+    }
+}
+
+TEST(arena_reuses_scratch_between_decodes)
+{
+    for (const std::vector<uint8_t>* bytes : { &jpeg(), &png() }) {
+        stbi_thread_arena_free();
+        long before = heap::mallocs;
+        std::vector<uint8_t> first = decode(*bytes);
+        long firstMallocs = heap::mallocs - before;
+        before = heap::mallocs;
+        std::vector<uint8_t> second = decode(*bytes);
+        long secondMallocs = heap::mallocs - before;
+        CHECK(!first.empty() && first == second);
+        
+        // the second decode only allocates what it returns
+        CHECK(secondMallocs < firstMallocs);
+        CHECK(secondMallocs <= 2);
+    }
+}
+
+TEST(arena_keeps_one_block_and_frees_it_on_request)
+{
+    stbi_thread_arena_free();
+    CHECK(heap::live.empty());
+    decode(jpeg());
+    decode(png());
+    CHECK(heap::live.size() == 1);
+    CHECK(heap::liveBytes() <= STBI_ARENA_KEEP + 64);
+    
+    // a decode needing more scratch than the cap gives it all back
+    std::vector<uint8_t> large = corpus::png(synthesize(1024, 768, 5), 4, 8, PngEncoder::adaptive);
+    CHECK(!decode(large).empty());
+    CHECK(heap::live.size() == 1);
+    CHECK(heap::liveBytes() <= STBI_ARENA_KEEP + 64);
+    
+    stbi_thread_arena_free();
+    CHECK(heap::live.empty());
+}
+
+TEST(arena_handles_decodes_inside_decodes)
+{
+    // decoding from a row callback nests one decode inside another on the
+    // same thread; both must come out right and nothing may leak
+    struct Nested
+    {
+        std::vector<uint8_t> inner;
+        static int rows(void* user, const stbi_uc*, int y, int, int)
+        {
+            Nested& nested = *(Nested*) user;
+            if (y == 0) nested.inner = decode(png());
+            stbi_thread_arena_free(); // ignored while a decode is running
+            return 1;
+        }
+    };
+    std::vector<uint8_t> expected = decode(png());
+    Nested nested;
+    int x, y, n;
+    CHECK(stbi_load_rows_from_memory(jpeg().data(), (int) jpeg().size(), &x, &y, &n, 4, Nested::rows, &nested));
+    CHECK(nested.inner == expected);
+    stbi_thread_arena_free();
+    CHECK(heap::live.empty());
+}
+
+TEST(allocator_replaces_the_arena)
+{
+    struct Counting
+    {
+        int allocations = 0;
+        int live = 0;
+    } counting;
+    stbi_allocator allocator;
+    allocator.alloc = [](void* user, size_t size) -> void* {
+        ++((Counting*) user)->allocations;
+        ++((Counting*) user)->live;
+        return malloc(size);
+    };
+    allocator.resize = [](void* user, void* p, size_t, size_t size) -> void* {
+        ++((Counting*) user)->allocations;
+        if (!p) ++((Counting*) user)->live;
+        return realloc(p, size);
+    };
+    allocator.release = [](void* user, void* p) {
+        if (p) --((Counting*) user)->live;
+        free(p);
+    };
+    allocator.user = &counting;
+    stbi_thread_arena_free();
+    
+    stbi_load_options options;
+    stbi_load_options_default(&options);
+    options.allocator = &allocator;
+    for (const std::vector<uint8_t>* bytes : { &jpeg(), &png() }) {
+        int x, y, n;
+        stbi_uc* data = stbi_load_from_memory_ex(bytes->data(), (int) bytes->size(), &x, &y, &n, 4, &options);
+        CHECK(data && !memcmp(data, decode(*bytes).data(), (size_t) x * y * 4));
+        stbi_image_free(data);
+    }
+    stbi_thread_arena_free();
+    
+    // the allocator saw the scratch and got all of it back; stb_image's own
+    // heap only ever held the returned images
+    CHECK(counting.allocations > 0);
+    CHECK(counting.live == 0);
+    CHECK(heap::live.empty());
+}
+
+TEST_MAIN()
@@ -0,0 +1,542 @@
+//
+//  stb_image_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  The entry points added to stb_image, checked against the plain
+//  stbi_load_from_memory decode of the same file.
+//
+
+#include "test.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+    struct Sample
+    {
+        std::string name;
+        std::vector<uint8_t> bytes;
+    };
+    
+    /// A few files of every format the decoders stream or decode in place
+    const std::vector<Sample>& samples()
+    {
+        static std::vector<Sample> list;
+        if (list.empty()) {
+            Image rgba = synthesize(83, 61, 7);
+            typedef JpegEncoder J;
+            typedef PngEncoder P;
+            list.push_back({ "jpeg-444", corpus::jpeg(rgba, 3, J::s444, false, 0) });
+            list.push_back({ "jpeg-422", corpus::jpeg(rgba, 3, J::s422, false, 0) });
+            list.push_back({ "jpeg-420", corpus::jpeg(rgba, 3, J::s420, false, 0) });
+            list.push_back({ "jpeg-gray", corpus::jpeg(rgba, 1, J::s444, false, 0) });
+            list.push_back({ "jpeg-420-restart", corpus::jpeg(rgba, 3, J::s420, false, 2) });
+            list.push_back({ "jpeg-progressive", corpus::jpeg(rgba, 3, J::s420, true, 0) });
+            list.push_back({ "png-rgb8", corpus::png(rgba, 3, 8, P::adaptive) });
+            list.push_back({ "png-rgba8", corpus::png(rgba, 4, 8, P::paeth) });
+            list.push_back({ "png-gray4", corpus::png(rgba, 1, 4, P::adaptive) });
+            list.push_back({ "png-rgb16", corpus::png(rgba, 3, 16, P::adaptive) });
+            list.push_back({ "png-palette", corpus::png(rgba, 3, 8, P::adaptive, false, true) });
+            list.push_back({ "png-interlaced", corpus::png(rgba, 4, 8, P::adaptive, true) });
+            list.push_back({ "tga-rle", corpus::tga(rgba, 4, true) });
+            BmpEncoder bmp;
+            list.push_back({ "bmp", bmp.encode(convert(rgba, 3, 8)) });
+        }
+        return list;
+    }
+    
+    /// Reference decode with the given flip setting
+    struct Reference
+    {
+        int x = 0, y = 0, channels = 0;
+        std::vector<uint8_t> pixels;
+        
+        Reference(const Sample& sample, int requested, bool flip)
+        {
+            stbi_set_flip_vertically_on_load_thread(flip);
+            stbi_uc* data = stbi_load_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &channels, requested);
+            stbi_set_flip_vertically_on_load_thread(0);
+            if (!data) return;
+            pixels.assign(data, data + (size_t) x * y * (requested ? requested : channels));
+            stbi_image_free(data);
+        }
+    };
+}
+
+TEST(load_into_matches_load)
+{
+    for (const Sample& sample : samples())
+        for (int flip = 0; flip < 2; ++flip)
+            for (int requested = 0; requested <= 4; ++requested)
+                for (int padding = 0; padding < 3; ++padding) {
+                    Reference reference(sample, requested, flip);
+                    if (!CHECK(!reference.pixels.empty())) continue;
+                    int channels = requested ? requested : reference.channels;
+                    int stride = padding ? reference.x * channels + padding * 5 : 0;
+                    size_t rowBytes = stride ? stride : (size_t) reference.x * channels;
+                    size_t length = (reference.y - 1) * rowBytes + (size_t) reference.x * channels;
+                    
+                    // guard bytes after the image must survive, and a buffer
+                    // one byte short must fail without writing past the end
+                    std::vector<uint8_t> out(length + 64, 0xcd);
+                    stbi_set_flip_vertically_on_load_thread(flip);
+                    int x, y, n;
+                    bool loaded = stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), out.data(), length, stride, &x, &y, &n, requested);
+                    bool shortLoaded = stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), out.data(), length - 1, stride, &x, &y, &n, requested);
+                    stbi_set_flip_vertically_on_load_thread(0);
+                    if (!CHECK(loaded)) {
+                        std::printf("    %s: %s\n", sample.name.c_str(), stbi_failure_reason());
+                        continue;
+                    }
+                    CHECK(x == reference.x && y == reference.y && n == reference.channels);
+                    bool same = true;
+                    for (int j = 0; j < y; ++j)
+                        same = same && !memcmp(&out[j * rowBytes], &reference.pixels[(size_t) j * x * channels], (size_t) x * channels);
+                    if (!CHECK(same)) std::printf("    %s flip %d req %d stride %d\n", sample.name.c_str(), flip, requested, stride);
+                    CHECK(std::count(out.end() - 64, out.end(), 0xcd) == 64);
+                    CHECK(!shortLoaded);
+                }
+}
+
+TEST(load_into_rejects_bad_buffers)
+{
+    const Sample& sample = samples()[0];
+    uint8_t out[16];
+    int x, y, n;
+    CHECK(!stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), nullptr, 1 << 20, 0, &x, &y, &n, 4));
+    CHECK(!stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), out, sizeof(out), -4, &x, &y, &n, 4));
+    CHECK(!stbi_load_into_from_memory(sample.bytes.data(), (int) sample.bytes.size(), out, sizeof(out), 0, &x, &y, &n, 4));
+}
+
+namespace
+{
+    /// Copies streamed rows into a whole image and counts the callbacks
+    struct RowSink
+    {
+        int width = 0, height = 0, channels = 0;
+        int calls = 0, stopAfter = 0;
+        bool outOfRange = false;
+        std::vector<uint8_t> pixels;
+        
+        static int rows(void* user, const stbi_uc* rows, int y, int count, int stride)
+        {
+            RowSink& sink = *(RowSink*) user;
+            ++sink.calls;
+            if (y < 0 || count <= 0 || y + count > sink.height) {
+                sink.outOfRange = true;
+                return 0;
+            }
+            size_t rowBytes = (size_t) sink.width * sink.channels;
+            for (int i = 0; i < count; ++i)
+                memcpy(&sink.pixels[(y + i) * rowBytes], rows + (size_t) i * stride, rowBytes);
+            return sink.calls != sink.stopAfter;
+        }
+    };
+}
+
+TEST(load_rows_matches_load)
+{
+    for (const Sample& sample : samples())
+        for (int flip = 0; flip < 2; ++flip)
+            for (int requested = 0; requested <= 4; ++requested) {
+                Reference reference(sample, requested, flip);
+                if (!CHECK(!reference.pixels.empty())) continue;
+                RowSink sink;
+                sink.width = reference.x;
+                sink.height = reference.y;
+                sink.channels = requested ? requested : reference.channels;
+                sink.pixels.assign(reference.pixels.size(), 0);
+                int x = -1, y = -1, n = -1;
+                stbi_set_flip_vertically_on_load_thread(flip);
+                bool loaded = stbi_load_rows_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, requested, RowSink::rows, &sink);
+                stbi_set_flip_vertically_on_load_thread(0);
+                if (!CHECK(loaded)) {
+                    std::printf("    %s: %s\n", sample.name.c_str(), stbi_failure_reason());
+                    continue;
+                }
+                CHECK(!sink.outOfRange);
+                CHECK(x == reference.x && y == reference.y && n == reference.channels);
+                if (!CHECK(sink.pixels == reference.pixels)) std::printf("    %s flip %d req %d\n", sample.name.c_str(), flip, requested);
+            }
+}
+
+TEST(load_rows_stops_when_the_callback_does)
+{
+    for (const Sample& sample : samples()) {
+        RowSink sink;
+        int x, y, n;
+        stbi_info_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &sink.width, &sink.height, &n);
+        sink.channels = 3;
+        sink.pixels.assign((size_t) sink.width * sink.height * 3, 0);
+        sink.stopAfter = 1;
+        CHECK(!stbi_load_rows_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, 3, RowSink::rows, &sink));
+        CHECK(sink.calls == 1);
+    }
+    int x, y, n;
+    const Sample& sample = samples()[0];
+    CHECK(!stbi_load_rows_from_memory(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &n, 3, nullptr, nullptr));
+}
+
+TEST(load_region_matches_a_crop_of_load)
+{
+    // inside, along each edge, one pixel, and hanging off every side
+    const int rects[][4] = {
+        { 10, 9, 40, 30 }, { 0, 0, 83, 61 }, { 0, 20, 17, 41 }, { 60, 0, 23, 13 },
+        { 82, 60, 1, 1 }, { 33, 17, 1, 1 }, { -5, -7, 30, 20 }, { 70, 50, 50, 50 },
+        { -10, -10, 200, 200 },
+    };
+    for (const Sample& sample : samples())
+        for (int flip = 0; flip < 2; ++flip)
+            for (int requested : { 0, 3, 4 }) {
+                Reference reference(sample, requested, flip);
+                if (!CHECK(!reference.pixels.empty())) continue;
+                int channels = requested ? requested : reference.channels;
+                for (const auto& rect : rects) {
+                    int left = std::max(rect[0], 0), top = std::max(rect[1], 0);
+                    int width = std::min(rect[0] + rect[2], reference.x) - left;
+                    int height = std::min(rect[1] + rect[3], reference.y) - top;
+                    stbi_set_flip_vertically_on_load_thread(flip);
+                    int x = -1, y = -1, n = -1;
+                    stbi_uc* region = stbi_load_region_from_memory(sample.bytes.data(), (int) sample.bytes.size(), rect[0], rect[1], rect[2], rect[3], &x, &y, &n, requested);
+                    stbi_set_flip_vertically_on_load_thread(0);
+                    if (!CHECK(region)) {
+                        std::printf("    %s: %s\n", sample.name.c_str(), stbi_failure_reason());
+                        continue;
+                    }
+                    CHECK(x == width && y == height && n == reference.channels);
+                    bool same = x == width && y == height;
+                    for (int j = 0; same && j < height; ++j)
+                        same = !memcmp(region + (size_t) j * width * channels, &reference.pixels[((size_t) (top + j) * reference.x + left) * channels], (size_t) width * channels);
+                    if (!CHECK(same)) std::printf("    %s flip %d req %d at %d,%d %dx%d\n", sample.name.c_str(), flip, requested, rect[0], rect[1], rect[2], rect[3]);
+                    stbi_image_free(region);
+                }
+            }
+}
+
+TEST(load_region_rejects_empty_rectangles)
+{
+    int x, y, n;
+    for (const Sample& sample : samples()) {
+        const int rects[][4] = { { 0, 0, 0, 10 }, { 0, 0, 10, 0 }, { 5, 5, -3, 4 }, { 83, 0, 10, 10 }, { 0, 61, 10, 10 }, { -20, -20, 20, 20 } };
+        for (const auto& rect : rects) {
+            stbi_uc* region = stbi_load_region_from_memory(sample.bytes.data(), (int) sample.bytes.size(), rect[0], rect[1], rect[2], rect[3], &x, &y, &n, 4);
+            if (!CHECK(!region)) std::printf("    %s at %d,%d %dx%d\n", sample.name.c_str(), rect[0], rect[1], rect[2], rect[3]);
+            stbi_image_free(region);
+        }
+    }
+}
+
+namespace
+{
+    /// Scratch allocator that counts what goes through it
+    struct CountingAllocator
+    {
+        stbi_allocator allocator;
+        std::atomic<int> allocations{ 0 };
+        std::atomic<int> live{ 0 };
+        
+        CountingAllocator()
+        {
+            allocator.alloc = [](void* user, size_t size) -> void* {
+                CountingAllocator& self = *(CountingAllocator*) user;
+                ++self.allocations;
+                ++self.live;
+                return malloc(size);
+            };
+            allocator.resize = [](void* user, void* p, size_t, size_t size) -> void* {
+                CountingAllocator& self = *(CountingAllocator*) user;
+                ++self.allocations;
+                if (!p) ++self.live;
+                return realloc(p, size);
+            };
+            allocator.release = [](void* user, void* p) {
+                CountingAllocator& self = *(CountingAllocator*) user;
+                if (p) --self.live;
+                free(p);
+            };
+            allocator.user = this;
+        }
+    };
+    
+    struct MemoryStream
+    {
+        const std::vector<uint8_t>& bytes;
+        size_t position;
+        
+        static stbi_io_callbacks callbacks()
+        {
+            stbi_io_callbacks callbacks;
+            callbacks.read = [](void* user, char* data, int size) {
+                MemoryStream& stream = *(MemoryStream*) user;
+                int count = (int) std::min((size_t) size, stream.bytes.size() - stream.position);
+                memcpy(data, stream.bytes.data() + stream.position, count);
+                stream.position += count;
+                return count;
+            };
+            callbacks.skip = [](void* user, int n) { ((MemoryStream*) user)->position += n; };
+            callbacks.eof = [](void* user) { MemoryStream& stream = *(MemoryStream*) user; return (int) (stream.position >= stream.bytes.size()); };
+            return callbacks;
+        }
+    };
+    
+    std::vector<uint8_t> hdrSample()
+    {
+        HdrEncoder encoder;
+        return encoder.encode(convertHdr(synthesize(37, 29, 11)));
+    }
+    
+    std::vector<uint8_t> decodeEx(const std::vector<uint8_t>& bytes, const stbi_load_options& options, int requested = 4)
+    {
+        int x, y, n;
+        stbi_uc* data = stbi_load_from_memory_ex(bytes.data(), (int) bytes.size(), &x, &y, &n, requested, &options);
+        std::vector<uint8_t> pixels;
+        if (data) pixels.assign(data, data + (size_t) x * y * requested);
+        stbi_image_free(data);
+        return pixels;
+    }
+}
+
+TEST(scaled_decodes_average_the_full_decode)
+{
+    // each reduced pixel should be close to the mean of the pixels it covers.
+    // a full decode smooths subsampled chroma as it upsamples, so files with
+    // it are held to the source image instead: no further from its means
+    // than the full decode's are. edge pixels cover padding, so only whole
+    // boxes count
+    Image rgba = synthesize(160, 120, 11);
+    typedef JpegEncoder J;
+    const struct { Sample sample; bool subsampled; } jpegs[] = {
+        { { "jpeg-444", corpus::jpeg(rgba, 3, J::s444, false, 0) }, false },
+        { { "jpeg-gray", corpus::jpeg(rgba, 1, J::s444, false, 0) }, false },
+        { { "jpeg-422", corpus::jpeg(rgba, 3, J::s422, false, 0) }, true },
+        { { "jpeg-420", corpus::jpeg(rgba, 3, J::s420, false, 0) }, true },
+        { { "jpeg-420-restart", corpus::jpeg(rgba, 3, J::s420, false, 2) }, true },
+        { { "jpeg-progressive", corpus::jpeg(rgba, 3, J::s420, true, 0) }, true },
+    };
+    for (const auto& jpeg : jpegs) {
+        const Sample& sample = jpeg.sample;
+        Reference full(sample, 0, false);
+        if (!CHECK(!full.pixels.empty())) continue;
+        int n = full.channels;
+        Image source = convert(rgba, n, 8);
+        for (int scale : { 2, 4, 8 }) {
+            stbi_load_options options;
+            stbi_load_options_default(&options);
+            options.jpeg_scale = scale;
+            int x, y, channels;
+            stbi_uc* data = stbi_load_from_memory_ex(sample.bytes.data(), (int) sample.bytes.size(), &x, &y, &channels, 0, &options);
+            if (!CHECK(data)) continue;
+            CHECK(x == (full.x + scale-1) / scale && y == (full.y + scale-1) / scale && channels == n);
+            std::vector<uint8_t> reduced, averaged, original;
+            for (int j = 0; j < full.y / scale; ++j)
+            for (int i = 0; i < full.x / scale; ++i)
+            for (int c = 0; c < n; ++c) {
+                int sum = 0, sourceSum = 0, half = scale*scale / 2;
+                for (int v = 0; v < scale; ++v)
+                for (int u = 0; u < scale; ++u) {
+                    size_t at = ((size_t) (j*scale + v) * full.x + i*scale + u) * n + c;
+                    sum += full.pixels[at];
+                    sourceSum += source.data[at];
+                }
+                averaged.push_back((uint8_t) ((sum + half) / (scale*scale)));
+                original.push_back((uint8_t) ((sourceSum + half) / (scale*scale)));
+                reduced.push_back(data[((size_t) j * x + i) * n + c]);
+            }
+            double mean = test::meanError(reduced.data(), averaged.data(), reduced.size());
+            int worst = test::maxError(reduced.data(), averaged.data(), reduced.size());
+            double fromSource = test::meanError(reduced.data(), original.data(), reduced.size());
+            double fullFromSource = test::meanError(averaged.data(), original.data(), reduced.size());
+            bool close = jpeg.subsampled ? fromSource < fullFromSource + 0.25 : mean < 0.5 && worst <= 8;
+            if (!CHECK(close))
+                std::printf("    %s at 1/%d: max error %d, mean %.3f, from source %.3f against %.3f\n", sample.name.c_str(), scale, worst, mean, fromSource, fullFromSource);
+            
+            // streaming and regions decode the same pixels
+            RowSink sink;
+            sink.width = x;
+            sink.height = y;
+            sink.channels = n;
+            sink.pixels.assign((size_t) x * y * n, 0);
+            int rx, ry, rn;
+            CHECK(stbi_load_rows_from_memory_ex(sample.bytes.data(), (int) sample.bytes.size(), &rx, &ry, &rn, 0, RowSink::rows, &sink, &options));
+            CHECK(!memcmp(sink.pixels.data(), data, sink.pixels.size()));
+            stbi_uc* region = stbi_load_region_from_memory_ex(sample.bytes.data(), (int) sample.bytes.size(), 1, 2, x - 1, y - 2, &rx, &ry, &rn, 0, &options);
+            bool same = region && rx == x - 1 && ry == y - 2;
+            for (int j = 0; same && j < ry; ++j)
+                same = !memcmp(region + (size_t) j * rx * n, data + ((size_t) (j + 2) * x + 1) * n, (size_t) rx * n);
+            CHECK(same);
+            stbi_image_free(region);
+            stbi_image_free(data);
+        }
+    }
+}
+
+TEST(settings_are_per_thread_and_race_free)
+{
+    // per file: the plain decode both ways up, and the HDR file tone mapped
+    // with gamma 1 and 2.2
+    const std::vector<Sample>& files = samples();
+    std::vector<uint8_t> hdr = hdrSample();
+    std::vector<std::vector<uint8_t>> expected[2];
+    for (int flip = 0; flip < 2; ++flip)
+        for (const Sample& sample : files)
+            expected[flip].push_back(Reference(sample, 4, flip).pixels);
+    stbi_load_options options;
+    stbi_load_options_default(&options);
+    std::vector<uint8_t> hdrExpected[2][2];
+    for (int flip = 0; flip < 2; ++flip)
+        for (int linear = 0; linear < 2; ++linear) {
+            options.flip_vertically = flip;
+            options.hdr_to_ldr_gamma = linear ? 1.0f : 2.2f;
+            hdrExpected[flip][linear] = decodeEx(hdr, options);
+        }
+    
+    // one thread keeps flipping every process-wide setting while the others
+    // decode with their own overrides, or with explicit options
+    std::atomic<bool> done(false);
+    std::atomic<int> mismatches(0);
+    std::thread setter([&] {
+        for (int i = 0; !done; ++i) {
+            stbi_set_flip_vertically_on_load(i & 1);
+            stbi_set_unpremultiply_on_load(i & 2);
+            stbi_convert_iphone_png_to_rgb(i & 4);
+            stbi_hdr_to_ldr_gamma(i & 1 ? 1.0f : 2.2f);
+            stbi_hdr_to_ldr_scale(i & 2 ? 0.5f : 1.0f);
+            stbi_ldr_to_hdr_gamma(i & 1 ? 1.0f : 2.2f);
+            stbi_ldr_to_hdr_scale(i & 2 ? 0.5f : 1.0f);
+            std::this_thread::yield();
+        }
+    });
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < 4; ++t)
+        decoders.emplace_back([&, t] {
+            int flip = t & 1, linear = (t >> 1) & 1;
+            stbi_set_flip_vertically_on_load_thread(flip);
+            stbi_set_unpremultiply_on_load_thread(0);
+            stbi_convert_iphone_png_to_rgb_thread(0);
+            stbi_hdr_to_ldr_gamma_thread(linear ? 1.0f : 2.2f);
+            stbi_hdr_to_ldr_scale_thread(1.0f);
+            stbi_load_options explicitOptions;
+            stbi_load_options_default(&explicitOptions);
+            explicitOptions.flip_vertically = !flip;
+            for (int pass = 0; pass < 3; ++pass) {
+                for (size_t i = 0; i < files.size(); ++i) {
+                    int x, y, n;
+                    stbi_uc* data = stbi_load_from_memory(files[i].bytes.data(), (int) files[i].bytes.size(), &x, &y, &n, 4);
+                    if (!data || memcmp(data, expected[flip][i].data(), expected[flip][i].size())) ++mismatches;
+                    stbi_image_free(data);
+                    if (decodeEx(files[i].bytes, explicitOptions) != expected[!flip][i]) ++mismatches;
+                }
+                int x, y, n;
+                stbi_uc* data = stbi_load_from_memory(hdr.data(), (int) hdr.size(), &x, &y, &n, 4);
+                std::vector<uint8_t>& want = hdrExpected[flip][linear];
+                if (!data || memcmp(data, want.data(), want.size())) ++mismatches;
+                stbi_image_free(data);
+            }
+            stbi_thread_arena_free();
+        });
+    for (std::thread& decoder : decoders) decoder.join();
+    done = true;
+    setter.join();
+    CHECK(mismatches == 0);
+    
+    // put the process-wide defaults back for the cases that follow
+    stbi_set_flip_vertically_on_load(0);
+    stbi_set_unpremultiply_on_load(0);
+    stbi_convert_iphone_png_to_rgb(0);
+    stbi_hdr_to_ldr_gamma(2.2f);
+    stbi_hdr_to_ldr_scale(1.0f);
+    stbi_ldr_to_hdr_gamma(2.2f);
+    stbi_ldr_to_hdr_scale(1.0f);
+}
+
+TEST(every_loader_takes_options)
+{
+    const Sample& jpeg = samples()[2];
+    const std::vector<uint8_t>& bytes = jpeg.bytes;
+    CountingAllocator counting;
+    stbi_load_options options;
+    stbi_load_options_default(&options);
+    options.flip_vertically = 1;
+    options.jpeg_scale = 2;
+    options.allocator = &counting.allocator;
+    int x, y, n;
+    stbi_uc* data = stbi_load_from_memory_ex(bytes.data(), (int) bytes.size(), &x, &y, &n, 3, &options);
+    if (!CHECK(data)) return;
+    std::vector<uint8_t> expected(data, data + (size_t) x * y * 3);
+    stbi_image_free(data);
+    CHECK(x == 42 && y == 31);
+    
+    // into
+    int before = counting.allocations;
+    std::vector<uint8_t> into(expected.size());
+    int ix, iy, in;
+    CHECK(stbi_load_into_from_memory_ex(bytes.data(), (int) bytes.size(), into.data(), into.size(), 0, &ix, &iy, &in, 3, &options));
+    CHECK(ix == x && iy == y && into == expected);
+    CHECK(counting.allocations > before);
+    
+    // rows
+    before = counting.allocations;
+    RowSink sink;
+    sink.width = x;
+    sink.height = y;
+    sink.channels = 3;
+    sink.pixels.assign(expected.size(), 0);
+    CHECK(stbi_load_rows_from_memory_ex(bytes.data(), (int) bytes.size(), &ix, &iy, &in, 3, RowSink::rows, &sink, &options));
+    CHECK(ix == x && iy == y && sink.pixels == expected);
+    CHECK(counting.allocations > before);
+    
+    // region, in reduced coordinates
+    before = counting.allocations;
+    stbi_uc* region = stbi_load_region_from_memory_ex(bytes.data(), (int) bytes.size(), 5, 7, 20, 11, &ix, &iy, &in, 3, &options);
+    if (CHECK(region)) {
+        bool same = ix == 20 && iy == 11;
+        for (int j = 0; same && j < iy; ++j)
+            same = !memcmp(region + (size_t) j * ix * 3, &expected[((size_t) (7 + j) * x + 5) * 3], (size_t) ix * 3);
+        CHECK(same);
+    }
+    stbi_image_free(region);
+    CHECK(counting.allocations > before);
+    
+    // callbacks and files
+    MemoryStream stream = { bytes, 0 };
+    stbi_io_callbacks callbacks = MemoryStream::callbacks();
+    std::fill(into.begin(), into.end(), 0);
+    CHECK(stbi_load_into_from_callbacks_ex(&callbacks, &stream, into.data(), into.size(), 0, &ix, &iy, &in, 3, &options) && into == expected);
+    std::string path = test::temporaryPath("options.jpg");
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+    region = stbi_load_region_ex(path.c_str(), 0, 0, x, y, &ix, &iy, &in, 3, &options);
+    CHECK(region && !memcmp(region, expected.data(), expected.size()));
+    stbi_image_free(region);
+    std::fill(into.begin(), into.end(), 0);
+    CHECK(stbi_load_into_ex(path.c_str(), into.data(), into.size(), 0, &ix, &iy, &in, 3, &options) && into == expected);
+    remove(path.c_str());
+    
+    // float and 16-bit
+    float* floats = stbi_loadf_from_memory_ex(bytes.data(), (int) bytes.size(), &ix, &iy, &in, 3, &options);
+    stream.position = 0;
+    float* streamed = stbi_loadf_from_callbacks_ex(&callbacks, &stream, &x, &y, &n, 3, &options);
+    CHECK(floats && streamed && ix == 42 && !memcmp(floats, streamed, sizeof(float) * ix * iy * 3));
+    stbi_image_free(floats);
+    stbi_image_free(streamed);
+    stbi_us* wide = stbi_load_16_from_memory_ex(bytes.data(), (int) bytes.size(), &ix, &iy, &in, 3, &options);
+    stream.position = 0;
+    stbi_us* wideStreamed = stbi_load_16_from_callbacks_ex(&callbacks, &stream, &x, &y, &n, 3, &options);
+    CHECK(wide && wideStreamed && ix == 42 && !memcmp(wide, wideStreamed, sizeof(stbi_us) * ix * iy * 3));
+    CHECK(wide && (wide[0] >> 8) == expected[0]);
+    stbi_image_free(wide);
+    stbi_image_free(wideStreamed);
+    CHECK(counting.live == 0);
+}
+
+TEST_MAIN()
@@ -0,0 +1,45 @@
+//
+//  glew.h
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Stands in for GLEW so the GLcontext headers build against the system's
+//  core profile prototypes. Extension flags are answered by asking the
+//  current context.
+//
+
+#pragma once
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+
+#include <cstring>
+
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT     0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
+
+#define GLEW_OK 0
+
+static GLboolean glewExperimental __attribute__((unused));
+
+inline GLenum glewInit() { return GLEW_OK; }
+
+/// Whether the current context lists an extension
+inline bool glewHasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+        if (!strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), name)) return true;
+    return false;
+}
+
+#define GLEW_ARB_compute_shader               glewHasExtension("GL_ARB_compute_shader")
+#define GLEW_ARB_shader_storage_buffer_object glewHasExtension("GL_ARB_shader_storage_buffer_object")
+#define GLEW_ARB_shading_language_packing     glewHasExtension("GL_ARB_shading_language_packing")
+#define GLEW_ARB_texture_storage              glewHasExtension("GL_ARB_texture_storage")
+#define GLEW_EXT_texture_filter_anisotropic   glewHasExtension("GL_EXT_texture_filter_anisotropic")
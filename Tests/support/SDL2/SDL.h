@@ -0,0 +1,90 @@
+//
+//  SDL.h
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Stands in for the few SDL2 calls the GLcontext headers make for contexts,
+//  on EGL. A window is only a handle; contexts are surfaceless OpenGL 4.1
+//  core contexts on the display of the current one, and creating one fails
+//  without a window, as it does in SDL.
+//
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+struct SDL_Window {};
+typedef void* SDL_GLContext;
+
+typedef enum
+{
+    SDL_GL_SHARE_WITH_CURRENT_CONTEXT = 22
+} SDL_GLattr;
+
+namespace sdl
+{
+    struct State
+    {
+        EGLDisplay display = EGL_NO_DISPLAY;
+        bool share = false;
+        const char* error = "";
+    };
+
+    inline State& state()
+    {
+        static State instance;
+        return instance;
+    }
+}
+
+inline const char* SDL_GetError() { return sdl::state().error; }
+
+inline int SDL_GL_SetAttribute(SDL_GLattr attribute, int value)
+{
+    if (attribute == SDL_GL_SHARE_WITH_CURRENT_CONTEXT) sdl::state().share = value != 0;
+    return 0;
+}
+
+inline SDL_GLContext SDL_GL_GetCurrentContext()
+{
+    EGLContext context = eglGetCurrentContext();
+    return context == EGL_NO_CONTEXT ? nullptr : context;
+}
+
+/// Made current on this thread, as SDL does
+inline SDL_GLContext SDL_GL_CreateContext(SDL_Window* window)
+{
+    sdl::State& state = sdl::state();
+    if (!window) {
+        state.error = "Invalid window";
+        return nullptr;
+    }
+    if (eglGetCurrentDisplay() != EGL_NO_DISPLAY) state.display = eglGetCurrentDisplay();
+    const EGLint attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(state.display, EGL_NO_CONFIG_KHR, state.share ? eglGetCurrentContext() : EGL_NO_CONTEXT, attributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(state.display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(state.display, context);
+        state.error = "Could not create EGL context";
+        return nullptr;
+    }
+    return context;
+}
+
+inline int SDL_GL_MakeCurrent(SDL_Window*, SDL_GLContext context)
+{
+    EGLDisplay display = eglGetCurrentDisplay() != EGL_NO_DISPLAY ? eglGetCurrentDisplay() : sdl::state().display;
+    return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ? (EGLContext) context : EGL_NO_CONTEXT) ? 0 : -1;
+}
+
+inline void SDL_GL_DeleteContext(SDL_GLContext context)
+{
+    if (context) eglDestroyContext(sdl::state().display, (EGLContext) context);
+}
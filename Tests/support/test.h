@@ -0,0 +1,148 @@
+//
+//  test.h
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Just enough of a test runner for the module tests: TEST registers a case,
+//  CHECK records a failure without stopping it, and TEST_MAIN runs every
+//  case whose name contains one of the command line arguments.
+//
+
+#pragma once
+
+#include <GL/glew.h>  // Has to be included first
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace test
+{
+    struct Case
+    {
+        const char* name;
+        void (*run)();
+    };
+    
+    struct State
+    {
+        std::vector<Case> cases;
+        int checks = 0;
+        int failures = 0;
+        bool skipped = false;
+    };
+    
+    inline State& state()
+    {
+        static State instance;
+        return instance;
+    }
+    
+    struct Register
+    {
+        Register(const char* name, void (*run)()) { state().cases.push_back({ name, run }); }
+    };
+    
+    inline bool check(bool passed, const char* expression, const char* file, int line)
+    {
+        ++state().checks;
+        if (!passed) {
+            ++state().failures;
+            std::printf("    %s:%d: CHECK(%s) failed\n", file, line, expression);
+        }
+        return passed;
+    }
+    
+    /// Leave the current case without failing it, e.g. when the driver lacks
+    /// something the case needs
+    inline void skip(const char* reason)
+    {
+        state().skipped = true;
+        std::printf("    skipped: %s\n", reason);
+    }
+    
+    /// Make a headless OpenGL 4.1 core context current on this thread. The
+    /// first call creates it; later calls on any thread reuse it
+    inline bool context()
+    {
+        static EGLDisplay display = EGL_NO_DISPLAY;
+        static EGLContext context = EGL_NO_CONTEXT;
+        if (context == EGL_NO_CONTEXT) {
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+            display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr) : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            EGLint major, minor;
+            if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) return false;
+            const EGLint attributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, 1,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+            if (context == EGL_NO_CONTEXT) return false;
+        }
+        return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE;
+    }
+    
+    /// Mean absolute difference between two equally sized sample arrays
+    inline double meanError(const uint8_t* a, const uint8_t* b, size_t count)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; ++i) sum += std::abs(a[i] - b[i]);
+        return count ? sum / count : 0.0;
+    }
+    
+    /// Largest absolute difference between two equally sized sample arrays
+    inline int maxError(const uint8_t* a, const uint8_t* b, size_t count)
+    {
+        int worst = 0;
+        for (size_t i = 0; i < count; ++i) worst = std::max(worst, std::abs(a[i] - b[i]));
+        return worst;
+    }
+    
+    /// Scratch file path that is unique to this process
+    inline std::string temporaryPath(const std::string& name)
+    {
+        const char* directory = std::getenv("TMPDIR");
+        return std::string(directory ? directory : "/tmp") + "/glcontext-test-" + std::to_string(getpid()) + "-" + name;
+    }
+    
+    inline int run(int argc, char** argv)
+    {
+        int failed = 0, ran = 0;
+        for (const Case& c : state().cases) {
+            bool selected = argc < 2;
+            for (int i = 1; i < argc; ++i) selected = selected || std::strstr(c.name, argv[i]);
+            if (!selected) continue;
+            int before = state().failures;
+            state().skipped = false;
+            c.run();
+            ++ran;
+            bool passed = state().failures == before;
+            failed += !passed;
+            std::printf("%s %s\n", !passed ? "FAIL" : state().skipped ? "SKIP" : "PASS", c.name);
+        }
+        std::printf("%d of %d cases failed, %d checks\n", failed, ran, state().checks);
+        return failed ? 1 : 0;
+    }
+}
+
+#define TEST(name) \
+    static void name(); \
+    static test::Register name##_register(#name, name); \
+    static void name()
+
+#define CHECK(condition) test::check((condition), #condition, __FILE__, __LINE__)
+
+#define TEST_MAIN() int main(int argc, char** argv) { return test::run(argc, argv); }
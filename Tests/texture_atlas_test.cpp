@@ -0,0 +1,264 @@
+//
+//  texture_atlas_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  TextureAtlas packing images into array layers: where the regions go, what
+//  the array holds after build() (padding included), growing by layers, and
+//  files that fail to load leaving everything as it was.
+//
+
+#include "test.h"
+
+#include "texture_atlas.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// The padded rectangle 'region' takes in its layer, as the atlas rounds
+    /// it up to the grid
+    struct Rect
+    {
+        int x, y, width, height;
+    };
+    
+    Rect padded(const TextureAtlas::Region& region, int padding)
+    {
+        auto roundUp = [&](int size) { return (size + padding - 1) / padding * padding; };
+        return { region.x - padding, region.y - padding, roundUp(region.width + 2 * padding), roundUp(region.height + 2 * padding) };
+    }
+    
+    bool overlap(const Rect& a, const Rect& b)
+    {
+        return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+    }
+    
+    /// Every layer of the bound array's 'level', one after another
+    std::vector<uint8_t> layers(int layerSize, int count, int level = 0)
+    {
+        int size = std::max(layerSize >> level, 1);
+        std::vector<uint8_t> rgba((size_t) size * size * 4 * count);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        return rgba;
+    }
+    
+    /// Whether the padded rectangle of 'region' in 'array' holds 'image',
+    /// with the edge texels repeated out to the rectangle's border
+    bool holds(const std::vector<uint8_t>& array, int layerSize, const TextureAtlas::Region& region, int padding, const Image& image)
+    {
+        Rect rect = padded(region, padding);
+        for (int y = rect.y; y < rect.y + rect.height; ++y)
+            for (int x = rect.x; x < rect.x + rect.width; ++x) {
+                int sx = std::min(std::max(x - region.x, 0), image.width - 1);
+                int sy = std::min(std::max(y - region.y, 0), image.height - 1);
+                const uint8_t* texel = &array[(((size_t) region.layer * layerSize + y) * layerSize + x) * 4];
+                if (memcmp(texel, &image.data[((size_t) sy * image.width + sx) * 4], 4)) return false;
+            }
+        return true;
+    }
+    
+    void writeFile(const std::string& path, const std::vector<uint8_t>& bytes)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    }
+}
+
+TEST(regions_sit_apart_on_the_padding_grid)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // the padding goes up to a power of two, and the grid with it
+    const int layerSize = 256, padding = 8;
+    TextureAtlas atlas(layerSize, 6, 4);
+    std::vector<int> sizes = { 40, 17, 90, 3, 64, 25, 120, 9, 33, 1, 70, 48, 11, 100, 5, 60, 29, 80, 14, 37 };
+    uint64_t used = 0;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        int width = sizes[i], height = sizes[(i * 7 + 3) % sizes.size()];
+        Image image = synthesize(width, height, 100 + (uint32_t) i);
+        CHECK(atlas.add(image.data.data(), width, height) == (int) i);
+        const TextureAtlas::Region& region = atlas.region((int) i);
+        CHECK(region.width == width && region.height == height);
+        Rect rect = padded(region, padding);
+        used += (uint64_t) rect.width * rect.height;
+    }
+    CHECK(atlas.size() == sizes.size());
+    
+    bool apart = true, onGrid = true, inside = true, uvs = true;
+    for (size_t i = 0; i < atlas.size(); ++i) {
+        const TextureAtlas::Region& region = atlas.region((int) i);
+        Rect rect = padded(region, padding);
+        onGrid = onGrid && rect.x % padding == 0 && rect.y % padding == 0;
+        inside = inside && rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= layerSize && rect.y + rect.height <= layerSize;
+        uvs = uvs && region.uv0[0] == (float) region.x / layerSize && region.uv0[1] == (float) region.y / layerSize
+                  && region.uv1[0] == (float) (region.x + region.width) / layerSize && region.uv1[1] == (float) (region.y + region.height) / layerSize;
+        for (size_t j = 0; j < i; ++j)
+            apart = apart && (atlas.region((int) j).layer != region.layer || !overlap(padded(atlas.region((int) j), padding), rect));
+    }
+    CHECK(apart && onGrid && inside && uvs);
+    
+    TextureAtlas::Stats stats = atlas.stats();
+    CHECK(stats.images == sizes.size() && stats.pending == sizes.size() && stats.layers >= 2);
+    CHECK(stats.usedTexels == used && stats.layerTexels == (uint64_t) layerSize * layerSize * stats.layers);
+    
+    // too big for a layer once padded, or empty: refused, nothing taken
+    std::vector<uint8_t> big((size_t) 241 * 4 * 4);
+    CHECK(atlas.add(big.data(), 241, 4) == -1 && atlas.add(big.data(), 0, 4) == -1);
+    CHECK(atlas.stats().usedTexels == used && atlas.size() == sizes.size());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(images_and_their_edges_are_uploaded)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    const int layerSize = 128, padding = 4;
+    TextureAtlas atlas(layerSize, padding, 4);
+    std::vector<Image> images;
+    for (int i = 0; i < 9; ++i) {
+        images.push_back(synthesize(13 + 9 * i, 40 - 3 * i, 200 + i));
+        atlas.add(images.back().data.data(), images.back().width, images.back().height);
+    }
+    atlas.build();
+    size_t count = atlas.stats().layers;
+    CHECK(atlas.stats().pending == 0);
+    
+    // level 0 has every image, and copies of its edges out into its padding
+    GLint bound;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound);
+    CHECK((GLuint) bound == atlas.name());
+    std::vector<uint8_t> array = layers(layerSize, (int) count);
+    bool all = true;
+    for (size_t i = 0; i < images.size(); ++i) all = all && holds(array, layerSize, atlas.region((int) i), padding, images[i]);
+    CHECK(all);
+    
+    // mips down to where a texel is the padding across, and no further
+    GLint maxLevel, minFilter, wrap;
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, &minFilter);
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, &wrap);
+    CHECK(maxLevel == 2 && minFilter == GL_LINEAR_MIPMAP_LINEAR && wrap == GL_CLAMP_TO_EDGE);
+    CHECK(atlas.stats().bytes == (uint64_t) 4 * count * (128 * 128 + 64 * 64 + 32 * 32));
+    
+    // at the last level a texel covers no more than the padding: in each
+    // corner, sixteen copies of the image's corner texel and nothing else
+    std::vector<uint8_t> coarse = layers(layerSize, (int) count, 2);
+    bool unmixed = true;
+    for (size_t i = 0; i < images.size(); ++i) {
+        const TextureAtlas::Region& region = atlas.region((int) i);
+        Rect rect = padded(region, padding);
+        unmixed = unmixed && !memcmp(&coarse[(((size_t) region.layer * 32 + rect.y / 4) * 32 + rect.x / 4) * 4], &images[i].data[0], 4);
+    }
+    CHECK(unmixed);
+    
+    // without padding there is a single level
+    TextureAtlas flat(64, 0, 1);
+    flat.add(images[0].data.data(), images[0].width, images[0].height);
+    flat.build();
+    glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    CHECK(maxLevel == 0 && flat.region(0).x == 0 && flat.region(0).y == 0);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(growing_keeps_the_layers_built_before)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    const int layerSize = 64, padding = 4;
+    TextureAtlas atlas(layerSize, padding, 8);
+    
+    // each of these fills a layer of its own
+    std::vector<Image> images = { synthesize(56, 56, 300), synthesize(50, 53, 301) };
+    atlas.add(images[0].data.data(), 56, 56);
+    atlas.build();
+    GLuint first = atlas.name();
+    CHECK(first != 0 && atlas.stats().layers == 1);
+    
+    // another build with nothing new keeps the name
+    atlas.build();
+    CHECK(atlas.name() == first);
+    
+    // a new layer: a new name, the old array gone, its layer still there
+    atlas.add(images[1].data.data(), 50, 53);
+    CHECK(atlas.region(1).layer == 1 && atlas.name() == first);
+    atlas.build();
+    CHECK(atlas.name() != first && !glIsTexture(first) && atlas.stats().layers == 2);
+    std::vector<uint8_t> array = layers(layerSize, 2);
+    CHECK(holds(array, layerSize, atlas.region(0), padding, images[0]));
+    CHECK(holds(array, layerSize, atlas.region(1), padding, images[1]));
+    
+    // and the copied layer has its mips again, as if built in one go
+    std::vector<uint8_t> smallest = layers(layerSize, 2, 2);
+    TextureAtlas once(layerSize, padding, 8);
+    once.add(images[0].data.data(), 56, 56);
+    once.add(images[1].data.data(), 50, 53);
+    once.build();
+    CHECK(layers(layerSize, 2, 2) == smallest && layers(layerSize, 2, 1) != std::vector<uint8_t>((size_t) 32 * 32 * 4 * 2));
+    CHECK(atlas.stats().bytes == (uint64_t) 4 * 2 * (64 * 64 + 32 * 32 + 16 * 16));
+    atlas.bind(0);
+    
+    // a bound framebuffer is left bound
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    Image third = synthesize(30, 30, 302);
+    atlas.add(third.data.data(), 30, 30);
+    atlas.build();
+    GLint readFramebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    CHECK((GLuint) readFramebuffer == framebuffer && atlas.stats().layers == 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    array = layers(layerSize, 3);
+    CHECK(holds(array, layerSize, atlas.region(0), padding, images[0]) && holds(array, layerSize, atlas.region(2), padding, third));
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(failed_loads_leave_the_atlas_as_it_was)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    const int layerSize = 64, padding = 4;
+    
+    // a whole file, and one cut off after its header, which stbi_info
+    // takes but decoding doesn't
+    Image image = synthesize(20, 20, 400);
+    std::vector<uint8_t> bytes = corpus::png(image, 4, 8, PngEncoder::adaptive);
+    std::string whole = test::temporaryPath("atlas.png"), cut = test::temporaryPath("atlas-cut.png");
+    writeFile(whole, bytes);
+    writeFile(cut, std::vector<uint8_t>(bytes.begin(), bytes.begin() + bytes.size() / 2));
+    int width, height, channels;
+    CHECK(stbi_info(cut.c_str(), &width, &height, &channels));
+    
+    // layer 0 full, so a placement would have opened another
+    TextureAtlas atlas(layerSize, padding, 2);
+    Image full = synthesize(56, 56, 401);
+    atlas.add(full.data.data(), 56, 56);
+    TextureAtlas::Stats before = atlas.stats();
+    CHECK(atlas.add(cut) == -1);
+    CHECK(atlas.add(test::temporaryPath("missing.png")) == -1);
+    TextureAtlas::Stats after = atlas.stats();
+    CHECK(after.images == before.images && after.layers == before.layers && after.pending == before.pending);
+    CHECK(after.usedTexels == before.usedTexels && after.layerTexels == before.layerTexels);
+    
+    // the next image goes where it would have gone anyway
+    TextureAtlas untouched(layerSize, padding, 2);
+    untouched.add(full.data.data(), 56, 56);
+    CHECK(atlas.add(whole) == 1 && untouched.add(image.data.data(), 20, 20) == 1);
+    const TextureAtlas::Region& got = atlas.region(1);
+    const TextureAtlas::Region& expected = untouched.region(1);
+    CHECK(got.layer == 1 && got.layer == expected.layer && got.x == expected.x && got.y == expected.y);
+    
+    // decoded from the file like the pixels it was made from
+    atlas.build();
+    CHECK(atlas.stats().layers == 2 && holds(layers(layerSize, 2), layerSize, got, padding, image));
+    unlink(whole.c_str());
+    unlink(cut.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
@@ -0,0 +1,258 @@
+//
+//  texture_cache_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  TextureCache stores a texture's levels and loads them back into another
+//  texture; both are read back from the GL and compared.
+//
+
+#include "test.h"
+
+#include "texture_cache.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// A fresh cache directory and a source file to key it by, both removed
+    /// again at the end of the case
+    struct Scratch
+    {
+        std::string directory = test::temporaryPath("cache/textures");
+        std::string source = test::temporaryPath("source.png");
+        
+        Scratch()
+        {
+            writeSource(corpus::png(synthesize(70, 45, 21), 3, 8, PngEncoder::adaptive));
+        }
+        
+        ~Scratch()
+        {
+            for (const std::string& name : entries()) unlink((directory + "/" + name).c_str());
+            rmdir(directory.c_str());
+            rmdir(test::temporaryPath("cache").c_str());
+            unlink(source.c_str());
+        }
+        
+        void writeSource(const std::vector<uint8_t>& bytes)
+        {
+            FILE* file = fopen(source.c_str(), "wb");
+            fwrite(bytes.data(), 1, bytes.size(), file);
+            fclose(file);
+        }
+        
+        std::vector<std::string> entries() const
+        {
+            std::vector<std::string> names;
+            if (DIR* dir = opendir(directory.c_str())) {
+                while (struct dirent* item = readdir(dir))
+                    if (item->d_name[0] != '.') names.push_back(item->d_name);
+                closedir(dir);
+            }
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+    };
+    
+    /// Every defined level of 'texture', tightly packed, one after another
+    std::vector<uint8_t> levels(GLuint texture, GLenum format, GLenum type, int pixelBytes)
+    {
+        std::vector<uint8_t> all;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int i = 0; ; ++i) {
+            GLint width = 0, height = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &height);
+            if (!width) break;
+            std::vector<uint8_t> level((size_t) width * height * pixelBytes);
+            glGetTexImage(GL_TEXTURE_2D, i, format, type, level.data());
+            all.insert(all.end(), level.begin(), level.end());
+            all.push_back(0xee); // keeps levels from running into each other
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        return all;
+    }
+    
+    /// The source decoded into the bound texture with a full mip chain
+    void makeMipmapped(const std::string& source)
+    {
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(source.c_str(), &width, &height, &channels, 3);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        stbi_image_free(pixels);
+    }
+}
+
+TEST(stored_levels_load_back_unchanged)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    TextureCache cache(scratch.directory);
+    GLuint textures[4];
+    glGenTextures(4, textures);
+    
+    TextureCache::Key key = cache.key(scratch.source.c_str(), "rgb8 mipmapped");
+    CHECK(!key.name.empty());
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    CHECK(!cache.load(key));
+    makeMipmapped(scratch.source);
+    CHECK(cache.store(key));
+    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    CHECK(cache.load(key));
+    std::vector<uint8_t> expected = levels(textures[0], GL_RGB, GL_UNSIGNED_BYTE, 3);
+    CHECK(!expected.empty() && levels(textures[1], GL_RGB, GL_UNSIGNED_BYTE, 3) == expected);
+    
+    // packed floats go through without conversion
+    std::vector<float> colours(37 * 23 * 3);
+    for (size_t i = 0; i < colours.size(); ++i) colours[i] = (i % 97) * 0.37f;
+    glBindTexture(GL_TEXTURE_2D, textures[2]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, 37, 23, 0, GL_RGB, GL_FLOAT, colours.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    TextureCache::Key packed = cache.key(scratch.source.c_str(), "packed float mipmapped");
+    CHECK(cache.store(packed));
+    glBindTexture(GL_TEXTURE_2D, textures[3]);
+    CHECK(cache.load(packed));
+    CHECK(levels(textures[2], GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4) == levels(textures[3], GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4));
+    
+    glDeleteTextures(4, textures);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(load_can_leave_out_the_largest_levels)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    TextureCache cache(scratch.directory);
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    TextureCache::Key key = cache.key(scratch.source.c_str(), "rgb8 mipmapped");
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    makeMipmapped(scratch.source);
+    CHECK(cache.store(key));
+    
+    // a full chain in the target first, so the levels past the new chain
+    // have something to free
+    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    CHECK(cache.load(key));
+    CHECK(cache.load(key, 2));
+    GLint width, height, beyond, maxLevel;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    CHECK(width == 70 / 4 && height == 45 / 4);
+    CHECK(maxLevel == 4);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, maxLevel + 1, GL_TEXTURE_WIDTH, &beyond);
+    CHECK(beyond == 0);
+    
+    // the chain below is the original's, level for level
+    std::vector<uint8_t> all = levels(textures[0], GL_RGB, GL_UNSIGNED_BYTE, 3);
+    std::vector<uint8_t> tail = levels(textures[1], GL_RGB, GL_UNSIGNED_BYTE, 3);
+    CHECK(tail.size() < all.size() && std::equal(tail.rbegin(), tail.rend(), all.rbegin()));
+    
+    // never past the 1x1
+    CHECK(cache.load(key, 100));
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    CHECK(width == 1);
+    glDeleteTextures(2, textures);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(keys_miss_on_other_options_or_an_edited_source)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    TextureCache cache(scratch.directory);
+    TextureCache::Key key = cache.key(scratch.source.c_str(), "rgb8 mipmapped");
+    CHECK(key.name == cache.key(scratch.source.c_str(), "rgb8 mipmapped").name);
+    CHECK(key.name != cache.key(scratch.source.c_str(), "rgb8").name);
+    CHECK(cache.key(test::temporaryPath("missing.png").c_str(), "rgb8").name.empty());
+    
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    makeMipmapped(scratch.source);
+    CHECK(cache.store(key));
+    CHECK(!cache.load(cache.key(scratch.source.c_str(), "rgb8")));
+    scratch.writeSource(corpus::png(synthesize(70, 45, 22), 3, 8, PngEncoder::adaptive));
+    TextureCache::Key edited = cache.key(scratch.source.c_str(), "rgb8 mipmapped");
+    CHECK(edited.name != key.name);
+    CHECK(!cache.load(edited));
+    glDeleteTextures(1, &texture);
+}
+
+TEST(torn_entries_are_deleted)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    TextureCache cache(scratch.directory);
+    TextureCache::Key key = cache.key(scratch.source.c_str(), "rgb8 mipmapped");
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    makeMipmapped(scratch.source);
+    CHECK(cache.store(key));
+    std::string path = scratch.directory + "/" + key.name;
+    CHECK(truncate(path.c_str(), 100) == 0);
+    CHECK(!cache.load(key));
+    CHECK(access(path.c_str(), F_OK) != 0);
+    glDeleteTextures(1, &texture);
+}
+
+TEST(eviction_drops_the_least_recently_used)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    makeMipmapped(scratch.source);
+    
+    // room for three entries, but not four
+    TextureCache::Key measure = TextureCache(scratch.directory).key(scratch.source.c_str(), "measure");
+    CHECK(TextureCache(scratch.directory).store(measure));
+    struct stat info;
+    stat((scratch.directory + "/" + measure.name).c_str(), &info);
+    uint64_t entryBytes = (uint64_t) info.st_size;
+    unlink((scratch.directory + "/" + measure.name).c_str());
+    TextureCache cache(scratch.directory, entryBytes * 3 + entryBytes / 2);
+    
+    // entries 0, 1 and 2 last used three, two and one minutes ago. loading
+    // 0 makes it the newest, so storing a fourth drops 1
+    std::vector<TextureCache::Key> keys;
+    for (int i = 0; i < 4; ++i) keys.push_back(cache.key(scratch.source.c_str(), "entry " + std::to_string(i)));
+    for (int i = 0; i < 3; ++i) {
+        CHECK(cache.store(keys[i]));
+        time_t used = time(nullptr) - 60 * (3 - i);
+        struct timeval times[2] = { { used, 0 }, { used, 0 } };
+        utimes((scratch.directory + "/" + keys[i].name).c_str(), times);
+    }
+    GLuint loaded;
+    glGenTextures(1, &loaded);
+    glBindTexture(GL_TEXTURE_2D, loaded);
+    CHECK(cache.load(keys[0]));
+    glBindTexture(GL_TEXTURE_2D, texture);
+    CHECK(cache.store(keys[3]));
+    
+    std::vector<std::string> expected = { keys[0].name, keys[2].name, keys[3].name };
+    std::sort(expected.begin(), expected.end());
+    CHECK(scratch.entries() == expected);
+    
+    // an entry bigger than the whole budget isn't written at all
+    TextureCache tiny(scratch.directory, entryBytes / 2);
+    CHECK(!tiny.store(cache.key(scratch.source.c_str(), "too big")));
+    CHECK(scratch.entries() == expected);
+    glDeleteTextures(1, &loaded);
+    glDeleteTextures(1, &texture);
+}
+
+TEST_MAIN()
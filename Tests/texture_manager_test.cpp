@@ -0,0 +1,195 @@
+//
+//  texture_manager_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  TextureManager sharing and its byte budget, over a few frames of binding
+//  64x64 PNGs.
+//
+
+#include "test.h"
+
+#include "texture_manager.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// RGBA 64x64 with its full mip chain, as the manager measures it
+    const uint64_t ChainBytes = 4 * (64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2 + 1);
+    const uint64_t LevelZeroBytes = 4 * 64*64;
+    
+    /// Source images and a cache directory, removed at the end of the case
+    struct Scratch
+    {
+        std::string cache = test::temporaryPath("manager-cache");
+        std::vector<std::string> images;
+        
+        explicit Scratch(int count)
+        {
+            for (int i = 0; i < count; ++i) {
+                images.push_back(test::temporaryPath("image" + std::to_string(i) + ".png"));
+                write(images.back(), corpus::png(synthesize(64, 64, 40 + i), 4, 8, PngEncoder::adaptive));
+            }
+        }
+        
+        ~Scratch()
+        {
+            for (const std::string& image : images) unlink(image.c_str());
+            if (DIR* dir = opendir(cache.c_str())) {
+                while (struct dirent* item = readdir(dir))
+                    if (item->d_name[0] != '.') unlink((cache + "/" + item->d_name).c_str());
+                closedir(dir);
+            }
+            rmdir(cache.c_str());
+        }
+        
+        static void write(const std::string& path, const std::vector<uint8_t>& bytes)
+        {
+            FILE* file = fopen(path.c_str(), "wb");
+            fwrite(bytes.data(), 1, bytes.size(), file);
+            fclose(file);
+        }
+    };
+    
+    /// Level 0 of a texture read back as RGBA
+    std::vector<uint8_t> pixels(GLuint texture)
+    {
+        std::vector<uint8_t> rgba(64 * 64 * 4);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        return rgba;
+    }
+}
+
+TEST(the_same_image_is_loaded_once)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(1);
+    std::string copy = test::temporaryPath("copy.png");
+    Scratch::write(copy, corpus::png(synthesize(64, 64, 40), 4, 8, PngEncoder::adaptive));
+    {
+        TextureManager manager("../GLcontext/shaders/", 1 << 20, scratch.cache);
+        TextureManager::Handle first = manager.acquire(scratch.images[0]);
+        TextureManager::Handle again = manager.acquire(scratch.images[0]);
+        TextureManager::Handle copied = manager.acquire(copy);
+        CHECK(first && again && copied);
+        CHECK(first.bind() == again.bind() && first.bind() == copied.bind());
+        TextureManager::Stats stats = manager.stats();
+        CHECK(stats.textures == 1 && stats.references == 3 && stats.loads == 1 && stats.shared == 2);
+        CHECK(stats.residentBytes == ChainBytes);
+        
+        // decoded right, and freed with the last handle
+        int width, height, channels;
+        stbi_uc* expected = stbi_load(scratch.images[0].c_str(), &width, &height, &channels, 4);
+        CHECK(expected && pixels(first.bind()) == std::vector<uint8_t>(expected, expected + 64 * 64 * 4));
+        stbi_image_free(expected);
+        GLuint texture = first.bind();
+        first.reset();
+        again.reset();
+        CHECK(glIsTexture(texture));
+        copied.reset();
+        CHECK(!glIsTexture(texture));
+        CHECK(manager.stats().textures == 0);
+        CHECK(!manager.acquire(test::temporaryPath("missing.png")));
+    }
+    unlink(copy.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(textures_in_use_stay_resident)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(3);
+    TextureManager manager("../GLcontext/shaders/", 3 * ChainBytes, scratch.cache);
+    std::vector<TextureManager::Handle> handles;
+    for (const std::string& image : scratch.images) handles.push_back(manager.acquire(image));
+    
+    // bound every frame and within budget: never evicted or reloaded
+    for (int frame = 0; frame < 5; ++frame) {
+        manager.beginFrame();
+        for (const TextureManager::Handle& handle : handles) handle.bind();
+    }
+    TextureManager::Stats stats = manager.stats();
+    CHECK(stats.resident == 3 && stats.reduced == 0);
+    CHECK(stats.evictions == 0 && stats.mipDrops == 0 && stats.loads == 3);
+    
+    // over budget with all three in use: mips go, textures stay, and the
+    // drops settle instead of recurring every frame
+    manager.setBudget(3 * ChainBytes - LevelZeroBytes / 2);
+    stats = manager.stats();
+    CHECK(stats.resident == 3 && stats.reduced == 1 && stats.mipDrops == 1);
+    CHECK(stats.residentBytes <= stats.budget);
+    for (int frame = 0; frame < 5; ++frame) {
+        manager.beginFrame();
+        for (const TextureManager::Handle& handle : handles) handle.bind();
+    }
+    stats = manager.stats();
+    CHECK(stats.evictions == 0 && stats.mipDrops == 1 && stats.loads == 3);
+    CHECK(stats.residentBytes <= stats.budget);
+    
+    // and come back once there is room
+    manager.setBudget(3 * ChainBytes);
+    manager.beginFrame();
+    for (const TextureManager::Handle& handle : handles) handle.bind();
+    stats = manager.stats();
+    CHECK(stats.reduced == 0 && stats.residentBytes == 3 * ChainBytes);
+    
+    // too small even for three 1x1s: they stay over budget rather than
+    // being evicted and reloaded every frame
+    manager.setBudget(8);
+    for (int frame = 0; frame < 5; ++frame) {
+        manager.beginFrame();
+        for (const TextureManager::Handle& handle : handles) handle.bind();
+    }
+    stats = manager.stats();
+    CHECK(stats.resident == 3 && stats.reduced == 3 && stats.residentBytes == 3 * 4);
+    CHECK(stats.evictions == 0 && stats.loads == 3);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(unused_textures_are_evicted_first)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(4);
+    TextureManager manager("../GLcontext/shaders/", 3 * ChainBytes, scratch.cache);
+    std::vector<TextureManager::Handle> handles;
+    for (int i = 0; i < 3; ++i) handles.push_back(manager.acquire(scratch.images[i]));
+    manager.beginFrame();
+    for (const TextureManager::Handle& handle : handles) handle.bind();
+    
+    // the first sits out a frame; with a fourth texture in the next, it is
+    // the one to go, whole, while the others keep every level
+    manager.beginFrame();
+    handles[1].bind();
+    handles[2].bind();
+    manager.beginFrame();
+    handles[1].bind();
+    handles[2].bind();
+    TextureManager::Stats stats = manager.stats();
+    CHECK(stats.evictions == 0 && stats.resident == 3);
+    handles.push_back(manager.acquire(scratch.images[3]));
+    stats = manager.stats();
+    CHECK(stats.evictions == 1 && stats.resident == 3 && stats.reduced == 0 && stats.mipDrops == 0);
+    
+    // binding it brings it back from the cache. everything is in use now,
+    // so the least recently bound lose mips instead
+    GLuint texture = handles[0].bind();
+    stats = manager.stats();
+    CHECK(stats.loads == 5 && stats.resident == 4);
+    CHECK(stats.residentBytes <= stats.budget);
+    CHECK(stats.evictions == 1 && stats.reduced == 2);
+    
+    int width, height, channels;
+    stbi_uc* expected = stbi_load(scratch.images[0].c_str(), &width, &height, &channels, 4);
+    CHECK(expected && pixels(texture) == std::vector<uint8_t>(expected, expected + 64 * 64 * 4));
+    stbi_image_free(expected);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
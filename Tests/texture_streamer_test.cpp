@@ -0,0 +1,280 @@
+//
+//  texture_streamer_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  TextureStreamer over runs of simulated frames: levels coming in finest
+//  last within the upload budget, storage growing under a new name with
+//  what was loaded kept, and textures nobody asks for going back to their
+//  starting levels.
+//
+
+#include "test.h"
+
+#include "texture_streamer.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// Source images and a cache directory, removed at the end of the case
+    struct Scratch
+    {
+        std::string cache = test::temporaryPath("streamer-cache");
+        std::vector<std::string> images;
+        
+        Scratch(int count, int size)
+        {
+            for (int i = 0; i < count; ++i) {
+                images.push_back(test::temporaryPath("stream" + std::to_string(i) + ".png"));
+                std::vector<uint8_t> bytes = corpus::png(synthesize(size, size, 70 + i), 4, 8, PngEncoder::adaptive);
+                FILE* file = fopen(images.back().c_str(), "wb");
+                fwrite(bytes.data(), 1, bytes.size(), file);
+                fclose(file);
+            }
+        }
+        
+        ~Scratch()
+        {
+            for (const std::string& image : images) unlink(image.c_str());
+            if (DIR* dir = opendir(cache.c_str())) {
+                while (struct dirent* item = readdir(dir))
+                    if (item->d_name[0] != '.') unlink((cache + "/" + item->d_name).c_str());
+                closedir(dir);
+            }
+            rmdir(cache.c_str());
+        }
+    };
+    
+    /// What a texture has in its storage and how much of it is loaded: the
+    /// width of its mip 0 and of its base level
+    struct Levels
+    {
+        int storageWidth = 0, loadedWidth = 0;
+        GLint baseLevel = 0;
+    };
+    
+    Levels levels(GLuint texture)
+    {
+        Levels result;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &result.baseLevel);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &result.storageWidth);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, result.baseLevel, GL_TEXTURE_WIDTH, &result.loadedWidth);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return result;
+    }
+    
+    /// Mip 'level' of a texture, read back as RGBA
+    std::vector<uint8_t> pixels(GLuint texture, int level)
+    {
+        GLint width, height;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+        std::vector<uint8_t> rgba((size_t) width * height * 4);
+        glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return rgba;
+    }
+    
+    /// Every level of the cache entry the manager bakes for 'path', read
+    /// back through a texture of its own
+    std::vector<std::vector<uint8_t>> baked(TextureManager& manager, const std::string& path)
+    {
+        TextureCache::Blob blob;
+        std::vector<std::vector<uint8_t>> result;
+        if (!manager.bake(path, blob)) return result;
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (int level = 0; level < blob.levels(); ++level) blob.define(level, level);
+        for (int level = 0; level < blob.levels(); ++level) result.push_back(pixels(texture, level));
+        glDeleteTextures(1, &texture);
+        return result;
+    }
+    
+    int log2(int size)
+    {
+        int result = 0;
+        while (size > 1) size >>= 1, ++result;
+        return result;
+    }
+}
+
+TEST(textures_start_small_and_grow_a_level_at_a_time)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(1, 512);
+    TextureManager manager("../GLcontext/shaders/", 64 << 20, scratch.cache);
+    
+    // a byte a frame: each frame sends the one level that always goes
+    TextureStreamer streamer(manager, 1, 64);
+    int id = streamer.add(scratch.images[0]);
+    CHECK(id == 0);
+    CHECK(streamer.add(test::temporaryPath("missing.png")) == -1);
+    Levels start = levels(streamer.texture(id));
+    CHECK(start.storageWidth == 64 && start.loadedWidth == 64 && start.baseLevel == 0);
+    TextureStreamer::Stats stats = streamer.stats();
+    CHECK(stats.textures == 1 && stats.pending == 0);
+    CHECK(stats.allocatedBytes == 4 * (64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2 + 1));
+    CHECK(stats.fullBytes == stats.allocatedBytes + 4 * (512*512 + 256*256 + 128*128));
+    
+    // seen at 400 pixels it wants the 512 level; the base level moves a
+    // level finer a frame, and once storage covers them all stays there
+    std::vector<int> widths;
+    GLuint previous = streamer.texture(id);
+    int renames = 0;
+    for (int frame = 0; frame < 6; ++frame) {
+        streamer.request(id, 100);
+        streamer.request(id, 400);
+        streamer.update();
+        Levels now = levels(streamer.texture(id));
+        widths.push_back(now.loadedWidth);
+        CHECK(now.storageWidth == 512 && now.baseLevel == log2(512 / now.loadedWidth));
+        renames += streamer.texture(id) != previous;
+        previous = streamer.texture(id);
+    }
+    CHECK((widths == std::vector<int> { 128, 256, 512, 512, 512, 512 }));
+    CHECK(renames == 1 && streamer.stats().pending == 0);
+    
+    // what arrived is the image
+    int width, height, channels;
+    stbi_uc* expected = stbi_load(scratch.images[0].c_str(), &width, &height, &channels, 4);
+    CHECK(expected && pixels(streamer.texture(id), 0) == std::vector<uint8_t>(expected, expected + 512 * 512 * 4));
+    stbi_image_free(expected);
+    CHECK(TextureStreamer::projectedSize(1.0f, 1.0f, 1.5707963f, 800) > 399.0f);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(frames_stay_within_the_upload_budget)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(6, 256);
+    TextureManager manager("../GLcontext/shaders/", 64 << 20, scratch.cache);
+    const uint64_t budget = 100 << 10;
+    TextureStreamer streamer(manager, budget, 64);
+    std::vector<int> ids;
+    for (const std::string& image : scratch.images) ids.push_back(streamer.add(image));
+    
+    // all of them up close, the first ones closest. A frame may go over
+    // the budget only to send a single level
+    std::vector<int> before(ids.size(), 64);
+    int frames = 0, overBudget = 0;
+    bool finerFirst = true;
+    while (streamer.stats().pending || frames == 0) {
+        for (size_t i = 0; i < ids.size(); ++i) streamer.request(ids[i], 300.0f - 10 * i);
+        streamer.update();
+        int levelsSent = 0;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            int now = levels(streamer.texture(ids[i])).loadedWidth;
+            CHECK(now >= before[i]);
+            levelsSent += log2(now) - log2(before[i]);
+            before[i] = now;
+        }
+        uint64_t uploaded = streamer.stats().uploadedBytes;
+        if (uploaded > budget) {
+            ++overBudget;
+            CHECK(levelsSent == 1);
+        }
+        
+        // the most blurred go first, so no texture is two levels behind
+        // another that is asked for at much the same size
+        int least = *std::min_element(before.begin(), before.end()), most = *std::max_element(before.begin(), before.end());
+        finerFirst = finerFirst && most <= least * 2;
+        if (++frames > 100) break;
+    }
+    CHECK(frames > 4 && frames < 100);
+    CHECK(overBudget > 0);
+    CHECK(finerFirst);
+    for (int width : before) CHECK(width == 256);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(storage_grows_under_a_new_name_and_keeps_its_levels)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(1, 256);
+    TextureManager manager("../GLcontext/shaders/", 64 << 20, scratch.cache);
+    TextureStreamer streamer(manager, 1, 64);
+    int id = streamer.add(scratch.images[0]);
+    GLuint small = streamer.texture(id);
+    
+    // it starts with the entry's 64 and smaller levels
+    std::vector<std::vector<uint8_t>> entry = baked(manager, scratch.images[0]);
+    CHECK(entry.size() == 9);
+    bool started = entry.size() == 9;
+    for (int level = 0; started && level <= 6; ++level) started = pixels(small, level) == entry[level + 2];
+    CHECK(started);
+    
+    // a texture bound elsewhere is left bound
+    GLuint other;
+    glGenTextures(1, &other);
+    glBindTexture(GL_TEXTURE_2D, other);
+    streamer.request(id, 200);
+    streamer.update();
+    GLint bound;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    CHECK((GLuint) bound == other);
+    glDeleteTextures(1, &other);
+    
+    // new storage from 256 down; the old name is gone and the 64 and
+    // smaller levels were sent again, two mips further down
+    GLuint grown = streamer.texture(id);
+    CHECK(grown != small && !glIsTexture(small));
+    Levels now = levels(grown);
+    CHECK(now.storageWidth == 256 && now.loadedWidth == 128 && now.baseLevel == 1);
+    bool kept = entry.size() == 9;
+    for (int level = 2; kept && level <= 8; ++level) kept = pixels(grown, level) == entry[level];
+    CHECK(kept);
+    CHECK(streamer.stats().uploadedBytes == 4 * (64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2 + 1 + 128*128));
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(unrequested_textures_go_back_to_where_they_started)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch(1, 256);
+    TextureManager manager("../GLcontext/shaders/", 64 << 20, scratch.cache);
+    TextureStreamer streamer(manager, 64 << 20, 64);
+    int id = streamer.add(scratch.images[0]);
+    uint64_t startBytes = streamer.stats().allocatedBytes;
+    for (int frame = 0; frame < 4; ++frame) {
+        streamer.request(id, 250);
+        streamer.update();
+    }
+    CHECK(levels(streamer.texture(id)).loadedWidth == 256);
+    
+    // a level less is within the slack it keeps, so nothing is given up
+    GLuint full = streamer.texture(id);
+    streamer.request(id, 100);
+    streamer.update();
+    CHECK(streamer.texture(id) == full && levels(full).loadedWidth == 256);
+    
+    // then nobody asks: it holds through 120 frames without a request and
+    // drops back on the next
+    int frames = 0;
+    while (streamer.texture(id) == full && frames < 200) {
+        streamer.update();
+        ++frames;
+    }
+    CHECK(frames == 121);
+    Levels now = levels(streamer.texture(id));
+    CHECK(now.storageWidth == 64 && now.loadedWidth == 64 && now.baseLevel == 0);
+    CHECK(streamer.stats().allocatedBytes == startBytes && streamer.stats().pending == 0);
+    
+    // and streams in again when it is wanted
+    for (int frame = 0; frame < 4; ++frame) {
+        streamer.request(id, 250);
+        streamer.update();
+    }
+    CHECK(levels(streamer.texture(id)).loadedWidth == 256);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
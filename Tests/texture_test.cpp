@@ -0,0 +1,200 @@
+//
+//  texture_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  Texture's formats for each channel count, uploads at every unpack
+//  alignment and row stride read back from the GL, and moves handing the
+//  name over.
+//
+
+#include "test.h"
+
+#include "texture.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// Level 'level' of the bound texture in 'format', rows tightly packed
+    std::vector<uint8_t> readBack(GLenum format, int channels, int level = 0)
+    {
+        GLint width, height;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+        std::vector<uint8_t> pixels((size_t) width * height * channels);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, level, format, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        return pixels;
+    }
+    
+    bool swizzled(const GLint (&expected)[4])
+    {
+        GLint swizzle[4];
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        return std::equal(swizzle, swizzle + 4, expected);
+    }
+}
+
+TEST(formats_are_the_tightest_for_the_channels)
+{
+    const GLenum linear[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    const GLenum srgb[4] = { GL_SRGB8, GL_SRGB8_ALPHA8, GL_SRGB8, GL_SRGB8_ALPHA8 };
+    const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    bool right = true;
+    for (int channels = 1; channels <= 4; ++channels) {
+        Texture::Format format = Texture::formatFor(channels, false);
+        right = right && format.internalFormat == linear[channels - 1] && format.format == formats[channels - 1] && format.channels == channels;
+        
+        // sRGB gray goes up as one channel; gray and alpha only as RGBA
+        Texture::Format encoded = Texture::formatFor(channels, true);
+        int given = channels == 2 ? 4 : channels;
+        right = right && encoded.internalFormat == srgb[channels - 1] && encoded.format == formats[given - 1] && encoded.channels == given;
+    }
+    CHECK(right);
+    
+    // gray reads as gray, with alpha from the second channel if there is one
+    Texture::Format gray = Texture::formatFor(1, true), grayAlpha = Texture::formatFor(2, false), rgb = Texture::formatFor(3, true);
+    CHECK(gray.swizzle[0] == GL_RED && gray.swizzle[1] == GL_RED && gray.swizzle[2] == GL_RED && gray.swizzle[3] == GL_ONE);
+    CHECK(grayAlpha.swizzle[0] == GL_RED && grayAlpha.swizzle[2] == GL_RED && grayAlpha.swizzle[3] == GL_GREEN);
+    CHECK(rgb.swizzle[0] == GL_RED && rgb.swizzle[1] == GL_GREEN && rgb.swizzle[2] == GL_BLUE && rgb.swizzle[3] == GL_ONE);
+    CHECK(Texture::formatFor(4, false).swizzle[3] == GL_ALPHA && Texture::formatFor(0, false).internalFormat == GL_RGBA8);
+    
+    CHECK(Texture::mipLevels(1, 1) == 1 && Texture::mipLevels(5, 3) == 3 && Texture::mipLevels(1024, 1) == 11 && Texture::mipLevels(3, 1024) == 11);
+}
+
+TEST(files_load_in_their_own_format)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Image image = synthesize(37, 21, 600);
+    std::string path = test::temporaryPath("texture.png");
+    for (int channels = 1; channels <= 4; ++channels)
+        for (bool srgb : { false, true }) {
+            std::vector<uint8_t> bytes = corpus::png(image, channels, 8, PngEncoder::adaptive);
+            FILE* file = fopen(path.c_str(), "wb");
+            fwrite(bytes.data(), 1, bytes.size(), file);
+            fclose(file);
+            
+            Texture texture = Texture::load(path.c_str(), srgb);
+            Texture::Format format = Texture::formatFor(channels, srgb);
+            CHECK((bool) texture && texture.width() == 37 && texture.height() == 21 && texture.levels() == 6);
+            CHECK(texture.format().internalFormat == format.internalFormat && texture.format().channels == format.channels);
+            
+            // what the GL holds, level 0 as decoded and mips built under it
+            GLint internalFormat, smallest;
+            glBindTexture(GL_TEXTURE_2D, texture.name());
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 5, GL_TEXTURE_WIDTH, &smallest);
+            CHECK((GLenum) internalFormat == format.internalFormat && smallest == 1);
+            CHECK(swizzled(format.swizzle));
+            int width, height, decoded;
+            stbi_uc* expected = stbi_load(path.c_str(), &width, &height, &decoded, format.channels);
+            CHECK(expected && readBack(format.format, format.channels) == std::vector<uint8_t>(expected, expected + 37 * 21 * format.channels));
+            stbi_image_free(expected);
+        }
+    
+    Texture single = Texture::load(path.c_str(), false, false);
+    CHECK(single.levels() == 1);
+    unlink(path.c_str());
+    CHECK(!Texture::load(path.c_str()) && Texture::load(path.c_str()).name() == 0);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(uploads_take_any_alignment_and_stride)
+{
+    // the largest of 8, 4, 2 and 1 both the address and the row size are
+    // multiples of
+    alignas(8) static const unsigned char base[64] = {};
+    CHECK(Texture::unpackAlignment(base, 16) == 8 && Texture::unpackAlignment(base, 12) == 4);
+    CHECK(Texture::unpackAlignment(base, 6) == 2 && Texture::unpackAlignment(base, 15) == 1);
+    CHECK(Texture::unpackAlignment(base + 4, 16) == 4 && Texture::unpackAlignment(base + 2, 8) == 2 && Texture::unpackAlignment(base + 1, 8) == 1);
+    CHECK(Texture::unpackAlignment((const void*) 24, 32) == 8 && Texture::unpackAlignment(nullptr, 1024) == 8);
+    
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // 5x3 RGB, rows of 15 bytes, from every offset into the buffer: rows
+    // tightly packed, every 8 pixels (24 bytes), and padded out to 16 where
+    // the address allows an alignment that pads them. The caller's unpack
+    // state is put back each time
+    const int width = 5, height = 3;
+    std::vector<uint8_t> expected(width * height * 3);
+    for (size_t i = 0; i < expected.size(); ++i) expected[i] = (uint8_t) (i * 37 + 11);
+    alignas(8) unsigned char buffer[8 + 24 * height];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 3);
+    Texture texture(width, height, 3, false, false);
+    bool all = true, restored = true;
+    for (size_t stride : { (size_t) 0, (size_t) 16, (size_t) 24 })
+        for (int offset = 0; offset < 8; offset += stride == 16 ? 2 : 1) {
+            size_t rowStep = stride ? stride : width * 3;
+            unsigned char* pixels = buffer + offset;
+            memset(buffer, 0xcd, sizeof(buffer));
+            for (int row = 0; row < height; ++row) memcpy(pixels + row * rowStep, &expected[row * width * 3], width * 3);
+            texture.upload(pixels, 0, stride);
+            all = all && readBack(GL_RGB, 3) == expected;
+            GLint alignment, rowLength;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+            glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+            restored = restored && alignment == 2 && rowLength == 3;
+        }
+    CHECK(all && restored);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    
+    // a level below 0, gray and alpha: 3x3, rows of 6 bytes
+    Texture gray(7, 6, 2);
+    std::vector<uint8_t> level1((size_t) 3 * 3 * 2);
+    for (size_t i = 0; i < level1.size(); ++i) level1[i] = (uint8_t) (200 - i);
+    gray.upload(level1.data(), 1);
+    CHECK(readBack(GL_RG, 2, 1) == level1);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(moves_hand_the_name_over)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Texture empty;
+    CHECK(!empty && empty.name() == 0 && empty.levels() == 0);
+    
+    Texture first(16, 8, 1);
+    GLuint name = first.name();
+    CHECK(name && first.levels() == 5);
+    GLint bound;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    CHECK((GLuint) bound == name);
+    
+    // construction takes it and leaves nothing behind
+    Texture second(std::move(first));
+    CHECK(second.name() == name && second.width() == 16 && second.height() == 8 && second.levels() == 5);
+    CHECK(second.format().internalFormat == GL_R8);
+    CHECK(!first && first.width() == 0 && first.levels() == 0);
+    
+    // assignment swaps, so the texture assigned over goes with the other
+    GLuint replaced;
+    {
+        Texture third(4, 4, 4, false, false);
+        replaced = third.name();
+        third = std::move(second);
+        CHECK(third.name() == name && third.format().internalFormat == GL_R8 && third.levels() == 5);
+        CHECK(second.name() == replaced && second.levels() == 1 && second.format().channels == 4);
+        CHECK(glIsTexture(name) && glIsTexture(replaced));
+    }
+    CHECK(!glIsTexture(name) && glIsTexture(replaced));
+    
+    // unit and name from bind()
+    CHECK(second.bind(3) == replaced);
+    GLint unit;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    CHECK(unit == GL_TEXTURE3 && (GLuint) bound == replaced);
+    glActiveTexture(GL_TEXTURE0);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
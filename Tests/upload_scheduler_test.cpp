@@ -0,0 +1,197 @@
+//
+//  upload_scheduler_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  UploadScheduler over a run of simulated frames: what arrives, in what
+//  order, how much a frame, and how the time budget follows the headroom.
+//
+
+#include "test.h"
+
+#include "upload_scheduler.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <thread>
+
+namespace
+{
+    /// Frames until nothing is queued, or 'limit' of them
+    int runFrames(UploadScheduler& uploads, int limit = 1000)
+    {
+        int frames = 0;
+        while (uploads.stats().queued && frames < limit) {
+            uploads.beginFrame();
+            uploads.update();
+            ++frames;
+        }
+        return frames;
+    }
+    
+    std::vector<unsigned char> pattern(size_t size, unsigned seed)
+    {
+        std::vector<unsigned char> bytes(size);
+        for (size_t i = 0; i < size; ++i) bytes[i] = (unsigned char) (i * 131 + seed);
+        return bytes;
+    }
+    
+    std::vector<unsigned char> bufferContents(GLuint buffer, size_t size)
+    {
+        std::vector<unsigned char> bytes(size);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, bytes.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return bytes;
+    }
+}
+
+TEST(texture_rows_arrive_whole)
+{
+    // an odd width, rows padded past the alignment, and a budget that
+    // splits the image into many bands
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    const int width = 333, height = 517;
+    const size_t stride = width * 3 + 7;
+    std::vector<unsigned char> pixels = pattern(stride * height, 7);
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, textures[1]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 8);
+    
+    UploadScheduler uploads(64 << 10);
+    int done = 0;
+    uint64_t id = uploads.texture(textures[0], 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels, 0, [&] { ++done; }, stride);
+    CHECK(uploads.pending(id));
+    int frames = runFrames(uploads);
+    CHECK(!uploads.pending(id) && done == 1);
+    CHECK(frames >= (int) (stride * height / (64 << 10)));
+    CHECK(uploads.stats().totalBytes == stride * height);
+    
+    // the unpack state and binding it found are put back
+    GLint alignment, rowLength, bound;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    CHECK(alignment == 8 && rowLength == 0 && (GLuint) bound == textures[1]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    
+    std::vector<unsigned char> got((size_t) width * height * 3);
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, got.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    int wrongRows = 0;
+    for (int y = 0; y < height; ++y)
+        wrongRows += memcmp(&got[(size_t) y * width * 3], &pixels[y * stride], width * 3) != 0;
+    CHECK(wrongRows == 0);
+    glDeleteTextures(2, textures);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(urgent_uploads_go_first)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, 1 << 20, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    
+    // each upload covers the start of the buffer, so the one issued last
+    // is the one left there
+    UploadScheduler uploads(256 << 10);
+    std::vector<int> order;
+    std::vector<unsigned char> large = pattern(1 << 20, 1);
+    uint64_t low = uploads.buffer(buffer, 0, std::vector<unsigned char>(1000, 0x11), 0, [&] { order.push_back(1); });
+    uint64_t high = uploads.buffer(buffer, 0, large, 5, [&] { order.push_back(2); });
+    uint64_t cancelled = uploads.buffer(buffer, 0, std::vector<unsigned char>(100, 0x33), 1, [&] { order.push_back(3); });
+    uint64_t raised = uploads.buffer(buffer, 0, std::vector<unsigned char>(100, 0x44), -1, [&] { order.push_back(4); });
+    CHECK(uploads.cancel(cancelled));
+    CHECK(!uploads.cancel(cancelled));
+    uploads.setPriority(raised, 10);
+    CHECK(uploads.stats().queued == 3 && uploads.stats().queuedBytes == 1000 + (1 << 20) + 100);
+    
+    runFrames(uploads);
+    CHECK((order == std::vector<int> { 4, 2, 1 }));
+    CHECK(!uploads.pending(low) && !uploads.pending(high));
+    std::vector<unsigned char> expected = large;
+    std::fill(expected.begin(), expected.begin() + 1000, 0x11);
+    CHECK(bufferContents(buffer, 1 << 20) == expected);
+    glDeleteBuffers(1, &buffer);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(frames_stay_within_the_byte_budget)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, 3 << 20, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    
+    // a generous time budget, so bytes are what limits each frame
+    const uint64_t perFrame = 100 << 10;
+    UploadScheduler uploads(perFrame, 1000.0, 0.25, 1000.0);
+    std::vector<unsigned char> data = pattern(3 << 20, 9);
+    uploads.buffer(buffer, 0, data);
+    int frames = 0;
+    uint64_t most = 0;
+    while (uploads.stats().queued && frames < 1000) {
+        uploads.beginFrame();
+        uploads.update();
+        most = std::max(most, uploads.stats().uploadedBytes);
+        ++frames;
+    }
+    CHECK(most <= perFrame);
+    CHECK(frames >= (int) ((3 << 20) / perFrame));
+    CHECK(uploads.stats().bands >= (uint64_t) frames);
+    CHECK(bufferContents(buffer, 3 << 20) == data);
+    glDeleteBuffers(1, &buffer);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(time_budget_follows_the_headroom)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    UploadScheduler uploads(16 << 20, 20.0, 0.25, 2.0);
+    
+    // short frames: the budget grows a step a frame, up to the most
+    double last = uploads.stats().budgetMs;
+    for (int frame = 0; frame < 4; ++frame) {
+        uploads.beginFrame();
+        uploads.update();
+        CHECK(uploads.stats().budgetMs > last);
+        last = uploads.stats().budgetMs;
+    }
+    for (int frame = 0; frame < 10; ++frame) {
+        uploads.beginFrame();
+        uploads.update();
+    }
+    CHECK(uploads.stats().budgetMs == 2.0);
+    
+    // a frame whose work leaves less room than the budget halves it
+    uploads.beginFrame();
+    std::this_thread::sleep_for(std::chrono::milliseconds(19));
+    uploads.update();
+    CHECK(uploads.stats().workMs >= 19.0);
+    CHECK(uploads.stats().budgetMs < 2.0);
+    
+    // and one that comes late, however little work it had, does too
+    for (int frame = 0; frame < 10; ++frame) {
+        uploads.beginFrame();
+        uploads.update();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    uploads.beginFrame();
+    uploads.update();
+    CHECK(uploads.stats().budgetMs == 1.0);
+}
+
+TEST_MAIN()
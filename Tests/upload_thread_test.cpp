@@ -0,0 +1,184 @@
+//
+//  upload_thread_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  UploadThread with a shared context of its own, handing work over in the
+//  order it came and on the render thread, and without one, running it in
+//  poll(); and what unfinished work made going with it. The SDL calls come
+//  from the EGL stand-in in support/SDL2.
+//
+
+#include "test.h"
+
+#include "upload_thread.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+#include <atomic>
+
+namespace
+{
+    /// Poll until nothing is queued, or a few seconds have gone by
+    bool drain(UploadThread& loader)
+    {
+        for (int i = 0; i < 2000 && loader.stats().queued; ++i) {
+            loader.poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return loader.stats().queued == 0;
+    }
+    
+    std::vector<uint8_t> bufferContents(GLuint buffer, size_t size)
+    {
+        std::vector<uint8_t> contents(size);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, contents.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return contents;
+    }
+    
+    /// How many of the first few hundred names are live buffers and textures
+    int liveObjects()
+    {
+        int live = 0;
+        for (GLuint name = 1; name < 512; ++name) live += glIsBuffer(name) + glIsTexture(name);
+        return live;
+    }
+    
+    void writePng(const std::string& path, const Image& image)
+    {
+        std::vector<uint8_t> bytes = corpus::png(image, 4, 8, PngEncoder::adaptive);
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fclose(file);
+    }
+}
+
+TEST(work_is_handed_over_in_order)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    SDL_Window window;
+    EGLContext main = eglGetCurrentContext();
+    UploadThread loader(&window);
+    CHECK(loader.threaded() && loader.stats().threaded);
+    CHECK(eglGetCurrentContext() == main);
+    
+    // plain work, a buffer and a texture, mixed; the work runs elsewhere and
+    // 'done' here, each in turn
+    std::string path = test::temporaryPath("upload.png");
+    Image image = synthesize(40, 24, 700);
+    writePng(path, image);
+    std::vector<uint8_t> data(1000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (uint8_t) (i * 13);
+    
+    std::thread::id renderThread = std::this_thread::get_id();
+    std::vector<int> order;
+    bool elsewhere = true, here = true;
+    GLuint buffer = 0;
+    Texture texture;
+    for (int i = 0; i < 30; ++i) {
+        if (i == 10) {
+            loader.buffer(data, GL_STATIC_DRAW, [&](GLuint name) { buffer = name; order.push_back(10); });
+        } else if (i == 20) {
+            loader.texture(path, false, true, [&](Texture loaded) { texture = std::move(loaded); order.push_back(20); });
+        } else {
+            loader.submit([&elsewhere, renderThread, i] { elsewhere = elsewhere && std::this_thread::get_id() != renderThread; return i; },
+                          [&](int value) { here = here && std::this_thread::get_id() == renderThread; order.push_back(value); });
+        }
+    }
+    
+    // and what 'done' submits goes after all of it
+    loader.submit([] { return 30; }, [&](int value) {
+        order.push_back(value);
+        loader.submit([] { return 31; }, [&](int value) { order.push_back(value); });
+    });
+    CHECK(drain(loader));
+    std::vector<int> expected;
+    for (int i = 0; i < 32; ++i) expected.push_back(i);
+    CHECK(order == expected);
+    CHECK(elsewhere && here);
+    
+    // both usable from this context once handed over
+    CHECK(buffer && glIsBuffer(buffer) && bufferContents(buffer, data.size()) == data);
+    CHECK((bool) texture && texture.width() == 40 && texture.levels() == 6);
+    std::vector<uint8_t> pixels(image.data.size());
+    glBindTexture(GL_TEXTURE_2D, texture.name());
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    CHECK(pixels == image.data);
+    
+    UploadThread::Stats stats = loader.stats();
+    CHECK(stats.finished == 32 && stats.queued == 0 && stats.bytes == data.size() + image.data.size());
+    glDeleteBuffers(1, &buffer);
+    unlink(path.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(without_a_shared_context_work_runs_in_poll)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // no window, so no context to share
+    UploadThread loader(nullptr);
+    CHECK(!loader.threaded() && !loader.stats().threaded);
+    
+    std::thread::id renderThread = std::this_thread::get_id();
+    std::vector<int> order;
+    bool here = true;
+    for (int i = 0; i < 3; ++i)
+        loader.submit([&here, renderThread, i] { here = here && std::this_thread::get_id() == renderThread; return i; },
+                      [&](int value) { order.push_back(value); });
+    std::vector<uint8_t> data(64, 0x5a);
+    GLuint buffer = 0;
+    loader.buffer(data, GL_STATIC_DRAW, [&](GLuint name) { buffer = name; });
+    CHECK(loader.stats().queued == 4 && order.empty());
+    
+    // one piece a poll, in order
+    bool onePerPoll = true;
+    for (size_t polls = 1; polls <= 3; ++polls) {
+        loader.poll();
+        onePerPoll = onePerPoll && order.size() == polls && order.back() == (int) polls - 1 && loader.stats().queued == 4 - polls;
+    }
+    CHECK(onePerPoll && here && buffer == 0);
+    loader.poll();
+    CHECK(buffer && bufferContents(buffer, data.size()) == data);
+    UploadThread::Stats stats = loader.stats();
+    CHECK(stats.finished == 4 && stats.queued == 0 && stats.bytes == data.size());
+    loader.poll();
+    CHECK(loader.stats().finished == 4);
+    glDeleteBuffers(1, &buffer);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(unfinished_work_goes_with_the_thread)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    std::string path = test::temporaryPath("unfinished.png");
+    writePng(path, synthesize(16, 16, 701));
+    int before = liveObjects();
+    {
+        // buffers and textures made but never polled for, and work after
+        // them that lets the test know they were
+        SDL_Window window;
+        UploadThread loader(&window);
+        std::atomic<bool> ran(false);
+        for (int i = 0; i < 5; ++i) {
+            loader.buffer(std::vector<unsigned char>(256, (unsigned char) i), GL_STATIC_DRAW, [](GLuint) {});
+            loader.texture(path, false, false, [](Texture) {});
+        }
+        loader.submit([&ran] { ran = true; return 0; }, [](int) {});
+        for (int i = 0; i < 2000 && !ran; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        CHECK(ran && loader.stats().queued == 11);
+        CHECK(liveObjects() == before + 10);
+    }
+    CHECK(liveObjects() == before);
+    unlink(path.c_str());
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
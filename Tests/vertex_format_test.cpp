@@ -0,0 +1,337 @@
+//
+//  vertex_format_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  VertexEncoding round trips: values encoded on the CPU, read by a vertex
+//  shader through the layout a VertexFormat gives, and caught with transform
+//  feedback, so the GL does the decoding. Octahedral normals are unfolded
+//  with the GLSL from vertex_format.h.
+//
+
+#include "test.h"
+
+#include "vertex_format.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+namespace
+{
+    /// A vertex shader reading attribute 'location' and writing 'body' of
+    /// it to 'result', captured by transform feedback
+    GLuint captureProgram(GLuint location, const char* body)
+    {
+        std::string source = "#version 410 core\n"
+                             "layout (location = " + std::to_string(location) + ") in vec4 value;\n"
+                             "out vec4 result;\n"
+                             "void main()\n{\n" + body + "\n    gl_Position = vec4(0.0);\n}\n";
+        const char* text = source.c_str();
+        GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        const char* varying = "result";
+        glTransformFeedbackVaryings(program, 1, &varying, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(program);
+        glDeleteShader(shader);
+        GLint linked;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        return linked ? program : 0;
+    }
+    
+    const char* const Copy = "    result = value;";
+    
+    /// The unfolding in vertex_format.h's comment on Octahedral
+    const char* const Unfold = "    vec2 e = value.xy;\n"
+                               "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+                               "    float t = max(-n.z, 0.0);\n"
+                               "    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));\n"
+                               "    result = vec4(normalize(n), 0.0);";
+    
+    /// What the vertex shader sees of attribute 'location' for each of
+    /// 'count' vertices, four floats a vertex, missing components 0 0 0 1
+    std::vector<float> shaderSees(const VertexLayout& layout, GLuint location, const std::vector<unsigned char>& vertices, size_t count,
+                                  const char* body = Copy)
+    {
+        std::vector<float> seen(count * 4, NAN);
+        GLuint program = captureProgram(location, body);
+        if (!program) return seen;
+        
+        // nothing is drawn, but drawing at all wants a complete framebuffer
+        GLuint framebuffer, color, vao, buffers[2];
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 1, 1);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(2, buffers);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+        layout.apply(buffers[0]);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffers[1]);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, seen.size() * sizeof(float), nullptr, GL_STATIC_READ);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1]);
+        
+        glUseProgram(program);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, (GLsizei) count);
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, seen.size() * sizeof(float), seen.data());
+        
+        glUseProgram(0);
+        glBindVertexArray(0);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(2, buffers);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &color);
+        glDeleteProgram(program);
+        return seen;
+    }
+    
+    /// The first component of each vertex, as the shader saw it
+    template <typename Format>
+    std::vector<float> roundTrip(const std::vector<float>& values)
+    {
+        std::vector<unsigned char> vertices = Format::pack(values.data(), values.size());
+        std::vector<float> seen = shaderSees(Format::layout(), 0, vertices, values.size()), first;
+        for (size_t i = 0; i < values.size(); ++i) first.push_back(seen[i * 4]);
+        return first;
+    }
+    
+    /// Evenly spread values in [lo, hi], the ends and zero included, and
+    /// some either side of the range
+    std::vector<float> spread(float lo, float hi)
+    {
+        std::vector<float> values = { lo, hi, 0.0f, -0.0f, lo - 0.5f, hi + 0.5f, -1e30f, 1e30f };
+        Random random(800);
+        for (int i = 0; i < 4000; ++i) values.push_back(lo + (hi - lo) * (random.next() % 1000001) / 1000000.0f);
+        return values;
+    }
+    
+    /// Unit vectors over the whole sphere: random ones, the axes, the
+    /// diagonals, and ones right at the fold, z = 0
+    std::vector<float> directions()
+    {
+        std::vector<float> xyz;
+        Random random(801);
+        for (int i = 0; i < 3000; ++i) {
+            float v[3];
+            for (float& c : v) c = (float) (random.next() % 2000001) / 1000000.0f - 1.0f;
+            float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            if (length < 1e-3f) continue;
+            for (float c : v) xyz.push_back(c / length);
+        }
+        const float r = 0.57735027f, h = 0.70710678f;
+        const float special[][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+                                     { r, r, r }, { -r, r, -r }, { r, -r, -r }, { -r, -r, -r }, { h, h, 0 }, { -h, h, 0 },
+                                     { h, 0, -h }, { 0, -h, -h }, { 0.6f, 0.8f, -0.0f }, { -0.8f, -0.6f, 0.0f } };
+        for (const float* v : special) xyz.insert(xyz.end(), v, v + 3);
+        return xyz;
+    }
+}
+
+TEST(layouts_add_up_at_compile_time)
+{
+    typedef VertexFormat<Attribute<0, VertexEncoding::Snorm16<3>>, Attribute<1, VertexEncoding::Octahedral>,
+                         Attribute<2, VertexEncoding::Unorm16<2>>, Attribute<5, VertexEncoding::Half<1>>> Format;
+    static_assert(Format::stride == 8 + 4 + 4 + 4 && Format::inputs == 3 + 3 + 2 + 1, "");
+    static_assert(Format::offset(0) == 0 && Format::offset(1) == 8 && Format::offset(2) == 12 && Format::offset(3) == 16, "");
+    static_assert(VertexEncoding::Unorm8<3>::size == 4 && VertexEncoding::Snorm8<4>::size == 4 && VertexEncoding::Half<3>::size == 8, "");
+    
+    VertexLayout layout = Format::layout();
+    CHECK(layout.stride == 20 && layout.attributes.size() == 4);
+    const VertexAttribute* normal = layout.find(1);
+    CHECK(normal && normal->components == 2 && normal->type == GL_SHORT && normal->normalized && normal->offset == 8 && normal->inputs == 3);
+    CHECK(layout.find(5) && layout.find(5)->type == GL_HALF_FLOAT && !layout.find(3));
+    
+    // pack() from interleaved floats and write() from an array each agree,
+    // and the padding is zeroed
+    const float position[3] = { 0.5f, -0.25f, 1.0f }, direction[3] = { 0, 0, -1 }, uv[2] = { 0.75f, 0.125f }, scalar[1] = { 3.5f };
+    std::vector<float> interleaved(position, position + 3);
+    interleaved.insert(interleaved.end(), direction, direction + 3);
+    interleaved.insert(interleaved.end(), uv, uv + 2);
+    interleaved.push_back(scalar[0]);
+    std::vector<unsigned char> packed = Format::pack(interleaved.data(), 1), written(Format::stride, 0xcd);
+    Format::write(written.data(), position, direction, uv, scalar);
+    CHECK(packed == written);
+    int16_t pad;
+    memcpy(&pad, &packed[6], 2);
+    uint16_t halfPad;
+    memcpy(&halfPad, &packed[18], 2);
+    CHECK(pad == 0 && halfPad == 0);
+}
+
+TEST(halves_round_trip_to_the_nearest_half)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // normal halves to within half an ulp, 2^-11 of the value, and the
+    // denormals below 2^-14 to within half of 2^-24
+    std::vector<float> values = spread(-70000.0f, 70000.0f);
+    for (int exponent = -27; exponent <= 16; ++exponent)
+        for (float sign : { 1.0f, -1.0f }) values.push_back(sign * std::ldexp(1.37f, exponent));
+    values.insert(values.end(), { 65504.0f, -65504.0f, 65519.0f, 65520.0f, 6.1035156e-05f, 5.9604645e-08f, -2.9802322e-08f, INFINITY, -INFINITY, NAN });
+    std::vector<float> seen = roundTrip<VertexFormat<Attribute<0, VertexEncoding::Half<1>>>>(values);
+    
+    size_t wrong = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        float value = values[i], got = seen[i];
+        if (std::isnan(value)) wrong += !std::isnan(got);
+        else if (std::fabs(value) >= 65520.0f) wrong += got != std::copysign(INFINITY, value);
+        else wrong += std::fabs(got - value) > std::max(std::fabs(value) * std::ldexp(1.0f, -11), std::ldexp(1.0f, -25))
+                      || std::signbit(got) != std::signbit(value);
+    }
+    CHECK(wrong == 0);
+    CHECK(seen[values.size() - 6] == 6.1035156e-05f && seen[values.size() - 5] == 5.9604645e-08f && seen[values.size() - 4] == 0.0f && std::signbit(seen[values.size() - 4]));
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(normalized_integers_round_trip_within_half_a_step)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    
+    // within half of 1 / scale inside the range, the range's ends exact,
+    // and anything outside clamped to them
+    auto check = [](const std::vector<float>& values, const std::vector<float>& seen, float lo, float scale) {
+        size_t wrong = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            float expected = std::max(lo, std::min(values[i], 1.0f));
+            wrong += std::fabs(seen[i] - expected) > 0.5f / scale + 1e-6f;
+            if (expected == lo || expected == 1.0f) wrong += seen[i] != expected;
+        }
+        return wrong;
+    };
+    std::vector<float> signedValues = spread(-1.0f, 1.0f), unsignedValues = spread(0.0f, 1.0f);
+    CHECK(check(signedValues, roundTrip<VertexFormat<Attribute<0, VertexEncoding::Snorm16<1>>>>(signedValues), -1.0f, 32767) == 0);
+    CHECK(check(signedValues, roundTrip<VertexFormat<Attribute<0, VertexEncoding::Snorm8<1>>>>(signedValues), -1.0f, 127) == 0);
+    CHECK(check(unsignedValues, roundTrip<VertexFormat<Attribute<0, VertexEncoding::Unorm16<1>>>>(unsignedValues), 0.0f, 65535) == 0);
+    CHECK(check(unsignedValues, roundTrip<VertexFormat<Attribute<0, VertexEncoding::Unorm8<1>>>>(unsignedValues), 0.0f, 255) == 0);
+    
+    // zero is exactly zero both signed and not, so signs never flip it
+    std::vector<float> zeros = { 0.0f, -0.0f, -1e-9f, 1e-9f };
+    std::vector<float> seen = roundTrip<VertexFormat<Attribute<0, VertexEncoding::Snorm16<1>>>>(zeros);
+    CHECK(seen[0] == 0 && seen[1] == 0 && seen[2] == 0 && seen[3] == 0);
+    
+    // the codes themselves: -1 is -scale, never the code below it
+    const float ends[2] = { -1.0f, 1.0f };
+    int16_t shorts[2];
+    VertexEncoding::Snorm16<2>::encode(ends, shorts);
+    int8_t bytes[4];
+    VertexEncoding::Snorm8<2>::encode(ends, bytes);
+    uint8_t unsignedBytes[4];
+    VertexEncoding::Unorm8<2>::encode(ends, unsignedBytes);
+    CHECK(shorts[0] == -32767 && shorts[1] == 32767 && bytes[0] == -127 && bytes[1] == 127 && bytes[2] == 0 && bytes[3] == 0);
+    CHECK(unsignedBytes[0] == 0 && unsignedBytes[1] == 255);
+    
+    // all components of a wider one, in order
+    const float four[4] = { -0.5f, 0.25f, 1.0f, -1.0f };
+    std::vector<unsigned char> vertex(8);
+    VertexEncoding::Snorm16<4>::encode(four, vertex.data());
+    std::vector<float> all = shaderSees(VertexFormat<Attribute<3, VertexEncoding::Snorm16<4>>>::layout(), 3, vertex, 1);
+    bool close = true;
+    for (int c = 0; c < 4; ++c) close = close && std::fabs(all[c] - four[c]) <= 0.5f / 32767;
+    CHECK(close);
+    
+    // fewer components: the rest as the GL fills them in
+    std::vector<unsigned char> pair = VertexFormat<Attribute<3, VertexEncoding::Unorm8<2>>>::pack(four + 1, 1);
+    all = shaderSees(VertexFormat<Attribute<3, VertexEncoding::Unorm8<2>>>::layout(), 3, pair, 1);
+    CHECK(std::fabs(all[0] - 0.25f) <= 0.5f / 255 && all[1] == 1.0f && all[2] == 0.0f && all[3] == 1.0f);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(octahedral_normals_unfold_to_the_same_direction)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    typedef VertexFormat<Attribute<1, VertexEncoding::Octahedral>> Format;
+    std::vector<float> xyz = directions();
+    size_t count = xyz.size() / 3;
+    std::vector<unsigned char> vertices = Format::pack(xyz.data(), count);
+    std::vector<float> seen = shaderSees(Format::layout(), 1, vertices, count, Unfold);
+    
+    // within a hundredth of a degree everywhere, on the right side of the
+    // equator, and the lower half folded out past |x| + |y| = 1
+    double worst = 0;
+    size_t wrongSide = 0, unfolded = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float* in = &xyz[i * 3];
+        const float* out = &seen[i * 4];
+        double dot = (double) in[0] * out[0] + (double) in[1] * out[1] + (double) in[2] * out[2];
+        double cross[3] = { (double) in[1] * out[2] - (double) in[2] * out[1], (double) in[2] * out[0] - (double) in[0] * out[2],
+                            (double) in[0] * out[1] - (double) in[1] * out[0] };
+        worst = std::max(worst, std::atan2(std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]), dot));
+        if (std::fabs(in[2]) > 1e-3f) wrongSide += (in[2] < 0) != (out[2] < 0);
+        
+        int16_t code[2];
+        memcpy(code, &vertices[i * 4], 4);
+        float l1 = std::fabs(code[0] / 32767.0f) + std::fabs(code[1] / 32767.0f);
+        if (in[2] < -1e-3f) unfolded += l1 < 1.0f - 1e-4f;
+        if (in[2] > 1e-3f) unfolded += l1 > 1.0f + 1e-4f;
+    }
+    CHECK(worst < 0.01 * M_PI / 180);
+    CHECK(wrongSide == 0 && unfolded == 0);
+    
+    // the poles: straight up is the middle, straight down every corner
+    int16_t up[2], down[2];
+    const float north[3] = { 0, 0, 1 }, south[3] = { 0, 0, -1 };
+    VertexEncoding::Octahedral::encode(north, up);
+    VertexEncoding::Octahedral::encode(south, down);
+    CHECK(up[0] == 0 && up[1] == 0 && std::abs(down[0]) == 32767 && std::abs(down[1]) == 32767);
+    
+    // any length: only the direction is kept; nothing at all points up
+    const float scaled[6] = { 0, 0, 0, -3, 4, -12 };
+    std::vector<unsigned char> two = Format::pack(scaled, 2);
+    std::vector<float> back = shaderSees(Format::layout(), 1, two, 2, Unfold);
+    CHECK(back[0] == 0 && back[1] == 0 && back[2] == 1);
+    CHECK(std::fabs(back[4] + 3 / 13.0f) < 1e-4f && std::fabs(back[5] - 4 / 13.0f) < 1e-4f && std::fabs(back[6] + 12 / 13.0f) < 1e-4f);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(packed_tangents_keep_ten_bits_and_the_sign)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    typedef VertexFormat<Attribute<4, VertexEncoding::Packed1010102>> Format;
+    
+    // xyz anywhere in the range, w each of -1, 0 and 1 and beyond
+    std::vector<float> values;
+    Random random(802);
+    const float ws[] = { -1.0f, 1.0f, 0.0f, -0.4f, 0.6f, -5.0f, 5.0f };
+    for (int i = 0; i < 2000; ++i) {
+        for (int c = 0; c < 3; ++c) values.push_back((random.next() % 2400001) / 1000000.0f - 1.2f);
+        values.push_back(ws[i % 7]);
+    }
+    size_t count = values.size() / 4;
+    std::vector<unsigned char> vertices = Format::pack(values.data(), count);
+    std::vector<float> seen = shaderSees(Format::layout(), 4, vertices, count);
+    size_t wrong = 0;
+    for (size_t i = 0; i < count; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            float expected = std::max(-1.0f, std::min(values[i * 4 + c], 1.0f));
+            wrong += std::fabs(seen[i * 4 + c] - expected) > 0.5f / 511 + 1e-6f;
+        }
+        wrong += seen[i * 4 + 3] != std::round(std::max(-1.0f, std::min(values[i * 4 + 3], 1.0f)));
+    }
+    CHECK(wrong == 0);
+    
+    // the bits: x low, then y and z, and w's two bits on top, -1 as 0b11
+    const float tangent[4] = { 1.0f, -1.0f, 0.0f, -1.0f }, other[4] = { -0.5f, 0.5f, 1.0f, 1.0f };
+    uint32_t bits, otherBits;
+    VertexEncoding::Packed1010102::encode(tangent, &bits);
+    VertexEncoding::Packed1010102::encode(other, &otherBits);
+    CHECK(bits == (511u | (uint32_t) (-511 & 0x3ff) << 10 | 0u << 20 | 3u << 30));
+    CHECK(otherBits == ((uint32_t) (-256 & 0x3ff) | 256u << 10 | 511u << 20 | 1u << 30));
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()
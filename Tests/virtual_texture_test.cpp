@@ -0,0 +1,276 @@
+//
+//  virtual_texture_test.cpp
+//  Tests
+//
+//  Created by David Richter on 10/18/26.
+//  Copyright © 2019 David Richter. All rights reserved.
+//
+//  VirtualTexture's tile cache and page table read back after feedback
+//  frames asking for particular tiles: tiles against a box filter of the
+//  image run on the CPU, from the mip tail and from regions of the file,
+//  and pages pointing at the finest resident tile over them.
+//
+
+#include "test.h"
+
+#include "shader.h"
+#include "virtual_texture.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "corpus.h"
+
+#include <chrono>
+#include <map>
+
+namespace
+{
+    const int TileSize = 32, SlotSize = TileSize + 2, CacheTiles = 4;
+    
+    /// A 600x440 PNG: 32 pages across level 0, so levels 0 to 5, with the
+    /// tail from level 4 (38x28) down
+    struct Scratch
+    {
+        std::string path = test::temporaryPath("virtual.png");
+        Image image = synthesize(600, 440, 500);
+        
+        Scratch()
+        {
+            std::vector<uint8_t> bytes = corpus::png(image, 4, 8, PngEncoder::adaptive);
+            FILE* file = fopen(path.c_str(), "wb");
+            fwrite(bytes.data(), 1, bytes.size(), file);
+            fclose(file);
+        }
+        
+        ~Scratch() { unlink(path.c_str()); }
+    };
+    
+    int levelSize(int size, int level)
+    {
+        return std::max((size + (1 << level) - 1) >> level, 1);
+    }
+    
+    /// 'levels' further down from 'image' by a box filter: each texel the
+    /// rounded mean of the texels under it, fewer at the right and bottom
+    /// edges when the size doesn't divide
+    Image boxFilter(const Image& image, int levels)
+    {
+        Image level;
+        level.width = levelSize(image.width, levels);
+        level.height = levelSize(image.height, levels);
+        level.channels = 4;
+        level.data.resize((size_t) level.width * level.height * 4);
+        int factor = 1 << levels;
+        for (int y = 0; y < level.height; ++y)
+            for (int x = 0; x < level.width; ++x) {
+                uint32_t sum[4] = { 0, 0, 0, 0 }, count = 0;
+                for (int sy = y * factor; sy < std::min(y * factor + factor, image.height); ++sy)
+                    for (int sx = x * factor; sx < std::min(x * factor + factor, image.width); ++sx, ++count)
+                        for (int c = 0; c < 4; ++c) sum[c] += image.data[((size_t) sy * image.width + sx) * 4 + c];
+                for (int c = 0; c < 4; ++c) level.data[((size_t) y * level.width + x) * 4 + c] = (uint8_t) ((sum[c] + count / 2) / count);
+            }
+        return level;
+    }
+    
+    /// Tile (x, y) of 'level' with its border, the texels past the level's
+    /// edges clamped to them
+    std::vector<uint8_t> referenceTile(const Image& level, int x, int y)
+    {
+        std::vector<uint8_t> tile((size_t) SlotSize * SlotSize * 4);
+        for (int j = 0; j < SlotSize; ++j)
+            for (int i = 0; i < SlotSize; ++i) {
+                int tx = std::min(std::max(x * TileSize - 1 + i, 0), level.width - 1);
+                int ty = std::min(std::max(y * TileSize - 1 + j, 0), level.height - 1);
+                memcpy(&tile[((size_t) j * SlotSize + i) * 4], &level.data[((size_t) ty * level.width + tx) * 4], 4);
+            }
+        return tile;
+    }
+    
+    /// The page table and tile cache, as use() binds them
+    struct Names
+    {
+        GLuint pageTable = 0, tileCache = 0;
+    };
+    
+    Names names(const VirtualTexture& texture, GLuint program)
+    {
+        Names result;
+        GLint name;
+        texture.use(program, 0);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &name);
+        result.pageTable = (GLuint) name;
+        glActiveTexture(GL_TEXTURE1);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &name);
+        result.tileCache = (GLuint) name;
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+        return result;
+    }
+    
+    /// What is in tile cache slot 'slot', border included
+    std::vector<uint8_t> slotTexels(GLuint tileCache, int slot)
+    {
+        int size = CacheTiles * SlotSize;
+        std::vector<uint8_t> cache((size_t) size * size * 4), tile;
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, cache.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        int left = slot % CacheTiles * SlotSize, top = slot / CacheTiles * SlotSize;
+        for (int row = 0; row < SlotSize; ++row) {
+            const uint8_t* line = &cache[((size_t) (top + row) * size + left) * 4];
+            tile.insert(tile.end(), line, line + SlotSize * 4);
+        }
+        return tile;
+    }
+    
+    int difference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+    {
+        int most = a.size() == b.size() ? 0 : 256;
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i) most = std::max(most, std::abs(a[i] - b[i]));
+        return most;
+    }
+    
+    /// Feedback frames that see only tile (x, y) of 'level', until 'count'
+    /// tiles are resident or a couple of seconds have gone by
+    bool want(VirtualTexture& texture, int level, int x, int y, size_t count)
+    {
+        for (int frame = 0; frame < 400 && texture.stats().resident < count; ++frame) {
+            texture.beginFeedback(64, 64);
+            const GLuint wanted[4] = { (GLuint) x, (GLuint) y, (GLuint) level, 1 };
+            glClearBufferuiv(GL_COLOR, 0, wanted);
+            texture.endFeedback();
+            texture.update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return texture.stats().resident == count;
+    }
+    
+    /// Every page of every level as it should be with the tiles in
+    /// 'resident' (key to slot): its own tile's slot and level if there is
+    /// one, else its parent page's
+    bool pagesPointAt(GLuint pageTable, const std::map<std::vector<int>, int>& resident, int pages, int maxLevel)
+    {
+        bool right = true;
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        for (int level = 0; level <= maxLevel; ++level) {
+            int count = pages >> level;
+            std::vector<uint8_t> entries((size_t) count * count * 4);
+            glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+            for (int y = 0; y < count; ++y)
+                for (int x = 0; x < count; ++x) {
+                    int tileLevel = level;
+                    auto found = resident.end();
+                    for (; tileLevel <= maxLevel; ++tileLevel) {
+                        int shift = tileLevel - level;
+                        found = resident.find({ tileLevel, x >> shift, y >> shift });
+                        if (found != resident.end()) break;
+                    }
+                    const uint8_t* entry = &entries[((size_t) y * count + x) * 4];
+                    right = right && found != resident.end() && entry[0] == found->second % CacheTiles
+                                  && entry[1] == found->second / CacheTiles && entry[2] == tileLevel && entry[3] == 255;
+                }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return right;
+    }
+}
+
+TEST(the_top_tile_is_the_mip_tail_box_filtered)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    Shader program("../GLcontext/shaders/vertShader.vert", "../GLcontext/shaders/virtualTexture.frag");
+    VirtualTexture texture(scratch.path, TileSize, CacheTiles, 64);
+    CHECK(texture.valid() && texture.imageWidth() == 600 && texture.imageHeight() == 440);
+    VirtualTexture::Stats stats = texture.stats();
+    CHECK(stats.resident == 1 && stats.slots == 16 && stats.uploads == 1);
+    uint64_t pageTexels = 32 * 32 + 16 * 16 + 8 * 8 + 4 * 4 + 2 * 2 + 1;
+    CHECK(stats.bytes == (uint64_t) (CacheTiles * SlotSize) * (CacheTiles * SlotSize) * 4 + pageTexels * 4);
+    
+    // level 5, 19x14, is filtered from the level 4 tail, not the image
+    Names gl = names(texture, program.shaderProgram);
+    CHECK(gl.pageTable && gl.tileCache && gl.pageTable != gl.tileCache);
+    std::vector<uint8_t> top = slotTexels(gl.tileCache, 0);
+    Image tail = boxFilter(scratch.image, 4);
+    CHECK(difference(top, referenceTile(boxFilter(tail, 1), 0, 0)) == 0);
+    
+    // past the image the edge texels repeat
+    bool clamped = true;
+    for (int j = 0; j < SlotSize; ++j)
+        for (int i = 20; i < SlotSize; ++i)
+            clamped = clamped && !memcmp(&top[((size_t) j * SlotSize + i) * 4], &top[((size_t) j * SlotSize + 19) * 4], 4);
+    CHECK(clamped);
+    
+    // a tile of the tail level itself is the tail, filtered once
+    CHECK(want(texture, 4, 1, 0, 2));
+    CHECK(difference(slotTexels(gl.tileCache, 1), referenceTile(tail, 1, 0)) == 0);
+    
+    // every page points at the top tile, but for the new one's
+    CHECK(pagesPointAt(gl.pageTable, { { { 5, 0, 0 }, 0 }, { { 4, 1, 0 }, 1 } }, 32, 5));
+    
+    // a file it can't read
+    VirtualTexture missing(test::temporaryPath("missing.png"));
+    CHECK(!missing.valid());
+    missing.update();
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(tiles_below_the_tail_are_filtered_from_the_image)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    Shader program("../GLcontext/shaders/vertShader.vert", "../GLcontext/shaders/virtualTexture.frag");
+    VirtualTexture texture(scratch.path, TileSize, CacheTiles, 64);
+    Names gl = names(texture, program.shaderProgram);
+    
+    // a level 2 tile inside the image, exactly the box filter, border and all
+    CHECK(want(texture, 2, 2, 1, 2));
+    CHECK(difference(slotTexels(gl.tileCache, 1), referenceTile(boxFilter(scratch.image, 2), 2, 1)) == 0);
+    
+    // one at level 0 in the corner, clamped right and below
+    CHECK(want(texture, 0, 18, 13, 3));
+    CHECK(difference(slotTexels(gl.tileCache, 2), referenceTile(scratch.image, 18, 13)) == 0);
+    
+    // and one at level 3 the image only partly covers
+    CHECK(want(texture, 3, 2, 1, 4));
+    CHECK(difference(slotTexels(gl.tileCache, 3), referenceTile(boxFilter(scratch.image, 3), 2, 1)) == 0);
+    VirtualTexture::Stats stats = texture.stats();
+    CHECK(stats.uploads == 4 && stats.replaced == 0 && stats.starved == 0);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST(pages_fall_back_to_the_nearest_coarser_tile)
+{
+    if (!test::context()) return test::skip("no OpenGL 4.1 context");
+    Scratch scratch;
+    Shader program("../GLcontext/shaders/vertShader.vert", "../GLcontext/shaders/virtualTexture.frag");
+    VirtualTexture texture(scratch.path, TileSize, CacheTiles, 64);
+    Names gl = names(texture, program.shaderProgram);
+    std::map<std::vector<int>, int> resident = { { { 5, 0, 0 }, 0 } };
+    CHECK(pagesPointAt(gl.pageTable, resident, 32, 5));
+    
+    // a level 3 tile over level 0 pages 8 to 15 each way, then a level 1
+    // tile inside it over pages 10 and 11: pages under both show the finer,
+    // the rest of the level 3 tile's pages that, and everything else the top
+    CHECK(want(texture, 3, 1, 1, 2));
+    resident[{ 3, 1, 1 }] = 1;
+    CHECK(pagesPointAt(gl.pageTable, resident, 32, 5));
+    CHECK(want(texture, 1, 5, 5, 3));
+    resident[{ 1, 5, 5 }] = 2;
+    CHECK(pagesPointAt(gl.pageTable, resident, 32, 5));
+    
+    // what the level 2 pages between them hold: the level 3 tile's
+    std::vector<uint8_t> level2((size_t) 8 * 8 * 4);
+    glBindTexture(GL_TEXTURE_2D, gl.pageTable);
+    glGetTexImage(GL_TEXTURE_2D, 2, GL_RGBA, GL_UNSIGNED_BYTE, level2.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    const uint8_t* entry = &level2[((size_t) 2 * 8 + 2) * 4];
+    CHECK(entry[0] == 1 && entry[1] == 0 && entry[2] == 3 && entry[3] == 255);
+    
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+TEST_MAIN()